@@ -8,7 +8,8 @@ template <typename T> inline T env_convert_default(T &&default_value, char const
     T ret;
     auto is = std::istringstream{given};
     is >> ret;
-    if (!is.good()) { return default_value; }
+    // reaching the end of the value is expected, only a value that does not parse falls back
+    if (is.fail()) { return default_value; }
     return ret;
 }
 
@@ -30,7 +31,7 @@ template <typename T> inline std::vector<T> env(char const *var, std::vector<T>
     for (;;) {
         T tmp;
         is >> tmp;
-        if (!is.good()) { break; }
+        if (is.fail()) { break; }
         ret.push_back(tmp);
     }
     return ret;
@@ -0,0 +1,46 @@
+#include "rebootping_test.hpp"
+
+#include <cstdlib>
+
+TEST(env_suite, env_parses_whole_value) {
+    setenv("rebootping_env_test_value", "1234", 1);
+    rebootping_test_check(env("rebootping_env_test_value", 7), ==, 1234);
+    rebootping_test_check(env("rebootping_env_test_value", uint64_t{7}), ==, uint64_t{1234});
+    rebootping_test_check(env("rebootping_env_test_value", 0.5), ==, 1234.0);
+
+    setenv("rebootping_env_test_value", " 42 ", 1);
+    rebootping_test_check(env("rebootping_env_test_value", 7), ==, 42);
+
+    unsetenv("rebootping_env_test_value");
+    rebootping_test_check(env("rebootping_env_test_value", 7), ==, 7);
+}
+
+TEST(env_suite, env_unparsable_falls_back) {
+    setenv("rebootping_env_test_value", "not_a_number", 1);
+    rebootping_test_check(env("rebootping_env_test_value", 7), ==, 7);
+    setenv("rebootping_env_test_value", "", 1);
+    rebootping_test_check(env("rebootping_env_test_value", 7), ==, 7);
+    unsetenv("rebootping_env_test_value");
+}
+
+TEST(env_suite, env_string_is_verbatim) {
+    setenv("rebootping_env_test_value", "two words", 1);
+    rebootping_test_check(env("rebootping_env_test_value", "default"), ==, std::string{"two words"});
+    unsetenv("rebootping_env_test_value");
+}
+
+TEST(env_suite, env_vector_keeps_every_element) {
+    setenv("rebootping_env_test_value", "1.1.1.1 8.8.8.8 9.9.9.9", 1);
+    auto ips = env("rebootping_env_test_value", std::vector<std::string>{"default"});
+    rebootping_test_check(ips.size(), ==, size_t{3});
+    if (ips.size() == 3) { rebootping_test_check(ips[2], ==, std::string{"9.9.9.9"}); }
+
+    setenv("rebootping_env_test_value", "1 2 3", 1);
+    auto numbers = env("rebootping_env_test_value", std::vector<int>{});
+    rebootping_test_check(numbers.size(), ==, size_t{3});
+    if (numbers.size() == 3) { rebootping_test_check(numbers[2], ==, 3); }
+
+    setenv("rebootping_env_test_value", "1 2 x 4", 1);
+    rebootping_test_check(env("rebootping_env_test_value", std::vector<int>{}).size(), ==, size_t{2});
+    unsetenv("rebootping_env_test_value");
+}
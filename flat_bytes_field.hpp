@@ -22,6 +22,7 @@ struct flat_timeshard_field_bytes_base : flat_timeshard_base_field<flat_bytes_of
 
     flat_timeshard_field_bytes_base(flat_timeshard &timeshard, std::string const &name, std::string const &dir, flat_mmap_settings const &settings)
         : flat_timeshard_base_field<flat_bytes_offset_tag>(timeshard, name, dir, settings), flat_smap(dir + "/field_" + name + ".flatsmap", settings) {
+        timeshard.timeshard_synced_mmaps.push_back(&flat_smap);
         if (!flat_smap.mmap_allocated_len()) {
             flat_smap.mmap_allocate_at_least(sizeof(flat_smap_header_ref()));
             flat_smap_header_ref() = flat_smap_header();
@@ -43,10 +44,15 @@ struct flat_timeshard_field_bytes_base : flat_timeshard_base_field<flat_bytes_of
 
     flat_smap_header &flat_smap_header_ref() const { return flat_smap.mmap_cast<flat_smap_header>(0); }
 
+    void flat_timeshard_field_seal() {
+        flat_timeshard_base_field<flat_bytes_offset_tag>::flat_timeshard_field_seal();
+        flat_smap.mmap_trim_to(flat_smap_header_ref().flat_smap_offset_next);
+    }
+
     uint64_t smap_allocate_bytes(uint64_t bytes) {
         auto offset = flat_smap_header_ref().flat_smap_offset_next;
         auto required_len = offset + bytes;
-        flat_smap.mmap_allocate_at_least(required_len);
+        flat_smap.mmap_reserve_at_least(required_len);
         flat_smap_header_ref().flat_smap_offset_next = required_len;
         return offset;
     }
@@ -72,7 +78,7 @@ template <> struct flat_timeshard_field<std::string_view> : flat_timeshard_field
     inline auto operator[](uint64_t index) const {
         return flat_bytes_ptr<flat_timeshard_field<std::string_view>, flat_bytes_offset_tag &>{
             // TODO create distinction between a writeable flat_bytes_ptr and a const one
-            const_cast<flat_timeshard_field<std::string_view> &>(*this), field_mmap.mmap_cast<flat_bytes_offset_tag>(index * sizeof(flat_bytes_offset_tag))};
+            const_cast<flat_timeshard_field<std::string_view> &>(*this), field_ref(index)};
     }
 };
 
@@ -84,6 +90,11 @@ template <> struct flat_timeshard_field<flat_bytes_interned_ptr> : flat_timeshar
     using flat_timeshard_base_field<flat_bytes_offset_tag>::flat_timeshard_base_field;
 
     inline flat_bytes_interned_ptr operator[](uint64_t index) const {
-        return flat_bytes_interned_ptr{field_timeshard, field_mmap.mmap_cast<flat_bytes_interned_tag>(index * sizeof(flat_bytes_interned_tag))};
+        return flat_bytes_interned_ptr{field_timeshard, reinterpret_cast<flat_bytes_interned_tag &>(field_ref(index))};
+    }
+
+    std::span<flat_bytes_interned_tag const> field_column(uint64_t count) const {
+        auto offsets = flat_timeshard_base_field<flat_bytes_offset_tag>::field_column(count);
+        return {reinterpret_cast<flat_bytes_interned_tag const *>(offsets.data()), offsets.size()};
     }
 };
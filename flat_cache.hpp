@@ -1,6 +1,142 @@
 #pragma once
 
+#include "cmake_variables.hpp"
 #include "flat_hash.hpp"
-#include "flat_record.hpp"
+#include "flat_mmap.hpp"
+#include "now_unixtime.hpp"
+#include "str.hpp"
 
-template <typename record_type, typename should_expire_function, typename hash_function = flat_hash_function_class> struct flat_cache {};
\ No newline at end of file
+#include <type_traits>
+
+struct flat_cache_header {
+    uint64_t flat_cache_magic = 0x666c617463616368;
+    uint64_t flat_cache_version = 202610170000;
+    double flat_cache_git_unixtime = flat_git_unixtime;
+    uint8_t flat_cache_git_sha_string_array[128] = flat_git_sha_string;
+    double flat_cache_create_unixtime = now_unixtime();
+
+    uint64_t flat_cache_slot_size = 0;
+    uint64_t flat_cache_capacity = 0;
+    uint64_t flat_cache_clock_hand = 0;
+};
+
+template <typename key_type, typename record_type> struct flat_cache_slot {
+    key_type slot_key;
+    record_type slot_record;
+    double slot_stored_unixtime;
+    bool slot_occupied;
+    bool slot_referenced;
+};
+
+// Expires entries after a fixed number of seconds, for caches whose records do not carry their own lifetime
+template <unsigned max_age_seconds> struct flat_cache_expire_after {
+    template <typename record_type> bool operator()(record_type const &, double stored_unixtime, double now) const {
+        return now >= stored_unixtime + max_age_seconds;
+    }
+};
+
+// Holds at most flat_cache_capacity records in a file of fixed size, with flat_hash mapping keys to slots.
+// When full, the slot to reuse is chosen by CLOCK: the hand clears the referenced flag of each slot it
+// passes and stops at the first slot that was not looked up since the hand last went by. Entries for which
+// should_expire_function(record, stored_unixtime, now) holds are dropped when they are looked up.
+// The cache only holds derived data, so a file with an unexpected header or capacity is started afresh.
+template <typename key_type, typename record_type, typename should_expire_function, typename hash_function = flat_hash_function_class>
+struct flat_cache {
+    static_assert(std::is_trivially_copyable_v<key_type> && std::is_trivially_copyable_v<record_type>, "flat_cache entries are stored in a flat_mmap");
+    using slot_type = flat_cache_slot<key_type, record_type>;
+
+    flat_mmap cache_mmap;
+    flat_hash<key_type, uint64_t, hash_function> cache_hash;
+    [[no_unique_address]] should_expire_function cache_should_expire;
+
+    flat_cache(std::string const &filename_prefix, uint64_t capacity, should_expire_function should_expire = should_expire_function())
+        : cache_mmap(filename_prefix + ".flatcache"), cache_hash(filename_prefix + ".flathash"), cache_should_expire(should_expire) {
+        if (!capacity) { throw std::runtime_error(str("flat_cache needs a capacity: ", filename_prefix)); }
+        flat_cache_header expected;
+        expected.flat_cache_slot_size = sizeof(slot_type);
+        expected.flat_cache_capacity = capacity;
+        if (cache_mmap.mmap_allocated_len() < sizeof(flat_cache_header) || cache_header().flat_cache_magic != expected.flat_cache_magic ||
+            cache_header().flat_cache_version != expected.flat_cache_version || cache_header().flat_cache_slot_size != expected.flat_cache_slot_size ||
+            cache_header().flat_cache_capacity != expected.flat_cache_capacity) {
+            cache_mmap.mmap_discard();
+            cache_mmap.mmap_allocate_at_least(sizeof(flat_cache_header) + capacity * sizeof(slot_type));
+            cache_header() = expected;
+            cache_hash.hash_clear();
+        }
+    }
+
+    flat_cache_header &cache_header() const { return cache_mmap.mmap_cast<flat_cache_header>(0); }
+    slot_type &cache_slot(uint64_t slot) const { return cache_mmap.mmap_cast<slot_type>(sizeof(flat_cache_header) + slot * sizeof(slot_type)); }
+    [[nodiscard]] uint64_t cache_capacity() const { return cache_header().flat_cache_capacity; }
+
+    // the unexpired record for key, or nullptr
+    record_type *cache_find(key_type const &key, double now = now_unixtime()) {
+        auto slot_ptr = cache_slot_for_key(key);
+        if (!slot_ptr) { return nullptr; }
+        auto &slot = *slot_ptr;
+        if (cache_should_expire(static_cast<record_type const &>(slot.slot_record), slot.slot_stored_unixtime, now)) {
+            cache_evict(slot);
+            return nullptr;
+        }
+        slot.slot_referenced = true;
+        return &slot.slot_record;
+    }
+
+    // a record for key stored at now, to be filled in by the caller, replacing any record already there
+    record_type &cache_store(key_type const &key, double now = now_unixtime()) {
+        auto slot = cache_slot_for_key(key);
+        if (!slot) {
+            auto slot_index = cache_claim_slot();
+            slot = &cache_slot(slot_index);
+            cache_hash.hash_add_key(key) = slot_index + 1;
+            slot->slot_key = key;
+            slot->slot_occupied = true;
+        }
+        slot->slot_record = record_type();
+        slot->slot_stored_unixtime = now;
+        slot->slot_referenced = true;
+        return slot->slot_record;
+    }
+
+    // looks key up, calling compute(record_type &) to fill in a new record when there is none
+    template <typename compute_function> record_type const &cache_lookup(key_type const &key, compute_function &&compute, double now = now_unixtime()) {
+        if (auto found = cache_find(key, now)) { return *found; }
+        auto &record = cache_store(key, now);
+        compute(record);
+        return record;
+    }
+
+  private:
+    // the slot the hash names for key, dropping a hash entry that a crash left pointing at another key's slot
+    slot_type *cache_slot_for_key(key_type const &key) {
+        auto index = cache_hash.hash_find_key(key);
+        if (!index) { return nullptr; }
+        if (*index <= cache_capacity()) {
+            auto &slot = cache_slot(*index - 1);
+            if (slot.slot_occupied && flat_hash_compare(cache_hash.hash_compare_function, slot.slot_key, key)) { return &slot; }
+        }
+        cache_hash.hash_del_key(key);
+        return nullptr;
+    }
+
+    void cache_evict(slot_type &slot) {
+        cache_hash.hash_del_key(slot.slot_key);
+        slot.slot_occupied = false;
+        slot.slot_referenced = false;
+    }
+
+    uint64_t cache_claim_slot() {
+        auto &hand = cache_header().flat_cache_clock_hand;
+        for (;;) {
+            auto slot_index = hand;
+            hand = (hand + 1) % cache_capacity();
+            auto &slot = cache_slot(slot_index);
+            if (!slot.slot_occupied) { return slot_index; }
+            if (!slot.slot_referenced) {
+                cache_evict(slot);
+                return slot_index;
+            }
+            slot.slot_referenced = false;
+        }
+    }
+};
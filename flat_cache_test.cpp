@@ -0,0 +1,69 @@
+#include "flat_cache.hpp"
+#include "rebootping_test.hpp"
+
+namespace {
+struct cached_square {
+    uint64_t square;
+    uint64_t computed_count;
+};
+
+struct expire_odd_squares_after_ten_seconds {
+    bool operator()(cached_square const &record, double stored_unixtime, double now) const { return record.square % 2 && now >= stored_unixtime + 10; }
+};
+
+using square_cache = flat_cache<uint64_t, cached_square, expire_odd_squares_after_ten_seconds>;
+
+uint64_t computed = 0;
+cached_square const &lookup_square(square_cache &cache, uint64_t n, double now) {
+    return cache.cache_lookup(
+        n,
+        [&](cached_square &record) {
+            record.square = n * n;
+            record.computed_count = ++computed;
+        },
+        now);
+}
+} // namespace
+
+TEST(flat_cache_suite, clock_eviction_and_expiry) {
+    tmpdir tmpdir;
+    auto prefix = tmpdir.tmpdir_name + "/squares";
+    const uint64_t capacity = 64;
+    {
+        square_cache cache(prefix, capacity);
+        for (uint64_t n = 0; capacity > n; ++n) { rebootping_test_check(lookup_square(cache, n, 1).square, ==, n * n); }
+        rebootping_test_check(computed, ==, capacity);
+        for (uint64_t n = 0; capacity > n; ++n) { lookup_square(cache, n, 2); }
+        rebootping_test_check(computed, ==, capacity);
+
+        // the hand clears every referenced flag on its first lap, so the first key it comes back to goes
+        lookup_square(cache, capacity, 3);
+        rebootping_test_check(cache.cache_find(0, 3), ==, nullptr);
+        rebootping_test_check(cache.cache_find(1, 3)->square, ==, 1);
+        // 1 was looked up since the hand passed it, so 2 goes next
+        lookup_square(cache, capacity + 1, 3);
+        rebootping_test_check(cache.cache_find(1, 3)->square, ==, 1);
+        rebootping_test_check(cache.cache_find(2, 3), ==, nullptr);
+    }
+    {
+        square_cache cache(prefix, capacity);
+        auto before = computed;
+        rebootping_test_check(lookup_square(cache, capacity, 4).square, ==, capacity * capacity);
+        rebootping_test_check(lookup_square(cache, 4, 4).square, ==, 16);
+        rebootping_test_check(computed, ==, before);
+
+        rebootping_test_check(cache.cache_find(3, 20), ==, nullptr);
+        rebootping_test_check(cache.cache_find(4, 20)->square, ==, 16);
+        rebootping_test_check(lookup_square(cache, 3, 20).computed_count, ==, ++before);
+        rebootping_test_check(computed, ==, before);
+    }
+    {
+        square_cache smaller(prefix, capacity / 2);
+        rebootping_test_check(smaller.cache_find(4, 20), ==, nullptr);
+        for (uint64_t n = 0; 4 * capacity > n; ++n) { rebootping_test_check(lookup_square(smaller, n, 30).square, ==, n * n); }
+        uint64_t held = 0;
+        smaller.cache_hash.hash_walk([&](auto &&, auto &&) { ++held; });
+        rebootping_test_check(held, ==, capacity / 2);
+        rebootping_test_check(smaller.cache_capacity(), ==, capacity / 2);
+    }
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include "env.hpp"
+#include "flat_bytes_field.hpp"
+#include "flat_timeshard.hpp"
+#include "str.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Kernels over the spans that flat_dirtree::timeshard_column_chunks yields. NaN marks a missing value in
+// the repo's double columns (an unanswered ping has a NaN ping_recv_seconds), so the kernels count NaNs
+// and leave them out of sums, minimums and maximums.
+
+struct flat_column_stats {
+    uint64_t stats_count = 0;
+    uint64_t stats_nan_count = 0;
+    double stats_sum = 0;
+    double stats_min = std::numeric_limits<double>::infinity();
+    double stats_max = -std::numeric_limits<double>::infinity();
+
+    void stats_add(double value) {
+        ++stats_count;
+        if (std::isnan(value)) {
+            ++stats_nan_count;
+            return;
+        }
+        stats_sum += value;
+        stats_min = std::min(stats_min, value);
+        stats_max = std::max(stats_max, value);
+    }
+
+    void stats_merge(flat_column_stats const &other) {
+        stats_count += other.stats_count;
+        stats_nan_count += other.stats_nan_count;
+        stats_sum += other.stats_sum;
+        stats_min = std::min(stats_min, other.stats_min);
+        stats_max = std::max(stats_max, other.stats_max);
+    }
+
+    // of the values that are not NaN, or NaN when there are none
+    [[nodiscard]] double stats_mean() const { return stats_count > stats_nan_count ? stats_sum / double(stats_count - stats_nan_count) : std::nan(""); }
+    [[nodiscard]] double stats_nan_fraction() const { return stats_count ? double(stats_nan_count) / double(stats_count) : std::nan(""); }
+};
+
+// The portable kernels use SSE2 where the target has it, which every x86-64 target does. The AVX2 kernels
+// are compiled for x86-64 whatever the -march, and flat_column_use_avx2 picks them when the CPU has AVX2;
+// flat_column_scan_avx2=0 turns them off. Each AVX2 kernel hands its tail to the portable one.
+
+inline uint64_t flat_column_count_nan_portable(std::span<double const> values) {
+    uint64_t count = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    auto counts = _mm_setzero_si128();
+    for (; values.size() >= i + 2; i += 2) {
+        auto v = _mm_loadu_pd(values.data() + i);
+        // a true comparison is all ones, which is -1 in each 64 bit lane
+        counts = _mm_sub_epi64(counts, _mm_castpd_si128(_mm_cmpunord_pd(v, v)));
+    }
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), counts);
+    count = lanes[0] + lanes[1];
+#endif
+    for (; values.size() > i; ++i) { count += std::isnan(values[i]); }
+    return count;
+}
+
+// values in [lo, hi); NaN is in no range
+inline uint64_t flat_column_count_between_portable(std::span<double const> values, double lo, double hi) {
+    uint64_t count = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    auto counts = _mm_setzero_si128();
+    auto lo_v = _mm_set1_pd(lo), hi_v = _mm_set1_pd(hi);
+    for (; values.size() >= i + 2; i += 2) {
+        auto v = _mm_loadu_pd(values.data() + i);
+        counts = _mm_sub_epi64(counts, _mm_castpd_si128(_mm_and_pd(_mm_cmpge_pd(v, lo_v), _mm_cmplt_pd(v, hi_v))));
+    }
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), counts);
+    count = lanes[0] + lanes[1];
+#endif
+    for (; values.size() > i; ++i) { count += values[i] >= lo && values[i] < hi; }
+    return count;
+}
+
+// count, NaN count, sum, min and max in one pass. The vector paths add in a different order from the
+// scalar one, so sums can differ from it in the last bits.
+inline flat_column_stats flat_column_summarize_portable(std::span<double const> values) {
+    flat_column_stats stats;
+    size_t i = 0;
+#if defined(__SSE2__)
+    auto sums = _mm_setzero_pd();
+    auto mins = _mm_set1_pd(stats.stats_min), maxs = _mm_set1_pd(stats.stats_max);
+    auto nans = _mm_setzero_si128();
+    for (; values.size() >= i + 2; i += 2) {
+        auto v = _mm_loadu_pd(values.data() + i);
+        auto nan = _mm_cmpunord_pd(v, v);
+        nans = _mm_sub_epi64(nans, _mm_castpd_si128(nan));
+        sums = _mm_add_pd(sums, _mm_andnot_pd(nan, v));
+        // min and max return their second operand when either is NaN
+        mins = _mm_min_pd(v, mins);
+        maxs = _mm_max_pd(v, maxs);
+    }
+    alignas(16) double sum_lanes[2], min_lanes[2], max_lanes[2];
+    alignas(16) uint64_t nan_lanes[2];
+    _mm_store_pd(sum_lanes, sums);
+    _mm_store_pd(min_lanes, mins);
+    _mm_store_pd(max_lanes, maxs);
+    _mm_store_si128(reinterpret_cast<__m128i *>(nan_lanes), nans);
+    for (int lane = 0; 2 > lane; ++lane) {
+        stats.stats_sum += sum_lanes[lane];
+        stats.stats_min = std::min(stats.stats_min, min_lanes[lane]);
+        stats.stats_max = std::max(stats.stats_max, max_lanes[lane]);
+        stats.stats_nan_count += nan_lanes[lane];
+    }
+#endif
+    stats.stats_count = i;
+    for (; values.size() > i; ++i) { stats.stats_add(values[i]); }
+    return stats;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) inline uint64_t flat_column_count_nan_avx2(std::span<double const> values) {
+    size_t i = 0;
+    auto counts = _mm256_setzero_si256();
+    for (; values.size() >= i + 4; i += 4) {
+        auto v = _mm256_loadu_pd(values.data() + i);
+        counts = _mm256_sub_epi64(counts, _mm256_castpd_si256(_mm256_cmp_pd(v, v, _CMP_UNORD_Q)));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), counts);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + flat_column_count_nan_portable(values.subspan(i));
+}
+
+__attribute__((target("avx2"))) inline uint64_t flat_column_count_between_avx2(std::span<double const> values, double lo, double hi) {
+    size_t i = 0;
+    auto counts = _mm256_setzero_si256();
+    auto lo_v = _mm256_set1_pd(lo), hi_v = _mm256_set1_pd(hi);
+    for (; values.size() >= i + 4; i += 4) {
+        auto v = _mm256_loadu_pd(values.data() + i);
+        auto in = _mm256_and_pd(_mm256_cmp_pd(v, lo_v, _CMP_GE_OQ), _mm256_cmp_pd(v, hi_v, _CMP_LT_OQ));
+        counts = _mm256_sub_epi64(counts, _mm256_castpd_si256(in));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), counts);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + flat_column_count_between_portable(values.subspan(i), lo, hi);
+}
+
+__attribute__((target("avx2"))) inline flat_column_stats flat_column_summarize_avx2(std::span<double const> values) {
+    flat_column_stats stats;
+    size_t i = 0;
+    auto sums = _mm256_setzero_pd();
+    auto mins = _mm256_set1_pd(stats.stats_min), maxs = _mm256_set1_pd(stats.stats_max);
+    auto nans = _mm256_setzero_si256();
+    for (; values.size() >= i + 4; i += 4) {
+        auto v = _mm256_loadu_pd(values.data() + i);
+        auto nan = _mm256_cmp_pd(v, v, _CMP_UNORD_Q);
+        nans = _mm256_sub_epi64(nans, _mm256_castpd_si256(nan));
+        sums = _mm256_add_pd(sums, _mm256_andnot_pd(nan, v));
+        mins = _mm256_min_pd(v, mins);
+        maxs = _mm256_max_pd(v, maxs);
+    }
+    alignas(32) double sum_lanes[4], min_lanes[4], max_lanes[4];
+    alignas(32) uint64_t nan_lanes[4];
+    _mm256_store_pd(sum_lanes, sums);
+    _mm256_store_pd(min_lanes, mins);
+    _mm256_store_pd(max_lanes, maxs);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(nan_lanes), nans);
+    for (int lane = 0; 4 > lane; ++lane) {
+        stats.stats_sum += sum_lanes[lane];
+        stats.stats_min = std::min(stats.stats_min, min_lanes[lane]);
+        stats.stats_max = std::max(stats.stats_max, max_lanes[lane]);
+        stats.stats_nan_count += nan_lanes[lane];
+    }
+    stats.stats_count = i;
+    stats.stats_merge(flat_column_summarize_portable(values.subspan(i)));
+    return stats;
+}
+#endif
+
+inline bool flat_column_use_avx2() {
+#if defined(__x86_64__)
+    static const bool use_avx2 = __builtin_cpu_supports("avx2") && env("flat_column_scan_avx2", true);
+    return use_avx2;
+#else
+    return false;
+#endif
+}
+
+inline uint64_t flat_column_count_nan(std::span<double const> values) {
+#if defined(__x86_64__)
+    if (flat_column_use_avx2()) { return flat_column_count_nan_avx2(values); }
+#endif
+    return flat_column_count_nan_portable(values);
+}
+
+inline uint64_t flat_column_count_between(std::span<double const> values, double lo, double hi) {
+#if defined(__x86_64__)
+    if (flat_column_use_avx2()) { return flat_column_count_between_avx2(values, lo, hi); }
+#endif
+    return flat_column_count_between_portable(values, lo, hi);
+}
+
+inline flat_column_stats flat_column_summarize(std::span<double const> values) {
+#if defined(__x86_64__)
+    if (flat_column_use_avx2()) { return flat_column_summarize_avx2(values); }
+#endif
+    return flat_column_summarize_portable(values);
+}
+
+// keyed by the interned string and by floor(unixtime / bucket_seconds)
+using flat_column_groups = std::map<std::pair<std::string, int64_t>, flat_column_stats>;
+
+// Adds values to groups by the interned key and the time bucket of their row, for rows whose time is in
+// [start_unixtime, end_unixtime). Interned keys are offsets into their own timeshard, so a chunk's few
+// distinct keys are gathered first and each resolved to its string once, and its buckets are kept in a
+// dense array spanning the chunk's times.
+inline void flat_column_group_stats(flat_timeshard const &timeshard, std::span<flat_bytes_interned_tag const> keys, std::span<double const> times,
+                                    std::span<double const> values, double bucket_seconds, double start_unixtime, double end_unixtime,
+                                    flat_column_groups &groups) {
+    if (keys.size() != times.size() || keys.size() != values.size()) {
+        throw std::runtime_error(str("flat_column_group_stats columns differ in length ", keys.size(), " ", times.size(), " ", values.size()));
+    }
+    auto time_stats = flat_column_summarize(times);
+    auto first_time = std::max(time_stats.stats_min, start_unixtime), last_time = std::min(time_stats.stats_max, end_unixtime);
+    if (!(first_time <= last_time)) { return; }
+    auto first_bucket = int64_t(std::floor(first_time / bucket_seconds));
+    auto bucket_count = uint64_t(int64_t(std::floor(last_time / bucket_seconds)) - first_bucket + 1);
+    if (bucket_count > env("flat_column_group_max_buckets", uint64_t{1} << 20)) {
+        throw std::runtime_error(
+            str("flat_column_group_stats too many buckets ", bucket_count, " of ", bucket_seconds, " seconds in ", timeshard.flat_timeshard_name));
+    }
+
+    std::vector<uint64_t> chunk_keys;
+    std::vector<std::vector<flat_column_stats>> chunk_buckets;
+    std::unordered_map<uint64_t, size_t> chunk_key_index;
+    uint64_t last_key = 0;
+    size_t last_key_index = SIZE_MAX;
+    for (size_t i = 0; keys.size() > i; ++i) {
+        auto time = times[i];
+        if (!(time >= start_unixtime && time < end_unixtime)) { continue; }
+        auto key = keys[i].bytes_offset;
+        if (key != last_key || last_key_index == SIZE_MAX) {
+            auto [found, inserted] = chunk_key_index.try_emplace(key, chunk_keys.size());
+            if (inserted) {
+                chunk_keys.push_back(key);
+                chunk_buckets.emplace_back(bucket_count);
+            }
+            last_key = key;
+            last_key_index = found->second;
+        }
+        chunk_buckets[last_key_index][int64_t(std::floor(time / bucket_seconds)) - first_bucket].stats_add(values[i]);
+    }
+
+    for (size_t k = 0; chunk_keys.size() > k; ++k) {
+        // TODO create distinction between a writeable flat_bytes_ptr and a const one
+        std::string name(
+            flat_bytes_ptr<flat_timeshard, flat_bytes_interned_tag>{const_cast<flat_timeshard &>(timeshard), flat_bytes_interned_tag{chunk_keys[k]}}
+                .operator std::string_view());
+        for (uint64_t b = 0; bucket_count > b; ++b) {
+            if (chunk_buckets[k][b].stats_count) { groups[std::make_pair(name, first_bucket + int64_t(b))].stats_merge(chunk_buckets[k][b]); }
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#include "flat_column_scan.hpp"
+#include "flat_record.hpp"
+#include "rebootping_test.hpp"
+
+#include <random>
+
+define_flat_record(column_scan_record, (double, scan_unixtime), (double, scan_seconds), (flat_bytes_interned_ptr, scan_interface), (uint64_t, scan_cookie), );
+
+namespace {
+bool close_enough(double a, double b) { return std::abs(a - b) <= 1e-9 * std::max(1.0, std::abs(a)); }
+} // namespace
+
+TEST(flat_column_scan_suite, kernels_match_scalar) {
+    struct kernels {
+        char const *kernels_name;
+        uint64_t (*kernels_count_nan)(std::span<double const>);
+        uint64_t (*kernels_count_between)(std::span<double const>, double, double);
+        flat_column_stats (*kernels_summarize)(std::span<double const>);
+    };
+    std::vector<kernels> paths{{"dispatched", flat_column_count_nan, flat_column_count_between, flat_column_summarize},
+                               {"portable", flat_column_count_nan_portable, flat_column_count_between_portable, flat_column_summarize_portable}};
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) { paths.push_back({"avx2", flat_column_count_nan_avx2, flat_column_count_between_avx2, flat_column_summarize_avx2}); }
+#endif
+
+    std::mt19937_64 random_engine{17};
+    std::uniform_real_distribution<double> distro{-1000, 1000};
+    // every length up to a few vectors, so each tail is exercised on every path
+    for (size_t length = 0; 67 > length; ++length) {
+        std::vector<double> values(length);
+        flat_column_stats expected;
+        uint64_t expected_between = 0;
+        for (auto &&v : values) {
+            v = random_engine() % 5 ? distro(random_engine) : std::nan("");
+            expected.stats_add(v);
+            expected_between += v >= -500 && v < 250;
+        }
+        for (auto &&path : paths) {
+            auto stats = path.kernels_summarize(values);
+            rebootping_test_check(stats.stats_count, ==, length, " ", path.kernels_name);
+            rebootping_test_check(stats.stats_nan_count, ==, expected.stats_nan_count, " ", path.kernels_name);
+            rebootping_test_check(path.kernels_count_nan(values), ==, expected.stats_nan_count, " ", path.kernels_name);
+            rebootping_test_check(path.kernels_count_between(values, -500, 250), ==, expected_between, " ", path.kernels_name);
+            rebootping_test_check(stats.stats_min, ==, expected.stats_min, " ", path.kernels_name);
+            rebootping_test_check(stats.stats_max, ==, expected.stats_max, " ", path.kernels_name);
+            rebootping_test_check(close_enough(stats.stats_sum, expected.stats_sum), ==, true, " ", path.kernels_name, " sum ", stats.stats_sum, " expected ",
+                                  expected.stats_sum);
+        }
+    }
+    rebootping_test_check(std::isnan(flat_column_summarize(std::vector<double>{std::nan(""), std::nan("")}).stats_mean()), ==, true);
+}
+
+TEST(flat_column_scan_suite, chunks_group_like_records) {
+    tmpdir tmpdir;
+    column_scan_record records(tmpdir.tmpdir_name);
+    const double day = 24 * 60 * 60, start = 20 * day;
+    const char *interfaces[] = {"eth0", "wlan0", "ppp0"};
+    for (int i = 0; 3 * 24 * 60 > i; ++i) {
+        double unixtime = start + 60.0 * i + 7;
+        records.add_flat_record(unixtime, [&](auto &&record) {
+            record.scan_unixtime() = unixtime;
+            record.scan_seconds() = i % 11 ? 0.001 * (i % 13) : std::nan("");
+            record.scan_interface() = interfaces[i % 3];
+            record.scan_cookie() = i;
+        });
+    }
+
+    using schema = column_scan_record::flat_record_schema_type;
+    auto chunks = records.timeshard_column_chunks<schema::scan_unixtime, schema::scan_seconds, schema::scan_interface>();
+    rebootping_test_check(chunks.chunks_list.size(), ==, 3);
+    uint64_t rows = 0;
+    for (auto &&chunk : chunks) {
+        auto &&[times, seconds, keys] = chunk.chunk_columns;
+        rebootping_test_check(times.size(), ==, chunk.chunk_rows);
+        rebootping_test_check(keys.size(), ==, chunk.chunk_rows);
+        rows += chunk.chunk_rows;
+    }
+    rebootping_test_check(rows, ==, 3 * 24 * 60);
+
+    // per interface per ten minutes over the middle of the range, against a record at a time
+    const double query_start = start + day / 2, query_end = start + 2.5 * day, bucket = 600;
+    flat_column_groups groups;
+    for (auto &&chunk : records.timeshard_column_chunks<schema::scan_unixtime, schema::scan_seconds, schema::scan_interface>(query_start, query_end)) {
+        auto &&[times, seconds, keys] = chunk.chunk_columns;
+        flat_column_group_stats(*chunk.chunk_timeshard, keys, times, seconds, bucket, query_start, query_end, groups);
+    }
+    flat_column_groups expected;
+    for (auto &&record : records.timeshard_query()) {
+        if (record.scan_unixtime() < query_start || record.scan_unixtime() >= query_end) { continue; }
+        auto key = std::make_pair(std::string(record.scan_interface().operator std::string_view()), int64_t(std::floor(record.scan_unixtime() / bucket)));
+        expected[key].stats_add(record.scan_seconds());
+    }
+    rebootping_test_check(groups.size(), ==, expected.size());
+    rebootping_test_check(groups.size(), ==, 3 * 2 * 24 * 6);
+    for (auto &&[key, stats] : expected) {
+        auto &found = groups[key];
+        rebootping_test_check(found.stats_count, ==, stats.stats_count, " ", key.first, " ", key.second);
+        rebootping_test_check(found.stats_nan_count, ==, stats.stats_nan_count, " ", key.first, " ", key.second);
+        rebootping_test_check(close_enough(found.stats_sum, stats.stats_sum), ==, true, " ", key.first, " ", key.second);
+    }
+
+    rebootping_test_check(records.timeshard_column_chunks<schema::scan_cookie>(0, start - day).chunks_list.size(), ==, 0);
+}
@@ -1,5 +1,6 @@
 #include "flat_dirtree.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <ctime>
 #include <filesystem>
@@ -10,12 +11,20 @@
 double string_to_unixtime(std::string_view s) {
     tm parsed;
     std::memset(&parsed, 0, sizeof(parsed));
-    parsed.tm_year = std::stoi(std::string(s.substr(0, 4)));
-    if (s.size() >= 6) { parsed.tm_mon = std::stoi(std::string(s.substr(4, 6))); }
-    if (s.size() >= 8) { parsed.tm_mday = std::stoi(std::string(s.substr(6, 8))); }
+    parsed.tm_year = std::stoi(std::string(s.substr(0, 4))) - 1900;
+    if (s.size() >= 6) { parsed.tm_mon = std::stoi(std::string(s.substr(4, 2))) - 1; }
+    parsed.tm_mday = s.size() >= 8 ? std::stoi(std::string(s.substr(6, 2))) : 1;
     return timegm(&parsed);
 }
 
+double timeshard_name_to_unixtime(std::string_view timeshard_name) {
+    // timeshards that are not named for a day, like the metrics one, sort before every day
+    if (timeshard_name.size() < 4 || !std::all_of(timeshard_name.begin(), timeshard_name.end(), [](char c) { return '0' <= c && c <= '9'; })) {
+        return 0;
+    }
+    return string_to_unixtime(timeshard_name);
+}
+
 std::vector<std::string> fetch_flat_timeshard_dirs(std::string_view flat_dir, std::string_view flat_dir_suffix) {
     std::vector<std::string> dirs;
     for (const auto &p : std::filesystem::directory_iterator(flat_dir)) {
@@ -1,20 +1,28 @@
 #pragma once
 
+#include "flat_env.hpp"
 #include "flat_mmap.hpp"
+#include "flat_timeshard_manifest.hpp"
 #include "now_unixtime.hpp"
 #include "str.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <ranges>
 #include <string_view>
+#include <tuple>
+#include <utility>
 #include <unordered_map>
 #include <vector>
 
 double string_to_unixtime(std::string_view s);
+double timeshard_name_to_unixtime(std::string_view timeshard_name);
 
 std::vector<std::string> fetch_flat_timeshard_dirs(std::string_view flat_dir, std::string_view flat_dir_suffix);
 
@@ -26,82 +34,276 @@ template <typename timeshard_schema_type> struct flat_dirtree {
     std::string flat_dir;
     std::string flat_dir_suffix;
     flat_mmap_settings flat_settings;
-    std::vector<std::unique_ptr<timeshard_type>> flat_timeshards;
-    std::unordered_map<std::string, timeshard_type *> flat_name_to_timeshard;
+    static constexpr double flat_timeshard_seconds = 24 * 60 * 60;
+
+    static constexpr size_t flat_field_count = std::tuple_size_v<decltype(typename timeshard_schema_type::flat_timeshard_schema_type().flat_schema_fields)>;
+    using manifest_type = flat_timeshard_manifest<flat_field_count>;
+    // absent when readonly, in which case no timeshard is skipped by its zone maps
+    std::unique_ptr<manifest_type> flat_manifest;
+
+    // A timeshard of the list, known by its name until something reaches through the handle, when it is opened,
+    // from readers as well as the writer. Only close_timeshards_over_budget closes it again, so a timeshard
+    // stays put for as long as the store is locked. Copies of the list share the state of each handle.
+    struct flat_timeshard_handle {
+        struct handle_state {
+            std::string state_name;
+            std::string state_dir;
+            double state_start_unixtime;
+            flat_mmap_settings state_settings;
+            // opened with the flat_timeshard_hot_ policies, until the timeshard ages out and is sealed
+            bool state_hot = false;
+            std::optional<uint64_t> state_manifest_slot;
+            // the close pass of the dirtree during which the timeshard was last reached, for closing the least recently used
+            std::shared_ptr<std::atomic<uint64_t> const> state_close_passes;
+            std::atomic<uint64_t> state_touched_pass = 0;
+            std::mutex state_open_mutex;
+            std::unique_ptr<timeshard_type> state_owned;
+            std::atomic<timeshard_type *> state_open = nullptr;
+        };
+        std::shared_ptr<handle_state> handle;
+
+        [[nodiscard]] std::string const &handle_name() const { return handle->state_name; }
+        [[nodiscard]] double handle_start_unixtime() const { return handle->state_start_unixtime; }
+        [[nodiscard]] bool handle_is_open() const { return handle->state_open.load(std::memory_order_acquire); }
+        [[nodiscard]] uint64_t handle_touched_pass() const { return handle->state_touched_pass.load(std::memory_order_relaxed); }
+
+        timeshard_type &operator*() const {
+            auto *open = handle->state_open.load(std::memory_order_acquire);
+            if (!open) [[unlikely]] { open = handle_open(); }
+            auto pass = handle->state_close_passes->load(std::memory_order_relaxed);
+            if (handle->state_touched_pass.load(std::memory_order_relaxed) != pass) { handle->state_touched_pass.store(pass, std::memory_order_relaxed); }
+            return *open;
+        }
+        timeshard_type *operator->() const { return &**this; }
+
+        [[nodiscard]] bool handle_is_hot() const { return handle->state_hot; }
+
+        // Opens the timeshard with cold_settings from now on. Returns whether it was hot, in which case
+        // the caller closes it so that it is not left faulted in or locked.
+        bool handle_cool(flat_mmap_settings const &cold_settings) const {
+            std::lock_guard lock(handle->state_open_mutex);
+            if (!handle->state_hot) { return false; }
+            handle->state_hot = false;
+            handle->state_settings = cold_settings;
+            return true;
+        }
+
+        // nothing may refer into the timeshard any more
+        void handle_close() const {
+            std::lock_guard lock(handle->state_open_mutex);
+            handle->state_open.store(nullptr, std::memory_order_release);
+            handle->state_owned.reset();
+        }
+
+      private:
+        timeshard_type *handle_open() const {
+            std::lock_guard lock(handle->state_open_mutex);
+            if (auto *open = handle->state_open.load(std::memory_order_relaxed)) { return open; }
+            handle->state_owned = std::make_unique<timeshard_type>(handle->state_name, handle->state_dir, handle->state_settings);
+            handle->state_owned->flat_timeshard_manifest_slot = handle->state_manifest_slot;
+            handle->state_open.store(handle->state_owned.get(), std::memory_order_release);
+            return handle->state_owned.get();
+        }
+    };
+
+    // Published copy-on-write: the single writer builds a new list when a timeshard is created and swaps it in,
+    // while readers keep whichever list they loaded alive for as long as they iterate it.
+    struct flat_timeshard_list {
+        std::vector<flat_timeshard_handle> list_timeshards;
+        std::unordered_map<std::string, flat_timeshard_handle> list_name_to_timeshard;
+    };
+    using timeshard_vector_type = decltype(flat_timeshard_list::list_timeshards);
+    std::shared_ptr<flat_timeshard_list const> flat_timeshards_published = std::make_shared<flat_timeshard_list const>();
+    std::shared_ptr<std::atomic<uint64_t>> flat_timeshard_close_passes = std::make_shared<std::atomic<uint64_t>>(0);
+
+    [[nodiscard]] std::shared_ptr<flat_timeshard_list const> flat_timeshards_snapshot() const { return std::atomic_load(&flat_timeshards_published); }
 
     flat_dirtree(std::string_view dir, std::string_view after_shard_suffix, flat_mmap_settings const &settings = flat_mmap_settings())
-        : flat_dir{dir}, flat_dir_suffix{after_shard_suffix}, flat_settings{settings} {
+        : flat_dir{dir}, flat_dir_suffix{after_shard_suffix}, flat_settings{flat_mmap_settings_from_env(flat_dir_suffix, settings)} {
         assert(!dir.empty());
         assert(!after_shard_suffix.empty());
+        if (!flat_settings.mmap_readonly) { flat_manifest = std::make_unique<manifest_type>(flat_dir + "/" + flat_dir_suffix + ".flatmanifest"); }
         reset_flat_timeshards();
     }
 
+    // Lists the timeshards on disk without opening them, except those the manifest does not know yet and the
+    // newest, which may still have been written to when the process stopped. The headers of the others are
+    // read, so a timeshard that cannot be opened is noticed here rather than when it is first reached.
     void reset_flat_timeshards() {
         auto new_dirs = fetch_flat_timeshard_dirs(flat_dir, flat_dir_suffix);
         // ranges are not easily convertible to vector in C++20
         // https://timur.audio/how-to-make-a-container-from-a-c20-range
 
-        flat_name_to_timeshard.clear();
-        flat_timeshards.clear();
-        flat_timeshards.reserve(new_dirs.size());
-
-        for (auto const &d : new_dirs) { insert_new_timeshard(d); }
+        auto list = std::make_shared<flat_timeshard_list>();
+        list->list_timeshards.reserve(new_dirs.size());
+        for (auto const &d : new_dirs) {
+            auto &handle = insert_new_timeshard(*list, d);
+            if (manifest_attach(handle, &d == &new_dirs.back())) {
+                handle.handle_close();
+            } else if (flat_manifest) {
+                timeshard_type::timeshard_check_header_file(handle.handle->state_dir);
+            }
+        }
+        std::atomic_store(&flat_timeshards_published, std::shared_ptr<flat_timeshard_list const>(std::move(list)));
     }
 
-    typename decltype(flat_timeshards)::const_iterator timeshard_iter_including(double unixtime) const {
-        auto after = std::lower_bound(flat_timeshards.begin(), flat_timeshards.end(), unixtime, [](std::unique_ptr<timeshard_type> const &s, double unixtime) {
-            return string_to_unixtime(s->flat_timeshard_name) < unixtime;
+    static typename timeshard_vector_type::const_iterator timeshard_iter_including(timeshard_vector_type const &timeshards, double unixtime) {
+        auto after = std::lower_bound(timeshards.begin(), timeshards.end(), unixtime, [](flat_timeshard_handle const &s, double unixtime) {
+            return s.handle_start_unixtime() < unixtime;
         });
-        if (after == flat_timeshards.begin()) { return after; }
+        if (after == timeshards.begin()) { return after; }
         --after;
         return after;
     }
 
-    typename decltype(flat_timeshards)::const_iterator timeshard_iter_after(double unixtime) const {
-        return std::upper_bound(flat_timeshards.begin(), flat_timeshards.end(), unixtime, [](double unixtime, std::unique_ptr<timeshard_type> const &s) {
-            return string_to_unixtime(s->flat_timeshard_name) > unixtime;
+    static typename timeshard_vector_type::const_iterator timeshard_iter_after(timeshard_vector_type const &timeshards, double unixtime) {
+        return std::upper_bound(timeshards.begin(), timeshards.end(), unixtime, [](double unixtime, flat_timeshard_handle const &s) {
+            return s.handle_start_unixtime() > unixtime;
         });
     }
 
-    typename decltype(flat_timeshards)::const_reverse_iterator timeshard_reverse_iter_including(double unixtime) const {
-        auto after =
-            std::lower_bound(flat_timeshards.rbegin(), flat_timeshards.rend(), unixtime,
-                             [](std::unique_ptr<timeshard_type> const &s, double unixtime) { return string_to_unixtime(s->flat_timeshard_name) > unixtime; });
-        if (after == flat_timeshards.rbegin()) { return after; }
-        --after;
-        return after;
+    // newest timeshard starting no later than unixtime
+    static typename timeshard_vector_type::const_reverse_iterator timeshard_reverse_iter_including(timeshard_vector_type const &timeshards, double unixtime) {
+        return typename timeshard_vector_type::const_reverse_iterator(timeshard_iter_after(timeshards, unixtime));
     }
 
-    typename decltype(flat_timeshards)::const_reverse_iterator timeshard_reverse_iter_before(double unixtime) const {
-        return std::upper_bound(flat_timeshards.rbegin(), flat_timeshards.rend(), unixtime, [](double unixtime, std::unique_ptr<timeshard_type> const &s) {
-            return string_to_unixtime(s->flat_timeshard_name) < unixtime;
-        });
+    // first timeshard, walking backwards, that ends before the one including unixtime
+    static typename timeshard_vector_type::const_reverse_iterator timeshard_reverse_iter_before(timeshard_vector_type const &timeshards, double unixtime) {
+        return typename timeshard_vector_type::const_reverse_iterator(timeshard_iter_including(timeshards, unixtime));
     }
 
-    typename decltype(flat_name_to_timeshard)::iterator insert_new_timeshard(std::string_view timeshard_name) {
-        return flat_name_to_timeshard
-            .insert_or_assign(std::string(timeshard_name),
-                              flat_timeshards
-                                  .emplace_back(std::make_unique<timeshard_type>(
-                                      timeshard_name, flat_dir + "/" + std::string(timeshard_name) + "/" + flat_dir_suffix, flat_settings))
-                                  .get())
-            .first;
+    flat_timeshard_handle &insert_new_timeshard(flat_timeshard_list &list, std::string_view timeshard_name) {
+        auto state = std::make_shared<typename flat_timeshard_handle::handle_state>();
+        state->state_name = timeshard_name;
+        state->state_dir = flat_dir + "/" + std::string(timeshard_name) + "/" + flat_dir_suffix;
+        state->state_start_unixtime = timeshard_name_to_unixtime(timeshard_name);
+        state->state_settings = flat_settings;
+        if (!flat_settings.mmap_readonly && state->state_start_unixtime + flat_timeshard_seconds > now_unixtime()) {
+            state->state_settings.mmap_populate |= flat_env::flat_timeshard_hot_populate();
+            state->state_settings.mmap_lock_index |= flat_env::flat_timeshard_hot_lock_index();
+            state->state_hot = true;
+        }
+        state->state_close_passes = flat_timeshard_close_passes;
+        state->state_touched_pass = flat_timeshard_close_passes->load();
+        auto &handle = list.list_timeshards.emplace_back(flat_timeshard_handle{std::move(state)});
+        list.list_name_to_timeshard.insert_or_assign(std::string(timeshard_name), handle);
+        return handle;
     }
 
+    // only the single writer may call this, so it can read the published list without synchronisation
     timeshard_type &ensure_timeshard_name_to_timeshard(std::string_view timeshard_name) {
-        auto i = flat_name_to_timeshard.find(std::string(timeshard_name));
-        if (i == flat_name_to_timeshard.end()) {
-            if (flat_settings.mmap_readonly) { throw std::runtime_error(str("timeshard ", timeshard_name, " does not exist in readonly ", flat_dir)); }
-            std::filesystem::create_directories(flat_dir + "/" + std::string(timeshard_name) + "/" + flat_dir_suffix);
-            i = insert_new_timeshard(timeshard_name);
+        auto const &published = *flat_timeshards_published;
+        auto i = published.list_name_to_timeshard.find(std::string(timeshard_name));
+        if (i != published.list_name_to_timeshard.end()) { return *i->second; }
+
+        if (flat_settings.mmap_readonly) { throw std::runtime_error(str("timeshard ", timeshard_name, " does not exist in readonly ", flat_dir)); }
+        std::filesystem::create_directories(flat_dir + "/" + std::string(timeshard_name) + "/" + flat_dir_suffix);
+        auto list = std::make_shared<flat_timeshard_list>(published);
+        manifest_attach(insert_new_timeshard(*list, timeshard_name));
+        std::sort(list->list_timeshards.begin(), list->list_timeshards.end(),
+                  [](auto const &a, auto const &b) { return a.handle_name() < b.handle_name(); });
+        auto &timeshard = *list->list_name_to_timeshard.at(std::string(timeshard_name));
+        std::atomic_store(&flat_timeshards_published, std::shared_ptr<flat_timeshard_list const>(std::move(list)));
+        return timeshard;
+    }
+
+    typename manifest_type::entry_type &manifest_entry_ref(timeshard_type const &timeshard) const {
+        return flat_manifest->manifest_entry_ref(*timeshard.flat_timeshard_manifest_slot);
+    }
+    typename manifest_type::entry_type &manifest_entry_ref(flat_timeshard_handle const &handle) const {
+        return flat_manifest->manifest_entry_ref(*handle.handle->state_manifest_slot);
+    }
+
+    template <typename iterator_type> static void manifest_notice_record(typename manifest_type::entry_type &entry, iterator_type &iter) {
+        auto notice = [&](auto &&field, flat_zone_map &zone) {
+            if constexpr (std::is_arithmetic_v<typename std::decay_t<decltype(field)>::field_value_type>) {
+                zone.zone_notice(field.flat_field_value(iter));
+            } else {
+                zone.zone_unbounded();
+            }
+        };
+        size_t field_index = 0;
+        std::apply([&](auto &&...field) { (notice(field, entry.entry_zone_maps[field_index++]), ...); },
+                   typename timeshard_schema_type::flat_timeshard_schema_type().flat_schema_fields);
+    }
+
+    // Gives the timeshard its manifest entry. Zones are widened before a record is committed, so an entry that
+    // already exists covers every committed record and is used without opening the timeshard. A timeshard the
+    // manifest does not know is opened and scanned, and true is returned. With revalidate, a known timeshard is
+    // opened too, and scanned again if it holds a different number of records than its entry says, as after a
+    // crash between committing a record and counting it, or when the pages of the manifest were lost.
+    bool manifest_attach(flat_timeshard_handle &handle, bool revalidate = false) {
+        if (!flat_manifest) { return false; }
+        auto known = flat_manifest->manifest_name_to_slot.contains(handle.handle_name());
+        handle.handle->state_manifest_slot =
+            flat_manifest->manifest_ensure_slot(handle.handle_name(), handle.handle_start_unixtime(), handle.handle_start_unixtime() + flat_timeshard_seconds);
+        if (known && !revalidate) { return false; }
+
+        auto &timeshard = *handle;
+        auto &entry = manifest_entry_ref(handle);
+        auto record_count = timeshard.flat_timeshard_index_next();
+        if (known && entry.entry_record_count == record_count) { return true; }
+        for (auto &zone : entry.entry_zone_maps) { zone = flat_zone_map(); }
+        for (uint64_t index = 0; record_count > index; ++index) {
+            auto iter = timeshard.timeshard_iterator_at(index);
+            manifest_notice_record(entry, iter);
         }
-        return *i->second;
+        entry.entry_record_count = record_count;
+        return true;
+    }
+
+    // Rewrites the indexes of every timeshard that ended by unixtime into their compact read-only form.
+    // Sealing an already sealed timeshard only costs a check unless records were added to it since, and
+    // one that is not open is not even opened when its manifest entry says it was sealed with every record.
+    // A timeshard that was hot is closed once sealed, to be opened again without the hot policies.
+    void seal_timeshards_before(double unixtime) {
+        if (flat_manifest) {
+            for (auto &&timeshard : flat_timeshards_snapshot()->list_timeshards) {
+                if (timeshard.handle_start_unixtime() + flat_timeshard_seconds > unixtime) { continue; }
+                auto &entry = manifest_entry_ref(timeshard);
+                auto was_open = timeshard.handle_is_open();
+                auto was_hot = timeshard.handle_cool(flat_settings);
+                if (!was_open && entry.entry_sealed_record_count == entry.entry_record_count) { continue; }
+                timeshard->flat_timeshard_seal();
+                entry.entry_sealed_record_count = entry.entry_record_count;
+                if (!was_open || was_hot) { timeshard.handle_close(); }
+            }
+        }
+        close_timeshards_over_budget();
+    }
+
+    // While the process has more files open or bytes mapped than flat_timeshard_open_files_budget or
+    // flat_timeshard_mapped_bytes_budget, closes the timeshards of this store that were reached least recently,
+    // counted in calls to this function. It needs the same exclusive access as reset_flat_timeshards, as
+    // iterators and references into a closed timeshard are left dangling.
+    void close_timeshards_over_budget() {
+        auto over_budget = [] {
+            return flat_mmap_open_files() > flat_env::flat_timeshard_open_files_budget() ||
+                   flat_mmap_mapped_bytes() > flat_env::flat_timeshard_mapped_bytes_budget();
+        };
+        if (over_budget()) {
+            auto snapshot = flat_timeshards_snapshot();
+            std::vector<flat_timeshard_handle const *> open;
+            for (auto &&handle : snapshot->list_timeshards) {
+                if (handle.handle_is_open()) { open.push_back(&handle); }
+            }
+            std::sort(open.begin(), open.end(), [](auto *a, auto *b) {
+                return std::pair(a->handle_touched_pass(), a->handle_start_unixtime()) < std::pair(b->handle_touched_pass(), b->handle_start_unixtime());
+            });
+            for (auto *handle : open) {
+                if (!over_budget()) { break; }
+                handle->handle_close();
+            }
+        }
+        ++*flat_timeshard_close_passes;
     }
 
     timeshard_type &ensure_unixtime_to_timeshard(double unixtime) { return ensure_timeshard_name_to_timeshard(yyyymmdd(unixtime)); }
     timeshard_type const *timeshard_name_to_timeshard(std::string_view timeshard_name) const {
-        auto i = flat_name_to_timeshard.find(std::string(timeshard_name));
-        if (i == flat_name_to_timeshard.end()) { return nullptr; }
+        auto snapshot = flat_timeshards_snapshot();
+        auto i = snapshot->list_name_to_timeshard.find(std::string(timeshard_name));
+        if (i == snapshot->list_name_to_timeshard.end()) { return nullptr; }
+        // timeshards are only dropped or closed by reset_flat_timeshards and close_timeshards_over_budget, which already require exclusive access
         return &*i->second;
     }
 
@@ -119,18 +321,28 @@ template <typename timeshard_schema_type> struct flat_dirtree {
     }
 
     template <typename add_function> timeshard_iterator_type add_flat_record(timeshard_type &timeshard, add_function &&f) {
-        auto index = timeshard.timeshard_header_ref().flat_timeshard_index_next;
+        auto index = timeshard.flat_timeshard_index_next();
         timeshard.flat_timeshard_ensure_mmapped(index);
 
         auto iter = timeshard_iterator_type{&timeshard, index};
         f(iter);
         flat_indices_commit(timeshard, iter);
 
+        // zones only ever widen, so they may cover the record before it is visible
+        if (flat_manifest) { manifest_notice_record(manifest_entry_ref(timeshard), iter); }
         timeshard.timeshard_commit_index(index);
+        if (flat_manifest) { manifest_entry_ref(timeshard).entry_record_count = index + 1; }
 
         return iter;
     }
 
+    // widens the zone maps to cover a record whose fields were changed after it was added, and writes the
+    // change back if the record's timeshard was sealed into packed columns
+    template <typename iterator_type> void flat_record_updated(iterator_type &iter) {
+        const_cast<timeshard_type *>(iter.flat_iterator_timeshard)->flat_timeshard_write_back();
+        if (flat_manifest) { manifest_notice_record(manifest_entry_ref(*iter.flat_iterator_timeshard), iter); }
+    }
+
     template <typename add_function> timeshard_iterator_type add_flat_record(double unixtime, add_function &&f) {
         return add_flat_record(ensure_unixtime_to_timeshard(unixtime), std::forward<add_function>(f));
     }
@@ -146,13 +358,15 @@ template <typename timeshard_schema_type> struct flat_dirtree {
         using pointer = timeshard_iterator_type *;
         using reference = timeshard_iterator_type &;
 
-        typename decltype(flat_timeshards)::const_iterator outer_iterator;
+        std::shared_ptr<flat_timeshard_list const> iter_timeshards;
+        typename timeshard_vector_type::const_iterator outer_iterator;
         uint64_t flat_iterator_index = 0;
 
         flat_dirtree_iterator() = default;
 
-        explicit flat_dirtree_iterator(typename decltype(flat_timeshards)::const_iterator const &it, uint64_t index = 0)
-            : outer_iterator{it}, flat_iterator_index{index} {}
+        flat_dirtree_iterator(std::shared_ptr<flat_timeshard_list const> timeshards, typename timeshard_vector_type::const_iterator const &it,
+                              uint64_t index = 0)
+            : iter_timeshards{std::move(timeshards)}, outer_iterator{it}, flat_iterator_index{index} {}
 
         bool operator==(flat_dirtree_iterator const &other) const {
             return other.outer_iterator == outer_iterator && other.flat_iterator_index == flat_iterator_index;
@@ -172,7 +386,7 @@ template <typename timeshard_schema_type> struct flat_dirtree {
         flat_dirtree_iterator &operator++() {
             ++flat_iterator_index;
 
-            if (flat_iterator_index >= (*outer_iterator)->timeshard_header_ref().flat_timeshard_index_next) {
+            if (flat_iterator_index >= (*outer_iterator)->flat_timeshard_index_next()) {
                 flat_iterator_index = 0;
                 ++outer_iterator;
             }
@@ -181,7 +395,7 @@ template <typename timeshard_schema_type> struct flat_dirtree {
         flat_dirtree_iterator &operator--() {
             while (flat_iterator_index == 0) {
                 --outer_iterator;
-                flat_iterator_index = (*outer_iterator)->timeshard_header_ref().flat_timeshard_index_next;
+                flat_iterator_index = (*outer_iterator)->flat_timeshard_index_next();
             }
             --flat_iterator_index;
             return *this;
@@ -200,15 +414,78 @@ template <typename timeshard_schema_type> struct flat_dirtree {
     };
 
     auto timeshard_query(double start_unixtime = std::numeric_limits<double>::min(), double end_unixtime = std::numeric_limits<double>::max()) const {
-        auto begin = flat_dirtree_iterator{timeshard_iter_including(start_unixtime)};
-        auto end = flat_dirtree_iterator{timeshard_iter_after(end_unixtime)};
+        // timeshards created after this point are not visited, rows committed to existing ones are
+        auto snapshot = flat_timeshards_snapshot();
+        auto begin = flat_dirtree_iterator{snapshot, timeshard_iter_including(snapshot->list_timeshards, start_unixtime)};
+        auto end = flat_dirtree_iterator{snapshot, timeshard_iter_after(snapshot->list_timeshards, end_unixtime)};
 
         return std::ranges::subrange(begin, end);
     }
 
+    // Records of the timeshards whose zone map for field_schema may hold a value in [field_min, field_max].
+    // Only whole timeshards are skipped, so the records returned still need to be checked.
+    template <typename field_schema>
+    auto timeshard_zone_query(double field_min, double field_max, double start_unixtime = std::numeric_limits<double>::min(),
+                              double end_unixtime = std::numeric_limits<double>::max()) const {
+        auto snapshot = flat_timeshards_snapshot();
+        auto zoned = std::make_shared<flat_timeshard_list>();
+        auto after = timeshard_iter_after(snapshot->list_timeshards, end_unixtime);
+        for (auto i = timeshard_iter_including(snapshot->list_timeshards, start_unixtime); i != after; ++i) {
+            if (!flat_manifest || manifest_entry_ref(*i).entry_zone_maps[flat_field_index<field_schema>()].zone_overlaps(field_min, field_max)) {
+                zoned->list_timeshards.push_back(*i);
+            }
+        }
+        std::shared_ptr<flat_timeshard_list const> published = std::move(zoned);
+        auto begin = flat_dirtree_iterator{published, published->list_timeshards.begin()};
+        auto end = flat_dirtree_iterator{published, published->list_timeshards.end()};
+        return std::ranges::subrange(begin, end);
+    }
+
+    template <typename... field_schemas> struct flat_column_chunk {
+        timeshard_type const *chunk_timeshard;
+        uint64_t chunk_rows;
+        std::tuple<decltype(field_schemas::flat_field_of(std::declval<timeshard_type const &>()).field_column(0))...> chunk_columns;
+    };
+    template <typename... field_schemas> struct flat_column_chunks {
+        std::shared_ptr<flat_timeshard_list const> chunks_snapshot;
+        std::vector<flat_column_chunk<field_schemas...>> chunks_list;
+
+        auto begin() const { return chunks_list.begin(); }
+        auto end() const { return chunks_list.end(); }
+    };
+
+    // The committed rows of the timeshards overlapping [start_unixtime, end_unixtime] as one span per field per
+    // timeshard, for scans that run over whole columns rather than a record at a time. Like the records a
+    // query returns, the spans are only valid while the store is locked against writers.
+    template <typename... field_schemas>
+    flat_column_chunks<field_schemas...> timeshard_column_chunks(double start_unixtime = std::numeric_limits<double>::min(),
+                                                                 double end_unixtime = std::numeric_limits<double>::max()) const {
+        flat_column_chunks<field_schemas...> chunks{.chunks_snapshot = flat_timeshards_snapshot()};
+        auto &timeshards = chunks.chunks_snapshot->list_timeshards;
+        auto after = timeshard_iter_after(timeshards, end_unixtime);
+        for (auto i = timeshard_iter_including(timeshards, start_unixtime); i != after; ++i) {
+            timeshard_type const &timeshard = **i;
+            auto rows = timeshard.flat_timeshard_index_next();
+            if (!rows) { continue; }
+            chunks.chunks_list.push_back({&timeshard, rows, {field_schemas::flat_field_of(timeshard).field_column(rows)...}});
+        }
+        return chunks;
+    }
+
+    template <typename field_schema> static constexpr size_t flat_field_index() {
+        constexpr auto index = []<typename... field_schemas>(std::tuple<field_schemas...> const &) {
+            size_t index = 0;
+            ((std::is_same_v<field_schema, field_schemas> ? false : (++index, true)) && ...);
+            return index;
+        }(typename timeshard_schema_type::flat_timeshard_schema_type().flat_schema_fields);
+        static_assert(index < flat_field_count, "field_schema is not a field of this record");
+        return index;
+    }
+
     template <typename key_type, typename obj_to_field_mapper> struct flat_dirtree_search_context {
         key_type const search_key;
         obj_to_field_mapper const search_obj_to_field_mapper;
+        std::shared_ptr<flat_timeshard_list const> const search_timeshards;
     };
     template <typename search_context> struct flat_dirtree_linked_index_iterator {
         using iterator_category = std::input_iterator_tag;
@@ -218,8 +495,8 @@ template <typename timeshard_schema_type> struct flat_dirtree {
         using reference = timeshard_iterator_type &;
 
         std::shared_ptr<search_context> iter_search_context;
-        typename decltype(flat_timeshards)::const_reverse_iterator iter_timeshard;
-        typename decltype(flat_timeshards)::const_reverse_iterator iter_stop_timeshard;
+        typename timeshard_vector_type::const_reverse_iterator iter_timeshard;
+        typename timeshard_vector_type::const_reverse_iterator iter_stop_timeshard;
         timeshard_iterator_type iter_record;
 
         flat_dirtree_linked_index_iterator() = default;
@@ -312,23 +589,25 @@ template <typename timeshard_schema_type> struct flat_dirtree {
     template <typename key_type, typename obj_to_field_mapper>
     decltype(auto) dirtree_field_query(key_type &&iter_key, double start_unixtime, double end_unixtime, obj_to_field_mapper &&mapper) {
         // TODO fix object lifetimes
-        auto begin = timeshard_reverse_iter_including(end_unixtime);
-        auto end = timeshard_reverse_iter_before(start_unixtime);
         using search_context = flat_dirtree_search_context<std::decay_t<key_type>, obj_to_field_mapper>;
-        auto context = std::make_shared<search_context>(iter_key, mapper);
+        auto context = std::make_shared<search_context>(iter_key, mapper, flat_timeshards_snapshot());
+        auto begin = timeshard_reverse_iter_including(context->search_timeshards->list_timeshards, end_unixtime);
+        auto end = timeshard_reverse_iter_before(context->search_timeshards->list_timeshards, start_unixtime);
         flat_dirtree_linked_index_iterator<search_context> end_iter(context, end, end);
         flat_dirtree_linked_index_iterator<search_context> start_iter(context, begin, end);
         return flat_dirtree_linked_index_subrange<search_context>(*this, context, start_iter, end_iter);
     }
     template <typename obj_to_field_mapper, typename... arg_types>
     void dirtree_field_walk(double start_unixtime, double end_unixtime, obj_to_field_mapper &&mapper, arg_types &&...args) const {
-        auto begin = timeshard_reverse_iter_including(end_unixtime);
-        auto end = timeshard_reverse_iter_before(start_unixtime);
+        auto snapshot = flat_timeshards_snapshot();
+        auto begin = timeshard_reverse_iter_including(snapshot->list_timeshards, end_unixtime);
+        auto end = timeshard_reverse_iter_before(snapshot->list_timeshards, start_unixtime);
         for (auto i = begin; i != end; ++i) { mapper(**i).template flat_timeshard_field_walk<timeshard_schema_type>(args...); }
     }
     template <typename obj_to_field_mapper> decltype(auto) dirtree_field_walk(double start_unixtime, double end_unixtime, obj_to_field_mapper &&mapper) const {
-        auto begin = timeshard_reverse_iter_including(end_unixtime);
-        auto end = timeshard_reverse_iter_before(start_unixtime);
+        auto snapshot = flat_timeshards_snapshot();
+        auto begin = timeshard_reverse_iter_including(snapshot->list_timeshards, end_unixtime);
+        auto end = timeshard_reverse_iter_before(snapshot->list_timeshards, start_unixtime);
         std::unordered_map<typename std::decay_t<decltype(mapper(**begin))>::field_hydrated_key_type, timeshard_iterator_type> ret;
         for (auto i = begin; i != end; ++i) {
             mapper(**i).template flat_timeshard_field_walk<timeshard_schema_type>([&](auto &&k, auto &&v) { ret[k] = v; });
@@ -0,0 +1,176 @@
+#include "flat_index_field.hpp"
+#include "flat_record.hpp"
+#include "rebootping_test.hpp"
+
+#include <cstdlib>
+
+define_flat_record(lazy_test_record, (double, lazy_unixtime), (uint64_t, lazy_value), (flat_bytes_interned_ptr, lazy_name),
+                   (flat_index_linked_field<uint64_t>, lazy_value_index));
+
+namespace {
+constexpr double day = 24 * 60 * 60;
+constexpr int day_count = 40;
+
+uint64_t open_timeshard_count(lazy_test_record const &records) {
+    uint64_t open = 0;
+    for (auto &&handle : records.flat_timeshards_snapshot()->list_timeshards) { open += handle.handle_is_open(); }
+    return open;
+}
+} // namespace
+
+TEST(flat_dirtree_suite, timeshards_open_on_first_touch) {
+    tmpdir tmpdir;
+    {
+        lazy_test_record records(tmpdir.tmpdir_name);
+        for (int d = 0; day_count > d; ++d) {
+            records.add_flat_record(d * day, [&](auto &&record) {
+                record.lazy_unixtime() = d * day;
+                record.lazy_value() = d;
+                record.lazy_name() = str("day ", d);
+                record.flat_iterator_timeshard->lazy_value_index.index_linked_field_add(record.lazy_value(), record);
+            });
+        }
+        rebootping_test_check(open_timeshard_count(records), ==, day_count);
+    }
+    {
+        auto files_before = flat_mmap_open_files();
+        lazy_test_record records(tmpdir.tmpdir_name);
+        rebootping_test_check(records.flat_timeshards_snapshot()->list_timeshards.size(), ==, day_count);
+        rebootping_test_check(open_timeshard_count(records), ==, 0);
+        // the manifest is the only file opened
+        rebootping_test_check(flat_mmap_open_files() - files_before, ==, 1);
+
+        // zone maps choose timeshards without opening the others
+        using schema = lazy_test_record::flat_record_schema_type;
+        auto zoned = records.timeshard_zone_query<schema::lazy_value>(7, 7);
+        rebootping_test_check(open_timeshard_count(records), ==, 0);
+        rebootping_test_check(std::ranges::distance(zoned), ==, 1);
+        rebootping_test_check(open_timeshard_count(records), ==, 1);
+
+        auto found = records.lazy_value_index(uint64_t{3}, 3 * day + 1, 3 * day + 1);
+        rebootping_test_check(found.begin()->lazy_name(), ==, "day 3");
+        rebootping_test_check(open_timeshard_count(records), ==, 2);
+
+        uint64_t visited = 0;
+        for (auto &&record : records.timeshard_query()) { rebootping_test_check(record.lazy_value(), ==, visited++); }
+        rebootping_test_check(visited, ==, day_count);
+        rebootping_test_check(open_timeshard_count(records), ==, day_count);
+    }
+}
+
+TEST(flat_dirtree_suite, close_least_recently_used_over_budget) {
+    tmpdir tmpdir;
+    lazy_test_record records(tmpdir.tmpdir_name);
+    for (int d = 0; day_count > d; ++d) {
+        records.add_flat_record(d * day, [&](auto &&record) {
+            record.lazy_value() = d;
+            record.lazy_name() = str("day ", d);
+        });
+    }
+    // nothing is closed while the process is within budget
+    records.close_timeshards_over_budget();
+    rebootping_test_check(open_timeshard_count(records), ==, day_count);
+
+    // the last few days are reached after the pass, so they are the ones kept
+    for (int d = day_count - 3; day_count > d; ++d) { rebootping_test_check(records.unixtime_to_timeshard(d * day)->flat_timeshard_index_next(), ==, 1); }
+    auto files = flat_mmap_open_files();
+    auto per_timeshard = (files - 1) / day_count;
+    setenv("flat_timeshard_open_files_budget", str(files - per_timeshard * (day_count - 3)).c_str(), 1);
+    records.close_timeshards_over_budget();
+    unsetenv("flat_timeshard_open_files_budget");
+    rebootping_test_check(open_timeshard_count(records), ==, 3);
+    rebootping_test_check(flat_mmap_open_files(), <=, files - per_timeshard * (day_count - 3));
+    for (auto &&handle : records.flat_timeshards_snapshot()->list_timeshards) {
+        rebootping_test_check(handle.handle_is_open(), ==, handle.handle_start_unixtime() >= (day_count - 3) * day, " ", handle.handle_name());
+    }
+
+    // closed timeshards open again with everything they held, and take records as before
+    rebootping_test_check(records.unixtime_to_timeshard(0)->timeshard_iterator_at(0).lazy_name(), ==, "day 0");
+    records.add_flat_record(0.5 * day, [&](auto &&record) { record.lazy_name() = "day 0"; });
+    rebootping_test_check(records.unixtime_to_timeshard(0)->timeshard_iterator_at(1).lazy_name().flat_bytes_offset.bytes_offset, ==,
+                          records.unixtime_to_timeshard(0)->timeshard_iterator_at(0).lazy_name().flat_bytes_offset.bytes_offset);
+
+    // sealing opens only the timeshards the manifest does not record as sealed with all their records
+    records.seal_timeshards_before(day_count * day);
+    setenv("flat_timeshard_open_files_budget", "0", 1);
+    records.close_timeshards_over_budget();
+    unsetenv("flat_timeshard_open_files_budget");
+    rebootping_test_check(open_timeshard_count(records), ==, 0);
+    records.seal_timeshards_before(day_count * day);
+    rebootping_test_check(open_timeshard_count(records), ==, 0);
+    records.add_flat_record(1.5 * day, [&](auto &&record) { record.lazy_value() = 100; });
+    records.close_timeshards_over_budget();
+    rebootping_test_check(open_timeshard_count(records), ==, 1);
+    setenv("flat_timeshard_open_files_budget", "0", 1);
+    records.close_timeshards_over_budget();
+    unsetenv("flat_timeshard_open_files_budget");
+    records.seal_timeshards_before(day_count * day);
+    rebootping_test_check(open_timeshard_count(records), ==, 0);
+    rebootping_test_check(records.unixtime_to_timeshard(day)->timeshard_iterator_at(1).lazy_value(), ==, 100);
+    rebootping_test_check(records.unixtime_to_timeshard(day)->lazy_value.field_packed != nullptr, ==, true);
+}
+
+TEST(flat_dirtree_suite, manifest_revalidates_newest_timeshard) {
+    tmpdir tmpdir;
+    {
+        lazy_test_record records(tmpdir.tmpdir_name);
+        for (int d = 0; 3 > d; ++d) {
+            for (uint64_t v = 0; 3 > v; ++v) {
+                records.add_flat_record(d * day, [&](auto &&record) { record.lazy_value() = d * 10 + v; });
+            }
+        }
+        // as if the process stopped after committing the newest records but before the manifest counted them
+        auto &entry = records.manifest_entry_ref(records.flat_timeshards_snapshot()->list_timeshards.back());
+        entry.entry_record_count = 1;
+        for (auto &zone : entry.entry_zone_maps) { zone = flat_zone_map(); }
+    }
+    lazy_test_record records(tmpdir.tmpdir_name);
+    rebootping_test_check(records.manifest_entry_ref(records.flat_timeshards_snapshot()->list_timeshards.back()).entry_record_count, ==, 3);
+    using schema = lazy_test_record::flat_record_schema_type;
+    uint64_t found = 0;
+    for (auto &&record : records.timeshard_zone_query<schema::lazy_value>(22, 22)) { found += record.lazy_value() == 22; }
+    rebootping_test_check(found, ==, 1);
+}
+
+TEST(flat_dirtree_suite, header_checked_when_listed) {
+    tmpdir tmpdir;
+    {
+        lazy_test_record records(tmpdir.tmpdir_name);
+        records.add_flat_record(0.0, [&](auto &&record) { record.lazy_value() = 1; });
+        records.add_flat_record(day, [&](auto &&record) { record.lazy_value() = 2; });
+    }
+    {
+        // the older timeshard is only listed, not opened, when the store starts
+        flat_mmap main_mmap{str(tmpdir.tmpdir_name, "/", yyyymmdd(0.0), "/lazy_test_record/flat_timeshard_main.flatmap")};
+        main_mmap.mmap_cast<flat_timeshard_header>(0).flat_timeshard_magic = 0xdeadbeaf;
+    }
+    try {
+        lazy_test_record records(tmpdir.tmpdir_name);
+        rebootping_test_fail("flat_dirtree header_checked_when_listed no failure");
+    } catch (std::exception const &e) {
+        rebootping_test_check(std::string(e.what()).find("flat_timeshard_magic") != std::string::npos, ==, true, e.what());
+    }
+}
+
+TEST(flat_dirtree_suite, hot_timeshard_cools_when_sealed) {
+    tmpdir tmpdir;
+    lazy_test_record records(tmpdir.tmpdir_name);
+    auto now = now_unixtime();
+    records.add_flat_record(now, [&](auto &&record) { record.lazy_value() = 1; });
+    records.add_flat_record(now - 3 * day, [&](auto &&record) { record.lazy_value() = 2; });
+    auto snapshot = records.flat_timeshards_snapshot();
+    auto &hot = snapshot->list_timeshards.back();
+    rebootping_test_check(hot.handle_is_hot(), ==, true);
+    rebootping_test_check(snapshot->list_timeshards.front().handle_is_hot(), ==, false);
+
+    // still being written, so it stays hot and open
+    records.seal_timeshards_before(now);
+    rebootping_test_check(hot.handle_is_hot(), ==, true);
+    rebootping_test_check(hot.handle_is_open(), ==, true);
+
+    records.seal_timeshards_before(now + 2 * day);
+    rebootping_test_check(hot.handle_is_hot(), ==, false);
+    rebootping_test_check(hot.handle_is_open(), ==, false);
+    rebootping_test_check(hot.handle->state_settings.mmap_populate, ==, false);
+    rebootping_test_check(hot->timeshard_iterator_at(0).lazy_value(), ==, 1);
+}
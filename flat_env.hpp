@@ -2,6 +2,8 @@
 
 #include "env.hpp"
 
+#include <cstdint>
+
 #define define_flat_env(name, default_value)                                                                                                                   \
     namespace flat_env {                                                                                                                                       \
     inline auto name() -> decltype(env(#name, default_value)) { return env(#name, default_value); }                                                            \
@@ -11,3 +13,21 @@ define_flat_env(oui_database_filename, "/var/lib/ieee-data/oui.txt");
 define_flat_env(obfuscate_address, false);
 define_flat_env(obfuscate_address_reveal_prefix, 8);
 define_flat_env(timeshard_strftime_format, "%Y%m%d");
+define_flat_env(flat_timeshard_pack_sealed, true);
+define_flat_env(flat_timeshard_open_files_budget, uint64_t{2048});
+define_flat_env(flat_timeshard_mapped_bytes_budget, uint64_t{8} << 30);
+// bounds of the chunk an appended flat_mmap grows by, which is otherwise as big as the file already is
+define_flat_env(flat_mmap_reserve_min_bytes, uint64_t{64} << 10);
+define_flat_env(flat_mmap_reserve_max_bytes, uint64_t{64} << 20);
+// address space reserved for each writable flat_mmap to grow into without moving; on by default only where
+// address space is plentiful, and never more than a sixteenth of it
+define_flat_env(flat_mmap_stable_reserve_bytes, uint64_t{sizeof(void *) >= 8 ? 4u : 0u} << 30);
+// policy for the timeshard still being written, which every new record touches
+define_flat_env(flat_timeshard_hot_populate, true);
+define_flat_env(flat_timeshard_hot_lock_index, false);
+// "writeback" leaves records to reach the disk whenever the kernel writes their pages back, in any order;
+// "group_commit" has flat_flusher sync them every flat_durability_group_commit_ms, data before commit
+define_flat_env(flat_durability_mode, "writeback");
+define_flat_env(flat_durability_group_commit_ms, uint64_t{100});
+
+inline bool flat_durability_group_commit() { return flat_env::flat_durability_mode() == "group_commit"; }
@@ -25,7 +25,7 @@ template <typename offset_type, typename length_type> struct flat_file_string_po
         if (s.string_offset < sizeof(offset_type)) { s.string_offset = sizeof(offset_type); }
         auto end_offset = uint64_t(s.string_offset) + sizeof(length_type) + v.length();
         assert(std::numeric_limits<offset_type>::max() >= end_offset);
-        file_map.mmap_allocate_at_least(end_offset);
+        file_map.mmap_reserve_at_least(end_offset);
         file_map.mmap_cast<length_type>(s.string_offset) = v.length();
         std::memcpy(s.flat_string_view(file_map).data(), v.data(), v.length());
 
@@ -0,0 +1,80 @@
+#include "flat_flusher.hpp"
+
+#include "flat_env.hpp"
+#include "flat_timeshard.hpp"
+#include "loop_thread.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+std::atomic<uint64_t> global_group_commits;
+std::atomic<uint64_t> global_committed_records;
+std::atomic<uint64_t> global_dropped_records;
+
+// flusher_pass_mutex is held for a whole pass, so detaching waits for the timeshard to be let go.
+// Attaching only takes flusher_attached_mutex, so opening a timeshard never waits for the disk.
+struct flat_flusher : loop_thread {
+    std::mutex flusher_pass_mutex;
+    std::vector<flat_timeshard *> flusher_timeshards;
+    std::mutex flusher_attached_mutex;
+    std::vector<flat_timeshard *> flusher_attached;
+
+    flat_flusher() { loop_spawn(); }
+    ~flat_flusher() override { loop_stop_join(); }
+
+    bool loop_run_once() override {
+        std::this_thread::sleep_for(std::chrono::milliseconds(flat_env::flat_durability_group_commit_ms()));
+        std::lock_guard pass_lock(flusher_pass_mutex);
+        {
+            std::lock_guard attached_lock(flusher_attached_mutex);
+            flusher_timeshards.insert(flusher_timeshards.end(), flusher_attached.begin(), flusher_attached.end());
+            flusher_attached.clear();
+        }
+        for (auto *timeshard : flusher_timeshards) {
+            try {
+                timeshard->timeshard_flush();
+            } catch (std::exception const &e) {
+                // the records stay committed and the next pass tries again
+                std::cerr << "flat_flusher " << timeshard->flat_timeshard_name << ": " << e.what() << std::endl;
+            }
+        }
+        return false;
+    }
+};
+
+// never destroyed, so that timeshards of static stores can still detach while the process exits
+flat_flusher &flat_flusher_instance() {
+    static auto *flusher = new flat_flusher;
+    return *flusher;
+}
+} // namespace
+
+void flat_flusher_attach(flat_timeshard &timeshard) {
+    auto &flusher = flat_flusher_instance();
+    std::lock_guard lock(flusher.flusher_attached_mutex);
+    flusher.flusher_attached.push_back(&timeshard);
+}
+
+void flat_flusher_detach(flat_timeshard &timeshard) {
+    auto &flusher = flat_flusher_instance();
+    std::lock_guard pass_lock(flusher.flusher_pass_mutex);
+    std::lock_guard attached_lock(flusher.flusher_attached_mutex);
+    std::erase(flusher.flusher_timeshards, &timeshard);
+    std::erase(flusher.flusher_attached, &timeshard);
+}
+
+uint64_t flat_flusher_group_commits() { return global_group_commits.load(std::memory_order_relaxed); }
+uint64_t flat_flusher_committed_records() { return global_committed_records.load(std::memory_order_relaxed); }
+uint64_t flat_flusher_dropped_records() { return global_dropped_records.load(std::memory_order_relaxed); }
+
+void flat_flusher_count_commit(uint64_t records) {
+    ++global_group_commits;
+    global_committed_records += records;
+}
+void flat_flusher_count_dropped(uint64_t records) { global_dropped_records += records; }
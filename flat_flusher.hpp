@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+struct flat_timeshard;
+
+// In flat_durability_mode group_commit, every writable timeshard is attached to a process-wide thread that
+// wakes every flat_durability_group_commit_ms and calls timeshard_flush on each, so that the records committed
+// since the last pass reach the disk together. Writers never wait for it: it finds what to flush by comparing
+// each timeshard's flat_timeshard_index_next with what it last made durable.
+void flat_flusher_attach(flat_timeshard &timeshard);
+// waits out a pass in progress, after which the thread no longer reaches the timeshard
+void flat_flusher_detach(flat_timeshard &timeshard);
+
+// across every timeshard of the process
+[[nodiscard]] uint64_t flat_flusher_group_commits();
+[[nodiscard]] uint64_t flat_flusher_committed_records();
+// records that were committed but not made durable before a crash, and so were dropped when reopened
+[[nodiscard]] uint64_t flat_flusher_dropped_records();
+void flat_flusher_count_commit(uint64_t records);
+void flat_flusher_count_dropped(uint64_t records);
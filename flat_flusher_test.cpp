@@ -0,0 +1,100 @@
+#include "flat_flusher.hpp"
+#include "flat_index_field.hpp"
+#include "flat_record.hpp"
+#include "rebootping_test.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <thread>
+
+define_flat_record(durable_test_record, (uint64_t, durable_value), (flat_bytes_interned_ptr, durable_name),
+                   (flat_index_linked_field<uint64_t>, durable_value_index));
+
+namespace {
+constexpr double unixtime = 1;
+
+void add_durable(durable_test_record &records, uint64_t i) {
+    records.add_flat_record(unixtime, [&](auto &&record) {
+        record.durable_value() = i;
+        record.durable_name() = str("name ", i % 7);
+        record.flat_iterator_timeshard->durable_value_index.index_linked_field_add(i % 10 + (i >= 100 ? 1000 : 0), record);
+    });
+}
+
+uint64_t durable_index_next(durable_test_record const &records) {
+    auto &timeshard = *records.unixtime_to_timeshard(unixtime);
+    return timeshard.timeshard_durable_mmap->mmap_cast<flat_timeshard_durable_header>(0).flat_durable_index_next;
+}
+
+uint64_t found_count(durable_test_record &records, uint64_t key) {
+    uint64_t found = 0;
+    for (auto &&record : records.durable_value_index(key, unixtime, unixtime)) {
+        rebootping_test_check(record.durable_value() % 10, ==, key % 1000);
+        ++found;
+    }
+    return found;
+}
+} // namespace
+
+TEST(flat_flusher_suite, group_commit_after_data) {
+    tmpdir tmpdir;
+    auto dir = tmpdir.tmpdir_name + "/19700101/durable_test_record";
+    setenv("flat_durability_mode", "group_commit", 1);
+    setenv("flat_durability_group_commit_ms", "5", 1);
+    {
+        durable_test_record records(tmpdir.tmpdir_name);
+        auto syncs = flat_mmap_data_syncs();
+        for (uint64_t i = 0; 100 > i; ++i) { add_durable(records, i); }
+        // writers only store to memory, the flusher catches up on its own
+        for (int tries = 0; 1000 > tries && durable_index_next(records) != 100; ++tries) { std::this_thread::sleep_for(std::chrono::milliseconds(5)); }
+        rebootping_test_check(durable_index_next(records), ==, 100);
+        rebootping_test_check(flat_mmap_data_syncs(), >, syncs);
+
+        for (uint64_t i = 100; 150 > i; ++i) { add_durable(records, i); }
+    }
+    {
+        // closing flushes what the flusher had not reached yet
+        flat_mmap durable(dir + "/flat_timeshard_durable.flatmap");
+        rebootping_test_check(durable.mmap_cast<flat_timeshard_durable_header>(0).flat_durable_index_next, ==, 150);
+        // as if the process crashed with rows 100 onwards committed but not flushed
+        durable.mmap_cast<flat_timeshard_durable_header>(0).flat_durable_index_next = 100;
+    }
+    {
+        auto dropped = flat_flusher_dropped_records();
+        durable_test_record records(tmpdir.tmpdir_name);
+        rebootping_test_check(records.unixtime_to_timeshard(unixtime)->flat_timeshard_index_next(), ==, 100);
+        rebootping_test_check(flat_flusher_dropped_records() - dropped, ==, 50);
+        uint64_t i = 0;
+        for (auto &&record : records.timeshard_query()) {
+            rebootping_test_check(record.durable_value(), ==, i);
+            rebootping_test_check(record.durable_name(), ==, str("name ", i % 7));
+            ++i;
+        }
+        rebootping_test_check(i, ==, 100);
+
+        // index entries for the dropped rows are ignored, and new rows start their chains afresh
+        rebootping_test_check(found_count(records, 1003), ==, 0);
+        add_durable(records, 103);
+        rebootping_test_check(found_count(records, 1003), ==, 1);
+        rebootping_test_check(records.unixtime_to_timeshard(unixtime)->flat_timeshard_index_next(), ==, 101);
+    }
+    unsetenv("flat_durability_mode");
+    unsetenv("flat_durability_group_commit_ms");
+    {
+        // written without durability, so a later group commit run must not drop these rows
+        durable_test_record records(tmpdir.tmpdir_name);
+        add_durable(records, 104);
+        rebootping_test_check(std::filesystem::exists(dir + "/flat_timeshard_durable.flatmap"), ==, false);
+    }
+    setenv("flat_durability_mode", "group_commit", 1);
+    {
+        durable_test_record records(tmpdir.tmpdir_name);
+        rebootping_test_check(records.unixtime_to_timeshard(unixtime)->flat_timeshard_index_next(), ==, 102);
+        rebootping_test_check(durable_index_next(records), ==, 102);
+        // sealing packs and renames in order with the flushes
+        records.seal_timeshards_before(unixtime + 24 * 60 * 60);
+        rebootping_test_check(found_count(records, 1004), ==, 1);
+    }
+    unsetenv("flat_durability_mode");
+}
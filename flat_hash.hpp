@@ -5,6 +5,18 @@
 #include "now_unixtime.hpp"
 #include "str.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 struct flat_hash_header {
     uint64_t flat_hash_magic = 0x666c617468617368;
     uint64_t flat_hash_version = 202101210000;
@@ -25,6 +37,17 @@ inline uint64_t constexpr flat_hash_mix(uint64_t z) {
 
 template <typename key_type> inline uint64_t flat_hash_function(key_type const &k) { return flat_hash_mix(k); }
 
+// the same for every build, so that it can be kept on disk
+inline uint64_t flat_hash_bytes(std::string_view bytes) {
+    uint64_t hash = flat_hash_mix(bytes.size());
+    for (size_t i = 0; bytes.size() > i; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        std::memcpy(&word, bytes.data() + i, std::min(sizeof(word), bytes.size() - i));
+        hash = flat_hash_mix(hash ^ word);
+    }
+    return hash;
+}
+
 template <uint64_t max_val> struct smallest_uint {
     using type = typename std::conditional < max_val < (1 << 8), uint8_t,
           typename std::conditional < max_val<(1 << 16), uint16_t, typename std::conditional<max_val<(1llu << 32), uint32_t, uint64_t>::type>::type>::type;
@@ -35,6 +58,7 @@ static_assert(std::is_integral<smallest_uint<1l << 31>::type>::value);
 template <typename key_type, typename value_type, unsigned markers_count, unsigned values_count> struct flat_hash_page {
     using marker_type = typename smallest_uint<markers_count>::type;
     using counter_type = typename smallest_uint<values_count>::type;
+    static constexpr uint64_t page_magic = 0x666c617468617368;
 
     counter_type page_slots[markers_count];
     counter_type page_next_value;
@@ -42,8 +66,10 @@ template <typename key_type, typename value_type, unsigned markers_count, unsign
     key_type page_keys[values_count];
     value_type page_values[values_count];
 
-    template <typename key_compare_function> value_type *page_add_key(marker_type marker, key_type const &k, key_compare_function &&compare) {
-        auto &slot = page_slots[marker];
+    static marker_type page_marker(uint64_t rotated_hash) { return rotated_hash & (markers_count - 1); }
+
+    template <typename key_compare_function> value_type *page_add_key(uint64_t rotated_hash, key_type const &k, key_compare_function &&compare) {
+        auto &slot = page_slots[page_marker(rotated_hash)];
         if (slot) {
             if (flat_hash_compare(compare, page_keys[slot - 1], k)) { return &page_values[slot - 1]; }
             return nullptr;
@@ -51,28 +77,153 @@ template <typename key_type, typename value_type, unsigned markers_count, unsign
         if (page_next_value >= values_count) { return nullptr; }
         slot = ++page_next_value;
         page_keys[slot - 1] = k;
+        page_values[slot - 1] = value_type();
         return &page_values[slot - 1];
     }
 
-    template <typename key_to_marker> bool page_del_key(marker_type marker, key_type const &k, key_to_marker ktm) {
-        if (!page_find_key(marker, k)) { return false; }
-        auto &slot = page_slots[marker];
+    template <typename key_compare_function, typename key_to_rotated_hash>
+    bool page_del_key(uint64_t rotated_hash, key_type const &k, key_compare_function &&compare, key_to_rotated_hash &&ktrh) {
+        if (!page_find_key(rotated_hash, k, compare)) { return false; }
+        auto &slot = page_slots[page_marker(rotated_hash)];
+        auto freed_slot = slot;
+        slot = 0;
         auto last_slot = page_next_value--;
-        auto last_marker = ktm(page_keys[last_slot - 1]);
-        if (last_marker != marker) {
-            page_slots[last_marker] = slot;
-            page_keys[slot - 1] = page_keys[last_slot - 1];
-            page_values[slot - 1] = page_values[last_slot - 1];
+        if (last_slot != freed_slot) {
+            page_slots[page_marker(ktrh(page_keys[last_slot - 1]))] = freed_slot;
+            page_keys[freed_slot - 1] = page_keys[last_slot - 1];
+            page_values[freed_slot - 1] = page_values[last_slot - 1];
         }
         return true;
     }
 
-    template <typename key_compare_function> value_type *page_find_key(marker_type marker, key_type const &k, key_compare_function &&compare) {
-        auto const slot = page_slots[marker];
+    template <typename key_compare_function> value_type *page_find_key(uint64_t rotated_hash, key_type const &k, key_compare_function &&compare) {
+        auto const slot = page_slots[page_marker(rotated_hash)];
         if (!slot) { return nullptr; }
         if (!flat_hash_compare(compare, page_keys[slot - 1], k)) { return nullptr; }
         return &page_values[slot - 1];
     }
+
+    template <typename walker_type> void page_walk(walker_type &&walker) {
+        for (counter_type c = 0; c < page_next_value; ++c) { walker(page_keys[c], page_values[c]); }
+    }
+};
+
+// bit i is set when tags[i] == tag, for the group_width tags starting at tags
+template <unsigned group_width> inline uint32_t flat_hash_tag_match(uint8_t const *tags, uint8_t tag) {
+    static_assert(group_width == 16 || group_width == 32, "tag groups are one or two SSE2 registers wide");
+#if defined(__AVX2__)
+    if constexpr (group_width == 32) {
+        auto group = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(tags));
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8(tag)));
+    }
+#endif
+#if defined(__SSE2__)
+    uint32_t mask = 0;
+    for (unsigned half = 0; group_width > half * 16; ++half) {
+        auto group = _mm_loadu_si128(reinterpret_cast<__m128i const *>(tags + half * 16));
+        mask |= uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)))) << (half * 16);
+    }
+    return mask;
+#else
+    uint32_t mask = 0;
+    for (unsigned i = 0; group_width > i; ++i) { mask |= uint32_t(tags[i] == tag) << i; }
+    return mask;
+#endif
+}
+
+// Swiss table style page: each slot has a one byte tag holding eight bits of the hash, and tags are matched a
+// group at a time. A key may take any free slot in the page, starting from the group picked by its hash, so
+// a page fills to page_max_values before keys spill to the next level, where flat_hash_page turns a key away
+// as soon as its marker is taken. Keys sit next to their values so a hit reads one tag group and one entry.
+template <typename key_type, typename value_type, unsigned group_width, unsigned group_count> struct flat_hash_tag_page {
+    static_assert(group_count && !(group_count & (group_count - 1)), "group_count must be a power of two");
+    static constexpr unsigned values_count = group_width * group_count;
+    static constexpr unsigned page_max_values = values_count - values_count / 8;
+    using counter_type = typename smallest_uint<values_count>::type;
+    static constexpr uint64_t page_magic = 0x666c617474616773;
+
+    static constexpr uint8_t tag_empty = 0;
+    static constexpr uint8_t tag_deleted = 1;
+
+    struct page_entry {
+        key_type entry_key;
+        value_type entry_value;
+    };
+
+    uint8_t page_tags[values_count];
+    // slots that are not empty, including deleted ones
+    counter_type page_used_count;
+    page_entry page_entries[values_count];
+
+    static uint8_t page_tag(uint64_t rotated_hash) { return std::max<uint8_t>(rotated_hash & 0xff, tag_deleted + 1); }
+    static unsigned page_group(uint64_t rotated_hash) { return (rotated_hash >> 8) & (group_count - 1); }
+
+    // the slot holding k, or values_count
+    template <typename key_compare_function> unsigned page_find_slot(uint64_t rotated_hash, key_type const &k, key_compare_function &&compare) const {
+        auto tag = page_tag(rotated_hash);
+        auto group = page_group(rotated_hash);
+        for (unsigned probe = 0; group_count > probe; ++probe, group = (group + 1) & (group_count - 1)) {
+            auto *tags = page_tags + group * group_width;
+            for (auto match = flat_hash_tag_match<group_width>(tags, tag); match; match &= match - 1) {
+                auto slot = group * group_width + std::countr_zero(match);
+                if (flat_hash_compare(compare, page_entries[slot].entry_key, k)) { return slot; }
+            }
+            if (flat_hash_tag_match<group_width>(tags, tag_empty)) { break; }
+        }
+        return values_count;
+    }
+
+    template <typename key_compare_function> value_type *page_find_key(uint64_t rotated_hash, key_type const &k, key_compare_function &&compare) {
+        auto slot = page_find_slot(rotated_hash, k, compare);
+        return values_count > slot ? &page_entries[slot].entry_value : nullptr;
+    }
+
+    template <typename key_compare_function> value_type *page_add_key(uint64_t rotated_hash, key_type const &k, key_compare_function &&compare) {
+        if (auto v = page_find_key(rotated_hash, k, compare)) { return v; }
+        auto group = page_group(rotated_hash);
+        for (unsigned probe = 0; group_count > probe; ++probe, group = (group + 1) & (group_count - 1)) {
+            auto *tags = page_tags + group * group_width;
+            auto free = flat_hash_tag_match<group_width>(tags, tag_empty) | flat_hash_tag_match<group_width>(tags, tag_deleted);
+            if (!free) { continue; }
+            auto slot = group * group_width + std::countr_zero(free);
+            if (page_tags[slot] == tag_empty) {
+                if (page_used_count >= page_max_values) { return nullptr; }
+                ++page_used_count;
+            }
+            page_tags[slot] = page_tag(rotated_hash);
+            page_entries[slot] = page_entry{k, value_type()};
+            return &page_entries[slot].entry_value;
+        }
+        return nullptr;
+    }
+
+    template <typename key_compare_function, typename key_to_rotated_hash>
+    bool page_del_key(uint64_t rotated_hash, key_type const &k, key_compare_function &&compare, key_to_rotated_hash &&) {
+        auto slot = page_find_slot(rotated_hash, k, compare);
+        if (slot >= values_count) { return false; }
+        // a group with an empty slot ends every probe that reaches it, so nothing probes past this slot
+        if (flat_hash_tag_match<group_width>(page_tags + slot / group_width * group_width, tag_empty)) {
+            page_tags[slot] = tag_empty;
+            --page_used_count;
+        } else {
+            page_tags[slot] = tag_deleted;
+        }
+        return true;
+    }
+
+    template <typename walker_type> void page_walk(walker_type &&walker) {
+        for (unsigned slot = 0; values_count > slot; ++slot) {
+            if (page_tags[slot] > tag_deleted) { walker(page_entries[slot].entry_key, page_entries[slot].entry_value); }
+        }
+    }
+};
+
+// page layouts for flat_hash, which never mixes layouts in one file: each has its own flat_hash_magic
+template <unsigned marker_bits = 8> struct flat_hash_marker_pages {
+    template <typename key_type, typename value_type> using page_type = flat_hash_page<key_type, value_type, 1 << marker_bits, 1 << (marker_bits - 1)>;
+};
+template <unsigned group_width = 16, unsigned group_count = 8> struct flat_hash_tag_pages {
+    template <typename key_type, typename value_type> using page_type = flat_hash_tag_page<key_type, value_type, group_width, group_count>;
 };
 
 inline constexpr uint64_t ror(uint64_t val, unsigned amount) {
@@ -104,22 +255,21 @@ template <typename key_type, typename comparer, typename input_type> inline decl
 }
 
 template <typename key_type, typename value_type, typename hash_function = flat_hash_function_class,
-          typename compare_function = flat_hash_compare_function_class, unsigned marker_bits = 8>
+          typename compare_function = flat_hash_compare_function_class, typename page_layout = flat_hash_marker_pages<>>
 struct flat_hash : hash_function {
     flat_mmap hash_mmap;
-    using hash_page_type = flat_hash_page<key_type, value_type, 1 << marker_bits, 1 << (marker_bits - 1)>;
-    using marker_type = typename hash_page_type::marker_type;
+    using hash_page_type = typename page_layout::template page_type<key_type, value_type>;
     [[no_unique_address]] compare_function hash_compare_function;
 
     template <typename... arg_types>
     explicit flat_hash(std::string filename, flat_mmap_settings const &settings = flat_mmap_settings(),
                        compare_function &&passed_compare_function = compare_function(), arg_types &&...args)
-        : hash_function(std::forward<arg_types>(args)...), hash_mmap(filename, settings), hash_compare_function(passed_compare_function) {
+        : hash_function(std::forward<arg_types>(args)...), hash_mmap(filename, hash_settings(settings)), hash_compare_function(passed_compare_function) {
         if (!hash_mmap.mmap_allocated_len()) {
             hash_mmap.mmap_allocate_at_least(sizeof(flat_hash_header));
-            hash_header() = flat_hash_header();
+            hash_header() = hash_initial_header();
         } else {
-            flat_hash_header highest_supported_version;
+            auto highest_supported_version = hash_initial_header();
             if (highest_supported_version.flat_hash_magic != hash_header().flat_hash_magic) {
                 throw std::runtime_error(str("flat_hash_magic does not match ", hash_header().flat_hash_magic));
             }
@@ -128,7 +278,21 @@ struct flat_hash : hash_function {
             }
         }
     }
+    // lookups land on any page, so read ahead is wasted and huge pages save TLB misses; levels are sparse until filled, so they are not populated
+    static flat_mmap_settings hash_settings(flat_mmap_settings settings) {
+        settings.mmap_advice = flat_mmap_advice::advice_random;
+        settings.mmap_huge_pages = true;
+        settings.mmap_willneed = false;
+        settings.mmap_populate = false;
+        settings.mmap_lock = settings.mmap_lock_index;
+        return settings;
+    }
     flat_hash_header &hash_header() { return hash_mmap.template mmap_cast<flat_hash_header>(0); }
+    static flat_hash_header hash_initial_header() {
+        flat_hash_header header;
+        header.flat_hash_magic = hash_page_type::page_magic;
+        return header;
+    }
 
     static inline constexpr uint64_t hash_level_offset(unsigned level) { return ((1 << level) - 1) * sizeof(hash_page_type) + sizeof(flat_hash_header); }
     static_assert(hash_level_offset(0) - sizeof(flat_hash_header) == 0, "first level starts at 0");
@@ -145,13 +309,16 @@ struct flat_hash : hash_function {
     template <typename input_key> value_type *hash_find_key(input_key &&ik) const {
         auto mk = flat_hash_prepare_key_maybe<key_type>(hash_compare_function, ik);
         if (!mk) { return nullptr; }
-        auto k = *mk;
+        return hash_find_prepared_key(*mk);
+    }
+
+    value_type *hash_find_prepared_key(key_type const &k) const {
         auto rotated_hash = (*this)(k);
         for (unsigned level = 0; hash_mmap.mmap_allocated_len() >= hash_level_offset(level + 1); ++level) {
             assert(hash_level_offset(level + 1) >= hash_level_offset(level));
             auto &page = hash_page_for_level(level, rotated_hash);
             rotated_hash = ror(rotated_hash, level);
-            if (auto v = page.page_find_key((marker_type)(rotated_hash & ((1 << marker_bits) - 1)), k, hash_compare_function)) { return v; }
+            if (auto v = page.page_find_key(rotated_hash, k, hash_compare_function)) { return v; }
         }
         return nullptr;
     }
@@ -165,25 +332,25 @@ struct flat_hash : hash_function {
             auto &page = hash_page_for_level(level, rotated_hash);
 
             rotated_hash = ror(rotated_hash, level);
-            if (auto v = page.page_add_key(rotated_hash & ((1 << marker_bits) - 1), k, hash_compare_function)) { return *v; }
+            if (auto v = page.page_add_key(rotated_hash, k, hash_compare_function)) { return *v; }
         }
         hash_mmap.mmap_sparsely_allocate_at_least(hash_level_offset(level + 1));
         auto &page = hash_page_for_level(level, rotated_hash);
         rotated_hash = ror(rotated_hash, level);
         ++hash_header().flat_hash_entry_count;
-        return *page.page_add_key(rotated_hash & ((1 << marker_bits) - 1), k, hash_compare_function);
+        return *page.page_add_key(rotated_hash, k, hash_compare_function);
     }
 
     template <typename input_key> bool hash_del_key(input_key &&ik) {
-        auto mk = flat_hash_maybe_prepare_key<key_type>(hash_compare_function, ik);
+        auto mk = flat_hash_prepare_key_maybe<key_type>(hash_compare_function, ik);
         if (!mk) { return false; }
         auto k = *mk;
         auto rotated_hash = (*this)(k);
         for (unsigned level = 0; hash_mmap.mmap_allocated_len() >= hash_level_offset(level + 1); ++level) {
             auto &page = hash_page_for_level(level, rotated_hash);
             rotated_hash = ror(rotated_hash, level);
-            if (page.page_del_key((marker_type)(rotated_hash & ((1 << marker_bits) - 1)), k,
-                                  [level, this](key_type const &nk) { return ror((*this)(nk), (level * (level + 1)) / 2) & ((1 << marker_bits) - 1); })) {
+            if (page.page_del_key(rotated_hash, k, hash_compare_function,
+                                  [level, this](key_type const &nk) { return ror((*this)(nk), (level * (level + 1)) / 2); })) {
                 --hash_header().flat_hash_entry_count;
                 return true;
             }
@@ -191,10 +358,16 @@ struct flat_hash : hash_function {
         return false;
     }
 
+    // drops every key and gives the file's pages back
+    void hash_clear() {
+        hash_mmap.mmap_discard();
+        hash_mmap.mmap_allocate_at_least(sizeof(flat_hash_header));
+        hash_header() = hash_initial_header();
+    }
+
     template <typename Walker> void hash_walk(Walker &&walker) {
         for (uint64_t offset = hash_level_offset(0); offset + sizeof(hash_page_type) <= hash_mmap.mmap_allocated_len(); offset += sizeof(hash_page_type)) {
-            auto &page = hash_mmap.mmap_cast<hash_page_type>(offset);
-            for (typename hash_page_type::counter_type c = 0; c < page.page_next_value; ++c) { walker(page.page_keys[c], page.page_values[c]); }
+            hash_mmap.mmap_cast<hash_page_type>(offset).page_walk(walker);
         }
     }
 };
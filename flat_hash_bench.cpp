@@ -0,0 +1,78 @@
+#include "env.hpp"
+#include "flat_hash.hpp"
+#include "network_flat_records.hpp"
+#include "rebootping_test.hpp"
+
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Compares the flat_hash page layouts on the key types the records index by. Not run by ctest: run
+// flat_hash_bench directly, optionally with flat_hash_bench_max_keys set.
+
+namespace {
+uint64_t bench_key(uint64_t *, uint64_t i) { return flat_hash_mix(i); }
+
+macaddr bench_key(macaddr *, uint64_t i) {
+    // a handful of manufacturers, as on a real network
+    macaddr m{{0x00, 0x1b, uint8_t(0x21 + (i & 3)), uint8_t(i >> 16), uint8_t(i >> 8), uint8_t(i)}};
+    return m;
+}
+
+if_ip_lookup bench_key(if_ip_lookup *, uint64_t i) { return if_ip_lookup{flat_bytes_interned_tag{(i & 3) * 16}, htonl((10u << 24) + uint32_t(i >> 2))}; }
+
+double bench_ns_per_op(auto &&start, uint64_t ops) {
+    return ops ? std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ops : 0;
+}
+
+template <typename key_type, typename page_layout> void bench_layout(std::string const &dir, char const *key_name, char const *layout_name, uint64_t count) {
+    using hash_type = flat_hash<key_type, uint64_t, flat_hash_function_class, flat_hash_compare_function_class, page_layout>;
+    auto filename = dir + "/" + key_name + "_" + layout_name + "_" + str(count) + ".flathash";
+
+    std::vector<key_type> keys;
+    keys.reserve(2 * count);
+    for (uint64_t i = 0; 2 * count > i; ++i) { keys.push_back(bench_key((key_type *)nullptr, i)); }
+
+    hash_type hash(filename);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; count > i; ++i) { hash.hash_add_key(keys[i]) = i + 1; }
+    auto add_ns = bench_ns_per_op(start, count);
+
+    uint64_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; count > i; ++i) { found += *hash.hash_find_key(keys[i]); }
+    auto hit_ns = bench_ns_per_op(start, count);
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = count; 2 * count > i; ++i) { found += !!hash.hash_find_key(keys[i]); }
+    auto miss_ns = bench_ns_per_op(start, count);
+
+    if (found != count * (count + 1) / 2) { throw std::runtime_error(str("flat_hash_bench lost keys in ", filename)); }
+
+    std::cout << "flat_hash_bench key=" << key_name << " layout=" << layout_name << " keys=" << count << std::fixed << std::setprecision(1)
+              << " add_ns=" << add_ns << " hit_ns=" << hit_ns << " miss_ns=" << miss_ns
+              << " bytes_per_key=" << double(std::filesystem::file_size(filename)) / count << std::endl;
+    std::filesystem::remove(filename);
+}
+
+template <typename key_type> void bench_key_type(std::string const &dir, char const *key_name, uint64_t count) {
+    bench_layout<key_type, flat_hash_marker_pages<>>(dir, key_name, "markers", count);
+    bench_layout<key_type, flat_hash_tag_pages<16, 8>>(dir, key_name, "tags16", count);
+    bench_layout<key_type, flat_hash_tag_pages<32, 4>>(dir, key_name, "tags32", count);
+}
+} // namespace
+
+int main() {
+    tmpdir tmpdir;
+    for (uint64_t count = 1000; env("flat_hash_bench_max_keys", uint64_t{1} << 20) >= count; count *= 8) {
+        bench_key_type<uint64_t>(tmpdir.tmpdir_name, "uint64_t", count);
+        bench_key_type<macaddr>(tmpdir.tmpdir_name, "macaddr", count);
+        bench_key_type<if_ip_lookup>(tmpdir.tmpdir_name, "if_ip_lookup", count);
+    }
+    return 0;
+}
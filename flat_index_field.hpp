@@ -1,8 +1,14 @@
 #pragma once
 
 #include "flat_bytes_field.hpp"
+#include "flat_sealed_index.hpp"
 #include "flat_timeshard.hpp"
 
+#include <filesystem>
+#include <memory>
+#include <utility>
+#include <vector>
+
 template <typename key_type, typename... reduce_priority> decltype(auto) flat_timeshard_field_compare_prepare_key_maybe(key_type *, reduce_priority...) {
     return [](flat_timeshard &, auto &&i) { return flat_hash_compare_function_class().compare_prepare_key_maybe<key_type>(i); };
 }
@@ -39,27 +45,95 @@ template <> inline decltype(auto) flat_timeshard_field_key_rehydrate(flat_timesh
     return flat_bytes_interned_ptr{comparer.comparer_timeshard, tag}.operator std::string_view();
 }
 
+// Keys are added to field_hash. Once the timeshard is finished, flat_timeshard_field_seal moves them into
+// field_sealed and empties field_hash; keys added after that go to field_hash again and take precedence.
 template <typename key_type, typename hash_function = flat_hash_function_class> struct flat_timeshard_index_field {
     using field_hydrated_key_type =
         std::decay_t<decltype(flat_timeshard_field_key_rehydrate(std::declval<flat_timeshard_field_comparer &>(), std::declval<const key_type &>()))>;
+    using sealed_type = flat_sealed_index<key_type, uint64_t, hash_function, flat_timeshard_field_comparer>;
     flat_hash<key_type, uint64_t, hash_function, flat_timeshard_field_comparer> field_hash;
+    std::string field_sealed_filename;
+    std::unique_ptr<sealed_type> field_sealed;
+    // false only while field_hash is known to be empty, so that lookups in sealed timeshards skip it
+    bool field_hash_may_hold = true;
+
     flat_timeshard_index_field(flat_timeshard &timeshard, std::string const &name, std::string const &dir, flat_mmap_settings const &settings)
-        : field_hash(dir + "/field_" + name + ".flathash", settings, flat_timeshard_field_comparer{timeshard}) {}
+        : field_hash(dir + "/field_" + name + ".flathash", settings, flat_timeshard_field_comparer{timeshard}),
+          field_sealed_filename(dir + "/field_" + name + ".flatsealed") {
+        timeshard.timeshard_synced_mmaps.push_back(&field_hash.hash_mmap);
+        if (std::filesystem::exists(field_sealed_filename)) {
+            field_sealed = std::make_unique<sealed_type>(field_sealed_filename, field_hash.hash_compare_function);
+            field_hash_may_hold = index_hash_holds_any();
+        }
+    }
 
     void flat_timeshard_ensure_field_mmapped([[maybe_unused]] uint64_t) { field_hash.hash_mmap.mmap_allocate_at_least(1); }
-    template <typename lookup_type> [[nodiscard]] uint64_t *flat_timeshard_index_lookup_key(lookup_type &&k) const { return field_hash.hash_find_key(k); }
+    void flat_timeshard_field_write_back() {}
+    template <typename lookup_type> [[nodiscard]] uint64_t *flat_timeshard_index_lookup_key(lookup_type &&k) const {
+        if (field_hash_may_hold) {
+            if (auto v = field_hash.hash_find_key(k); v && *v <= index_rows()) { return v; }
+        }
+        if (field_sealed) { return field_sealed->sealed_find_key(k); }
+        return nullptr;
+    }
     template <typename lookup_type, typename iterator> void flat_timeshard_index_set_key(lookup_type &&key, iterator const &i) {
-        field_hash.hash_add_key(key) = i.flat_iterator_index + 1;
+        index_add_key(key) = i.flat_iterator_index + 1;
+    }
+
+    // the value for key in field_hash, carried over from field_sealed when the key is new to field_hash
+    template <typename lookup_type> uint64_t &index_add_key(lookup_type &&key) {
+        field_hash_may_hold = true;
+        auto &v = field_hash.hash_add_key(key);
+        if (v > index_rows()) { v = 0; }
+        if (!v && field_sealed) {
+            if (auto sealed = field_sealed->sealed_find_key(key)) { v = *sealed; }
+        }
+        return v;
+    }
+
+    void flat_timeshard_field_seal() {
+        if (!field_hash_may_hold || !index_hash_holds_any()) {
+            field_hash_may_hold = false;
+            return;
+        }
+        std::vector<std::pair<key_type, uint64_t>> entries;
+        field_hash.hash_walk([&](auto &&k, auto &&v) { entries.emplace_back(k, v); });
+        if (field_sealed) {
+            field_sealed->sealed_walk([&](auto &&k, auto &&v) { entries.emplace_back(k, v); });
+        }
+        field_sealed.reset();
+        sealed_type::sealed_write(field_sealed_filename, entries, field_hash.hash_compare_function);
+        field_sealed = std::make_unique<sealed_type>(field_sealed_filename, field_hash.hash_compare_function);
+        field_hash.hash_clear();
+        field_hash_may_hold = false;
     }
 
     template <typename timeshard_schema_type, typename walker_type> void flat_timeshard_field_walk(walker_type &&walker) {
         using timeshard_type = typename timeshard_schema_type::flat_schema_timeshard;
         using timeshard_iterator_type = typename timeshard_schema_type::flat_schema_timeshard_iterator;
-        field_hash.template hash_walk([&](auto &&k, auto &&v) {
+        auto walk = [&](auto &&k, auto &&v) {
             assert(v);
+            if (v > index_rows()) { return; }
             walker(flat_timeshard_field_key_rehydrate(field_hash.hash_compare_function, k),
                    timeshard_iterator_type(reinterpret_cast<timeshard_type *>(&field_hash.hash_compare_function.comparer_timeshard), v - 1));
-        });
+        };
+        if (field_sealed) {
+            field_sealed->sealed_walk([&](auto &&k, auto &&v) {
+                if (!field_hash_may_hold || !field_hash.hash_find_prepared_key(k)) { walk(k, v); }
+            });
+        }
+        if (field_hash_may_hold) { field_hash.template hash_walk(walk); }
+    }
+
+  private:
+    // Values name rows counting from 1. One past the committed rows was added for a record that was not
+    // committed, or that was dropped when its timeshard was reopened after a crash, and is ignored.
+    uint64_t index_rows() const { return field_hash.hash_compare_function.comparer_timeshard.flat_timeshard_index_next(); }
+
+    bool index_hash_holds_any() {
+        bool any = false;
+        field_hash.hash_walk([&](auto &&, auto &&) { any = true; });
+        return any;
     }
 };
 
@@ -77,9 +151,16 @@ struct flat_timeshard_index_linked_field : flat_timeshard_index_linked_field_bas
         flat_timeshard_index_field<key_type, hash_function>::flat_timeshard_ensure_field_mmapped(index);
     }
 
+    void flat_timeshard_field_write_back() { flat_timeshard_index_linked_field_base::flat_timeshard_field_write_back(); }
+
+    void flat_timeshard_field_seal() {
+        flat_timeshard_index_linked_field_base::flat_timeshard_field_seal();
+        flat_timeshard_index_field<key_type, hash_function>::flat_timeshard_field_seal();
+    }
+
     template <typename lookup_type, typename iterator> void index_linked_field_add(lookup_type &&key, iterator const &i) {
         auto index = i.flat_iterator_index;
-        auto &v = field_hash.hash_add_key(key);
+        auto &v = this->index_add_key(key);
         (*this)[index] = v;
         v = index + 1;
     }
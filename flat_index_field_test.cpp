@@ -2,6 +2,9 @@
 #include "flat_record.hpp"
 #include "rebootping_test.hpp"
 
+#include <filesystem>
+#include <map>
+
 define_flat_record(string_index_record, (uint64_t, thirteen), (flat_bytes_interned_ptr, seven), (flat_index_field<flat_bytes_interned_tag>, string_index));
 
 TEST(flat_index_field_suite, some_strings) {
@@ -79,3 +82,120 @@ TEST(flat_index_field_suite, just_ints) {
         rebootping_test_check(r, ==, again);
     }
 }
+
+TEST(flat_index_field_suite, sealed_indexes) {
+    tmpdir tmpdir;
+    const double unixtime = 1;
+    const int max_i = 10007;
+    auto index_lookup = [](int i) { return ~((uint32_t)i) * 0xdeadbeef; };
+    auto hash_filename = tmpdir.tmpdir_name + "/19700101/int_index_record/field_uint32_index.flathash";
+    auto sealed_filename = tmpdir.tmpdir_name + "/19700101/int_index_record/field_uint32_index.flatsealed";
+    auto check_all = [&](int_index_record &records, int count) {
+        for (int i = 0; count > i; ++i) {
+            auto r = *records.uint32_index(index_lookup(i)).begin();
+            rebootping_test_check(r.thirteen(), ==, i * 13);
+            rebootping_test_check(*records.uint64_index(index_lookup(i)).begin(), ==, r);
+        }
+        auto missing = records.uint32_index(index_lookup(count));
+        rebootping_test_check(missing.begin() == missing.end(), ==, true);
+        std::map<uint32_t, uint64_t> walked;
+        records.uint32_index(0, unixtime + 1, [&](auto &&k, auto &&v) { rebootping_test_check(walked.emplace(k, v.thirteen()).second, ==, true); });
+        rebootping_test_check(walked.size(), ==, (size_t)count);
+    };
+    {
+        int_index_record records(tmpdir.tmpdir_name);
+        for (int i = 0; max_i > i; ++i) {
+            auto r = records.uint32_index(index_lookup(i)).add_if_missing(unixtime);
+            r.thirteen() = i * 13;
+            records.uint64_index(index_lookup(i)).set_index(r);
+        }
+        auto unsealed_size = std::filesystem::file_size(hash_filename);
+        records.seal_timeshards_before(unixtime);
+        rebootping_test_check(std::filesystem::exists(sealed_filename), ==, false);
+        records.seal_timeshards_before(unixtime + 24 * 60 * 60);
+        rebootping_test_check(std::filesystem::exists(sealed_filename), ==, true);
+        rebootping_test_check(std::filesystem::file_size(hash_filename), <, unsealed_size);
+        check_all(records, max_i);
+
+        // a late record and a moved key go to the hash again and shadow the sealed entries
+        auto late = records.uint32_index(index_lookup(max_i)).add_if_missing(unixtime);
+        late.thirteen() = max_i * 13;
+        records.uint64_index(index_lookup(max_i)).set_index(late);
+        auto moved = records.uint32_index(index_lookup(max_i + 1)).add_if_missing(unixtime);
+        moved.thirteen() = 0;
+        records.uint32_index(index_lookup(0)).set_index(moved);
+        records.uint64_index(index_lookup(0)).set_index(moved);
+    }
+    {
+        int_index_record records(tmpdir.tmpdir_name);
+        auto check_reopened = [&] {
+            rebootping_test_check(records.uint32_index(index_lookup(0)).begin()->flat_iterator_index, ==, (uint64_t)max_i + 1);
+            rebootping_test_check(records.uint32_index(index_lookup(max_i)).begin()->thirteen(), ==, (uint64_t)max_i * 13);
+            for (int i = 1; max_i > i; ++i) { rebootping_test_check(records.uint32_index(index_lookup(i)).begin()->thirteen(), ==, (uint64_t)i * 13); }
+            std::map<uint32_t, uint64_t> walked;
+            records.uint32_index(0, unixtime + 1,
+                                 [&](auto &&k, auto &&v) { rebootping_test_check(walked.emplace(k, v.flat_iterator_index).second, ==, true); });
+            rebootping_test_check(walked.size(), ==, (size_t)max_i + 2);
+            rebootping_test_check(walked[index_lookup(0)], ==, (uint64_t)max_i + 1);
+        };
+        check_reopened();
+        records.seal_timeshards_before(unixtime + 24 * 60 * 60);
+        check_reopened();
+    }
+}
+
+TEST(flat_index_field_suite, interned_strings_index) {
+    tmpdir tmpdir;
+    const double unixtime = 1;
+    const int max_i = 3001, late_count = 1009;
+    auto dir = tmpdir.tmpdir_name + "/19700101/string_index_record";
+    auto check_all = [&](string_index_record &records, int count) {
+        auto &timeshard = *records.unixtime_to_timeshard(unixtime);
+        for (int i = 0; count > i; ++i) {
+            auto tag = timeshard.timeshard_lookup_interned_string(str("interned ", i));
+            rebootping_test_check(tag.has_value(), ==, true, " ", i);
+            if (tag) { rebootping_test_check(timeshard.smap_string_length(tag->bytes_offset), ==, str("interned ", i).size()); }
+        }
+        rebootping_test_check(timeshard.timeshard_lookup_interned_string(str("interned ", count)).has_value(), ==, false);
+        rebootping_test_check(records.string_index(str("interned ", count / 2)).begin()->thirteen(), ==, uint64_t(count / 2));
+    };
+    {
+        string_index_record records(tmpdir.tmpdir_name);
+        for (int i = 0; max_i > i; ++i) {
+            records.string_index(str("interned ", i)).add_if_missing(unixtime).thirteen() = i;
+            // interning a string again returns the same offset
+            auto first = records.add_flat_record(unixtime, [&](auto &&r) { r.seven() = str("interned ", i); });
+            auto again = records.add_flat_record(unixtime, [&](auto &&r) { r.seven() = str("interned ", i); });
+            rebootping_test_check(again.seven().flat_bytes_offset.bytes_offset, ==, first.seven().flat_bytes_offset.bytes_offset);
+        }
+        check_all(records, max_i);
+    }
+    {
+        // strings interned into the main mmap but not yet into the hash, as after a crash in between
+        string_index_record writer(tmpdir.tmpdir_name);
+        auto &timeshard = writer.ensure_unixtime_to_timeshard(unixtime);
+        auto covered = timeshard.interned_strings_index->hash_add_key(uint64_t{0});
+        for (int i = max_i; max_i + late_count > i; ++i) { writer.string_index(str("interned ", i)).add_if_missing(unixtime).thirteen() = i; }
+        timeshard.interned_strings_index->hash_add_key(uint64_t{0}) = covered;
+        string_index_record reader(tmpdir.tmpdir_name, flat_mmap_settings{.mmap_readonly = true});
+        check_all(reader, max_i + late_count);
+    }
+    {
+        string_index_record records(tmpdir.tmpdir_name);
+        check_all(records, max_i + late_count);
+    }
+
+    // timeshards written before the index existed are indexed when a writer opens them, and looked up
+    // without it by a reader
+    std::filesystem::remove(dir + "/flat_timeshard_interned.flathash");
+    {
+        string_index_record reader(tmpdir.tmpdir_name, flat_mmap_settings{.mmap_readonly = true});
+        rebootping_test_check(reader.unixtime_to_timeshard(unixtime)->interned_strings_index.has_value(), ==, false);
+        check_all(reader, max_i + late_count);
+    }
+    {
+        string_index_record records(tmpdir.tmpdir_name);
+        check_all(records, max_i + late_count);
+        rebootping_test_check(std::filesystem::exists(dir + "/flat_timeshard_interned.flathash"), ==, true);
+    }
+}
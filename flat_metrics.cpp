@@ -2,14 +2,78 @@
 
 #include "rebootping_records_dir.hpp"
 
-flat_metrics_struct &flat_metric() {
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+namespace {
+auto &flat_metrics_timeshard() {
     static flat_metrics_record store{rebootping_records_dir()};
-    return store.ensure_timeshard_name_to_timeshard("flat_metric_shard").flat_timeshard_ensure_mmapped(1).flat_metrics_value[0];
+    static auto &timeshard = store.ensure_timeshard_name_to_timeshard("flat_metric_shard").flat_timeshard_ensure_mmapped(flat_metrics_shards);
+    return timeshard;
+}
+
+void flat_metrics_merge(flat_metric_counter &sum, flat_metric_counter const &shard) { sum.counter_value += shard.counter_value; }
+void flat_metrics_merge(uint64_t &sum, uint64_t const &shard) { sum = std::max(sum, shard); }
+void flat_metrics_merge(flat_metric_histogram &sum, flat_metric_histogram const &shard) {
+    sum.histogram_count += shard.histogram_count;
+    sum.histogram_sum += shard.histogram_sum;
+    for (unsigned bucket = 0; flat_metric_histogram::histogram_bucket_count > bucket; ++bucket) {
+        sum.histogram_buckets[bucket] += shard.histogram_buckets[bucket];
+    }
+}
+
+void flat_metrics_report(std::ostream &os, std::string_view field_name, uint64_t field_delta) {
+    if (field_delta) { os << "flat_metrics_report_delta " << field_name << " " << field_delta << std::endl; }
+}
+void flat_metrics_report(std::ostream &os, std::string_view field_name, flat_metric_histogram const &field_delta) {
+    if (!field_delta.histogram_count) { return; }
+    uint64_t max = 0;
+    for (unsigned bucket = 0; flat_metric_histogram::histogram_bucket_count > bucket; ++bucket) {
+        if (field_delta.histogram_buckets[bucket]) { max = flat_metric_histogram::histogram_bucket_low(bucket); }
+    }
+    os << "flat_metrics_report_delta " << field_name << " count " << field_delta.histogram_count << " mean "
+       << field_delta.histogram_sum / field_delta.histogram_count << " p50 " << field_delta.histogram_quantile(0.5) << " p99 "
+       << field_delta.histogram_quantile(0.99) << " max " << max << std::endl;
+}
+} // namespace
+
+flat_metrics_struct &flat_metrics_thread_shard() {
+    static std::atomic<uint64_t> next_shard;
+    return flat_metrics_timeshard().flat_metrics_value[next_shard.fetch_add(1, std::memory_order_relaxed) % flat_metrics_shards];
+}
+
+flat_metrics_struct flat_metrics_sum() {
+    auto &timeshard = flat_metrics_timeshard();
+    flat_metrics_struct sum{};
+    for (uint64_t shard = 0; flat_metrics_shards > shard; ++shard) {
+        flat_metrics_struct::flat_metrics_walk(
+                [&](std::string_view, auto &&field_accessor) { flat_metrics_merge(field_accessor(sum), field_accessor(timeshard.flat_metrics_value[shard])); });
+    }
+    return sum;
+}
+
+void flat_metrics_collect_mmap() {
+    static uint64_t collected_grow_syscalls = 0, collected_grow_syscalls_avoided = 0, collected_address_moves = 0;
+    auto grow_syscalls = flat_mmap_grow_syscalls(), grow_syscalls_avoided = flat_mmap_grow_syscalls_avoided(), address_moves = flat_mmap_address_moves();
+    flat_metric().flat_mmap_grow_syscalls += grow_syscalls - std::exchange(collected_grow_syscalls, grow_syscalls);
+    flat_metric().flat_mmap_grow_syscalls_avoided += grow_syscalls_avoided - std::exchange(collected_grow_syscalls_avoided, grow_syscalls_avoided);
+    flat_metric().flat_mmap_address_moves += address_moves - std::exchange(collected_address_moves, address_moves);
+    static uint64_t collected_reserve_failures = 0;
+    auto reserve_failures = flat_mmap_reserve_failures();
+    flat_metric().flat_mmap_reserve_failures += reserve_failures - std::exchange(collected_reserve_failures, reserve_failures);
+
+    static uint64_t collected_data_syncs = 0, collected_group_commits = 0, collected_committed_records = 0, collected_dropped_records = 0;
+    auto data_syncs = flat_mmap_data_syncs(), group_commits = flat_flusher_group_commits(), committed_records = flat_flusher_committed_records(),
+         dropped_records = flat_flusher_dropped_records();
+    flat_metric().flat_mmap_data_syncs += data_syncs - std::exchange(collected_data_syncs, data_syncs);
+    flat_metric().flat_flusher_group_commits += group_commits - std::exchange(collected_group_commits, group_commits);
+    flat_metric().flat_flusher_committed_records += committed_records - std::exchange(collected_committed_records, committed_records);
+    flat_metric().flat_flusher_dropped_records += dropped_records - std::exchange(collected_dropped_records, dropped_records);
 }
 
 void flat_metrics_report_delta(std::ostream &os, flat_metrics_struct const &current, flat_metrics_struct const &previous) {
     flat_metrics_struct::flat_metrics_walk([&](std::string_view field_name, auto &&field_accessor) {
-        auto field_delta = field_accessor(current) - field_accessor(previous);
-        if (field_delta) { os << "flat_metrics_report_delta " << field_name << " " << field_delta << std::endl; }
+        flat_metrics_report(os, field_name, field_accessor(current) - field_accessor(previous));
     });
 }
\ No newline at end of file
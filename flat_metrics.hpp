@@ -1,8 +1,12 @@
 #pragma once
 
 #include "flat_record.hpp"
+#include "locked_reference.hpp"
 
+#include <bit>
+#include <chrono>
 #include <cstdint>
+#include <mutex>
 
 struct flat_metric_counter {
     uint64_t counter_value;
@@ -11,14 +15,71 @@ struct flat_metric_counter {
         __atomic_fetch_add(&counter_value, 1, __ATOMIC_RELAXED);
         return *this;
     }
+    flat_metric_counter &operator+=(uint64_t n) {
+        __atomic_fetch_add(&counter_value, n, __ATOMIC_RELAXED);
+        return *this;
+    }
     uint64_t operator-(flat_metric_counter const &c) const { return counter_value - c.counter_value; }
 };
 
+// Counts values into log-linear buckets: values below 2^histogram_sub_bucket_bits have a bucket each, and every
+// power of two above is split into 2^histogram_sub_bucket_bits equal buckets, so a bucket is never wider than a
+// quarter of the values in it. Recording is three relaxed atomic adds.
+struct flat_metric_histogram {
+    static constexpr unsigned histogram_sub_bucket_bits = 2;
+    static constexpr unsigned histogram_bucket_count = (64 - histogram_sub_bucket_bits + 1) << histogram_sub_bucket_bits;
+
+    uint64_t histogram_count;
+    uint64_t histogram_sum;
+    uint64_t histogram_buckets[histogram_bucket_count];
+
+    static unsigned histogram_bucket_of(uint64_t value) {
+        if (value < (uint64_t{1} << histogram_sub_bucket_bits)) { return unsigned(value); }
+        unsigned shift = std::bit_width(value) - 1 - histogram_sub_bucket_bits;
+        return ((shift + 1) << histogram_sub_bucket_bits) + unsigned((value >> shift) & ((uint64_t{1} << histogram_sub_bucket_bits) - 1));
+    }
+    // the smallest value counted in bucket
+    static uint64_t histogram_bucket_low(unsigned bucket) {
+        if (bucket < (1u << histogram_sub_bucket_bits)) { return bucket; }
+        unsigned shift = (bucket >> histogram_sub_bucket_bits) - 1;
+        return ((uint64_t{1} << histogram_sub_bucket_bits) | (bucket & ((1u << histogram_sub_bucket_bits) - 1))) << shift;
+    }
+
+    void histogram_record(uint64_t value) {
+        __atomic_fetch_add(&histogram_buckets[histogram_bucket_of(value)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&histogram_count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&histogram_sum, value, __ATOMIC_RELAXED);
+    }
+    void histogram_record_nanoseconds_since(std::chrono::steady_clock::time_point start) {
+        histogram_record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    // the lowest value of the bucket holding the given fraction of the values counted
+    [[nodiscard]] uint64_t histogram_quantile(double fraction) const {
+        auto rank = uint64_t(fraction * double(histogram_count));
+        uint64_t seen = 0;
+        for (unsigned bucket = 0; histogram_bucket_count > bucket; ++bucket) {
+            seen += histogram_buckets[bucket];
+            if (seen > rank) { return histogram_bucket_low(bucket); }
+        }
+        return 0;
+    }
+    flat_metric_histogram operator-(flat_metric_histogram const &h) const {
+        flat_metric_histogram delta = *this;
+        delta.histogram_count -= h.histogram_count;
+        delta.histogram_sum -= h.histogram_sum;
+        for (unsigned bucket = 0; histogram_bucket_count > bucket; ++bucket) { delta.histogram_buckets[bucket] -= h.histogram_buckets[bucket]; }
+        return delta;
+    }
+};
+
 #define flat_metrics_field_definition(kind, name) kind name;
 
-#define flat_metrics_walk_definition(kind, name) f(#name, [](auto &&s) { return s.name; });
+#define flat_metrics_walk_definition(kind, name) f(#name, [](auto &&s) -> auto & { return s.name; });
+// Each thread counts into a shard of its own, kept as a row of flat_metrics_record and aligned to a cache
+// line so that threads never write to the same one. flat_metrics_sum adds the shards up.
 #define define_flat_metrics(metrics_name, ...)                                                                                                                 \
-    struct metrics_name {                                                                                                                                      \
+    struct alignas(64) metrics_name {                                                                                                                          \
         evaluate_for_each(flat_metrics_field_definition, __VA_ARGS__)                                                                                          \
                                                                                                                                                                \
             template <typename func>                                                                                                                           \
@@ -32,16 +93,66 @@ define_flat_metrics(flat_metrics_struct, (flat_metric_counter, metric_restarts),
                     (flat_metric_counter, ping_record_store_process_packet_packets), (flat_metric_counter, ping_record_store_process_packet_missing_timeshard),
                     (flat_metric_counter, ping_record_store_process_packet_overflow_timeshard),
                     (flat_metric_counter, ping_record_store_process_packet_bad_cookie), (flat_metric_counter, ping_record_store_process_packet_icmp_echo),
-                    (flat_metric_counter, ping_record_store_process_packet_icmp_echoreply),
+                    (flat_metric_counter, ping_record_store_process_packet_icmp_echoreply), (flat_metric_counter, ping_rollup_reply_missing_row),
 
                     (flat_metric_counter, network_interface_ether_arp_packets), (flat_metric_counter, network_interface_ether_ipv4_packets),
                     (flat_metric_counter, network_interface_ether_llc_packets), (flat_metric_counter, network_interface_tcp_packets),
                     (flat_metric_counter, network_interface_udp_packets),
 
                     (flat_metric_counter, network_interface_dns_packets), (flat_metric_counter, network_interface_dns_packets_overflow_decompression),
-                    (flat_metric_counter, network_interface_dns_packets_qtype_a), (uint64_t, open_files_limit), );
+                    (flat_metric_counter, network_interface_dns_packets_qtype_a), (flat_metric_counter, network_interface_dns_packets_qtype_aaaa),
+                    (uint64_t, open_files_limit),
+
+                    (flat_metric_counter, network_interface_tpacket_blocks), (flat_metric_counter, network_interface_tpacket_packets),
+                    (flat_metric_counter, network_interface_tpacket_drops),
+
+                    (flat_metric_counter, network_interface_staging_flushes), (flat_metric_counter, network_interface_staging_observations),
+                    (flat_metric_counter, network_interface_staging_flush_nanoseconds),
+
+                    (flat_metric_counter, network_name_passive_answers), (flat_metric_counter, network_name_resolver_answers),
+                    (flat_metric_counter, network_name_resolver_queued), (flat_metric_counter, network_name_resolver_lookups),
+
+                    (flat_metric_counter, http_server_connections), (flat_metric_counter, http_server_requests),
+                    (flat_metric_counter, http_server_connection_errors), (flat_metric_counter, http_server_sendfile_bytes),
+                    (flat_metric_counter, http_server_accept_pauses),
+
+                    (flat_metric_counter, flat_mmap_grow_syscalls), (flat_metric_counter, flat_mmap_grow_syscalls_avoided),
+                    (flat_metric_counter, flat_mmap_address_moves), (flat_metric_counter, flat_mmap_reserve_failures),
+                    (flat_metric_counter, flat_mmap_data_syncs),
+                    (flat_metric_counter, flat_flusher_group_commits), (flat_metric_counter, flat_flusher_committed_records),
+                    (flat_metric_counter, flat_flusher_dropped_records),
+
+                    (flat_metric_histogram, network_interface_packet_nanoseconds), (flat_metric_histogram, store_lock_wait_nanoseconds),
+                    (flat_metric_histogram, ping_rtt_microseconds), (flat_metric_histogram, network_interface_dump_nanoseconds),
+                    (flat_metric_histogram, network_interface_learn_nanoseconds), );
 
 define_flat_record(flat_metrics_record, (flat_metrics_struct, flat_metrics_value), );
 
-flat_metrics_struct &flat_metric();
+inline constexpr uint64_t flat_metrics_shards = 16;
+
+// the shard of the calling thread, given out the first time the thread counts
+flat_metrics_struct &flat_metrics_thread_shard();
+inline flat_metrics_struct &flat_metric() {
+    thread_local flat_metrics_struct &shard = flat_metrics_thread_shard();
+    return shard;
+}
+// Counters and histograms are added up across the shards. Plain values are set rather than counted, by
+// whichever thread knows them, so the largest is taken.
+flat_metrics_struct flat_metrics_sum();
+
+// takes the write lock, counting in store_lock_wait_nanoseconds how long that took
+template <typename T> write_locked_reference<T> flat_metrics_write_locked(locked_reference<T> &ref) {
+    write_locked_reference<T> locked(ref, std::try_to_lock);
+    if (locked.lock.owns_lock()) [[likely]] {
+        flat_metric().store_lock_wait_nanoseconds.histogram_record(0);
+        return locked;
+    }
+    auto wait_start = std::chrono::steady_clock::now();
+    locked.lock.lock();
+    flat_metric().store_lock_wait_nanoseconds.histogram_record_nanoseconds_since(wait_start);
+    return locked;
+}
+
+// adds what the process-wide flat_mmap and flat_flusher counters have counted since the last call
+void flat_metrics_collect_mmap();
 void flat_metrics_report_delta(std::ostream &os, flat_metrics_struct const &current, flat_metrics_struct const &previous);
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "flat_metrics.hpp"
+#include "rebootping_test.hpp"
+
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+struct rebootping_records_tmpdir : tmpdir {
+    rebootping_records_tmpdir() { setenv("rebootping_records_dir", tmpdir_name.c_str(), 1); }
+};
+[[maybe_unused]] rebootping_records_tmpdir global_rebootping_records_tmpdir;
+} // namespace
+
+TEST(flat_metrics_suite, histogram_buckets) {
+    for (uint64_t value : {uint64_t{0}, uint64_t{1}, uint64_t{3}, uint64_t{4}, uint64_t{5}, uint64_t{7}, uint64_t{8}, uint64_t{1000}, uint64_t{123456789},
+                           ~uint64_t{0}}) {
+        auto bucket = flat_metric_histogram::histogram_bucket_of(value);
+        rebootping_test_check(bucket, <, flat_metric_histogram::histogram_bucket_count);
+        auto low = flat_metric_histogram::histogram_bucket_low(bucket);
+        rebootping_test_check(low, <=, value);
+        // no bucket is wider than a quarter of its values
+        rebootping_test_check(value - low, <=, low / 4, " value ", value);
+        if (bucket + 1 < flat_metric_histogram::histogram_bucket_count) {
+            rebootping_test_check(flat_metric_histogram::histogram_bucket_low(bucket + 1), >, value);
+        }
+    }
+
+    flat_metric_histogram histogram{};
+    for (uint64_t value = 1; 1000 >= value; ++value) { histogram.histogram_record(value); }
+    rebootping_test_check(histogram.histogram_count, ==, 1000);
+    rebootping_test_check(histogram.histogram_sum, ==, 1000 * 1001 / 2);
+    rebootping_test_check(histogram.histogram_quantile(0.5), <=, 500);
+    rebootping_test_check(histogram.histogram_quantile(0.5), >, 500 * 3 / 4);
+    rebootping_test_check(histogram.histogram_quantile(0.99), <=, 990);
+    rebootping_test_check(histogram.histogram_quantile(0.99), >, 990 * 3 / 4);
+
+    flat_metric_histogram earlier = histogram;
+    histogram.histogram_record(5000);
+    auto delta = histogram - earlier;
+    rebootping_test_check(delta.histogram_count, ==, 1);
+    rebootping_test_check(delta.histogram_quantile(0.5), ==, flat_metric_histogram::histogram_bucket_low(flat_metric_histogram::histogram_bucket_of(5000)));
+}
+
+TEST(flat_metrics_suite, threads_count_into_their_own_shards) {
+    auto before = flat_metrics_sum();
+    constexpr uint64_t thread_count = 8, per_thread = 64 * 1024;
+    std::vector<flat_metrics_struct *> shards(thread_count);
+    {
+        std::vector<std::jthread> threads;
+        for (uint64_t t = 0; thread_count > t; ++t) {
+            threads.emplace_back([&, t] {
+                shards[t] = &flat_metric();
+                for (uint64_t i = 0; per_thread > i; ++i) {
+                    ++flat_metric().http_server_requests;
+                    flat_metric().ping_rtt_microseconds.histogram_record(i % 64);
+                }
+                flat_metric().open_files_limit = 100 + t;
+            });
+        }
+    }
+    // fewer threads than shards each get their own
+    rebootping_test_check(std::set(shards.begin(), shards.end()).size(), ==, thread_count);
+    rebootping_test_check(uint64_t(shards[0]) % 64, ==, 0);
+
+    auto after = flat_metrics_sum();
+    rebootping_test_check(after.http_server_requests - before.http_server_requests, ==, thread_count * per_thread);
+    auto rtt = after.ping_rtt_microseconds - before.ping_rtt_microseconds;
+    rebootping_test_check(rtt.histogram_count, ==, thread_count * per_thread);
+    // 56 to 63 share a bucket
+    rebootping_test_check(rtt.histogram_buckets[flat_metric_histogram::histogram_bucket_of(63)], ==, thread_count * per_thread / 64 * 8);
+    rebootping_test_check(after.open_files_limit, ==, 100 + thread_count - 1);
+
+    std::ostringstream report;
+    flat_metrics_report_delta(report, after, before);
+    rebootping_test_check(report.str().find(str("flat_metrics_report_delta http_server_requests ", thread_count * per_thread, "\n")), !=, std::string::npos);
+    rebootping_test_check(report.str().find("flat_metrics_report_delta ping_rtt_microseconds count "), !=, std::string::npos);
+}
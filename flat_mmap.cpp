@@ -1,8 +1,23 @@
 #include "flat_mmap.hpp"
 
+#include "env.hpp"
+#include "flat_env.hpp"
 #include "thread_context.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
 namespace {
+std::atomic<uint64_t> global_open_files;
+std::atomic<uint64_t> global_mapped_bytes;
+std::atomic<uint64_t> global_grow_syscalls;
+std::atomic<uint64_t> global_grow_syscalls_avoided;
+std::atomic<uint64_t> global_address_moves;
+std::atomic<uint64_t> global_reserve_failures;
+std::atomic<uint64_t> global_advice_failures;
+std::atomic<uint64_t> global_data_syncs;
+
 uint64_t round_up_to_aligned_page(uint64_t len) {
     auto pagesize = getpagesize();
     auto aligned_len = pagesize * ((len + pagesize - 1) / pagesize);
@@ -10,36 +25,196 @@ uint64_t round_up_to_aligned_page(uint64_t len) {
 }
 } // namespace
 
+uint64_t flat_mmap_open_files() { return global_open_files.load(std::memory_order_relaxed); }
+uint64_t flat_mmap_mapped_bytes() { return global_mapped_bytes.load(std::memory_order_relaxed); }
+uint64_t flat_mmap_grow_syscalls() { return global_grow_syscalls.load(std::memory_order_relaxed); }
+uint64_t flat_mmap_grow_syscalls_avoided() { return global_grow_syscalls_avoided.load(std::memory_order_relaxed); }
+uint64_t flat_mmap_address_moves() { return global_address_moves.load(std::memory_order_relaxed); }
+uint64_t flat_mmap_reserve_failures() { return global_reserve_failures.load(std::memory_order_relaxed); }
+uint64_t flat_mmap_advice_failures() { return global_advice_failures.load(std::memory_order_relaxed); }
+uint64_t flat_mmap_data_syncs() { return global_data_syncs.load(std::memory_order_relaxed); }
+
+void flat_mmap_sync_directory(std::string const &directory) {
+    add_thread_context _("mmap_filename", directory);
+    auto fd = CALL_ERRNO_MINUS_1(open, directory.c_str(), O_RDONLY | O_DIRECTORY);
+    auto synced = fsync(fd);
+    auto sync_errno = errno;
+    close(fd);
+    if (synced) { throw errno_exception(sync_errno, "fsync"); }
+}
+
+flat_mmap_settings flat_mmap_settings_from_env(std::string const &prefix, flat_mmap_settings settings) {
+    auto advice = env((prefix + "_mmap_advice").c_str(), "");
+    if (advice == "normal") { settings.mmap_advice = flat_mmap_advice::advice_normal; }
+    if (advice == "sequential") { settings.mmap_advice = flat_mmap_advice::advice_sequential; }
+    if (advice == "random") { settings.mmap_advice = flat_mmap_advice::advice_random; }
+    settings.mmap_willneed = env((prefix + "_mmap_willneed").c_str(), settings.mmap_willneed);
+    settings.mmap_populate = env((prefix + "_mmap_populate").c_str(), settings.mmap_populate);
+    settings.mmap_lock_index = env((prefix + "_mmap_lock_index").c_str(), settings.mmap_lock_index);
+    settings.mmap_huge_pages = env((prefix + "_mmap_huge_pages").c_str(), settings.mmap_huge_pages);
+    return settings;
+}
+
 flat_mmap::flat_mmap(std::string filename, flat_mmap_settings const &settings)
-    : mmap_filename(std::move(filename)), mmap_fd(-1), mmap_base(nullptr), mmap_settings(settings), mmap_len(0) {
+    : mmap_filename(std::move(filename)), mmap_fd(-1), mmap_base(nullptr), mmap_settings(settings), mmap_len(0), mmap_logical_len(0), mmap_reserved_len(0) {
     open_mmap();
 }
 
 void flat_mmap::mmap_allocate_at_least(uint64_t len) {
-    if (mmap_len >= len) return;
-    auto aligned_len = round_up_to_aligned_page(len);
-    CALL_ERRNO_MINUS_1(fallocate, mmap_fd, 0, mmap_len, aligned_len - mmap_len);
-
-    mmap_ensure_mapped(aligned_len);
+    if (mmap_len < len) {
+        auto aligned_len = round_up_to_aligned_page(len);
+        CALL_ERRNO_MINUS_1(fallocate, mmap_fd, 0, mmap_len, aligned_len - mmap_len);
+        mmap_ensure_mapped(aligned_len);
+        global_grow_syscalls += 2;
+    }
+    mmap_logical_len = std::max(mmap_logical_len, std::min(round_up_to_aligned_page(len), mmap_len));
 }
 
 void flat_mmap::mmap_sparsely_allocate_at_least(uint64_t len) {
-    if (mmap_len >= len) return;
+    if (mmap_len < len) {
+        auto aligned_len = round_up_to_aligned_page(len);
+        CALL_ERRNO_MINUS_1(ftruncate, mmap_fd, aligned_len);
+        mmap_ensure_mapped(aligned_len);
+        global_grow_syscalls += 2;
+    }
+    mmap_logical_len = std::max(mmap_logical_len, std::min(round_up_to_aligned_page(len), mmap_len));
+}
+
+void flat_mmap::mmap_reserve_grow(uint64_t len) {
+    auto aligned_len = round_up_to_aligned_page(len);
+    if (aligned_len > mmap_len) {
+        auto chunk = std::clamp(mmap_len, flat_env::flat_mmap_reserve_min_bytes(), flat_env::flat_mmap_reserve_max_bytes());
+        auto reserved_len = std::max(aligned_len, round_up_to_aligned_page(mmap_len + chunk));
+        CALL_ERRNO_MINUS_1(fallocate, mmap_fd, 0, mmap_len, reserved_len - mmap_len);
+        mmap_ensure_mapped(reserved_len);
+        global_grow_syscalls += 2;
+    } else {
+        // a fallocate and an mremap, had the file only grown to the page that was needed
+        global_grow_syscalls_avoided += 2;
+    }
+    mmap_logical_len = aligned_len;
+}
+
+void flat_mmap::mmap_trim_to(uint64_t len) {
     auto aligned_len = round_up_to_aligned_page(len);
+    if (mmap_settings.mmap_readonly || aligned_len >= mmap_len) { return; }
+    if (mmap_reserved_len) {
+        mmap_unmap_to_reservation(aligned_len);
+    } else if (aligned_len) {
+        mmap_base = CALL_ERRNO_BAD_VALUE(mremap, MAP_FAILED, mmap_base, mmap_len, aligned_len, 0);
+    } else {
+        CALL_ERRNO_MINUS_1(munmap, mmap_base, mmap_len);
+        mmap_base = nullptr;
+    }
+    global_mapped_bytes -= mmap_len - aligned_len;
+    mmap_len = aligned_len;
+    mmap_logical_len = std::min(mmap_logical_len, aligned_len);
     CALL_ERRNO_MINUS_1(ftruncate, mmap_fd, aligned_len);
+}
+
+void flat_mmap::mmap_sync_data() const {
+    add_thread_context _("mmap_filename", mmap_filename);
+    CALL_ERRNO_MINUS_1(fdatasync, mmap_fd);
+    ++global_data_syncs;
+}
 
-    mmap_ensure_mapped(aligned_len);
+void flat_mmap::mmap_release_before(uint64_t len) const {
+    assert(mmap_settings.mmap_readonly);
+    auto aligned_len = std::min(len, mmap_len) / getpagesize() * getpagesize();
+    if (!aligned_len) { return; }
+    if (madvise(mmap_base, aligned_len, MADV_DONTNEED)) { ++global_advice_failures; }
+    if (posix_fadvise(mmap_fd, 0, off_t(aligned_len), POSIX_FADV_DONTNEED)) { ++global_advice_failures; }
+}
+
+void flat_mmap::mmap_discard() {
+    if (mmap_reserved_len) {
+        mmap_unmap_to_reservation(0);
+        global_mapped_bytes -= mmap_len;
+        mmap_len = 0;
+    } else if (mmap_base) {
+        CALL_ERRNO_MINUS_1(munmap, mmap_base, mmap_len);
+        global_mapped_bytes -= mmap_len;
+        mmap_base = nullptr;
+        mmap_len = 0;
+    }
+    mmap_logical_len = 0;
+    CALL_ERRNO_MINUS_1(ftruncate, mmap_fd, 0);
 }
 
 void flat_mmap::mmap_ensure_mapped(uint64_t new_mmap_len) {
     if (new_mmap_len <= mmap_len) { return; }
-    if (mmap_base) {
+    auto prot = PROT_READ | (mmap_settings.mmap_readonly ? 0 : PROT_WRITE);
+    if (!mmap_base && !mmap_settings.mmap_readonly) {
+        // address space only, so that the file can be mapped over it in place as it grows
+        auto reserve_len = std::min<uint64_t>(flat_env::flat_mmap_stable_reserve_bytes(), std::numeric_limits<size_t>::max() / 16);
+        if (reserve_len) {
+            auto len = std::max(round_up_to_aligned_page(new_mmap_len), round_up_to_aligned_page(reserve_len));
+            auto *reserved = mmap(nullptr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (reserved != MAP_FAILED) {
+                mmap_base = reserved;
+                mmap_reserved_len = len;
+            } else if (errno == ENOMEM) {
+                // out of address space: the mapping grows unreserved and may move
+                ++global_reserve_failures;
+            } else {
+                throw errno_exception(errno, "mmap");
+            }
+        }
+    }
+    if (mmap_reserved_len && new_mmap_len > mmap_reserved_len) {
+        // outgrew the reservation, so give up the rest of it and let the mapping move like an unreserved one
+        if (mmap_reserved_len > mmap_len) {
+            CALL_ERRNO_MINUS_1(munmap, static_cast<unsigned char *>(mmap_base) + round_up_to_aligned_page(mmap_len),
+                               mmap_reserved_len - round_up_to_aligned_page(mmap_len));
+        }
+        mmap_reserved_len = 0;
+        if (!mmap_len) { mmap_base = nullptr; }
+    }
+    if (mmap_reserved_len) {
+        // only the pages past the old end are mapped, so the ones before keep their advice and locks
+        auto mapped_end = round_up_to_aligned_page(mmap_len);
+        if (new_mmap_len > mapped_end) {
+            CALL_ERRNO_BAD_VALUE(mmap, MAP_FAILED, static_cast<unsigned char *>(mmap_base) + mapped_end, new_mmap_len - mapped_end, prot,
+                                 MAP_SHARED | MAP_FIXED, mmap_fd, off_t(mapped_end));
+        }
+    } else if (mmap_base) {
+        auto old_base = mmap_base;
         mmap_base = CALL_ERRNO_BAD_VALUE(mremap, MAP_FAILED, mmap_base, mmap_len, new_mmap_len, MREMAP_MAYMOVE);
+        if (mmap_base != old_base) { ++global_address_moves; }
     } else {
-        mmap_base =
-            CALL_ERRNO_BAD_VALUE(mmap, MAP_FAILED, nullptr, new_mmap_len, PROT_READ | (mmap_settings.mmap_readonly ? 0 : PROT_WRITE), MAP_SHARED, mmap_fd, 0);
+        mmap_base = CALL_ERRNO_BAD_VALUE(mmap, MAP_FAILED, nullptr, new_mmap_len, prot, MAP_SHARED, mmap_fd, 0);
+    }
+    global_mapped_bytes += new_mmap_len - mmap_len;
+    std::swap(mmap_len, new_mmap_len);
+    mmap_apply_settings(new_mmap_len);
+}
+
+void flat_mmap::mmap_apply_settings(uint64_t old_len) {
+    auto *base = static_cast<unsigned char *>(mmap_base);
+    auto from = old_len / getpagesize() * getpagesize();
+    if (from >= mmap_len) { return; }
+    auto advise = [&](int advice) {
+        if (madvise(base + from, mmap_len - from, advice)) { ++global_advice_failures; }
+    };
+    if (mmap_settings.mmap_advice == flat_mmap_advice::advice_sequential) { advise(MADV_SEQUENTIAL); }
+    if (mmap_settings.mmap_advice == flat_mmap_advice::advice_random) { advise(MADV_RANDOM); }
+    if (mmap_settings.mmap_huge_pages) { advise(MADV_HUGEPAGE); }
+    if (mmap_settings.mmap_willneed) { advise(MADV_WILLNEED); }
+    if (mmap_settings.mmap_populate) {
+#ifdef MADV_POPULATE_WRITE
+        advise(mmap_settings.mmap_readonly ? MADV_POPULATE_READ : MADV_POPULATE_WRITE);
+#else
+        for (auto offset = from; offset < mmap_len; offset += getpagesize()) { (void)*static_cast<unsigned char volatile *>(base + offset); }
+#endif
     }
-    mmap_len = new_mmap_len;
+    if (mmap_settings.mmap_lock && mlock(base + from, mmap_len - from)) { ++global_advice_failures; }
+}
+
+void flat_mmap::mmap_unmap_to_reservation(uint64_t aligned_len) {
+    auto mapped_end = round_up_to_aligned_page(mmap_len);
+    if (mapped_end <= aligned_len) { return; }
+    CALL_ERRNO_BAD_VALUE(mmap, MAP_FAILED, static_cast<unsigned char *>(mmap_base) + aligned_len, mapped_end - aligned_len, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
 }
 
 void flat_mmap::open_mmap() {
@@ -47,11 +222,13 @@ void flat_mmap::open_mmap() {
 
     destroy_mmap();
     mmap_fd = CALL_ERRNO_MINUS_1(open, mmap_filename.c_str(), mmap_settings.mmap_readonly ? O_RDONLY : (O_CREAT | O_RDWR), 0666);
+    ++global_open_files;
     struct stat buf;
     try {
         CALL_ERRNO_MINUS_1(fstat, mmap_fd, &buf);
 
         mmap_ensure_mapped(buf.st_size);
+        mmap_logical_len = mmap_len;
     } catch (...) {
         destroy_mmap();
         throw;
@@ -60,12 +237,16 @@ void flat_mmap::open_mmap() {
 
 void flat_mmap::destroy_mmap() {
     if (mmap_base) {
-        CALL_ERRNO_MINUS_1(munmap, mmap_base, mmap_len);
+        CALL_ERRNO_MINUS_1(munmap, mmap_base, std::max(mmap_len, mmap_reserved_len));
+        global_mapped_bytes -= mmap_len;
         mmap_base = nullptr;
         mmap_len = 0;
+        mmap_reserved_len = 0;
     }
+    mmap_logical_len = 0;
     if (mmap_fd >= 0) {
         CALL_ERRNO_MINUS_1(close, mmap_fd);
+        --global_open_files;
         mmap_fd = -1;
     }
 }
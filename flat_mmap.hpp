@@ -12,16 +12,60 @@
 #include <utility>
 #include <cstdint>
 
+// how the pages of a mapping are expected to be reached, passed to madvise
+enum class flat_mmap_advice : uint8_t {
+    advice_normal,
+    advice_sequential,
+    advice_random,
+};
+
+// Hints are best effort: a kernel that refuses one is counted in flat_mmap_advice_failures and otherwise ignored.
 struct flat_mmap_settings {
     bool mmap_readonly = false;
+    flat_mmap_advice mmap_advice = flat_mmap_advice::advice_normal;
+    // read ahead the whole file when it is mapped
+    bool mmap_willneed = false;
+    // fault pages in as they are mapped and as the file grows, rather than on first touch
+    bool mmap_populate = false;
+    // mlock the .flathash index files opened with these settings, so that lookups never wait for the disk
+    bool mmap_lock_index = false;
+    // mlock this mapping; set by flat_hash from mmap_lock_index
+    bool mmap_lock = false;
+    bool mmap_huge_pages = false;
 };
 
+// overrides from <prefix>_mmap_advice (normal, sequential or random), <prefix>_mmap_willneed,
+// <prefix>_mmap_populate, <prefix>_mmap_lock_index and <prefix>_mmap_huge_pages
+[[nodiscard]] flat_mmap_settings flat_mmap_settings_from_env(std::string const &prefix, flat_mmap_settings settings);
+
+// across every flat_mmap of the process
+[[nodiscard]] uint64_t flat_mmap_open_files();
+[[nodiscard]] uint64_t flat_mmap_mapped_bytes();
+// system calls made to grow files, and those that growing in chunks saved
+[[nodiscard]] uint64_t flat_mmap_grow_syscalls();
+[[nodiscard]] uint64_t flat_mmap_grow_syscalls_avoided();
+// times a mapping moved because it outgrew its reservation, and reservations refused for want of address space
+[[nodiscard]] uint64_t flat_mmap_address_moves();
+[[nodiscard]] uint64_t flat_mmap_reserve_failures();
+[[nodiscard]] uint64_t flat_mmap_advice_failures();
+[[nodiscard]] uint64_t flat_mmap_data_syncs();
+
+// makes the entries of directory, such as a file renamed into it, survive a crash
+void flat_mmap_sync_directory(std::string const &directory);
+
 class flat_mmap {
     const std::string mmap_filename;
     int mmap_fd;
     void *mmap_base;
     flat_mmap_settings mmap_settings;
     uint64_t mmap_len;
+    // the most that has been asked for, rounded up to a page; the file beyond it is capacity held for appends
+    uint64_t mmap_logical_len;
+    // Address space held from mmap_base for the file to grow into, so that it keeps its address while it fits
+    // and references into it stay good until it is trimmed or closed. Writable mappings reserve
+    // flat_mmap_stable_reserve_bytes, unless the address space has run out; readonly ones never grow and
+    // reserve nothing.
+    uint64_t mmap_reserved_len;
 
   public:
     explicit flat_mmap(std::string filename, flat_mmap_settings const &settings = flat_mmap_settings());
@@ -33,10 +77,28 @@ class flat_mmap {
 
     void mmap_allocate_at_least(uint64_t len);
     void mmap_sparsely_allocate_at_least(uint64_t len);
+    // For files that are appended to. When len does not fit, the file grows by a chunk as big as it already is,
+    // within flat_mmap_reserve_min_bytes and flat_mmap_reserve_max_bytes, so most appends only write memory.
+    inline void mmap_reserve_at_least(uint64_t len) {
+        if (len > mmap_logical_len) [[unlikely]] { mmap_reserve_grow(len); }
+    }
+    // Writes what has been stored through the mapping to the disk and waits for it. It goes through the file
+    // rather than the mapping, so another thread may call it while the mapping grows or shrinks.
+    void mmap_sync_data() const;
+    // For readonly mappings read once from front to back, such as captures larger than memory: drops the pages
+    // wholly before len from the mapping and the page cache, so they do not push out pages that are still wanted.
+    // They are read again from the file if touched.
+    void mmap_release_before(uint64_t len) const;
+    // gives back the capacity past len, rounded up to a page, invalidating every reference past it
+    void mmap_trim_to(uint64_t len);
+    // truncates the file to nothing, invalidating every reference into it
+    void mmap_discard();
 
     [[nodiscard]] std::string_view flat_mmap_filename() const { return mmap_filename; }
 
+    [[nodiscard]] bool mmap_readonly() const { return mmap_settings.mmap_readonly; }
     [[nodiscard]] uint64_t mmap_allocated_len() const { return mmap_len; }
+    [[nodiscard]] uint64_t mmap_used_len() const { return mmap_logical_len; }
 
     template <typename T> inline T &mmap_cast(uint64_t off, uint64_t count = 1) const {
         assert(off <= mmap_len);
@@ -54,4 +116,12 @@ class flat_mmap {
     void destroy_mmap();
 
     void mmap_ensure_mapped(uint64_t new_mmap_len);
+
+    void mmap_reserve_grow(uint64_t len);
+
+    // maps the reserved range from aligned_len to the end of the file back to inaccessible address space
+    void mmap_unmap_to_reservation(uint64_t aligned_len);
+
+    // applies mmap_settings to the pages mapped past old_len, as those before it already have them
+    void mmap_apply_settings(uint64_t old_len);
 };
@@ -0,0 +1,116 @@
+#include "env.hpp"
+#include "flat_mmap.hpp"
+#include "network_flat_records.hpp"
+#include "now_unixtime.hpp"
+#include "ping_record_store.hpp"
+#include "rebootping_test.hpp"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// Compares the flat_mmap_settings policies on the record types written on every ping and every packet seen.
+// Not run by ctest: run flat_mmap_policy_bench directly, optionally with flat_mmap_policy_bench_records set.
+// Faults are those of the whole process while each phase runs, so the first policy pays for warming the page cache.
+
+namespace {
+struct bench_policy {
+    char const *policy_name;
+    char const *policy_advice;
+    char const *policy_populate;
+    char const *policy_huge_pages;
+    char const *policy_hot_lock_index;
+};
+
+struct bench_faults {
+    rusage faults_start;
+    std::chrono::steady_clock::time_point faults_clock = std::chrono::steady_clock::now();
+
+    bench_faults() { getrusage(RUSAGE_SELF, &faults_start); }
+
+    void faults_report(char const *policy_name, char const *phase, uint64_t ops) {
+        auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - faults_clock).count();
+        rusage now;
+        getrusage(RUSAGE_SELF, &now);
+        std::cout << "flat_mmap_policy_bench policy=" << policy_name << " phase=" << phase << " ops=" << ops << std::fixed << std::setprecision(1)
+                  << " ns_per_op=" << (ops ? ns / ops : 0) << " minor_faults=" << now.ru_minflt - faults_start.ru_minflt
+                  << " major_faults=" << now.ru_majflt - faults_start.ru_majflt << std::endl;
+    }
+};
+
+void bench_setenv(std::string const &prefix, char const *name, char const *value) { setenv((prefix + name).c_str(), value, 1); }
+
+void bench_run(std::string const &dir, bench_policy const &policy, uint64_t count) {
+    for (std::string prefix : {"ping_record", "ip_contact_record"}) {
+        bench_setenv(prefix, "_mmap_advice", policy.policy_advice);
+        bench_setenv(prefix, "_mmap_populate", policy.policy_populate);
+        bench_setenv(prefix, "_mmap_huge_pages", policy.policy_huge_pages);
+    }
+    // the hot timeshard populates by default, so that is switched off with the other policies
+    setenv("flat_timeshard_hot_populate", policy.policy_populate, 1);
+    setenv("flat_timeshard_hot_lock_index", policy.policy_hot_lock_index, 1);
+
+    std::filesystem::create_directories(dir);
+    auto unixtime = now_unixtime();
+    {
+        ping_record pings(dir);
+        bench_faults faults;
+        for (uint64_t i = 0; count > i; ++i) {
+            pings.add_flat_record(unixtime, [&](auto &&record) {
+                record.ping_start_unixtime() = unixtime + 1e-6 * double(i);
+                record.ping_sent_seconds() = 0.001;
+                record.ping_recv_seconds() = 0.002;
+                record.ping_dest_addr() = network_addr((10u << 24) + uint32_t(i % 1024));
+                record.ping_src_addr() = network_addr((192u << 24) + 1);
+                record.ping_interface() = i % 2 ? "eth0" : "wlan0";
+                record.ping_cookie() = i;
+            });
+        }
+        faults.faults_report(policy.policy_name, "ping_append", count);
+    }
+    {
+        ping_record pings(dir);
+        bench_faults faults;
+        uint64_t cookies = 0;
+        for (auto &&record : pings.timeshard_query()) { cookies += record.ping_cookie(); }
+        faults.faults_report(policy.policy_name, "ping_scan", count);
+        if (cookies != count * (count - 1) / 2) { throw std::runtime_error(str("flat_mmap_policy_bench lost pings under ", policy.policy_name)); }
+    }
+    {
+        ip_contact_record contacts(dir);
+        bench_faults faults;
+        for (uint64_t i = 0; count > i; ++i) {
+            macaddr mac{{0x00, 0x1b, 0x21, uint8_t(i >> 16), uint8_t(i >> 8), uint8_t(i)}};
+            contacts.ip_contact_macaddr_index(mac).add_if_missing(unixtime).ip_contact_addrs().notice_key(network_addr((10u << 24) + uint32_t(i)));
+        }
+        faults.faults_report(policy.policy_name, "contact_notice", count);
+    }
+    for (auto name : {"flat_timeshard_hot_populate", "flat_timeshard_hot_lock_index"}) { unsetenv(name); }
+    for (std::string prefix : {"ping_record", "ip_contact_record"}) {
+        for (auto name : {"_mmap_advice", "_mmap_populate", "_mmap_huge_pages"}) { unsetenv((prefix + name).c_str()); }
+    }
+    std::filesystem::remove_all(dir);
+}
+} // namespace
+
+int main() {
+    tmpdir tmpdir;
+    auto count = env("flat_mmap_policy_bench_records", uint64_t{1} << 20);
+    for (auto &&policy : {
+             bench_policy{"default", "normal", "0", "0", "0"},
+             bench_policy{"sequential", "sequential", "0", "0", "0"},
+             bench_policy{"random", "random", "0", "0", "0"},
+             bench_policy{"populate", "normal", "1", "0", "0"},
+             bench_policy{"huge_pages", "normal", "0", "1", "0"},
+             bench_policy{"populate_locked_index", "normal", "1", "0", "1"},
+         }) {
+        bench_run(tmpdir.tmpdir_name + "/" + policy.policy_name, policy, count);
+    }
+    std::cout << "flat_mmap_policy_bench advice_failures=" << flat_mmap_advice_failures() << std::endl;
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "flat_bytes_field.hpp"
+#include "flat_mmap.hpp"
+#include "flat_record.hpp"
+#include "rebootping_test.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// too wide to be packed when sealed
+struct reserve_test_wide {
+    char wide_bytes[24];
+};
+
+define_flat_record(reserve_test_record, (uint64_t, reserve_value), (std::string_view, reserve_note), (flat_bytes_interned_ptr, reserve_name),
+                   (reserve_test_wide, reserve_unpacked));
+
+TEST(flat_mmap_suite, reserve_grows_in_chunks_and_trims) {
+    tmpdir tmpdir;
+    auto filename = tmpdir.tmpdir_name + "/reserved";
+    auto page = uint64_t(getpagesize());
+    {
+        flat_mmap reserved(filename);
+        auto syscalls = flat_mmap_grow_syscalls(), avoided = flat_mmap_grow_syscalls_avoided();
+        for (uint64_t i = 0; 100000 > i; ++i) {
+            reserved.mmap_reserve_at_least((i + 1) * sizeof(uint64_t));
+            reserved.mmap_cast<uint64_t>(i * sizeof(uint64_t)) = i;
+        }
+        auto pages = 100000 * sizeof(uint64_t) / page;
+        // growing by doubling chunks takes a handful of calls where growing by pages takes one per page
+        rebootping_test_check(flat_mmap_grow_syscalls() - syscalls, <, 2 * 8);
+        rebootping_test_check(flat_mmap_grow_syscalls_avoided() - avoided + flat_mmap_grow_syscalls() - syscalls, >=, 2 * pages);
+        rebootping_test_check(reserved.mmap_used_len(), ==, (100000 * sizeof(uint64_t) + page - 1) / page * page);
+        rebootping_test_check(reserved.mmap_allocated_len(), >=, reserved.mmap_used_len());
+        rebootping_test_check(std::filesystem::file_size(filename), ==, reserved.mmap_allocated_len());
+
+        reserved.mmap_trim_to(100000 * sizeof(uint64_t));
+        rebootping_test_check(reserved.mmap_allocated_len(), ==, reserved.mmap_used_len());
+        rebootping_test_check(std::filesystem::file_size(filename), ==, reserved.mmap_used_len());
+        rebootping_test_check(reserved.mmap_cast<uint64_t>(99999 * sizeof(uint64_t)), ==, 99999);
+
+        // an allocation within the reserve does not count as growing
+        reserved.mmap_reserve_at_least(1);
+        reserved.mmap_allocate_at_least(page);
+        rebootping_test_check(reserved.mmap_allocated_len(), ==, reserved.mmap_used_len());
+    }
+    {
+        flat_mmap readonly(filename, flat_mmap_settings{.mmap_readonly = true});
+        rebootping_test_check(readonly.mmap_used_len(), ==, readonly.mmap_allocated_len());
+        rebootping_test_check(readonly.mmap_cast<uint64_t>(99999 * sizeof(uint64_t)), ==, 99999);
+    }
+}
+
+TEST(flat_mmap_suite, reserved_address_stays_put) {
+    tmpdir tmpdir;
+    auto page = uint64_t(getpagesize());
+    {
+        flat_mmap stable(tmpdir.tmpdir_name + "/stable");
+        stable.mmap_allocate_at_least(page);
+        auto *first = &stable.mmap_cast<uint64_t>(0);
+        *first = 17;
+        auto moves = flat_mmap_address_moves();
+        for (uint64_t len = 2 * page; (uint64_t{64} << 20) >= len; len *= 2) {
+            stable.mmap_allocate_at_least(len);
+            rebootping_test_check(&stable.mmap_cast<uint64_t>(0), ==, first);
+        }
+        stable.mmap_sparsely_allocate_at_least(uint64_t{1} << 30);
+        rebootping_test_check(&stable.mmap_cast<uint64_t>(0), ==, first);
+        stable.mmap_cast<uint64_t>((uint64_t{1} << 30) - sizeof(uint64_t)) = 18;
+
+        // trimmed and discarded space is reserved again, so growing afterwards keeps the address too
+        stable.mmap_trim_to(page);
+        rebootping_test_check(*first, ==, 17);
+        stable.mmap_discard();
+        stable.mmap_allocate_at_least(3 * page);
+        rebootping_test_check(&stable.mmap_cast<uint64_t>(0), ==, first);
+        rebootping_test_check(*first, ==, 0);
+        rebootping_test_check(flat_mmap_address_moves(), ==, moves);
+    }
+    {
+        // a file that outgrows its reservation moves, and keeps its contents
+        setenv("flat_mmap_stable_reserve_bytes", str(4 * page).c_str(), 1);
+        flat_mmap small(tmpdir.tmpdir_name + "/small");
+        small.mmap_allocate_at_least(page);
+        unsetenv("flat_mmap_stable_reserve_bytes");
+        small.mmap_cast<uint64_t>(0) = 19;
+        for (uint64_t len = 2 * page; 1024 * page >= len; len *= 2) { small.mmap_allocate_at_least(len); }
+        rebootping_test_check(small.mmap_cast<uint64_t>(0), ==, 19);
+        small.mmap_trim_to(page);
+        small.mmap_discard();
+        small.mmap_allocate_at_least(page);
+        rebootping_test_check(small.mmap_cast<uint64_t>(0), ==, 0);
+    }
+}
+
+TEST(flat_mmap_suite, reservation_refused_grows_unreserved) {
+    tmpdir tmpdir;
+    auto page = uint64_t(getpagesize());
+    uint64_t mapped_pages = 0;
+    std::ifstream("/proc/self/statm") >> mapped_pages;
+    rlimit saved{};
+    CALL_ERRNO_MINUS_1(getrlimit, RLIMIT_AS, &saved);
+    // room for the file, but not for the reservation
+    rlimit lowered{.rlim_cur = rlim_t(mapped_pages * page + (uint64_t{256} << 20)), .rlim_max = saved.rlim_max};
+    CALL_ERRNO_MINUS_1(setrlimit, RLIMIT_AS, &lowered);
+    auto failures = flat_mmap_reserve_failures();
+    try {
+        flat_mmap unreserved(tmpdir.tmpdir_name + "/unreserved");
+        unreserved.mmap_allocate_at_least(page);
+        unreserved.mmap_cast<uint64_t>(0) = 23;
+        for (uint64_t len = 2 * page; (uint64_t{4} << 20) >= len; len *= 2) { unreserved.mmap_allocate_at_least(len); }
+        rebootping_test_check(unreserved.mmap_cast<uint64_t>(0), ==, 23);
+        unreserved.mmap_trim_to(page);
+        rebootping_test_check(unreserved.mmap_cast<uint64_t>(0), ==, 23);
+    } catch (std::exception const &e) {
+        rebootping_test_fail("flat_mmap reservation_refused_grows_unreserved ", e.what());
+    }
+    CALL_ERRNO_MINUS_1(setrlimit, RLIMIT_AS, &saved);
+    rebootping_test_check(flat_mmap_reserve_failures(), ==, failures + 1);
+}
+
+TEST(flat_mmap_suite, policies_keep_contents) {
+    tmpdir tmpdir;
+    auto page = uint64_t(getpagesize());
+    setenv("policy_test_mmap_advice", "sequential", 1);
+    setenv("policy_test_mmap_populate", "1", 1);
+    auto settings = flat_mmap_settings_from_env("policy_test", flat_mmap_settings{.mmap_huge_pages = true});
+    unsetenv("policy_test_mmap_advice");
+    unsetenv("policy_test_mmap_populate");
+    rebootping_test_check(int(settings.mmap_advice), ==, int(flat_mmap_advice::advice_sequential));
+    rebootping_test_check(settings.mmap_populate, ==, true);
+    rebootping_test_check(settings.mmap_huge_pages, ==, true);
+    rebootping_test_check(settings.mmap_willneed, ==, false);
+    {
+        // populated pages are resident before they are first touched, including those added by growing
+        flat_mmap populated(tmpdir.tmpdir_name + "/populated", settings);
+        populated.mmap_allocate_at_least(64 * page);
+        populated.mmap_allocate_at_least(256 * page);
+        std::vector<unsigned char> resident(256);
+        rebootping_test_check(mincore(&populated.mmap_cast<char>(0), 256 * page, resident.data()), ==, 0);
+        rebootping_test_check(std::ranges::count(resident, 0), ==, 0);
+        for (uint64_t i = 0; 256 > i; ++i) { populated.mmap_cast<uint64_t>(i * page) = i; }
+    }
+    for (auto advice : {flat_mmap_advice::advice_normal, flat_mmap_advice::advice_sequential, flat_mmap_advice::advice_random}) {
+        flat_mmap readonly(tmpdir.tmpdir_name + "/populated",
+                           flat_mmap_settings{.mmap_readonly = true, .mmap_advice = advice, .mmap_willneed = true, .mmap_populate = true});
+        for (uint64_t i = 0; 256 > i; ++i) { rebootping_test_check(readonly.mmap_cast<uint64_t>(i * page), ==, i); }
+    }
+    {
+        // locking asks for nothing but RLIMIT_MEMLOCK, and a refusal is counted rather than thrown
+        flat_mmap locked(tmpdir.tmpdir_name + "/locked", flat_mmap_settings{.mmap_lock = true});
+        locked.mmap_allocate_at_least(page);
+        locked.mmap_cast<uint64_t>(0) = 20;
+        rebootping_test_check(locked.mmap_cast<uint64_t>(0), ==, 20);
+    }
+}
+
+TEST(flat_mmap_suite, sealing_trims_timeshard_files) {
+    tmpdir tmpdir;
+    const double unixtime = 1;
+    auto dir = tmpdir.tmpdir_name + "/19700101/reserve_test_record";
+    auto page = uint64_t(getpagesize());
+    reserve_test_record records(tmpdir.tmpdir_name);
+    for (uint64_t i = 0; 1000 > i; ++i) {
+        records.add_flat_record(unixtime, [&](auto &&record) {
+            record.reserve_value() = i;
+            record.reserve_note() = str("note ", i);
+            record.reserve_name() = str("name ", i % 10);
+        });
+    }
+    auto unpacked_bytes = 1000 * sizeof(reserve_test_wide);
+    rebootping_test_check(std::filesystem::file_size(dir + "/field_reserve_unpacked.flatshard"), >, unpacked_bytes + page);
+    records.seal_timeshards_before(unixtime + 24 * 60 * 60);
+    rebootping_test_check(std::filesystem::file_size(dir + "/field_reserve_unpacked.flatshard"), ==, (unpacked_bytes + page - 1) / page * page);
+    auto &timeshard = *records.unixtime_to_timeshard(unixtime);
+    rebootping_test_check(std::filesystem::file_size(dir + "/flat_timeshard_main.flatmap"), ==,
+                          (timeshard.timeshard_header_ref().flat_timeshard_bytes_start_next + page - 1) / page * page);
+    rebootping_test_check(std::filesystem::file_size(dir + "/field_reserve_note.flatsmap"), ==,
+                          (timeshard.reserve_note.flat_smap_header_ref().flat_smap_offset_next + page - 1) / page * page);
+
+    // a late record reserves again and sees everything before it
+    records.add_flat_record(unixtime, [&](auto &&record) {
+        record.reserve_note() = "late";
+        record.reserve_name() = "name 3";
+    });
+    uint64_t i = 0;
+    for (auto &&record : records.timeshard_query()) {
+        if (i < 1000) {
+            rebootping_test_check(record.reserve_value(), ==, i);
+            rebootping_test_check(record.reserve_note(), ==, str("note ", i));
+            rebootping_test_check(record.reserve_name(), ==, str("name ", i % 10));
+        } else {
+            rebootping_test_check(record.reserve_note(), ==, "late");
+            rebootping_test_check(record.reserve_name(), ==, "name 3");
+        }
+        ++i;
+    }
+    rebootping_test_check(i, ==, 1001);
+}
@@ -0,0 +1,214 @@
+#include "flat_packed_column.hpp"
+
+#include "flat_env.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+struct flat_bit_writer {
+    std::string writer_bytes;
+    uint64_t writer_bits = 0;
+
+    void write_bits(uint64_t value, unsigned bits) {
+        for (unsigned done = 0; bits > done;) {
+            if (!(writer_bits % 8)) { writer_bytes.push_back(0); }
+            unsigned used = writer_bits % 8, take = std::min(8 - used, bits - done);
+            writer_bytes.back() = char(uint8_t(writer_bytes.back()) | (((value >> done) & ((1u << take) - 1)) << used));
+            done += take;
+            writer_bits += take;
+        }
+    }
+};
+
+struct flat_bit_reader {
+    std::string_view reader_bytes;
+    uint64_t reader_bits = 0;
+
+    uint64_t read_bits(unsigned bits) {
+        uint64_t value = 0;
+        for (unsigned done = 0; bits > done;) {
+            auto byte_index = reader_bits / 8;
+            if (byte_index >= reader_bytes.size()) { throw std::runtime_error(str("flat_packed block truncated at bit ", reader_bits)); }
+            unsigned used = reader_bits % 8, take = std::min(8 - used, bits - done);
+            value |= uint64_t((uint8_t(reader_bytes[byte_index]) >> used) & ((1u << take) - 1)) << done;
+            done += take;
+            reader_bits += take;
+        }
+        return value;
+    }
+};
+
+uint64_t zigzag_encode(uint64_t v) { return (v << 1) ^ uint64_t(int64_t(v) >> 63); }
+uint64_t zigzag_decode(uint64_t v) { return (v >> 1) ^ (0 - (v & 1)); }
+
+void frame_encode(flat_bit_writer &writer, std::span<uint64_t const> words) {
+    if (words.empty()) { return; }
+    auto [lowest, highest] = std::minmax_element(words.begin(), words.end());
+    auto base = *lowest;
+    unsigned bits = std::bit_width(*highest - base);
+    writer.write_bits(base, 64);
+    writer.write_bits(bits, 7);
+    for (auto w : words) { writer.write_bits(w - base, bits); }
+}
+
+void frame_decode(flat_bit_reader &reader, std::span<uint64_t> words) {
+    if (words.empty()) { return; }
+    auto base = reader.read_bits(64);
+    auto bits = unsigned(reader.read_bits(7));
+    if (bits > 64) { throw std::runtime_error(str("flat_packed frame too wide ", bits)); }
+    for (auto &w : words) { w = base + reader.read_bits(bits); }
+}
+
+// the first order values as they are, then the order-th differences zigzagged into a frame
+void delta_encode(flat_bit_writer &writer, std::span<uint64_t const> words, size_t order) {
+    std::vector<uint64_t> deltas(words.begin(), words.end());
+    for (size_t o = 1; order >= o; ++o) {
+        for (size_t i = deltas.size(); i-- > o;) { deltas[i] -= deltas[i - 1]; }
+    }
+    auto seeds = std::min(order, deltas.size());
+    for (size_t i = 0; seeds > i; ++i) { writer.write_bits(deltas[i], 64); }
+    for (size_t i = seeds; deltas.size() > i; ++i) { deltas[i] = zigzag_encode(deltas[i]); }
+    frame_encode(writer, std::span(deltas).subspan(seeds));
+}
+
+void delta_decode(flat_bit_reader &reader, std::span<uint64_t> words, size_t order) {
+    auto seeds = std::min(order, words.size());
+    for (size_t i = 0; seeds > i; ++i) { words[i] = reader.read_bits(64); }
+    frame_decode(reader, words.subspan(seeds));
+    for (size_t i = seeds; words.size() > i; ++i) { words[i] = zigzag_decode(words[i]); }
+    for (size_t o = order; o >= 1; --o) {
+        for (size_t i = o; words.size() > i; ++i) { words[i] += words[i - 1]; }
+    }
+}
+
+void xor_encode(flat_bit_writer &writer, std::span<uint64_t const> words) {
+    if (words.empty()) { return; }
+    writer.write_bits(words[0], 64);
+    unsigned window_leading = 0, window_bits = 0;
+    for (size_t i = 1; words.size() > i; ++i) {
+        auto x = words[i] ^ words[i - 1];
+        if (!x) {
+            writer.write_bits(0, 1);
+            continue;
+        }
+        writer.write_bits(1, 1);
+        unsigned leading = std::countl_zero(x), trailing = std::countr_zero(x);
+        if (window_bits && leading >= window_leading && trailing >= 64 - window_leading - window_bits) {
+            writer.write_bits(0, 1);
+            writer.write_bits(x >> (64 - window_leading - window_bits), window_bits);
+            continue;
+        }
+        window_leading = leading;
+        window_bits = 64 - leading - trailing;
+        writer.write_bits(1, 1);
+        writer.write_bits(window_leading, 6);
+        writer.write_bits(window_bits - 1, 6);
+        writer.write_bits(x >> trailing, window_bits);
+    }
+}
+
+void xor_decode(flat_bit_reader &reader, std::span<uint64_t> words) {
+    if (words.empty()) { return; }
+    words[0] = reader.read_bits(64);
+    unsigned window_leading = 0, window_bits = 0;
+    for (size_t i = 1; words.size() > i; ++i) {
+        uint64_t x = 0;
+        if (reader.read_bits(1)) {
+            if (reader.read_bits(1)) {
+                window_leading = unsigned(reader.read_bits(6));
+                window_bits = unsigned(reader.read_bits(6)) + 1;
+                if (window_leading + window_bits > 64) { throw std::runtime_error(str("flat_packed xor window too wide ", window_leading, "+", window_bits)); }
+            } else if (!window_bits) {
+                throw std::runtime_error("flat_packed xor reuses a window before setting one");
+            }
+            x = reader.read_bits(window_bits) << (64 - window_leading - window_bits);
+        }
+        words[i] = words[i - 1] ^ x;
+    }
+}
+} // namespace
+
+std::string flat_packed_encode_block(std::span<uint64_t const> words, uint64_t word_bytes, bool floating_point) {
+    auto encode = [&](flat_packed_codec codec, auto &&encode_words) {
+        flat_bit_writer writer;
+        writer.write_bits(uint8_t(codec), 8);
+        encode_words(writer);
+        return std::move(writer.writer_bytes);
+    };
+    auto best = encode(flat_packed_codec::packed_raw, [&](flat_bit_writer &writer) {
+        for (auto w : words) { writer.write_bits(w, unsigned(word_bytes * 8)); }
+    });
+    auto consider = [&](std::string &&candidate) {
+        if (candidate.size() < best.size()) { best = std::move(candidate); }
+    };
+    consider(encode(flat_packed_codec::packed_frame, [&](flat_bit_writer &writer) { frame_encode(writer, words); }));
+    consider(encode(flat_packed_codec::packed_delta, [&](flat_bit_writer &writer) { delta_encode(writer, words, 1); }));
+    consider(encode(flat_packed_codec::packed_delta_of_delta, [&](flat_bit_writer &writer) { delta_encode(writer, words, 2); }));
+    if (floating_point) { consider(encode(flat_packed_codec::packed_xor, [&](flat_bit_writer &writer) { xor_encode(writer, words); })); }
+    return best;
+}
+
+void flat_packed_decode_block(std::string_view block, std::span<uint64_t> words, uint64_t word_bytes) {
+    flat_bit_reader reader{block};
+    auto codec = flat_packed_codec(reader.read_bits(8));
+    switch (codec) {
+    case flat_packed_codec::packed_raw:
+        for (auto &w : words) { w = reader.read_bits(unsigned(word_bytes * 8)); }
+        break;
+    case flat_packed_codec::packed_frame: frame_decode(reader, words); break;
+    case flat_packed_codec::packed_delta: delta_decode(reader, words, 1); break;
+    case flat_packed_codec::packed_delta_of_delta: delta_decode(reader, words, 2); break;
+    case flat_packed_codec::packed_xor: xor_decode(reader, words); break;
+    default: throw std::runtime_error(str("flat_packed unknown codec ", int(codec)));
+    }
+}
+
+void flat_packed_write(std::string const &filename, flat_packed_header const &header, std::vector<std::string> const &blocks) {
+    std::vector<uint64_t> offsets{sizeof(flat_packed_header) + (blocks.size() + 1) * sizeof(uint64_t)};
+    for (auto &&block : blocks) { offsets.push_back(offsets.back() + block.size()); }
+
+    auto temporary = filename + ".tmp";
+    std::filesystem::remove(temporary);
+    {
+        flat_mmap out(temporary);
+        out.mmap_allocate_at_least(offsets.back());
+        out.mmap_cast<flat_packed_header>(0) = header;
+        std::memcpy(&out.mmap_cast<uint64_t>(sizeof(flat_packed_header), offsets.size()), offsets.data(), offsets.size() * sizeof(uint64_t));
+        for (size_t i = 0; blocks.size() > i; ++i) {
+            if (!blocks[i].empty()) { std::memcpy(&out.mmap_cast<char>(offsets[i], blocks[i].size()), blocks[i].data(), blocks[i].size()); }
+        }
+        // the .flatshard is discarded once this is in place, so whatever the durability setting it must not be renamed before
+        // its blocks are on the disk
+        out.mmap_sync_data();
+    }
+    std::filesystem::rename(temporary, filename);
+    flat_mmap_sync_directory(std::filesystem::path(filename).parent_path());
+}
+
+flat_packed_header const &flat_packed_check(flat_mmap const &packed_mmap, uint64_t word_bytes) {
+    flat_packed_header highest_supported_version;
+    if (packed_mmap.mmap_allocated_len() < sizeof(flat_packed_header) ||
+        highest_supported_version.flat_packed_magic != packed_mmap.mmap_cast<flat_packed_header>(0).flat_packed_magic) {
+        throw std::runtime_error(str("flat_packed_magic does not match in ", packed_mmap.flat_mmap_filename()));
+    }
+    auto &header = packed_mmap.mmap_cast<flat_packed_header>(0);
+    if (header.flat_packed_version > highest_supported_version.flat_packed_version) {
+        throw std::runtime_error(str("flat_packed_version too new: ", packed_mmap.flat_mmap_filename(), " at ", header.flat_packed_version, ">",
+                                     highest_supported_version.flat_packed_version));
+    }
+    if (header.flat_packed_word_bytes != word_bytes || !header.flat_packed_block_rows) {
+        throw std::runtime_error(str("flat_packed_word_bytes does not match: ", packed_mmap.flat_mmap_filename(), " at ", header.flat_packed_word_bytes,
+                                     " expected ", word_bytes));
+    }
+    auto block_count = (header.flat_packed_row_count + header.flat_packed_block_rows - 1) / header.flat_packed_block_rows;
+    auto directory_end = sizeof(flat_packed_header) + (block_count + 1) * sizeof(uint64_t);
+    if (directory_end > packed_mmap.mmap_allocated_len()) {
+        throw std::runtime_error(str("flat_packed block directory does not fit: ", packed_mmap.flat_mmap_filename()));
+    }
+    auto *offsets = &packed_mmap.mmap_cast<uint64_t>(sizeof(flat_packed_header), block_count + 1);
+    if (offsets[0] != directory_end || !std::is_sorted(offsets, offsets + block_count + 1) || offsets[block_count] > packed_mmap.mmap_allocated_len()) {
+        throw std::runtime_error(str("flat_packed blocks do not fit: ", packed_mmap.flat_mmap_filename()));
+    }
+    return header;
+}
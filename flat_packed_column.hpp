@@ -0,0 +1,139 @@
+#pragma once
+
+#include "cmake_variables.hpp"
+#include "flat_mmap.hpp"
+#include "now_unixtime.hpp"
+#include "str.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+struct flat_packed_header {
+    uint64_t flat_packed_magic = 0x666c61747061636b;
+    uint64_t flat_packed_version = 202610170000;
+    double flat_packed_git_unixtime = flat_git_unixtime;
+    uint8_t flat_packed_git_sha_string_array[128] = flat_git_sha_string;
+    double flat_packed_create_unixtime = now_unixtime();
+
+    uint64_t flat_packed_word_bytes = 0;
+    uint64_t flat_packed_row_count = 0;
+    uint64_t flat_packed_block_rows = 1024;
+};
+
+// How one block of a packed column is stored. Every block is written with whichever codec makes it smallest.
+enum class flat_packed_codec : uint8_t {
+    packed_raw,
+    // the lowest value, then each value less it in as few bits as the block needs
+    packed_frame,
+    // the first value, then the differences between neighbours as a frame
+    packed_delta,
+    // the first two values, then the differences between neighbouring differences, for steady timestamps
+    packed_delta_of_delta,
+    // Gorilla XOR of each value with the one before, for floating point that changes in its low bits
+    packed_xor,
+};
+
+// Values of at most 64 bits that can be copied bytewise are packed; everything else stays as written.
+template <typename field_type>
+inline constexpr bool flat_packed_column_supported = std::is_trivially_copyable_v<field_type> && sizeof(field_type) <= sizeof(uint64_t);
+
+// Each word holds one value in its low word_bytes bytes.
+[[nodiscard]] std::string flat_packed_encode_block(std::span<uint64_t const> words, uint64_t word_bytes, bool floating_point);
+void flat_packed_decode_block(std::string_view block, std::span<uint64_t> words, uint64_t word_bytes);
+void flat_packed_write(std::string const &filename, flat_packed_header const &header, std::vector<std::string> const &blocks);
+// throws unless the file holds a supported header and a complete block directory for values of word_bytes
+flat_packed_header const &flat_packed_check(flat_mmap const &packed_mmap, uint64_t word_bytes);
+
+// A column of a sealed timeshard read from its .flatpacked file. Each block of flat_packed_block_rows rows
+// is decoded into memory the first time one of its rows is wanted, so looking up a row decodes one block
+// and a scan decodes each block once. Rows are handed out by reference like those of the raw file; changes
+// to them stay in memory until the timeshard notices them with packed_rows_changed and unpacks the column.
+template <typename field_type> struct flat_packed_column {
+    flat_mmap packed_mmap;
+    flat_packed_header const &packed_header;
+    std::unique_ptr<field_type[]> packed_rows;
+    std::unique_ptr<std::atomic<bool>[]> packed_block_decoded;
+    std::mutex packed_decode_mutex;
+
+    explicit flat_packed_column(std::string filename)
+        : packed_mmap(std::move(filename), flat_mmap_settings{.mmap_readonly = true}), packed_header(flat_packed_check(packed_mmap, sizeof(field_type))),
+          packed_rows(std::make_unique_for_overwrite<field_type[]>(packed_header.flat_packed_row_count)),
+          packed_block_decoded(std::make_unique<std::atomic<bool>[]>(packed_block_count())) {}
+
+    [[nodiscard]] uint64_t packed_row_count() const { return packed_header.flat_packed_row_count; }
+    [[nodiscard]] uint64_t packed_block_count() const {
+        return (packed_header.flat_packed_row_count + packed_header.flat_packed_block_rows - 1) / packed_header.flat_packed_block_rows;
+    }
+
+    field_type &packed_ref(uint64_t index) {
+        assert(index < packed_row_count());
+        packed_ensure_decoded(index / packed_header.flat_packed_block_rows);
+        return packed_rows[index];
+    }
+
+    std::span<field_type const> packed_column(uint64_t count) {
+        assert(count <= packed_row_count());
+        if (!count) { return {}; }
+        for (uint64_t block = 0; (count - 1) / packed_header.flat_packed_block_rows >= block; ++block) { packed_ensure_decoded(block); }
+        return {packed_rows.get(), count};
+    }
+
+    // whether any decoded row no longer holds the value in the file, decoding those blocks again to compare
+    [[nodiscard]] bool packed_rows_changed() {
+        std::lock_guard lock(packed_decode_mutex);
+        std::vector<uint64_t> words;
+        for (uint64_t block = 0; packed_block_count() > block; ++block) {
+            if (!packed_block_decoded[block].load(std::memory_order_relaxed)) { continue; }
+            auto first = block * packed_header.flat_packed_block_rows;
+            words.assign(std::min(packed_header.flat_packed_block_rows, packed_row_count() - first), 0);
+            packed_decode_into(block, words);
+            for (size_t i = 0; words.size() > i; ++i) {
+                if (std::memcmp(&packed_rows[first + i], &words[i], sizeof(field_type))) { return true; }
+            }
+        }
+        return false;
+    }
+
+    static void packed_write(std::string const &filename, std::span<field_type const> rows) {
+        flat_packed_header header;
+        header.flat_packed_word_bytes = sizeof(field_type);
+        header.flat_packed_row_count = rows.size();
+        std::vector<std::string> blocks;
+        std::vector<uint64_t> words;
+        for (uint64_t first = 0; rows.size() > first; first += header.flat_packed_block_rows) {
+            words.assign(std::min<uint64_t>(header.flat_packed_block_rows, rows.size() - first), 0);
+            for (size_t i = 0; words.size() > i; ++i) { std::memcpy(&words[i], &rows[first + i], sizeof(field_type)); }
+            blocks.push_back(flat_packed_encode_block(words, sizeof(field_type), std::is_floating_point_v<field_type>));
+        }
+        flat_packed_write(filename, header, blocks);
+    }
+
+  private:
+    void packed_ensure_decoded(uint64_t block) {
+        if (packed_block_decoded[block].load(std::memory_order_acquire)) [[likely]] { return; }
+        std::lock_guard lock(packed_decode_mutex);
+        if (packed_block_decoded[block].load(std::memory_order_relaxed)) { return; }
+
+        auto first = block * packed_header.flat_packed_block_rows;
+        std::vector<uint64_t> words(std::min(packed_header.flat_packed_block_rows, packed_row_count() - first));
+        packed_decode_into(block, words);
+        for (size_t i = 0; words.size() > i; ++i) { std::memcpy(&packed_rows[first + i], &words[i], sizeof(field_type)); }
+        packed_block_decoded[block].store(true, std::memory_order_release);
+    }
+
+    void packed_decode_into(uint64_t block, std::span<uint64_t> words) const {
+        auto *offsets = &packed_mmap.mmap_cast<uint64_t>(sizeof(flat_packed_header), packed_block_count() + 1);
+        flat_packed_decode_block(std::string_view(&packed_mmap.mmap_cast<char>(offsets[block], offsets[block + 1] - offsets[block]),
+                                                  offsets[block + 1] - offsets[block]),
+                                 words, sizeof(field_type));
+    }
+};
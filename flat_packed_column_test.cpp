@@ -0,0 +1,212 @@
+#include "flat_bytes_field.hpp"
+#include "flat_index_field.hpp"
+#include "flat_record.hpp"
+#include "rebootping_test.hpp"
+
+#include <filesystem>
+#include <random>
+
+define_flat_record(packed_test_record, (double, packed_unixtime), (double, packed_seconds), (uint32_t, packed_addr), (uint8_t, packed_small),
+                   (int64_t, packed_counter), (flat_bytes_interned_ptr, packed_interface), (std::string_view, packed_note),
+                   (flat_index_linked_field<uint32_t>, packed_addr_index));
+
+namespace {
+template <typename value_type> void check_round_trip(std::vector<value_type> const &values, std::string const &what) {
+    tmpdir tmpdir;
+    auto filename = tmpdir.tmpdir_name + "/column.flatpacked";
+    flat_packed_column<value_type>::packed_write(filename, values);
+    flat_packed_column<value_type> column(filename);
+    rebootping_test_check(column.packed_row_count(), ==, values.size(), " ", what);
+    // rows out of order first, so that blocks are decoded one at a time
+    for (size_t i = values.size(); i > 0; i -= std::min<size_t>(i, 997)) {
+        rebootping_test_check(std::memcmp(&column.packed_ref(i - 1), &values[i - 1], sizeof(value_type)), ==, 0, " ", what, " row ", i - 1);
+    }
+    auto all = column.packed_column(values.size());
+    rebootping_test_check(values.empty() || !std::memcmp(all.data(), values.data(), all.size_bytes()), ==, true, " ", what);
+}
+
+uint64_t directory_bytes(std::string const &dir, std::string_view extension) {
+    uint64_t bytes = 0;
+    for (auto &&entry : std::filesystem::recursive_directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == extension) { bytes += entry.file_size(); }
+    }
+    return bytes;
+}
+} // namespace
+
+TEST(flat_packed_column_suite, codecs_round_trip) {
+    std::mt19937_64 random_engine{13};
+    for (size_t length : {0, 1, 2, 3, 1023, 1024, 1025, 5000}) {
+        std::vector<double> times(length), rtts(length), noise(length);
+        std::vector<uint64_t> counters(length), random_words(length);
+        std::vector<uint32_t> addrs(length);
+        std::vector<uint8_t> small(length);
+        for (size_t i = 0; length > i; ++i) {
+            times[i] = 1.7e9 + i + 1e-6 * double(random_engine() % 1000);
+            rtts[i] = i % 7 ? 0.001 * double(random_engine() % 50000) : std::nan("");
+            noise[i] = std::bit_cast<double>(random_engine());
+            counters[i] = 1000 * i;
+            random_words[i] = random_engine();
+            addrs[i] = 0x0a000000 | uint32_t(random_engine() % 4);
+            small[i] = uint8_t(random_engine());
+        }
+        check_round_trip(times, str("times ", length));
+        check_round_trip(rtts, str("rtts ", length));
+        check_round_trip(noise, str("noise ", length));
+        check_round_trip(counters, str("counters ", length));
+        check_round_trip(random_words, str("random_words ", length));
+        check_round_trip(addrs, str("addrs ", length));
+        check_round_trip(small, str("small ", length));
+        check_round_trip(std::vector<int64_t>(length, -5), str("constant ", length));
+    }
+
+    // each codec gets picked for the data it suits
+    auto codec_of = [](std::vector<uint64_t> const &words, bool floating_point) { return int(flat_packed_encode_block(words, 8, floating_point)[0]); };
+    std::vector<uint64_t> addrs(1024), steady(1024), accelerating(1024), wide(1024), repeated(1024, std::bit_cast<uint64_t>(0.25));
+    for (size_t i = 0; 1024 > i; ++i) {
+        addrs[i] = 0x0a000000 + random_engine() % 16;
+        steady[i] = 1'000'000'000 + 60 * i;
+        accelerating[i] = 1'000'000'000 + 60 * i + 3 * i * i;
+        wide[i] = random_engine();
+        if (!(i % 16)) { repeated[i] = std::bit_cast<uint64_t>(0.5); }
+    }
+    rebootping_test_check(codec_of(addrs, false), ==, int(flat_packed_codec::packed_frame));
+    rebootping_test_check(codec_of(steady, false), ==, int(flat_packed_codec::packed_delta));
+    rebootping_test_check(flat_packed_encode_block(steady, 8, false).size(), <, 32);
+    rebootping_test_check(codec_of(accelerating, false), ==, int(flat_packed_codec::packed_delta_of_delta));
+    rebootping_test_check(codec_of(wide, false), ==, int(flat_packed_codec::packed_raw));
+    rebootping_test_check(codec_of(repeated, true), ==, int(flat_packed_codec::packed_xor));
+}
+
+TEST(flat_packed_column_suite, sealed_timeshards_shrink_and_read_back) {
+    tmpdir tmpdir;
+    const double day = 24 * 60 * 60, start = 40 * day;
+    const uint64_t per_day = 20000;
+    auto add = [&](packed_test_record &records, uint64_t i) {
+        double unixtime = start + double(i) * day / per_day;
+        records.add_flat_record(unixtime, [&](auto &&record) {
+            record.packed_unixtime() = unixtime;
+            record.packed_seconds() = i % 10 ? 0.0005 * double(i % 97) : std::nan("");
+            record.packed_addr() = 0x0a000000 | uint32_t(i % 5);
+            record.packed_small() = uint8_t(i);
+            record.packed_counter() = -int64_t(i);
+            record.packed_interface() = i % 3 ? "eth0" : "wlan0";
+            record.packed_note() = str("note ", i % 11);
+            record.flat_iterator_timeshard->packed_addr_index.index_linked_field_add(record.packed_addr(), record);
+        });
+    };
+    auto check = [&](packed_test_record const &records, uint64_t count) {
+        uint64_t i = 0;
+        for (auto &&record : records.timeshard_query()) {
+            rebootping_test_check(record.packed_unixtime(), ==, start + double(i) * day / per_day);
+            rebootping_test_check(std::isnan(record.packed_seconds()) ? -1 : record.packed_seconds(), ==, i % 10 ? 0.0005 * double(i % 97) : -1);
+            rebootping_test_check(record.packed_addr(), ==, 0x0a000000 | uint32_t(i % 5));
+            rebootping_test_check(int(record.packed_small()), ==, int(uint8_t(i)));
+            rebootping_test_check(record.packed_counter(), ==, -int64_t(i));
+            rebootping_test_check(record.packed_interface(), ==, i % 3 ? "eth0" : "wlan0");
+            rebootping_test_check(record.packed_note(), ==, str("note ", i % 11));
+            ++i;
+        }
+        rebootping_test_check(i, ==, count);
+    };
+
+    auto raw_bytes = [&] { return directory_bytes(tmpdir.tmpdir_name, ".flatshard"); };
+    {
+        packed_test_record records(tmpdir.tmpdir_name);
+        for (uint64_t i = 0; 3 * per_day > i; ++i) { add(records, i); }
+        auto unpacked = raw_bytes();
+        records.seal_timeshards_before(start + 2 * day);
+        rebootping_test_check(raw_bytes() * 2, <, unpacked);
+        // two of the three days are sealed, and pack into less than a third of their raw size
+        auto packed = directory_bytes(tmpdir.tmpdir_name, ".flatpacked");
+        rebootping_test_check(packed * 3, <, unpacked * 2 / 3, " packed ", packed, " unpacked ", unpacked);
+        check(records, 3 * per_day);
+
+        // linked index walks cross packed link columns
+        uint64_t found = 0;
+        for (auto &&record : records.packed_addr_index(0x0a000002u)) {
+            rebootping_test_check(record.packed_addr(), ==, 0x0a000002u);
+            ++found;
+        }
+        rebootping_test_check(found, ==, 3 * per_day / 5);
+
+        using schema = packed_test_record::flat_record_schema_type;
+        uint64_t rows = 0;
+        for (auto &&chunk : records.timeshard_column_chunks<schema::packed_unixtime, schema::packed_interface>()) {
+            auto &&[times, interfaces] = chunk.chunk_columns;
+            rebootping_test_check(times.size(), ==, chunk.chunk_rows);
+            rebootping_test_check(times.front(), ==, start + double(rows) * day / per_day);
+            rows += chunk.chunk_rows;
+        }
+        rebootping_test_check(rows, ==, 3 * per_day);
+    }
+    {
+        packed_test_record readonly(tmpdir.tmpdir_name, flat_mmap_settings{.mmap_readonly = true});
+        check(readonly, 3 * per_day);
+    }
+    {
+        // a late record unpacks its timeshard again, and the next seal packs it with the record
+        packed_test_record records(tmpdir.tmpdir_name);
+        check(records, 3 * per_day);
+        auto packed_files = directory_bytes(tmpdir.tmpdir_name, ".flatpacked");
+        records.add_flat_record(start + day - 1, [&](auto &&record) {
+            record.packed_unixtime() = start + day - 1;
+            record.packed_counter() = 7;
+        });
+        rebootping_test_check(directory_bytes(tmpdir.tmpdir_name, ".flatpacked"), <, packed_files);
+        auto late = records.unixtime_to_timeshard(start)->timeshard_iterator_at(per_day);
+        rebootping_test_check(late.packed_counter(), ==, 7);
+        rebootping_test_check(late.flat_iterator_timeshard->timeshard_iterator_at(per_day - 1).packed_counter(), ==, -int64_t(per_day - 1));
+        records.seal_timeshards_before(start + 2 * day);
+    }
+    {
+        packed_test_record records(tmpdir.tmpdir_name);
+        auto late = records.unixtime_to_timeshard(start)->timeshard_iterator_at(per_day);
+        rebootping_test_check(late.packed_counter(), ==, 7);
+        rebootping_test_check(late.packed_unixtime(), ==, start + day - 1);
+        rebootping_test_check(records.unixtime_to_timeshard(start)->packed_counter.field_packed != nullptr, ==, true);
+    }
+}
+
+TEST(flat_packed_column_suite, rows_changed_after_packing_are_kept) {
+    tmpdir tmpdir;
+    const double day = 24 * 60 * 60, start = 40 * day;
+    const uint64_t rows = 3000;
+    {
+        packed_test_record records(tmpdir.tmpdir_name);
+        for (uint64_t i = 0; rows > i; ++i) {
+            records.add_flat_record(start + double(i), [&](auto &&record) {
+                record.packed_unixtime() = start + double(i);
+                record.packed_seconds() = std::nan("");
+                record.packed_counter() = int64_t(i);
+            });
+        }
+        records.seal_timeshards_before(start + day);
+        auto *timeshard = records.unixtime_to_timeshard(start);
+        rebootping_test_check(timeshard->packed_seconds.field_packed != nullptr, ==, true);
+
+        // a late reply, told to the dirtree, reaches the .flatshard file at once
+        auto replied = timeshard->timeshard_iterator_at(10);
+        replied.packed_seconds() = 0.25;
+        records.flat_record_updated(replied);
+        rebootping_test_check(timeshard->packed_seconds.field_packed == nullptr, ==, true);
+        rebootping_test_check(timeshard->timeshard_iterator_at(10).packed_seconds(), ==, 0.25);
+        // columns that did not change stay packed
+        rebootping_test_check(timeshard->packed_unixtime.field_packed != nullptr, ==, true);
+
+        // a change the dirtree was not told of is still written back when the timeshard is sealed
+        timeshard->timeshard_iterator_at(rows - 1).packed_counter() = -1;
+        records.seal_timeshards_before(start + day);
+        rebootping_test_check(timeshard->packed_counter.field_packed != nullptr, ==, true);
+        rebootping_test_check(timeshard->timeshard_iterator_at(rows - 1).packed_counter(), ==, -1);
+
+        // or when it is closed
+        timeshard->timeshard_iterator_at(0).packed_counter() = -2;
+    }
+    packed_test_record records(tmpdir.tmpdir_name);
+    auto *timeshard = records.unixtime_to_timeshard(start);
+    rebootping_test_check(timeshard->timeshard_iterator_at(10).packed_seconds(), ==, 0.25);
+    rebootping_test_check(timeshard->timeshard_iterator_at(rows - 1).packed_counter(), ==, -1);
+    rebootping_test_check(timeshard->timeshard_iterator_at(0).packed_counter(), ==, -2);
+    rebootping_test_check(timeshard->timeshard_iterator_at(1).packed_counter(), ==, 1);
+}
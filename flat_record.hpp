@@ -48,11 +48,14 @@ template <typename holder> inline std::string flat_record_schema_as_json() {
     }                                                                                                                                                          \
     inline decltype(auto) name() const { return flat_iterator_timeshard->name[flat_iterator_index]; }
 #define flat_timeshard_ensure_field_mmapped_statement(kind, name) name.flat_timeshard_ensure_field_mmapped(len);
+#define flat_timeshard_field_seal_statement(kind, name) name.flat_timeshard_field_seal();
+#define flat_timeshard_field_write_back_statement(kind, name) name.flat_timeshard_field_write_back();
 #define flat_timeshard_field_schema_declaration(kind, name)                                                                                                    \
     struct name : flat_timeshard_field_schema<kind> {                                                                                                          \
         constexpr char const *flat_field_name() { return #name; }                                                                                              \
         constexpr char const *flat_field_type_string() { return #kind; }                                                                                       \
         template <typename holder_type> decltype(auto) flat_field_value(holder_type &&holder) { return holder.name(); };                                       \
+        template <typename timeshard_type> static decltype(auto) flat_field_of(timeshard_type &timeshard) { return (timeshard.name); }                         \
     };
 
 #define flat_timeshard_field_schema_name(kind, name) name
@@ -93,9 +96,20 @@ template <typename holder> inline std::string flat_record_schema_as_json() {
             flat_timeshard_##record_name &flat_timeshard_ensure_mmapped(uint64_t len) {                                                                        \
             evaluate_for_each(flat_timeshard_ensure_field_mmapped_statement, __VA_ARGS__) return *this;                                                        \
         }                                                                                                                                                      \
+        void flat_timeshard_seal() {                                                                                                                           \
+            timeshard_seal_main();                                                                                                                             \
+            evaluate_for_each(flat_timeshard_field_seal_statement, __VA_ARGS__)                                                                                \
+        }                                                                                                                                                      \
+        void flat_timeshard_write_back() { evaluate_for_each(flat_timeshard_field_write_back_statement, __VA_ARGS__) }                                         \
                                                                                                                                                                \
         inline flat_timeshard_##record_name(std::string_view timeshard_name, std::string const &dir, flat_mmap_settings const &settings)                       \
-            : flat_timeshard(timeshard_name, dir, settings) evaluate_for_each(flat_timeshard_field_constructor, __VA_ARGS__) {}                                \
+            : flat_timeshard(timeshard_name, dir, settings) evaluate_for_each(flat_timeshard_field_constructor, __VA_ARGS__) {                                 \
+            timeshard_durability_attach();                                                                                                                     \
+        }                                                                                                                                                      \
+        ~flat_timeshard_##record_name() {                                                                                                                      \
+            flat_timeshard_write_back();                                                                                                                       \
+            timeshard_durability_detach();                                                                                                                     \
+        }                                                                                                                                                      \
         flat_timeshard_iterator_##record_name timeshard_iterator_at(uint64_t index);                                                                           \
         flat_timeshard_const_iterator_##record_name timeshard_iterator_at(uint64_t index) const;                                                               \
     };                                                                                                                                                         \
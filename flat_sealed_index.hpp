@@ -0,0 +1,150 @@
+#pragma once
+
+#include "cmake_variables.hpp"
+#include "flat_env.hpp"
+#include "flat_hash.hpp"
+#include "flat_mmap.hpp"
+#include "now_unixtime.hpp"
+#include "str.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <utility>
+#include <vector>
+
+struct flat_sealed_index_header {
+    uint64_t flat_sealed_magic = 0x666c61747365616c;
+    uint64_t flat_sealed_version = 202610170000;
+    double flat_sealed_git_unixtime = flat_git_unixtime;
+    uint8_t flat_sealed_git_sha_string_array[128] = flat_git_sha_string;
+    double flat_sealed_create_unixtime = now_unixtime();
+
+    uint64_t flat_sealed_entry_size = 0;
+    uint64_t flat_sealed_entry_count = 0;
+    uint64_t flat_sealed_bucket_bits = 0;
+};
+
+template <typename key_type, typename value_type> struct flat_sealed_index_entry {
+    uint64_t sealed_hash;
+    key_type sealed_key;
+    value_type sealed_value;
+};
+
+// Read-only replacement for a flat_hash that is not going to be written again. Entries are sorted by hash
+// and a directory records where each run of entries sharing the top flat_sealed_bucket_bits of their hash
+// starts, with about four entries per run. A lookup reads one directory slot and then the run itself,
+// where flat_hash could probe a sparse page on every level.
+template <typename key_type, typename value_type, typename hash_function = flat_hash_function_class,
+          typename compare_function = flat_hash_compare_function_class>
+struct flat_sealed_index : hash_function {
+    using entry_type = flat_sealed_index_entry<key_type, value_type>;
+    using bucket_type = uint32_t;
+
+    flat_mmap sealed_mmap;
+    [[no_unique_address]] compare_function sealed_compare_function;
+
+    explicit flat_sealed_index(std::string filename, compare_function passed_compare_function = compare_function())
+        : sealed_mmap(std::move(filename), flat_mmap_settings{.mmap_readonly = true}), sealed_compare_function(passed_compare_function) {
+        flat_sealed_index_header highest_supported_version;
+        if (sealed_mmap.mmap_allocated_len() < sizeof(flat_sealed_index_header) ||
+            highest_supported_version.flat_sealed_magic != sealed_header().flat_sealed_magic) {
+            throw std::runtime_error(str("flat_sealed_magic does not match in ", sealed_mmap.flat_mmap_filename()));
+        }
+        if (sealed_header().flat_sealed_version > highest_supported_version.flat_sealed_version) {
+            throw std::runtime_error(str("flat_sealed_version too new: ", sealed_mmap.flat_mmap_filename(), " at ", sealed_header().flat_sealed_version, ">",
+                                         highest_supported_version.flat_sealed_version));
+        }
+        if (sealed_header().flat_sealed_entry_size != sizeof(entry_type) ||
+            sealed_entries_offset(sealed_header()) + sealed_header().flat_sealed_entry_count * sizeof(entry_type) > sealed_mmap.mmap_allocated_len()) {
+            throw std::runtime_error(str("flat_sealed_index does not fit its entries: ", sealed_mmap.flat_mmap_filename()));
+        }
+    }
+
+    [[nodiscard]] flat_sealed_index_header const &sealed_header() const { return sealed_mmap.mmap_cast<flat_sealed_index_header>(0); }
+
+    static uint64_t sealed_bucket_count(flat_sealed_index_header const &header) { return (uint64_t{1} << header.flat_sealed_bucket_bits) + 1; }
+    static uint64_t sealed_entries_offset(flat_sealed_index_header const &header) {
+        auto end_of_buckets = sizeof(flat_sealed_index_header) + sealed_bucket_count(header) * sizeof(bucket_type);
+        return (end_of_buckets + alignof(entry_type) - 1) / alignof(entry_type) * alignof(entry_type);
+    }
+    static uint64_t sealed_bucket_of(flat_sealed_index_header const &header, uint64_t hash) {
+        return header.flat_sealed_bucket_bits ? hash >> (64 - header.flat_sealed_bucket_bits) : 0;
+    }
+
+    template <typename input_key> value_type *sealed_find_key(input_key &&ik) const {
+        auto mk = flat_hash_prepare_key_maybe<key_type>(sealed_compare_function, ik);
+        if (!mk) { return nullptr; }
+        auto k = *mk;
+        auto hash = (*this)(k);
+        auto const &header = sealed_header();
+        auto bucket = sealed_bucket_of(header, hash);
+        auto *buckets = &sealed_mmap.mmap_cast<bucket_type>(sizeof(flat_sealed_index_header), sealed_bucket_count(header));
+        auto *entries = &sealed_mmap.mmap_cast<entry_type>(sealed_entries_offset(header), header.flat_sealed_entry_count);
+        for (auto i = buckets[bucket]; i < buckets[bucket + 1] && entries[i].sealed_hash <= hash; ++i) {
+            if (entries[i].sealed_hash == hash && flat_hash_compare(sealed_compare_function, entries[i].sealed_key, k)) { return &entries[i].sealed_value; }
+        }
+        return nullptr;
+    }
+
+    template <typename walker_type> void sealed_walk(walker_type &&walker) const {
+        auto const &header = sealed_header();
+        for (uint64_t i = 0; header.flat_sealed_entry_count > i; ++i) {
+            auto &entry = sealed_mmap.mmap_cast<entry_type>(sealed_entries_offset(header) + i * sizeof(entry_type));
+            walker(entry.sealed_key, entry.sealed_value);
+        }
+    }
+
+    // Writes entries to filename through a temporary file that is renamed into place. When a key appears
+    // more than once the earliest entry is kept, so callers list newer entries first.
+    static void sealed_write(std::string const &filename, std::vector<std::pair<key_type, value_type>> const &entries,
+                             compare_function const &compare = compare_function(), hash_function const &hasher = hash_function()) {
+        std::vector<entry_type> sorted;
+        sorted.reserve(entries.size());
+        for (auto &&[k, v] : entries) { sorted.push_back(entry_type{hasher(k), k, v}); }
+        std::stable_sort(sorted.begin(), sorted.end(), [](entry_type const &a, entry_type const &b) { return a.sealed_hash < b.sealed_hash; });
+
+        std::vector<entry_type> unique;
+        unique.reserve(sorted.size());
+        for (size_t i = 0; sorted.size() > i;) {
+            auto run_start = unique.size();
+            for (auto hash = sorted[i].sealed_hash; sorted.size() > i && sorted[i].sealed_hash == hash; ++i) {
+                bool seen = false;
+                for (auto j = run_start; unique.size() > j && !seen; ++j) { seen = flat_hash_compare(compare, unique[j].sealed_key, sorted[i].sealed_key); }
+                if (!seen) { unique.push_back(sorted[i]); }
+            }
+        }
+        if (unique.size() >= std::numeric_limits<bucket_type>::max()) {
+            throw std::runtime_error(str("flat_sealed_index too many entries for ", filename, ": ", unique.size()));
+        }
+
+        flat_sealed_index_header header;
+        header.flat_sealed_entry_size = sizeof(entry_type);
+        header.flat_sealed_entry_count = unique.size();
+        header.flat_sealed_bucket_bits = unique.size() > 4 ? std::bit_width((unique.size() - 1) / 4) : 0;
+
+        auto temporary = filename + ".tmp";
+        std::filesystem::remove(temporary);
+        {
+            flat_mmap out(temporary);
+            out.mmap_allocate_at_least(sealed_entries_offset(header) + unique.size() * sizeof(entry_type));
+            out.mmap_cast<flat_sealed_index_header>(0) = header;
+            auto *buckets = &out.mmap_cast<bucket_type>(sizeof(flat_sealed_index_header), sealed_bucket_count(header));
+            uint64_t i = 0;
+            for (uint64_t bucket = 0; sealed_bucket_count(header) > bucket; ++bucket) {
+                while (unique.size() > i && bucket > sealed_bucket_of(header, unique[i].sealed_hash)) { ++i; }
+                buckets[bucket] = i;
+            }
+            if (!unique.empty()) {
+                std::memcpy(&out.mmap_cast<entry_type>(sealed_entries_offset(header), unique.size()), unique.data(), unique.size() * sizeof(entry_type));
+            }
+            // the hash it replaces is cleared once this is in place, so whatever flat_durability asks of rows, this must be on
+            // the disk before the rename is
+            out.mmap_sync_data();
+        }
+        std::filesystem::rename(temporary, filename);
+        flat_mmap_sync_directory(std::filesystem::path(filename).parent_path());
+    }
+};
@@ -2,12 +2,22 @@
 
 #include "cmake_variables.hpp"
 #include "flat_dirtree.hpp"
+#include "flat_env.hpp"
+#include "flat_flusher.hpp"
 #include "flat_hash.hpp"
 #include "flat_macro.hpp"
 #include "flat_mmap.hpp"
+#include "flat_packed_column.hpp"
 #include "now_unixtime.hpp"
 #include "str.hpp"
 
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <vector>
+
 struct flat_timeshard_header {
     uint64_t flat_timeshard_magic = 0x666c61746d6d6170;
     uint64_t flat_timeshard_version = 202111140000;
@@ -17,7 +27,17 @@ struct flat_timeshard_header {
 
     uint64_t flat_timeshard_index_next = 0;
     uint64_t flat_timeshard_bytes_start_next = sizeof(flat_timeshard_header);
-    // TODO: allow all fields to have min/max and monotonic flag
+    // per-field min/max live in the dirtree's flat_timeshard_manifest
+    // TODO: allow all fields to have a monotonic flag
+};
+
+// flat_timeshard_durable.flatmap, kept in flat_durability_mode group_commit. Every file of the timeshard was
+// synced up to the rows before flat_durable_index_next before it was written, so a timeshard reopened after a
+// crash drops the rows after it rather than expose ones whose fields never reached the disk.
+struct flat_timeshard_durable_header {
+    uint64_t flat_durable_magic = 0x666c617464757261;
+    uint64_t flat_durable_version = 202610171200;
+    uint64_t flat_durable_index_next = 0;
 };
 
 struct flat_bytes_offset_tag {
@@ -34,6 +54,7 @@ template <typename mmap_field, typename offset_type> struct flat_bytes_ptr {
     offset_type flat_bytes_offset;
     using length_type = decltype(flat_field.smap_string_length(0));
 
+    // the view stays good while the timeshard is open, as strings are never moved within their reserved mapping
     [[nodiscard]] inline operator std::string_view() const {
         auto offset = flat_bytes_offset.bytes_offset;
         if (!offset) { return std::string_view(""); }
@@ -83,59 +104,144 @@ template <typename mmap, typename offset> inline std::ostream &operator<<(std::o
     return os << (std::string_view)fbs;
 }
 
+// Interned strings are appended to the main mmap after the header. flat_timeshard_interned.flathash maps a
+// hash of each string's bytes to its offset, so opening a timeshard reads nothing but the strings added since
+// the hash was last brought up to date, and interning allocates nothing on the heap.
 struct flat_timeshard {
     std::string flat_timeshard_name;
+    double flat_timeshard_start_unixtime;
+    std::optional<uint64_t> flat_timeshard_manifest_slot;
     flat_mmap flat_timeshard_main_mmap;
-    std::unordered_map<std::string_view, uint64_t> interned_strings;
-    char *interned_strings_base;
+    // Absent only when a readonly timeshard was written before the hash existed. Keys are
+    // timeshard_interned_key of the string's hash and a probe count, for the strings whose hashes collide;
+    // key 0 holds the offset up to which the strings of the main mmap have been added.
+    std::optional<flat_hash<uint64_t, uint64_t>> interned_strings_index;
+    // Strings from here on are looked for by walking them. A readonly timeshard only maps the hash as it was
+    // when opened, so this stays where the hash ended then even while a writer in another process adds more.
+    uint64_t interned_strings_unindexed = sizeof(flat_timeshard_header);
+    // every file written with the records, for timeshard_flush; fields add theirs as they open
+    std::vector<flat_mmap const *> timeshard_synced_mmaps;
+    // present only while writing in flat_durability_mode group_commit
+    std::optional<flat_mmap> timeshard_durable_mmap;
 
     flat_timeshard(std::string_view timeshard_name, std::string_view dir, flat_mmap_settings const &settings)
-        : flat_timeshard_name(timeshard_name), flat_timeshard_main_mmap(std::string{dir} + "/flat_timeshard_main.flatmap", settings) {
+        : flat_timeshard_name(timeshard_name), flat_timeshard_start_unixtime(timeshard_name_to_unixtime(timeshard_name)),
+          flat_timeshard_main_mmap(std::string{dir} + "/flat_timeshard_main.flatmap", settings) {
         if (!flat_timeshard_main_mmap.mmap_allocated_len()) {
             flat_timeshard_main_mmap.mmap_allocate_at_least(sizeof(timeshard_header_ref()));
             timeshard_header_ref() = flat_timeshard_header();
         }
+        timeshard_check_header(timeshard_header_ref(), dir);
+        auto durable_filename = std::string{dir} + "/flat_timeshard_durable.flatmap";
+        if (!settings.mmap_readonly && flat_durability_group_commit()) {
+            timeshard_open_durable(durable_filename);
+        } else if (!settings.mmap_readonly) {
+            // rows written now are not covered by the durable commit, so a later group commit run must not drop them
+            std::filesystem::remove(durable_filename);
+        }
+        timeshard_synced_mmaps.push_back(&flat_timeshard_main_mmap);
+        auto index_filename = std::string{dir} + "/flat_timeshard_interned.flathash";
+        if (!settings.mmap_readonly || std::filesystem::exists(index_filename)) {
+            interned_strings_index.emplace(index_filename, settings);
+            timeshard_synced_mmaps.push_back(&interned_strings_index->hash_mmap);
+        }
+        interned_strings_unindexed = timeshard_interned_indexed_next();
+        if (!settings.mmap_readonly) { timeshard_index_interned_strings(); }
+    }
+    flat_timeshard(flat_timeshard const &) = delete;
+    flat_timeshard &operator=(flat_timeshard const &) = delete;
+
+    static void timeshard_check_header(flat_timeshard_header const &header, std::string_view dir) {
         flat_timeshard_header highest_supported_version;
         flat_timeshard_header &lowest_supported_version = highest_supported_version;
-        if (highest_supported_version.flat_timeshard_magic != timeshard_header_ref().flat_timeshard_magic) {
-            throw std::runtime_error(
-                str("flat_timeshard_magic does not match in timeshard: dir ", dir, " magic ", timeshard_header_ref().flat_timeshard_magic));
+        if (highest_supported_version.flat_timeshard_magic != header.flat_timeshard_magic) {
+            throw std::runtime_error(str("flat_timeshard_magic does not match in timeshard: dir ", dir, " magic ", header.flat_timeshard_magic));
         }
-        if (timeshard_header_ref().flat_timeshard_version > highest_supported_version.flat_timeshard_version) {
-            throw std::runtime_error(str("flat_timeshard_version too new: dir ", dir, " at ", timeshard_header_ref().flat_timeshard_version, ">",
+        if (header.flat_timeshard_version > highest_supported_version.flat_timeshard_version) {
+            throw std::runtime_error(str("flat_timeshard_version too new: dir ", dir, " at ", header.flat_timeshard_version, ">",
                                          highest_supported_version.flat_timeshard_version));
         }
-        if (timeshard_header_ref().flat_timeshard_version < lowest_supported_version.flat_timeshard_version) {
-            throw std::runtime_error(str("flat_timeshard_version too old: dir ", dir, " at ", timeshard_header_ref().flat_timeshard_version, "<",
+        if (header.flat_timeshard_version < lowest_supported_version.flat_timeshard_version) {
+            throw std::runtime_error(str("flat_timeshard_version too old: dir ", dir, " at ", header.flat_timeshard_version, "<",
                                          lowest_supported_version.flat_timeshard_version));
         }
-        timeshard_reload_interned_strings();
     }
-    flat_timeshard(flat_timeshard const &) = delete;
-    flat_timeshard &operator=(flat_timeshard const &) = delete;
+
+    // Checks the header of a timeshard on disk by reading it, without opening or mapping the timeshard,
+    // so that a store can reject a timeshard it cannot read while leaving it closed.
+    static void timeshard_check_header_file(std::string_view dir) {
+        auto filename = std::string{dir} + "/flat_timeshard_main.flatmap";
+        std::ifstream in(filename, std::ios::binary);
+        if (!in) { return; }
+        flat_timeshard_header header;
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) { return; }
+        timeshard_check_header(header, dir);
+    }
 
     inline flat_timeshard_header &timeshard_header_ref() { return flat_timeshard_main_mmap.mmap_cast<flat_timeshard_header>(0); }
     inline flat_timeshard_header const &timeshard_header_ref() const { return flat_timeshard_main_mmap.mmap_cast<flat_timeshard_header>(0); }
 
+    // gives back the capacity reserved past the interned strings, once no more are expected
+    void timeshard_seal_main() { flat_timeshard_main_mmap.mmap_trim_to(timeshard_header_ref().flat_timeshard_bytes_start_next); }
+
+    // The release store orders every field write of the row before the new index_next, so a reader that
+    // loads index_next with acquire semantics never sees a half written row.
     void timeshard_commit_index(uint64_t index) {
-        if (timeshard_header_ref().flat_timeshard_index_next != index) {
+        if (flat_timeshard_index_next() != index) {
             throw std::runtime_error(str("timeshard_commit_index index out of order: flat_timeshard_name ", flat_timeshard_name, " index ", index,
-                                         " flat_timeshard_index_next ", timeshard_header_ref().flat_timeshard_index_next));
+                                         " flat_timeshard_index_next ", flat_timeshard_index_next()));
         }
-        timeshard_header_ref().flat_timeshard_index_next = index + 1;
+        __atomic_store_n(&timeshard_header_ref().flat_timeshard_index_next, index + 1, __ATOMIC_RELEASE);
     }
 
-    uint64_t flat_timeshard_index_next() const { return timeshard_header_ref().flat_timeshard_index_next; }
+    uint64_t flat_timeshard_index_next() const { return __atomic_load_n(&timeshard_header_ref().flat_timeshard_index_next, __ATOMIC_ACQUIRE); }
+
+    // Makes the records committed so far durable: syncs every file of the timeshard, and only then moves
+    // flat_durable_index_next past them and syncs that. Called by flat_flusher, and by the timeshard as it closes.
+    void timeshard_flush() {
+        auto rows = flat_timeshard_index_next();
+        auto &durable = timeshard_durable_mmap->mmap_cast<flat_timeshard_durable_header>(0);
+        if (rows == durable.flat_durable_index_next) { return; }
+        for (auto *synced : timeshard_synced_mmaps) { synced->mmap_sync_data(); }
+        flat_flusher_count_commit(rows - durable.flat_durable_index_next);
+        durable.flat_durable_index_next = rows;
+        timeshard_durable_mmap->mmap_sync_data();
+    }
 
-    inline char *smap_string_ptr(uint64_t offset, uint64_t size) {
+    // the record's timeshard calls these once all its fields are open, and before any of them close
+    void timeshard_durability_attach() {
+        if (timeshard_durable_mmap) { flat_flusher_attach(*this); }
+    }
+    void timeshard_durability_detach() {
+        if (!timeshard_durable_mmap) { return; }
+        flat_flusher_detach(*this);
+        try {
+            timeshard_flush();
+        } catch (std::exception const &e) {
+            std::cerr << "flat_timeshard " << flat_timeshard_name << " not flushed when closed: " << e.what() << std::endl;
+        }
+    }
+
+    inline char *smap_string_ptr(uint64_t offset, uint64_t size) const {
         return &flat_timeshard_main_mmap.mmap_cast<char>(offset + sizeof(smap_string_length(offset)), size);
     }
-    inline uint64_t &smap_string_length(uint64_t offset) { return flat_timeshard_main_mmap.mmap_cast<uint64_t>(offset); }
+    inline uint64_t &smap_string_length(uint64_t offset) const { return flat_timeshard_main_mmap.mmap_cast<uint64_t>(offset); }
 
-    std::optional<flat_bytes_interned_tag> timeshard_lookup_interned_string(std::string_view s) {
+    std::optional<flat_bytes_interned_tag> timeshard_lookup_interned_string(std::string_view s) const {
         if (s.empty()) { return flat_bytes_interned_tag{0}; }
-        auto i = interned_strings.find(s);
-        if (i != interned_strings.end()) { return flat_bytes_interned_tag{i->second}; }
+        auto hash = flat_hash_bytes(s);
+        if (interned_strings_index) {
+            for (uint64_t probe = 0;; ++probe) {
+                auto offset = interned_strings_index->hash_find_key(timeshard_interned_key(hash, probe));
+                if (!offset) { break; }
+                if (timeshard_interned_string_at(*offset) == s) { return flat_bytes_interned_tag{*offset}; }
+            }
+        }
+        // a readonly mapping does not grow, so strings appended past it cannot be found, like rows past its fields' mappings
+        auto end = std::min(timeshard_header_ref().flat_timeshard_bytes_start_next, flat_timeshard_main_mmap.mmap_allocated_len());
+        for (auto offset = interned_strings_unindexed; offset < end; offset = timeshard_interned_string_after(offset)) {
+            if (timeshard_interned_string_at(offset) == s) { return flat_bytes_interned_tag{offset}; }
+        }
         return std::nullopt;
     }
 
@@ -151,29 +257,74 @@ struct flat_timeshard {
         p[s.size()] = 0;
         timeshard_allocate_bytes_finish(alloc_bytes);
 
-        interned_strings[(std::string_view)flat_bytes_ptr<flat_timeshard, flat_bytes_interned_tag>{*this, flat_bytes_interned_tag{offset}}] = offset;
+        timeshard_index_interned_strings();
         return flat_bytes_interned_tag{offset};
     }
 
   private:
-    void timeshard_reload_interned_strings() {
-        interned_strings.clear();
-        interned_strings_base = &flat_timeshard_main_mmap.mmap_cast<char>(0);
-        uint64_t offset = sizeof(flat_timeshard_header);
-        while (offset < timeshard_header_ref().flat_timeshard_bytes_start_next) {
-            auto s = (std::string_view)flat_bytes_ptr<flat_timeshard, flat_bytes_interned_tag>{*this, flat_bytes_interned_tag{offset}};
-            interned_strings[s] = offset;
-            offset += s.size() + 1 + sizeof(smap_string_length(offset));
+    void timeshard_open_durable(std::string const &filename) {
+        timeshard_durable_mmap.emplace(filename);
+        timeshard_durable_mmap->mmap_allocate_at_least(sizeof(flat_timeshard_durable_header));
+        auto &durable = timeshard_durable_mmap->mmap_cast<flat_timeshard_durable_header>(0);
+        flat_timeshard_durable_header highest_supported_version;
+        if (durable.flat_durable_magic != highest_supported_version.flat_durable_magic) {
+            // new, or created but never flushed: the rows written before durability was kept are taken as they are
+            durable = highest_supported_version;
+            durable.flat_durable_index_next = flat_timeshard_index_next();
+            return;
+        }
+        if (durable.flat_durable_version > highest_supported_version.flat_durable_version) {
+            throw std::runtime_error(
+                str("flat_durable_version too new: ", filename, " at ", durable.flat_durable_version, ">", highest_supported_version.flat_durable_version));
+        }
+        auto rows = flat_timeshard_index_next();
+        if (rows > durable.flat_durable_index_next) {
+            std::cerr << "flat_timeshard " << flat_timeshard_name << " dropping " << rows - durable.flat_durable_index_next
+                      << " records committed after its last group commit" << std::endl;
+            flat_flusher_count_dropped(rows - durable.flat_durable_index_next);
+            timeshard_header_ref().flat_timeshard_index_next = durable.flat_durable_index_next;
         }
     }
+
+    static uint64_t timeshard_interned_key(uint64_t hash, uint64_t probe) { return std::max<uint64_t>(flat_hash_mix(hash + probe), 1); }
+
+    std::string_view timeshard_interned_string_at(uint64_t offset) const {
+        auto size = smap_string_length(offset);
+        return std::string_view(smap_string_ptr(offset, size), size);
+    }
+    uint64_t timeshard_interned_string_after(uint64_t offset) const { return offset + sizeof(smap_string_length(offset)) + smap_string_length(offset) + 1; }
+
+    uint64_t timeshard_interned_indexed_next() const {
+        auto *indexed = interned_strings_index ? interned_strings_index->hash_find_key(uint64_t{0}) : nullptr;
+        return indexed ? *indexed : sizeof(flat_timeshard_header);
+    }
+
+    // adds the strings that are not yet in interned_strings_index, which is all of them in a timeshard
+    // written before it existed
+    void timeshard_index_interned_strings() {
+        auto end = timeshard_header_ref().flat_timeshard_bytes_start_next;
+        auto offset = timeshard_interned_indexed_next();
+        if (offset >= end) { return; }
+        for (; offset < end; offset = timeshard_interned_string_after(offset)) {
+            auto s = timeshard_interned_string_at(offset);
+            auto hash = flat_hash_bytes(s);
+            for (uint64_t probe = 0;; ++probe) {
+                auto &indexed = interned_strings_index->hash_add_key(timeshard_interned_key(hash, probe));
+                if (!indexed) { indexed = offset; }
+                if (timeshard_interned_string_at(indexed) == s) { break; }
+            }
+        }
+        interned_strings_index->hash_add_key(uint64_t{0}) = end;
+        interned_strings_unindexed = end;
+    }
+
     uint64_t timeshard_allocate_bytes_prepare(uint64_t count) {
         auto cur = timeshard_header_ref().flat_timeshard_bytes_start_next;
         assert(cur >= sizeof(flat_timeshard_header));
         assert(cur <= flat_timeshard_main_mmap.mmap_allocated_len());
         auto new_start = cur + count;
         assert(new_start >= cur);
-        flat_timeshard_main_mmap.mmap_allocate_at_least(new_start);
-        if (interned_strings_base != &flat_timeshard_main_mmap.mmap_cast<char>(0)) { timeshard_reload_interned_strings(); }
+        flat_timeshard_main_mmap.mmap_reserve_at_least(new_start);
         return cur;
     }
     void timeshard_allocate_bytes_finish(uint64_t count) { timeshard_header_ref().flat_timeshard_bytes_start_next += count; }
@@ -190,20 +341,90 @@ template <typename... field_schemas> struct flat_timeshard_schema {
     std::tuple<field_schemas...> flat_schema_fields;
 };
 
+// Values are appended to the .flatshard file. When the timeshard is sealed, values that
+// flat_packed_column_supported are rewritten into a .flatpacked file and the .flatshard is truncated; a
+// record added after that first unpacks them again. Whenever the .flatpacked file exists it holds every value.
+// Rows of a packed column that are changed in place are written back by unpacking the column, when the
+// dirtree is told of the change by flat_record_updated, and at the latest when the timeshard is sealed or closed.
 template <typename field_type> struct flat_timeshard_base_field {
     flat_timeshard &field_timeshard;
     flat_mmap field_mmap;
+    std::string field_packed_filename;
+    std::unique_ptr<flat_packed_column<field_type>> field_packed;
 
     flat_timeshard_base_field(flat_timeshard &timeshard, std::string const &name, std::string const &dir, flat_mmap_settings const &settings)
-        : field_timeshard(timeshard), field_mmap(dir + "/field_" + name + ".flatshard", settings) {}
+        : field_timeshard(timeshard), field_mmap(dir + "/field_" + name + ".flatshard", settings),
+          field_packed_filename(dir + "/field_" + name + ".flatpacked") {
+        timeshard.timeshard_synced_mmaps.push_back(&field_mmap);
+        if constexpr (flat_packed_column_supported<field_type>) {
+            if (std::filesystem::exists(field_packed_filename)) {
+                field_packed = std::make_unique<flat_packed_column<field_type>>(field_packed_filename);
+                // left by a seal or unpack that was interrupted
+                if (field_mmap.mmap_allocated_len() && !settings.mmap_readonly) { field_mmap.mmap_discard(); }
+            }
+        }
+    }
+
+    void flat_timeshard_ensure_field_mmapped(uint64_t index) {
+        if (field_packed) [[unlikely]] { field_unpack(); }
+        field_mmap.mmap_reserve_at_least((index + 1) * flat_field_sizeof<field_type>());
+    }
+
+    // unpacks the column if a row decoded from it was changed, so the change reaches the .flatshard file
+    void flat_timeshard_field_write_back() {
+        if constexpr (flat_packed_column_supported<field_type>) {
+            if (field_packed && !field_mmap.mmap_readonly() && field_packed->packed_rows_changed()) { field_unpack(); }
+        }
+    }
+
+    void flat_timeshard_field_seal() {
+        flat_timeshard_field_write_back();
+        if (field_packed) { return; }
+        auto rows = field_timeshard.flat_timeshard_index_next();
+        if constexpr (flat_packed_column_supported<field_type>) {
+            if (rows && flat_env::flat_timeshard_pack_sealed()) {
+                flat_packed_column<field_type>::packed_write(field_packed_filename, field_column(rows));
+                field_packed = std::make_unique<flat_packed_column<field_type>>(field_packed_filename);
+                field_mmap.mmap_discard();
+                return;
+            }
+        }
+        field_mmap.mmap_trim_to(rows * flat_field_sizeof<field_type>());
+    }
+
+    inline field_type &field_ref(uint64_t index) const {
+        if constexpr (flat_packed_column_supported<field_type>) {
+            if (field_packed) [[unlikely]] { return field_packed->packed_ref(index); }
+        }
+        return field_mmap.template mmap_cast<field_type>(index * sizeof(field_type));
+    }
 
-    void flat_timeshard_ensure_field_mmapped(uint64_t index) { field_mmap.mmap_allocate_at_least((index + 1) * flat_field_sizeof<field_type>()); }
+    // the first count stored values as one array, valid until the timeshard is sealed or closed
+    // or the mmap outgrows its reservation
+    std::span<field_type const> field_column(uint64_t count) const {
+        if (!count) { return {}; }
+        if constexpr (flat_packed_column_supported<field_type>) {
+            if (field_packed) { return field_packed->packed_column(count); }
+        }
+        return {&field_mmap.template mmap_cast<field_type>(0, count), count};
+    }
+
+  private:
+    void field_unpack() {
+        if constexpr (flat_packed_column_supported<field_type>) {
+            auto rows = field_packed->packed_column(field_packed->packed_row_count());
+            field_mmap.mmap_allocate_at_least(rows.size_bytes());
+            if (!rows.empty()) { std::memcpy(&field_mmap.template mmap_cast<field_type>(0, rows.size()), rows.data(), rows.size_bytes()); }
+            if (field_timeshard.timeshard_durable_mmap) { field_mmap.mmap_sync_data(); }
+            field_packed.reset();
+            std::filesystem::remove(field_packed_filename);
+        }
+    }
 };
 
 template <typename field_type> struct flat_timeshard_field : flat_timeshard_base_field<field_type> {
     using flat_timeshard_base_field<field_type>::flat_timeshard_base_field;
-    using flat_timeshard_base_field<field_type>::field_mmap;
-    inline field_type &operator[](uint64_t index) const { return field_mmap.template mmap_cast<field_type>(index * sizeof(field_type)); }
+    inline field_type &operator[](uint64_t index) const { return this->field_ref(index); }
 };
 
 template <typename timeshard_type> struct flat_timeshard_iterator {
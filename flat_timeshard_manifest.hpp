@@ -0,0 +1,127 @@
+#pragma once
+
+#include "flat_mmap.hpp"
+#include "str.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+// A double that is <= v, even for 64 bit integers that a double cannot represent exactly
+template <typename value_type> inline double flat_zone_lower_bound(value_type v) {
+    auto d = static_cast<double>(v);
+    if constexpr (std::is_integral_v<value_type> && std::numeric_limits<value_type>::digits > std::numeric_limits<double>::digits) {
+        if (d >= static_cast<double>(std::numeric_limits<value_type>::max()) || static_cast<value_type>(d) > v) {
+            d = std::nextafter(d, -std::numeric_limits<double>::infinity());
+        }
+    }
+    return d;
+}
+
+// A double that is >= v
+template <typename value_type> inline double flat_zone_upper_bound(value_type v) {
+    auto d = static_cast<double>(v);
+    if constexpr (std::is_integral_v<value_type> && std::numeric_limits<value_type>::digits > std::numeric_limits<double>::digits) {
+        if (d < static_cast<double>(std::numeric_limits<value_type>::max()) && static_cast<value_type>(d) < v) {
+            d = std::nextafter(d, std::numeric_limits<double>::infinity());
+        }
+    }
+    return d;
+}
+
+// Bounds of one field over the records of one timeshard. A zone with zone_min > zone_max holds no values;
+// fields that are not numbers get an unbounded zone as soon as they hold a record. NaNs are not noticed.
+struct flat_zone_map {
+    double zone_min = std::numeric_limits<double>::infinity();
+    double zone_max = -std::numeric_limits<double>::infinity();
+
+    [[nodiscard]] bool zone_overlaps(double lo, double hi) const { return zone_min <= hi && lo <= zone_max; }
+
+    template <typename value_type> void zone_notice(value_type v) {
+        if constexpr (std::is_floating_point_v<value_type>) {
+            if (std::isnan(v)) { return; }
+        }
+        zone_min = std::min(zone_min, flat_zone_lower_bound(v));
+        zone_max = std::max(zone_max, flat_zone_upper_bound(v));
+    }
+
+    void zone_unbounded() {
+        zone_min = -std::numeric_limits<double>::infinity();
+        zone_max = std::numeric_limits<double>::infinity();
+    }
+};
+
+struct flat_timeshard_manifest_header {
+    uint64_t flat_manifest_magic = 0x666c61746d616e69;
+    uint64_t flat_manifest_version = 202610171200;
+    uint64_t flat_manifest_field_count = 0;
+    uint64_t flat_manifest_entry_count = 0;
+};
+
+template <size_t field_count> struct flat_timeshard_manifest_entry {
+    char entry_timeshard_name[24];
+    double entry_start_unixtime;
+    double entry_end_unixtime;
+    // records covered by entry_zone_maps, lags flat_timeshard_index_next until the zones are updated
+    uint64_t entry_record_count;
+    // entry_record_count when the timeshard was last sealed
+    uint64_t entry_sealed_record_count;
+    flat_zone_map entry_zone_maps[field_count];
+};
+
+// One file per record directory describing every timeshard, so that timeshards can be chosen without
+// parsing their names or reading their fields. It only holds derived data: entries that disagree with
+// their timeshard are recomputed, and a manifest with an unexpected header is started afresh.
+template <size_t field_count> struct flat_timeshard_manifest {
+    using entry_type = flat_timeshard_manifest_entry<field_count>;
+
+    flat_mmap manifest_mmap;
+    std::unordered_map<std::string, uint64_t> manifest_name_to_slot;
+
+    explicit flat_timeshard_manifest(std::string filename) : manifest_mmap(std::move(filename)) {
+        flat_timeshard_manifest_header expected;
+        expected.flat_manifest_field_count = field_count;
+        if (manifest_mmap.mmap_allocated_len() < sizeof(expected) || manifest_header_ref().flat_manifest_magic != expected.flat_manifest_magic ||
+            manifest_header_ref().flat_manifest_version != expected.flat_manifest_version ||
+            manifest_header_ref().flat_manifest_field_count != expected.flat_manifest_field_count) {
+            manifest_mmap.mmap_allocate_at_least(sizeof(expected));
+            manifest_header_ref() = expected;
+        }
+        for (uint64_t slot = 0; manifest_header_ref().flat_manifest_entry_count > slot; ++slot) {
+            auto &entry = manifest_entry_ref(slot);
+            manifest_name_to_slot[std::string(entry.entry_timeshard_name, strnlen(entry.entry_timeshard_name, sizeof(entry.entry_timeshard_name)))] = slot;
+        }
+    }
+
+    flat_timeshard_manifest_header &manifest_header_ref() const { return manifest_mmap.mmap_cast<flat_timeshard_manifest_header>(0); }
+    entry_type &manifest_entry_ref(uint64_t slot) const { return manifest_mmap.mmap_cast<entry_type>(sizeof(flat_timeshard_manifest_header) + slot * sizeof(entry_type)); }
+
+    // returns the slot of the entry for timeshard_name, adding an empty one if there is none
+    uint64_t manifest_ensure_slot(std::string_view timeshard_name, double start_unixtime, double end_unixtime) {
+        auto i = manifest_name_to_slot.find(std::string(timeshard_name));
+        if (i != manifest_name_to_slot.end()) { return i->second; }
+
+        entry_type entry{};
+        if (timeshard_name.size() >= sizeof(entry.entry_timeshard_name)) {
+            throw std::runtime_error(str("flat_timeshard_manifest timeshard name too long: ", timeshard_name));
+        }
+        std::memcpy(entry.entry_timeshard_name, timeshard_name.data(), timeshard_name.size());
+        entry.entry_start_unixtime = start_unixtime;
+        entry.entry_end_unixtime = end_unixtime;
+        entry.entry_record_count = 0;
+        entry.entry_sealed_record_count = 0;
+        for (auto &zone : entry.entry_zone_maps) { zone = flat_zone_map(); }
+
+        auto slot = manifest_header_ref().flat_manifest_entry_count;
+        manifest_mmap.mmap_allocate_at_least(sizeof(flat_timeshard_manifest_header) + (slot + 1) * sizeof(entry_type));
+        manifest_entry_ref(slot) = entry;
+        ++manifest_header_ref().flat_manifest_entry_count;
+        manifest_name_to_slot[std::string(timeshard_name)] = slot;
+        return slot;
+    }
+};
@@ -10,6 +10,7 @@
 #include <atomic>
 #include <filesystem>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -19,6 +20,8 @@ struct limited_pcap_dumper {
     std::filesystem::path pcap_dir;
     pcap_dumper_t *pcap_dumper = nullptr;
     std::uintmax_t pcap_filesize = 0;
+    // several PACKET_FANOUT workers of one interface can dump the same MAC address
+    std::mutex pcap_dumper_mutex;
 
     bool can_write_bytes(uintmax_t len) {
         auto ret = std::cmp_less(pcap_filesize + len, env("limited_pcap_dumper_max_dump_bytes", 100 * 1024 * 1024)) &&
@@ -39,6 +42,7 @@ struct limited_pcap_dumper {
     }
 
     void pcap_dump_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
+        std::lock_guard _{pcap_dumper_mutex};
         if (!pcap_dumper) { return; }
         if (!can_write_bytes(sizeof(pcap_pkthdr) + h->caplen)) {
             close_dumper();
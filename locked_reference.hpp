@@ -34,6 +34,8 @@ template <typename T> struct read_locked_reference {
 
 template <typename T> struct write_locked_reference {
     write_locked_reference(locked_reference<T> &ref) : lock(ref.reference_lock), reference(ref.reference) {}
+    // the caller locks lock if this did not
+    write_locked_reference(locked_reference<T> &ref, std::try_to_lock_t) : lock(ref.reference_lock, std::try_to_lock), reference(ref.reference) {}
     T &operator*() const { return reference; }
     T *operator->() const { return &reference; }
 
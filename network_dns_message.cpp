@@ -0,0 +1,75 @@
+#include "network_dns_message.hpp"
+
+#include <cstring>
+
+bool dns_name::name_equals(dns_name const &other) const {
+    if (name_len != other.name_len) { return false; }
+    for (uint16_t i = 0; name_len > i; ++i) {
+        auto c = name_chars[i], d = other.name_chars[i];
+        if (c == d) { continue; }
+        if ((c | 0x20) != (d | 0x20) || (c | 0x20) < 'a' || (c | 0x20) > 'z') { return false; }
+    }
+    return true;
+}
+
+bool dns_message_reader::read_uint16(uint16_t &value) {
+    if (reader_end - reader_ptr < 2) { return false; }
+    value = uint16_t(reader_ptr[0] << 8 | reader_ptr[1]);
+    reader_ptr += 2;
+    return true;
+}
+
+bool dns_message_reader::read_uint32(uint32_t &value) {
+    uint16_t high, low;
+    if (!read_uint16(high) || !read_uint16(low)) { return false; }
+    value = uint32_t(high) << 16 | low;
+    return true;
+}
+
+bool dns_message_reader::read_name(dns_name &name) {
+    name.name_len = 0;
+    auto ptr = reader_ptr;
+    // where the message continues after the first compression pointer
+    u_char const *resume = nullptr;
+    int depth = 0;
+    for (;;) {
+        if (ptr >= reader_end) { return false; }
+        u_char len = *ptr++;
+        if (!len) { break; }
+        if ((len & 0xc0) == 0xc0) {
+            if (ptr >= reader_end) { return false; }
+            if (++depth > reader_max_depth) {
+                reader_overflow_decompression = true;
+                return false;
+            }
+            if (!resume) { resume = ptr + 1; }
+            ptr = reader_start + (len & 0x3f) * 256 + *ptr;
+            continue;
+        }
+        // the extended label types were never deployed
+        if (len > 63) { return false; }
+        if (reader_end - ptr < len || size_t(name.name_len) + len + 1 > dns_name::name_capacity) { return false; }
+        std::memcpy(name.name_chars.data() + name.name_len, ptr, len);
+        name.name_len += len;
+        name.name_chars[name.name_len++] = '.';
+        ptr += len;
+    }
+    reader_ptr = resume ? resume : ptr;
+    return true;
+}
+
+bool dns_message_reader::skip_name() {
+    for (;;) {
+        if (reader_ptr >= reader_end) { return false; }
+        u_char len = *reader_ptr++;
+        if (!len) { return true; }
+        // a pointer ends the name where it is written
+        if ((len & 0xc0) == 0xc0) {
+            if (reader_ptr >= reader_end) { return false; }
+            ++reader_ptr;
+            return true;
+        }
+        if (len > 63 || reader_end - reader_ptr < len) { return false; }
+        reader_ptr += len;
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "network_flat_records.hpp"
+#include "wire_layout.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// A domain name as the labels of its wire form, each followed by a dot, decoded into a fixed buffer so that decoding
+// a message allocates nothing. The wire form of a name is at most 255 bytes, which bounds its text to fewer.
+struct dns_name {
+    static constexpr size_t name_capacity = 255;
+    std::array<char, name_capacity> name_chars;
+    uint16_t name_len = 0;
+
+    [[nodiscard]] std::string_view name_view() const { return {name_chars.data(), name_len}; }
+    // without regard to ASCII case, as DNS compares names
+    [[nodiscard]] bool name_equals(dns_name const &other) const;
+};
+
+struct dns_address_answer {
+    dns_qtype answer_qtype;
+    uint32_t answer_ttl_seconds;
+    // for DNS_QTYPE_A
+    network_addr answer_addr;
+    // for DNS_QTYPE_AAAA
+    in6_addr answer_addr6;
+};
+
+// Reads a DNS message in place, from the header to reader_end. Each name follows at most reader_max_depth compression
+// pointers, so that a message pointing into a loop costs a bounded amount of work.
+struct dns_message_reader {
+    u_char const *reader_start;
+    u_char const *reader_end;
+    u_char const *reader_ptr;
+    int reader_max_depth;
+    bool reader_overflow_decompression = false;
+
+    // the caller has checked that a whole dns_header lies between start and end
+    dns_message_reader(u_char const *start, u_char const *end, int max_depth)
+        : reader_start(start), reader_end(end), reader_ptr(start + sizeof(dns_header)), reader_max_depth(max_depth) {}
+
+    [[nodiscard]] dns_header const &reader_header() const { return *(dns_header const *)reader_start; }
+
+    // each false when the message ends first or, for names, is malformed
+    bool read_uint16(uint16_t &value);
+    bool read_uint32(uint32_t &value);
+    bool read_name(dns_name &name);
+    bool skip_name();
+};
+
+// Calls on_address(name, answer) for each A and AAAA answer of the message. An answer is named by the first question
+// when its owner is that name or is reached from it through the CNAME answers before it, and by its owner otherwise.
+// Returns false when the message is truncated or malformed, having called on_address for the answers before the damage.
+template <typename on_address_type> bool dns_message_for_each_address(dns_message_reader &reader, on_address_type &&on_address) {
+    dns_name question, chain, owner;
+    auto questions = ntohs(reader.reader_header().dns_questions);
+    for (auto q = 0; questions > q; ++q) {
+        if (!(q ? reader.skip_name() : reader.read_name(question))) { return false; }
+        uint16_t qtype, qclass;
+        if (!reader.read_uint16(qtype) || !reader.read_uint16(qclass)) { return false; }
+    }
+    chain = question;
+
+    auto answers = ntohs(reader.reader_header().dns_answers);
+    for (auto a = 0; answers > a; ++a) {
+        uint16_t qtype, qclass, rdlength;
+        dns_address_answer answer{};
+        if (!reader.read_name(owner) || !reader.read_uint16(qtype) || !reader.read_uint16(qclass) || !reader.read_uint32(answer.answer_ttl_seconds) ||
+            !reader.read_uint16(rdlength)) {
+            return false;
+        }
+        if (reader.reader_end - reader.reader_ptr < rdlength) { return false; }
+        auto rdata = reader.reader_ptr;
+        auto rdata_end = rdata + rdlength;
+        auto in_chain = questions && (owner.name_equals(chain) || owner.name_equals(question));
+        if (qclass == (uint16_t)dns_qclass::DNS_QCLASS_INET) {
+            switch (qtype) {
+            case (uint16_t)dns_qtype::DNS_QTYPE_CNAME:
+                if (owner.name_equals(chain) && !reader.read_name(chain)) { return false; }
+                break;
+            case (uint16_t)dns_qtype::DNS_QTYPE_A:
+                if (rdlength != sizeof(answer.answer_addr)) { return false; }
+                answer.answer_qtype = dns_qtype::DNS_QTYPE_A;
+                std::memcpy(&answer.answer_addr, rdata, sizeof(answer.answer_addr));
+                on_address(in_chain ? question : owner, answer);
+                break;
+            case (uint16_t)dns_qtype::DNS_QTYPE_AAAA:
+                if (rdlength != sizeof(answer.answer_addr6)) { return false; }
+                answer.answer_qtype = dns_qtype::DNS_QTYPE_AAAA;
+                std::memcpy(&answer.answer_addr6, rdata, sizeof(answer.answer_addr6));
+                on_address(in_chain ? question : owner, answer);
+                break;
+            }
+        }
+        reader.reader_ptr = rdata_end;
+    }
+    return true;
+}
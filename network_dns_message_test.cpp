@@ -0,0 +1,107 @@
+#include "network_dns_message.hpp"
+#include "network_synthetic_packets.hpp"
+#include "rebootping_test.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+struct decoded_address {
+    std::string address_name;
+    dns_qtype address_qtype;
+    network_addr address_addr;
+    uint32_t address_ttl_seconds;
+    bool operator==(decoded_address const &other) const = default;
+};
+
+std::ostream &operator<<(std::ostream &os, std::vector<decoded_address> const &addresses) {
+    for (auto &&address : addresses) {
+        os << address.address_name << " " << int(address.address_qtype) << " " << address.address_addr << " " << address.address_ttl_seconds << '\n';
+    }
+    return os;
+}
+
+struct decoded_message {
+    std::vector<decoded_address> message_addresses;
+    bool message_complete;
+    bool message_overflow_decompression;
+};
+
+// the DNS message of a synthetic packet, after its Ethernet, IP and UDP headers
+std::string dns_message_of(std::string const &packet) { return packet.substr(sizeof(ether_header) + sizeof(ip_header) + sizeof(udp_header)); }
+
+decoded_message decode(std::string const &message, int max_depth = 16) {
+    decoded_message decoded;
+    dns_message_reader reader((u_char const *)message.data(), (u_char const *)message.data() + message.size(), max_depth);
+    decoded.message_complete = dns_message_for_each_address(reader, [&](dns_name const &name, dns_address_answer const &answer) {
+        decoded.message_addresses.push_back({std::string(name.name_view()), answer.answer_qtype, answer.answer_addr, answer.answer_ttl_seconds});
+    });
+    decoded.message_overflow_decompression = reader.reader_overflow_decompression;
+    return decoded;
+}
+
+macaddr const resolver{{2, 0, 0, 0, 0, 1}};
+macaddr const client{{2, 0, 0, 0, 0, 2}};
+network_addr const resolver_addr = htonl(0x0a000001);
+network_addr const client_addr = htonl(0x0a000002);
+network_addr const answer_addr = htonl(0x0a000063);
+} // namespace
+
+TEST(network_dns_message_suite, cname_chain_names_the_question) {
+    in6_addr addr6{};
+    addr6.s6_addr[15] = 1;
+    auto message = dns_message_of(synthetic_dns_response_packet(resolver, client, resolver_addr, client_addr, "www.example.com",
+                                                                 {{dns_qtype::DNS_QTYPE_CNAME, 0, "edge.cdn.example.net"},
+                                                                  {dns_qtype::DNS_QTYPE_CNAME, 0, "a1.edge.cdn.example.net"},
+                                                                  {dns_qtype::DNS_QTYPE_A, answer_addr, {}},
+                                                                  {dns_qtype::DNS_QTYPE_AAAA, 0, {}, addr6}}));
+    auto decoded = decode(message);
+    rebootping_test_check(decoded.message_complete, ==, true);
+    rebootping_test_check(decoded.message_addresses, ==,
+                          (std::vector<decoded_address>{{"www.example.com.", dns_qtype::DNS_QTYPE_A, answer_addr, 300},
+                                                        {"www.example.com.", dns_qtype::DNS_QTYPE_AAAA, 0, 300}}));
+}
+
+TEST(network_dns_message_suite, answers_after_mx) {
+    auto message = dns_message_of(synthetic_dns_response_packet(resolver, client, resolver_addr, client_addr, "Mail.Example.com",
+                                                                 {{dns_qtype::DNS_QTYPE_MX, 0, "mx.example.com"},
+                                                                  {dns_qtype::DNS_QTYPE_A, answer_addr, {}},
+                                                                  {dns_qtype::DNS_QTYPE_A, client_addr, {}}}));
+    auto decoded = decode(message);
+    rebootping_test_check(decoded.message_complete, ==, true);
+    rebootping_test_check(decoded.message_addresses, ==,
+                          (std::vector<decoded_address>{{"Mail.Example.com.", dns_qtype::DNS_QTYPE_A, answer_addr, 300},
+                                                        {"Mail.Example.com.", dns_qtype::DNS_QTYPE_A, client_addr, 300}}));
+}
+
+TEST(network_dns_message_suite, truncated_after_an_answer) {
+    auto message = dns_message_of(synthetic_dns_response_packet(resolver, client, resolver_addr, client_addr, "www.example.com",
+                                                                 {{dns_qtype::DNS_QTYPE_A, answer_addr, {}}, {dns_qtype::DNS_QTYPE_A, client_addr, {}}}));
+    message.resize(message.size() - 1);
+    auto decoded = decode(message);
+    rebootping_test_check(decoded.message_complete, ==, false);
+    rebootping_test_check(decoded.message_addresses, ==, (std::vector<decoded_address>{{"www.example.com.", dns_qtype::DNS_QTYPE_A, answer_addr, 300}}));
+}
+
+TEST(network_dns_message_suite, pointer_loop_is_bounded) {
+    auto message = dns_message_of(synthetic_dns_response_packet(resolver, client, resolver_addr, client_addr, "www.example.com",
+                                                                 {{dns_qtype::DNS_QTYPE_A, answer_addr, {}}}));
+    // the question name becomes a pointer to itself
+    message[sizeof(dns_header)] = char(0xc0);
+    message[sizeof(dns_header) + 1] = char(sizeof(dns_header));
+    auto decoded = decode(message, 4);
+    rebootping_test_check(decoded.message_complete, ==, false);
+    rebootping_test_check(decoded.message_overflow_decompression, ==, true);
+    rebootping_test_check(decoded.message_addresses.size(), ==, 0);
+}
+
+TEST(network_dns_message_suite, names_compare_without_case) {
+    dns_name a, b;
+    for (auto [name, text] : {std::pair{&a, std::string_view("WWW.Example.com.")}, std::pair{&b, std::string_view("www.example.COM.")}}) {
+        std::copy(text.begin(), text.end(), name->name_chars.begin());
+        name->name_len = uint16_t(text.size());
+    }
+    rebootping_test_check(a.name_equals(b), ==, true);
+    b.name_chars[0] = 'v';
+    rebootping_test_check(a.name_equals(b), ==, false);
+}
@@ -2,6 +2,8 @@
 
 #include "rebootping_records_dir.hpp"
 
+#include <mutex>
+
 locked_reference<dns_response_record> &dns_response_record_store() {
     static locked_holder<dns_response_record> store(rebootping_records_dir());
     return store;
@@ -31,3 +33,32 @@ locked_reference<stp_record> &stp_record_store() {
     static locked_holder<stp_record> store(rebootping_records_dir());
     return store;
 }
+
+void network_flat_records_seal_before(double unixtime) {
+    write_locked_reference(dns_response_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(tcp_accept_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(udp_recv_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(arp_response_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(ip_contact_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(stp_record_store())->seal_timeshards_before(unixtime);
+}
+
+namespace {
+std::mutex network_dirty_mutex;
+network_dirty_macaddrs network_dirty;
+} // namespace
+
+void network_flat_records_mark_dirty(network_dirty_macaddrs const &dirty) {
+    std::lock_guard lock(network_dirty_mutex);
+    for (auto &&[ma, interfaces] : dirty) { network_dirty[ma].insert(interfaces.begin(), interfaces.end()); }
+}
+
+void network_flat_records_mark_dirty(macaddr const &ma) {
+    std::lock_guard lock(network_dirty_mutex);
+    network_dirty[ma];
+}
+
+network_dirty_macaddrs network_flat_records_take_dirty() {
+    std::lock_guard lock(network_dirty_mutex);
+    return std::exchange(network_dirty, {});
+}
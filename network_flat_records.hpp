@@ -8,6 +8,10 @@
 #include "locked_reference.hpp"
 #include "wire_layout.hpp"
 
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
 using network_addr = in_addr_t;
 
 inline network_addr network_addr_from_sockaddr(sockaddr const &sa) {
@@ -103,7 +107,8 @@ template <> struct hash<if_addr_lookup_view<macaddr>> {
 } // namespace std
 
 define_flat_record(dns_response_record, (double, dns_response_unixtime), (std::string_view, dns_response_hostname), (network_addr, dns_response_addr),
-                   (flat_index_linked_field<macaddr_ip_lookup>, dns_macaddr_lookup_index));
+                   (flat_index_linked_field<macaddr_ip_lookup>, dns_macaddr_lookup_index), (uint32_t, dns_response_ttl_seconds),
+                   (flat_index_linked_field<network_addr>, dns_addr_index));
 
 locked_reference<dns_response_record> &dns_response_record_store();
 
@@ -130,3 +135,13 @@ locked_reference<ip_contact_record> &ip_contact_record_store();
 
 define_flat_record(stp_record, (double, stp_unixtime), (flat_index_field<macaddr>, stp_source_macaddr_index));
 locked_reference<stp_record> &stp_record_store();
+
+// seals the indexes of every network record timeshard that ended by unixtime
+void network_flat_records_seal_before(double unixtime);
+
+// MACs whose records changed since the last network_flat_records_take_dirty, each with the interfaces it
+// answered ARP on, so that the report can redraw just those devices
+using network_dirty_macaddrs = std::unordered_map<macaddr, std::unordered_set<std::string>>;
+void network_flat_records_mark_dirty(network_dirty_macaddrs const &dirty);
+void network_flat_records_mark_dirty(macaddr const &ma);
+network_dirty_macaddrs network_flat_records_take_dirty();
@@ -0,0 +1,145 @@
+#include "network_interface_staging.hpp"
+
+#include "env.hpp"
+#include "flat_metrics.hpp"
+#include "now_unixtime.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+// Observations mostly repeat a few hosts, so a flush looks up each host's record once per daily timeshard and then
+// reuses it, which is what add_if_missing would have found again. Timeshards are not closed under the write lock.
+template <typename iterator_type> struct staging_record_cache {
+    std::unordered_map<macaddr, std::pair<int64_t, iterator_type>> cache_records;
+
+    template <typename lookup_function> iterator_type &cache_record(macaddr const &ma, double unixtime, lookup_function &&lookup) {
+        auto day = int64_t(std::floor(unixtime / (24 * 60 * 60)));
+        auto &cached = cache_records[ma];
+        if (!cached.second || cached.first != day) { cached = {day, lookup()}; }
+        return cached.second;
+    }
+};
+} // namespace
+
+void network_interface_staging::staging_noted() {
+    if (!staged_count++) { staged_first_unixtime = now_unixtime(); }
+    if (!staging_held && std::cmp_greater_equal(staged_count, env("network_interface_staging_max_observations", 4096))) { staging_flush(); }
+}
+
+void network_interface_staging::staging_flush_if_due() {
+    if (staged_count && !staging_held && now_unixtime() >= staged_first_unixtime + env("network_interface_staging_max_seconds", 1.0)) { staging_flush(); }
+}
+
+void network_interface_staging::staging_flush() {
+    if (!staged_count) { return; }
+    auto flush_start = std::chrono::steady_clock::now();
+    network_dirty_macaddrs dirty;
+
+    if (!staged_tcp_accepts.empty()) {
+        auto store = flat_metrics_write_locked(tcp_accept_record_store());
+        staging_record_cache<flat_timeshard_iterator_tcp_accept_record> records;
+        for (auto &&o : staged_tcp_accepts) {
+            records
+                .cache_record(o.observed_macaddr, o.observed_unixtime,
+                              [&]() { return store->tcp_macaddr_index(o.observed_macaddr).add_if_missing(o.observed_unixtime); })
+                .tcp_ports()
+                .notice_key(o.observed_port);
+            dirty[o.observed_macaddr];
+        }
+        staged_tcp_accepts.clear();
+    }
+    if (!staged_udp_recvs.empty()) {
+        auto store = flat_metrics_write_locked(udp_recv_record_store());
+        staging_record_cache<flat_timeshard_iterator_udp_recv_record> records;
+        for (auto &&o : staged_udp_recvs) {
+            records
+                .cache_record(o.observed_macaddr, o.observed_unixtime,
+                              [&]() { return store->udp_macaddr_index(o.observed_macaddr).add_if_missing(o.observed_unixtime); })
+                .udp_ports()
+                .notice_key(o.observed_port);
+            dirty[o.observed_macaddr];
+        }
+        staged_udp_recvs.clear();
+    }
+    if (!staged_ip_contacts.empty()) {
+        auto store = flat_metrics_write_locked(ip_contact_record_store());
+        staging_record_cache<flat_timeshard_iterator_ip_contact_record> records;
+        for (auto &&o : staged_ip_contacts) {
+            records
+                .cache_record(o.observed_macaddr, o.observed_unixtime,
+                              [&]() { return store->ip_contact_macaddr_index(o.observed_macaddr).add_if_missing(o.observed_unixtime); })
+                .ip_contact_addrs()
+                .notice_key(o.observed_addr);
+            dirty[o.observed_macaddr];
+        }
+        staged_ip_contacts.clear();
+    }
+    if (!staged_arp_responses.empty()) {
+        auto store = flat_metrics_write_locked(arp_response_record_store());
+        for (auto &&o : staged_arp_responses) {
+            store->arp_macaddr_index(std::make_pair(o.observed_interface, o.observed_macaddr))
+                .add_if_missing(o.observed_unixtime)
+                .arp_addresses()
+                .notice_key(o.observed_addr);
+            dirty[o.observed_macaddr].insert(o.observed_interface);
+        }
+        staged_arp_responses.clear();
+    }
+    if (!staged_stp.empty()) {
+        auto store = flat_metrics_write_locked(stp_record_store());
+        staging_record_cache<flat_timeshard_iterator_stp_record> records;
+        for (auto &&o : staged_stp) {
+            records
+                .cache_record(o.observed_macaddr, o.observed_unixtime,
+                              [&]() { return store->stp_source_macaddr_index(o.observed_macaddr).add_if_missing(o.observed_unixtime); })
+                .stp_unixtime() = o.observed_unixtime;
+            dirty[o.observed_macaddr];
+        }
+        staged_stp.clear();
+    }
+    if (!staged_dns_responses.empty()) {
+        auto store = flat_metrics_write_locked(dns_response_record_store());
+        for (auto &&o : staged_dns_responses) {
+            auto lookup = macaddr_ip_lookup{
+                .lookup_macaddr = o.observed_macaddr,
+                .lookup_addr = o.observed_addr,
+            };
+            store->add_flat_record(o.observed_unixtime, [&](flat_timeshard_iterator_dns_response_record &iter) {
+                iter.flat_iterator_timeshard->dns_macaddr_lookup_index.index_linked_field_add(lookup, iter);
+                iter.flat_iterator_timeshard->dns_addr_index.index_linked_field_add(o.observed_addr, iter);
+                iter.dns_response_hostname() = std::string_view(staged_dns_hostnames).substr(o.observed_hostname_offset, o.observed_hostname_len);
+                iter.dns_response_unixtime() = o.observed_unixtime;
+                iter.dns_response_addr() = o.observed_addr;
+                iter.dns_response_ttl_seconds() = o.observed_ttl_seconds;
+            });
+            dirty[o.observed_macaddr];
+        }
+        staged_dns_responses.clear();
+        staged_dns_hostnames.clear();
+    }
+
+    network_flat_records_mark_dirty(dirty);
+
+    ++flat_metric().network_interface_staging_flushes;
+    flat_metric().network_interface_staging_observations += staged_count;
+    flat_metric().network_interface_staging_flush_nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - flush_start).count();
+    staged_count = 0;
+}
+
+network_interface_staging::~network_interface_staging() {
+    // whoever held it flushes it in order, or means to drop it
+    if (staging_held) { return; }
+    try {
+        staging_flush();
+    } catch (std::exception const &e) { std::cerr << "network_interface_staging flush at thread exit failed: " << e.what() << std::endl; }
+}
+
+network_interface_staging &network_interface_thread_staging() {
+    thread_local network_interface_staging staging;
+    return staging;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "network_flat_records.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Observations made by the packet analyzers of one thread, held back so that each record store
+// is write locked once per batch instead of once per packet.
+struct network_interface_staging {
+    struct port_observation {
+        macaddr observed_macaddr;
+        double observed_unixtime;
+        uint16_t observed_port;
+    };
+    struct addr_observation {
+        macaddr observed_macaddr;
+        double observed_unixtime;
+        network_addr observed_addr;
+    };
+    struct arp_observation {
+        std::string observed_interface;
+        macaddr observed_macaddr;
+        double observed_unixtime;
+        network_addr observed_addr;
+    };
+    struct stp_observation {
+        macaddr observed_macaddr;
+        double observed_unixtime;
+    };
+    struct dns_observation {
+        macaddr observed_macaddr;
+        double observed_unixtime;
+        network_addr observed_addr;
+        uint32_t observed_ttl_seconds;
+        // in staged_dns_hostnames, so that staging a name allocates nothing once the buffer has grown
+        uint32_t observed_hostname_offset;
+        uint32_t observed_hostname_len;
+    };
+
+    std::vector<port_observation> staged_tcp_accepts;
+    std::vector<port_observation> staged_udp_recvs;
+    std::vector<addr_observation> staged_ip_contacts;
+    std::vector<arp_observation> staged_arp_responses;
+    std::vector<stp_observation> staged_stp;
+    std::vector<dns_observation> staged_dns_responses;
+    std::string staged_dns_hostnames;
+    uint64_t staged_count = 0;
+    double staged_first_unixtime = 0;
+    // set by bulk ingest, which holds each file's observations until it can flush them in file order
+    bool staging_held = false;
+
+    network_interface_staging() = default;
+    network_interface_staging(network_interface_staging const &) = delete;
+    network_interface_staging &operator=(network_interface_staging const &) = delete;
+
+    ~network_interface_staging();
+
+    void stage_tcp_accept(macaddr const &ma, double unixtime, uint16_t port) {
+        staged_tcp_accepts.push_back({ma, unixtime, port});
+        staging_noted();
+    }
+    void stage_udp_recv(macaddr const &ma, double unixtime, uint16_t port) {
+        staged_udp_recvs.push_back({ma, unixtime, port});
+        staging_noted();
+    }
+    void stage_ip_contact(macaddr const &ma, double unixtime, network_addr addr) {
+        staged_ip_contacts.push_back({ma, unixtime, addr});
+        staging_noted();
+    }
+    void stage_arp_response(std::string_view interface_name, macaddr const &ma, double unixtime, network_addr addr) {
+        staged_arp_responses.push_back({std::string(interface_name), ma, unixtime, addr});
+        staging_noted();
+    }
+    void stage_stp(macaddr const &ma, double unixtime) {
+        staged_stp.push_back({ma, unixtime});
+        staging_noted();
+    }
+    void stage_dns_response(macaddr const &ma, double unixtime, network_addr addr, uint32_t ttl_seconds, std::string_view hostname) {
+        staged_dns_responses.push_back({ma, unixtime, addr, ttl_seconds, uint32_t(staged_dns_hostnames.size()), uint32_t(hostname.size())});
+        staged_dns_hostnames.append(hostname);
+        staging_noted();
+    }
+
+    // applies everything staged so far, taking each store's write lock once
+    void staging_flush();
+
+    // flushes when the oldest staged observation has waited network_interface_staging_max_seconds, unless held
+    void staging_flush_if_due();
+
+  private:
+    void staging_noted();
+};
+
+network_interface_staging &network_interface_thread_staging();
@@ -0,0 +1,131 @@
+#include "network_interface_tpacket_ring.hpp"
+
+#include "call_errno.hpp"
+#include "env.hpp"
+#include "flat_metrics.hpp"
+#include "str.hpp"
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <poll.h>
+#include <unistd.h>
+
+network_interface_tpacket_settings network_interface_tpacket_settings_from_env() {
+    network_interface_tpacket_settings settings;
+    settings.tpacket_block_bytes = env("capture_tpacket_block_bytes", settings.tpacket_block_bytes);
+    settings.tpacket_block_count = env("capture_tpacket_block_count", settings.tpacket_block_count);
+    settings.tpacket_block_timeout_ms = env("capture_tpacket_block_timeout_ms", settings.tpacket_block_timeout_ms);
+    settings.tpacket_snaplen = env("capture_snaplen_bytes", settings.tpacket_snaplen);
+    return settings;
+}
+
+network_interface_tpacket_ring::network_interface_tpacket_ring(std::string_view interface_name, network_interface_tpacket_settings const &settings)
+    : ring_interface_name(interface_name), ring_settings(settings) {
+    add_thread_context _("tpacket_interface", ring_interface_name);
+    auto page_size = (uint64_t)getpagesize();
+    if (!ring_settings.tpacket_block_bytes || ring_settings.tpacket_block_bytes % page_size ||
+        (ring_settings.tpacket_block_bytes & (ring_settings.tpacket_block_bytes - 1))) {
+        throw std::runtime_error(str("capture_tpacket_block_bytes must be a power of two multiple of the page size: ", ring_settings.tpacket_block_bytes));
+    }
+    if (!ring_settings.tpacket_block_count) { throw std::runtime_error("capture_tpacket_block_count must be positive"); }
+
+    ring_fd = CALL_ERRNO_MINUS_1(socket, AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    try {
+        int version = TPACKET_V3;
+        CALL_ERRNO_MINUS_1(setsockopt, ring_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+
+        tpacket_req3 req{};
+        req.tp_block_size = ring_settings.tpacket_block_bytes;
+        req.tp_block_nr = ring_settings.tpacket_block_count;
+        req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+        req.tp_frame_nr = req.tp_block_size / req.tp_frame_size * req.tp_block_nr;
+        req.tp_retire_blk_tov = ring_settings.tpacket_block_timeout_ms;
+        req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+        CALL_ERRNO_MINUS_1(setsockopt, ring_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+
+        ring_base = (unsigned char *)CALL_ERRNO_BAD_VALUE(mmap, MAP_FAILED, nullptr, ring_settings.tpacket_block_bytes * ring_settings.tpacket_block_count,
+                                                          PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+
+        sockaddr_ll ll{};
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_ALL);
+        ll.sll_ifindex = (int)CALL_ERRNO_BAD_VALUE(if_nametoindex, 0u, ring_interface_name.c_str());
+        CALL_ERRNO_MINUS_1(bind, ring_fd, (sockaddr *)&ll, sizeof(ll));
+
+        packet_mreq promiscuous{};
+        promiscuous.mr_ifindex = ll.sll_ifindex;
+        promiscuous.mr_type = PACKET_MR_PROMISC;
+        CALL_ERRNO_MINUS_1(setsockopt, ring_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &promiscuous, sizeof(promiscuous));
+
+        if (ring_settings.tpacket_fanout_group) {
+            // hash on the flow so that each TCP/UDP conversation stays on one worker
+            int fanout = ring_settings.tpacket_fanout_group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+            CALL_ERRNO_MINUS_1(setsockopt, ring_fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout));
+        }
+    } catch (...) {
+        ring_close();
+        throw;
+    }
+}
+
+uint64_t network_interface_tpacket_ring::ring_dispatch(int timeout_ms, pcap_handler handler, u_char *user) {
+    uint64_t packets = 0;
+    // at most one pass around the ring so that the caller can notice a stop request under sustained load
+    for (uint64_t blocks = 0; blocks < ring_settings.tpacket_block_count; ++blocks) {
+        auto *block = (tpacket_block_desc *)(ring_base + ring_block_next * ring_settings.tpacket_block_bytes);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            if (packets) { break; }
+            pollfd pfd{.fd = ring_fd, .events = POLLIN | POLLERR, .revents = 0};
+            auto ready = poll(&pfd, 1, timeout_ms);
+            if (ready < 0 && errno != EINTR) { throw errno_exception(errno, "poll"); }
+            if (ready <= 0) { break; }
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) { break; }
+        }
+
+        auto *packet = (tpacket3_hdr *)((unsigned char *)block + block->hdr.bh1.offset_to_first_pkt);
+        for (uint32_t n = 0; n < block->hdr.bh1.num_pkts; ++n) {
+            pcap_pkthdr h;
+            h.ts.tv_sec = packet->tp_sec;
+            h.ts.tv_usec = packet->tp_nsec / 1000;
+            h.caplen = std::min(packet->tp_snaplen, ring_settings.tpacket_snaplen);
+            h.len = packet->tp_len;
+            handler(user, &h, (unsigned char *)packet + packet->tp_mac);
+            packet = (tpacket3_hdr *)((unsigned char *)packet + packet->tp_next_offset);
+        }
+        packets += block->hdr.bh1.num_pkts;
+        ++flat_metric().network_interface_tpacket_blocks;
+
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring_block_next = (ring_block_next + 1) % ring_settings.tpacket_block_count;
+    }
+    if (packets) {
+        flat_metric().network_interface_tpacket_packets += packets;
+        ring_note_drops();
+    }
+    return packets;
+}
+
+void network_interface_tpacket_ring::ring_note_drops() {
+    tpacket_stats_v3 stats{};
+    socklen_t len = sizeof(stats);
+    // reading the statistics resets them in the kernel
+    CALL_ERRNO_MINUS_1(getsockopt, ring_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len);
+    flat_metric().network_interface_tpacket_drops += stats.tp_drops;
+}
+
+void network_interface_tpacket_ring::ring_close() {
+    if (ring_base) {
+        CALL_ERRNO_MINUS_1(munmap, ring_base, ring_settings.tpacket_block_bytes * ring_settings.tpacket_block_count);
+        ring_base = nullptr;
+    }
+    if (ring_fd >= 0) {
+        CALL_ERRNO_MINUS_1(close, ring_fd);
+        ring_fd = -1;
+    }
+}
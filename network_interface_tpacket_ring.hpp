@@ -0,0 +1,42 @@
+#pragma once
+
+#include <pcap/pcap.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+struct network_interface_tpacket_settings {
+    uint64_t tpacket_block_bytes = 1 << 22;
+    uint64_t tpacket_block_count = 16;
+    uint32_t tpacket_block_timeout_ms = 10;
+    uint32_t tpacket_snaplen = 10 * 1024;
+    // sockets sharing a non-zero group spread the interface's flows across themselves
+    uint16_t tpacket_fanout_group = 0;
+};
+
+network_interface_tpacket_settings network_interface_tpacket_settings_from_env();
+
+// AF_PACKET TPACKET_V3 receive ring: the kernel fills whole blocks of packets in a shared mmap
+// and each block is handed back once every packet in it has been processed, so nothing is copied.
+struct network_interface_tpacket_ring {
+    std::string ring_interface_name;
+    network_interface_tpacket_settings ring_settings;
+    int ring_fd = -1;
+    unsigned char *ring_base = nullptr;
+    uint64_t ring_block_next = 0;
+
+    network_interface_tpacket_ring(std::string_view interface_name, network_interface_tpacket_settings const &settings);
+
+    network_interface_tpacket_ring(network_interface_tpacket_ring const &) = delete;
+    network_interface_tpacket_ring &operator=(network_interface_tpacket_ring const &) = delete;
+
+    // calls handler for each packet in every ready block, waiting up to timeout_ms for the first; returns number of packets
+    uint64_t ring_dispatch(int timeout_ms, pcap_handler handler, u_char *user);
+
+    ~network_interface_tpacket_ring() { ring_close(); }
+
+  private:
+    void ring_close();
+    void ring_note_drops();
+};
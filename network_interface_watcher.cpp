@@ -2,14 +2,31 @@
 
 #include "flat_metrics.hpp"
 #include "make_unique_ptr_closer.hpp"
+#include "network_dns_message.hpp"
 #include "network_flat_records.hpp"
+#include "network_interface_staging.hpp"
+#include "network_interface_tpacket_ring.hpp"
+#include "network_pcap_file.hpp"
 #include "rebootping_event.hpp"
 
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
 #include <mutex>
+#include <regex>
+#include <thread>
+#include <unordered_map>
 
 struct network_interface_watcher {
     std::string interface_name;
+    // where the analyzers stage their observations, the calling thread's staging when null
+    network_interface_staging *interface_staging = nullptr;
+    // read once here rather than for every name decoded
+    int dns_max_depth = env("network_interface_dns_packets_overflow_max_depth", 16);
     explicit network_interface_watcher(std::string_view name) : interface_name(name) {}
+    network_interface_staging &watcher_staging() { return interface_staging ? *interface_staging : network_interface_thread_staging(); }
     void learn_from_packet(const struct pcap_pkthdr *h, const u_char *bytes);
 
     network_interface_watcher(network_interface_watcher const &) = delete;
@@ -25,93 +42,18 @@ struct network_interface_watcher {
         if (!p) { return; }
         ++flat_metric().network_interface_dns_packets;
 
-        auto dns_start = (const u_char *)&p->dns_id;
-        auto dns_ptr = bytes + sizeof(*p);
-        auto dns_end = bytes + h->caplen;
-        auto eat_one = [&]() {
-            if (dns_ptr < dns_end) { return *dns_ptr++; }
-            return (u_char)0;
-        };
-        auto eat_addr = [&]() {
-            if (dns_ptr + sizeof(network_addr) <= dns_end) {
-                auto ret = *(const network_addr *)dns_ptr;
-                dns_ptr += sizeof(network_addr);
-                return ret;
+        dns_message_reader reader((const u_char *)&p->dns_id, bytes + h->caplen, dns_max_depth);
+        dns_message_for_each_address(reader, [&](dns_name const &name, dns_address_answer const &answer) {
+            // the records hold IPv4 addresses only
+            if (answer.answer_qtype == dns_qtype::DNS_QTYPE_AAAA) {
+                ++flat_metric().network_interface_dns_packets_qtype_aaaa;
+                return;
             }
-            return (network_addr)0;
-        };
-        auto eat_short = [&]() { return eat_one() * 256 + eat_one(); };
-        auto eat_qname = [&]() {
-            std::ostringstream oss;
-            const u_char *saved_ptr = nullptr;
-            const int max_depth = env("network_interface_dns_packets_overflow_max_depth", 16);
-            int depth = 0;
-            while (u_char len = eat_one()) {
-                if (len > 63) {
-                    auto next_len = eat_one();
-
-                    if (++depth > max_depth) {
-                        oss << "rebootping_network_interface_dns_packets_overflow_decompression";
-                        ++flat_metric().network_interface_dns_packets_overflow_decompression;
-                        break;
-                    }
-
-                    if (!saved_ptr) { saved_ptr = dns_ptr; }
-                    dns_ptr = dns_start + (len & 63) * 256 + next_len;
-
-                    continue;
-                }
-                if (dns_ptr + len > dns_end) { break; }
-                oss << std::string_view((const char *)(dns_ptr), len);
-                dns_ptr += len;
-                oss << '.';
-            }
-            if (saved_ptr) { dns_ptr = saved_ptr; }
-            return oss.str();
-        };
-
-        auto questions = ntohs(p->dns_questions);
-        for (auto q = 0; questions > q; ++q) {
-            eat_qname();
-            eat_short();
-            eat_short();
-        }
-
-        auto answers = ntohs(p->dns_answers);
-        for (auto a = 0; answers > a; ++a) {
-            auto name = eat_qname();
-            auto qtype = eat_short();
-            auto qclass = eat_short();
-            auto ttl = (eat_short() << 16) + eat_short();
-            (void)ttl;
-            auto rdlength = eat_short();
-            (void)rdlength;
-            if (qclass != (int)dns_qclass::DNS_QCLASS_INET) { break; }
-            switch (qtype) {
-            case (int)dns_qtype::DNS_QTYPE_A: {
-                network_addr addr = eat_addr();
-                ++flat_metric().network_interface_dns_packets_qtype_a;
-                auto lookup = macaddr_ip_lookup{
-                    .lookup_macaddr = p->ether_dhost,
-                    .lookup_addr = addr,
-                };
-                auto unixtime = timeval_to_unixtime(h->ts);
-                write_locked_reference(dns_response_record_store())->add_flat_record(unixtime, [&](flat_timeshard_iterator_dns_response_record &iter) {
-                    iter.flat_iterator_timeshard->dns_macaddr_lookup_index.index_linked_field_add(lookup, iter);
-                    iter.dns_response_hostname() = name;
-                    iter.dns_response_unixtime() = unixtime;
-                    iter.dns_response_addr() = addr;
-                });
-            } break;
-            case (int)dns_qtype::DNS_QTYPE_MX:
-                eat_short(); // preference
-                eat_qname();
-                break;
-            default:
-                // std::cout << "answer qname " << name << " type " << qtype << " class " << qclass << " ttl " << ttl << " rdlength " << rdlength << std::endl;
-                break;
-            }
-        }
+            ++flat_metric().network_interface_dns_packets_qtype_a;
+            watcher_staging().stage_dns_response(p->ether_dhost, timeval_to_unixtime(h->ts), answer.answer_addr, answer.answer_ttl_seconds,
+                                                 name.name_view());
+        });
+        if (reader.reader_overflow_decompression) { ++flat_metric().network_interface_dns_packets_overflow_decompression; }
     }
 
     void note_tcp_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
@@ -122,11 +64,7 @@ struct network_interface_watcher {
         auto port = ntohs(p->th_sport);
         switch (p->th_flags & ((uint8_t)tcp_flags::SYN | (uint8_t)tcp_flags::ACK)) {
         case ((uint8_t)tcp_flags::SYN | (uint8_t)tcp_flags::ACK):
-            write_locked_reference(tcp_accept_record_store())
-                ->tcp_macaddr_index(p->ether_shost)
-                .add_if_missing(timeval_to_unixtime(h->ts))
-                .tcp_ports()
-                .notice_key(port);
+            watcher_staging().stage_tcp_accept(p->ether_shost, timeval_to_unixtime(h->ts), port);
             break;
         }
     }
@@ -138,11 +76,7 @@ struct network_interface_watcher {
 
         auto port = ntohs(p->uh_dport);
         if (port < env("udp_recv_tracking_min_port", 10000)) {
-            write_locked_reference(udp_recv_record_store())
-                ->udp_macaddr_index(p->ether_dhost)
-                .add_if_missing(timeval_to_unixtime(h->ts))
-                .udp_ports()
-                .notice_key(port);
+            watcher_staging().stage_udp_recv(p->ether_dhost, timeval_to_unixtime(h->ts), port);
         }
 
         if (auto dns_p = wire_header<ether_header, ip_header, udp_header, dns_header>::header_from_packet(bytes, h->caplen)) {
@@ -160,11 +94,7 @@ struct network_interface_watcher {
         case (uint8_t)ip_protocol::TCP: note_tcp_packet(h, bytes); break;
         }
 
-        write_locked_reference(ip_contact_record_store())
-            ->ip_contact_macaddr_index(p->ether_shost)
-            .add_if_missing(timeval_to_unixtime(h->ts))
-            .ip_contact_addrs()
-            .notice_key(p->ip_dst.s_addr);
+        watcher_staging().stage_ip_contact(p->ether_shost, timeval_to_unixtime(h->ts), p->ip_dst.s_addr);
     }
 
     void note_arp_packet_sent(const struct pcap_pkthdr *h, const u_char *bytes) {
@@ -175,36 +105,57 @@ struct network_interface_watcher {
         if (ntohs(p->arp_ptype) != (uint16_t)ether_type::IPv4) { return; }
         if (p->arp_plen != sizeof(in_addr)) { return; }
         if (p->arp_sender != p->ether_shost) { return; }
-        write_locked_reference(arp_response_record_store())
-            ->arp_macaddr_index(std::make_pair(interface_name, p->ether_shost))
-            .add_if_missing(timeval_to_unixtime(h->ts))
-            .arp_addresses()
-            .notice_key(p->arp_spa.s_addr);
+        watcher_staging().stage_arp_response(interface_name, p->ether_shost, timeval_to_unixtime(h->ts), p->arp_spa.s_addr);
     }
 
     void note_stp_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
         auto p = wire_header<ether_header, llc_stp_bpdu>::header_from_packet(bytes, h->caplen);
         if (!p) { return; }
 
-        auto unixtime = timeval_to_unixtime(h->ts);
-        write_locked_reference(stp_record_store())->stp_source_macaddr_index(p->ether_shost).add_if_missing(unixtime).stp_unixtime() = unixtime;
+        watcher_staging().stage_stp(p->ether_shost, timeval_to_unixtime(h->ts));
     }
 };
 
-struct network_interface_watcher_live : network_interface_watcher, loop_thread {
+// dumps each packet to the files of the MAC addresses it is from and to, then learns from it
+struct network_interface_watcher_dumping : network_interface_watcher {
+    // the dumps are opened against this handle
     pcap_t *interface_pcap = nullptr;
     std::mutex dumpers_mutex;
     std::unordered_map<macaddr, std::unique_ptr<limited_pcap_dumper>> macaddr_dumpers;
 
+    explicit network_interface_watcher_dumping(std::string_view name) : network_interface_watcher(name) {}
+
+    limited_pcap_dumper &dumper_for_macaddr(macaddr const &ma);
+
+    limited_pcap_dumper *existing_dumper_for_macaddr(macaddr const &ma);
+
+    void process_one_packet(const struct pcap_pkthdr *h, const u_char *bytes);
+};
+
+struct network_interface_tpacket_worker;
+
+struct network_interface_watcher_live : network_interface_watcher_dumping, loop_thread {
+    // set when capturing through an AF_PACKET ring; interface_pcap is then only a dead handle describing the dumps
+    std::unique_ptr<network_interface_tpacket_ring> interface_ring;
+    std::vector<std::unique_ptr<network_interface_tpacket_worker>> interface_fanout_workers;
+
     explicit network_interface_watcher_live(std::string_view name);
 
+    static void process_one_packet_callback(u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) {
+        ((network_interface_watcher_live *)user)->process_one_packet(h, bytes);
+    }
+
     bool loop_run_once() override {
         add_thread_context _("pcap_interface", interface_name);
 
-        auto ret = pcap_loop(
-            interface_pcap, -1 /*cnt*/,
-            [](u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) { ((network_interface_watcher_live *)user)->process_one_packet(h, bytes); },
-            (u_char *)this);
+        if (interface_ring) {
+            interface_ring->ring_dispatch(env("capture_tpacket_poll_timeout_ms", 100), process_one_packet_callback, (u_char *)this);
+            network_interface_thread_staging().staging_flush_if_due();
+            return false;
+        }
+        // returns after each buffer timeout so that staged observations do not wait for the next packet
+        auto ret = pcap_dispatch(interface_pcap, -1 /*cnt*/, process_one_packet_callback, (u_char *)this);
+        network_interface_thread_staging().staging_flush_if_due();
         if (ret == -1) {
             if (interface_pcap) { std::cerr << "pcap_loop " << interface_name << " " << pcap_geterr(interface_pcap) << std::endl; }
             return true;
@@ -213,23 +164,39 @@ struct network_interface_watcher_live : network_interface_watcher, loop_thread {
     }
 
     void loop_started() override;
-    void loop_stopped() override {
-        if (interface_pcap) {
-            auto *pcap = interface_pcap;
-            interface_pcap = nullptr;
-            pcap_close(pcap);
-        }
-    }
-
-    limited_pcap_dumper &dumper_for_macaddr(macaddr const &ma);
-
-    limited_pcap_dumper *existing_dumper_for_macaddr(macaddr const &ma);
+    void loop_stopped() override;
 
     void process_one_packet(const struct pcap_pkthdr *h, const u_char *bytes);
     ~network_interface_watcher_live() override {
-        if (interface_pcap) { pcap_breakloop(interface_pcap); }
+        if (interface_pcap && !interface_ring) { pcap_breakloop(interface_pcap); }
         loop_stop_join();
     }
+
+  private:
+    bool open_tpacket_ring();
+};
+
+// extra PACKET_FANOUT member of an interface's ring group, feeding the same watcher from its own thread
+struct network_interface_tpacket_worker : loop_thread {
+    network_interface_watcher_live &worker_watcher;
+    network_interface_tpacket_ring worker_ring;
+
+    network_interface_tpacket_worker(network_interface_watcher_live &watcher, network_interface_tpacket_settings const &settings)
+        : worker_watcher(watcher), worker_ring(watcher.interface_name, settings) {
+        loop_spawn();
+    }
+
+    bool loop_run_once() override {
+        add_thread_context _("pcap_interface", worker_watcher.interface_name);
+        worker_ring.ring_dispatch(env("capture_tpacket_poll_timeout_ms", 100), network_interface_watcher_live::process_one_packet_callback,
+                                  (u_char *)&worker_watcher);
+        network_interface_thread_staging().staging_flush_if_due();
+        return false;
+    }
+
+    void loop_stopped() override { network_interface_thread_staging().staging_flush(); }
+
+    ~network_interface_tpacket_worker() override { loop_stop_join(); }
 };
 
 void network_interface_watcher::learn_from_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
@@ -262,26 +229,233 @@ void network_interface_watcher::learn_from_packet(const struct pcap_pkthdr *h, c
     }
 }
 
-void network_interface_watcher_learn_from_pcap_file(std::string const &filename) {
+namespace {
+// returns the number of packets learned from, staging the observations in staging or, when null, the calling thread's
+uint64_t learn_from_pcap_file_staged(std::string const &filename, network_interface_staging *staging) {
     network_interface_watcher watcher(filename);
-    char errbuf[PCAP_ERRBUF_SIZE];
+    watcher.interface_staging = staging;
+    network_pcap_file file(filename);
+    uint64_t packets = 0;
+    pcap_pkthdr h;
+    const u_char *bytes;
+    while (file.pcap_next_packet(h, bytes)) {
+        watcher.learn_from_packet(&h, bytes);
+        ++packets;
+    }
+    return packets;
+}
+} // namespace
+
+void network_interface_watcher_learn_from_pcap_file(std::string const &filename) {
+    try {
+        learn_from_pcap_file_staged(filename, nullptr);
+    } catch (...) {
+        network_interface_thread_staging().staging_flush();
+        throw;
+    }
+    network_interface_thread_staging().staging_flush();
+}
 
-    auto pcap = pcap_open_offline(filename.c_str(), errbuf);
+network_interface_ingest_settings network_interface_ingest_settings_from_env() {
+    network_interface_ingest_settings settings;
+    settings.ingest_workers = env("network_interface_ingest_workers", settings.ingest_workers);
+    settings.ingest_window = env("network_interface_ingest_window", settings.ingest_window);
+    return settings;
+}
 
-    if (!pcap) { throw std::runtime_error(str("learn_from_pcap_file failed on ", filename, ": ", errbuf)); }
-    auto pcap_closer = make_unique_ptr_closer(pcap, [](pcap_t *p) {
+network_interface_ingest_report network_interface_watcher_learn_from_pcap_files(std::vector<std::string> const &filenames,
+                                                                                 network_interface_ingest_settings const &settings) {
+    struct ingest_file {
+        network_interface_staging file_staging;
+        uint64_t file_packets = 0;
+        std::exception_ptr file_error;
+        bool file_ready = false;
+    };
+    network_interface_ingest_report report;
+    report.ingest_workers = settings.ingest_workers ? settings.ingest_workers : std::max(std::thread::hardware_concurrency(), 1u);
+    report.ingest_workers = std::min<uint64_t>(report.ingest_workers, std::max<uint64_t>(filenames.size(), 1));
+    auto window = settings.ingest_window ? settings.ingest_window : 2 * report.ingest_workers;
+    auto ingest_start = std::chrono::steady_clock::now();
+
+    // unique_ptrs, so that the merge can let go of each file's observations as soon as they are flushed
+    std::vector<std::unique_ptr<ingest_file>> files(filenames.size());
+    std::mutex files_mutex;
+    std::condition_variable files_changed;
+    uint64_t next_file = 0;
+    uint64_t merged_files = 0;
+    bool stopping = false;
+
+    auto worker = [&]() {
+        std::unique_lock lock(files_mutex);
+        for (;;) {
+            files_changed.wait(lock, [&]() { return stopping || next_file == files.size() || next_file < merged_files + window; });
+            if (stopping || next_file == files.size()) { return; }
+            auto i = next_file++;
+            lock.unlock();
+            auto file = std::make_unique<ingest_file>();
+            file->file_staging.staging_held = true;
+            try {
+                add_thread_context _("pcap_file", filenames[i]);
+                file->file_packets = learn_from_pcap_file_staged(filenames[i], &file->file_staging);
+            } catch (...) { file->file_error = std::current_exception(); }
+            lock.lock();
+            file->file_ready = true;
+            files[i] = std::move(file);
+            files_changed.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    auto stop_workers = make_unique_ptr_closer(&workers, [&](std::vector<std::thread> *threads) {
+        {
+            std::lock_guard lock(files_mutex);
+            stopping = true;
+        }
+        files_changed.notify_all();
+        for (auto &&thread : *threads) { thread.join(); }
+    });
+    for (uint64_t w = 0; report.ingest_workers > w; ++w) { workers.emplace_back(worker); }
+
+    for (uint64_t i = 0; files.size() > i; ++i) {
+        std::unique_ptr<ingest_file> file;
+        {
+            std::unique_lock lock(files_mutex);
+            files_changed.wait(lock, [&]() { return files[i] && files[i]->file_ready; });
+            file = std::move(files[i]);
+        }
+        auto merge_start = std::chrono::steady_clock::now();
+        file->file_staging.staging_flush();
+        report.ingest_merge_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - merge_start).count();
+        if (file->file_error) { std::rethrow_exception(file->file_error); }
+        report.ingest_packets += file->file_packets;
+        ++report.ingest_files;
+        {
+            std::lock_guard lock(files_mutex);
+            ++merged_files;
+        }
+        files_changed.notify_all();
+    }
+    report.ingest_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - ingest_start).count();
+    return report;
+}
+
+void network_interface_watcher_learn_from_packet(std::string_view interface_name, const struct pcap_pkthdr *h, const u_char *bytes) {
+    network_interface_watcher watcher(interface_name);
+    watcher.learn_from_packet(h, bytes);
+}
+
+namespace {
+struct network_interface_watcher_replay : network_interface_watcher_dumping {
+    network_interface_replay_settings const &replay_settings;
+    network_interface_replay_report &replay_report;
+    std::chrono::steady_clock::time_point replay_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point replay_read_start;
+    double replay_first_unixtime = std::nan("");
+    // by the cookie in the capture
+    std::unordered_map<uint64_t, rebootping_icmp_payload> replay_pings;
+    std::string replay_ping_packet;
+
+    network_interface_watcher_replay(network_interface_replay_settings const &settings, network_interface_replay_report &report)
+        : network_interface_watcher_dumping(settings.replay_interface_name), replay_settings(settings), replay_report(report) {}
+
+    void replay_one_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
+        replay_report.replay_read_nanoseconds.histogram_record_nanoseconds_since(replay_read_start);
+        if (replay_settings.replay_speed > 0) {
+            auto unixtime = timeval_to_unixtime(h->ts);
+            if (std::isnan(replay_first_unixtime)) { replay_first_unixtime = unixtime; }
+            auto due = replay_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                          std::chrono::duration<double>((unixtime - replay_first_unixtime) / replay_settings.replay_speed));
+            auto paced_start = std::chrono::steady_clock::now();
+            if (due > paced_start) {
+                std::this_thread::sleep_until(due);
+                replay_report.replay_paced_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - paced_start).count();
+            }
+        }
+        if (replay_settings.replay_prepare_pings) { bytes = replay_prepare_ping(h, bytes); }
+        process_one_packet(h, bytes);
+        ++replay_report.replay_packets;
+        replay_report.replay_bytes += h->len;
+        // the live loop checks after each pcap_dispatch, which returns a buffer of packets at a time
+        if (!(replay_report.replay_packets % 256)) { network_interface_thread_staging().staging_flush_if_due(); }
+    }
+
+    // the packet with the payload of its prepared ping in place of the captured one, or bytes when it is not a ping
+    const u_char *replay_prepare_ping(const struct pcap_pkthdr *h, const u_char *bytes) {
+        const auto *packet = rebootping_ping_ether_packet::header_from_packet(bytes, h->caplen);
+        if (!packet || ntohs(packet->ether_type_or_len) != (uint16_t)ether_type::IPv4 || packet->ip_p != (uint8_t)ip_protocol::ICMP) { return bytes; }
+        auto const &captured = static_cast<rebootping_icmp_payload const &>(*packet);
+        auto found = replay_pings.find(captured.ping_cookie);
+        if (found == replay_pings.end()) {
+            if (packet->icmp_type != (uint8_t)icmp_type::ECHO) { return bytes; }
+            auto prepared = captured;
+            ping_record_store_prepare(sockaddr_from_network_addr(packet->ip_src.s_addr), sockaddr_from_network_addr(packet->ip_dst.s_addr),
+                                      replay_settings.replay_interface_name, prepared);
+            found = replay_pings.emplace(captured.ping_cookie, prepared).first;
+        }
+        replay_ping_packet.assign((char const *)bytes, h->caplen);
+        std::memcpy(replay_ping_packet.data() + ((u_char const *)&captured - bytes), &found->second, sizeof(found->second));
+        return (u_char const *)replay_ping_packet.data();
+    }
+};
+} // namespace
+
+network_interface_replay_report network_interface_watcher_replay_pcap_file(std::string const &filename, network_interface_replay_settings const &settings) {
+    network_pcap_file file(filename);
+    // only describes the per-MAC dumps
+    auto pcap = make_unique_ptr_closer(pcap_open_dead(DLT_EN10MB, 65535), [](pcap_t *p) {
         if (p) { pcap_close(p); }
     });
-    auto ret = pcap_loop(
-        pcap, -1 /*cnt*/,
-        [](u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) { ((network_interface_watcher *)user)->learn_from_packet(h, bytes); },
-        (u_char *)&watcher);
-    if (ret == -1) { throw std::runtime_error(str("pcap_loop failed on ", filename, ": ", pcap_geterr(pcap))); }
+    if (!pcap) { throw std::runtime_error(str("replay_pcap_file pcap_open_dead failed for ", filename)); }
+
+    network_interface_replay_report report;
+    report.replay_metrics_before = flat_metrics_sum();
+    {
+        network_interface_watcher_replay watcher(settings, report);
+        watcher.interface_pcap = pcap.get();
+        pcap_pkthdr h;
+        const u_char *bytes;
+        for (;;) {
+            watcher.replay_read_start = std::chrono::steady_clock::now();
+            if (!file.pcap_next_packet(h, bytes)) { break; }
+            watcher.replay_one_packet(&h, bytes);
+        }
+        network_interface_thread_staging().staging_flush();
+        report.replay_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - watcher.replay_start).count();
+    }
+    report.replay_metrics_after = flat_metrics_sum();
+    return report;
+}
+
+void network_interface_replay_report_dump(std::ostream &os, network_interface_replay_report const &report) {
+    auto seconds = std::max(report.replay_seconds, 1e-9);
+    os << "network_interface_replay packets " << report.replay_packets << " bytes " << report.replay_bytes << " seconds " << report.replay_seconds
+       << " packets_per_second " << uint64_t(double(report.replay_packets) / seconds) << " gigabits_per_second "
+       << 8e-9 * double(report.replay_bytes) / seconds << std::endl;
+    auto stage = [&](std::string_view stage_name, flat_metric_histogram const &histogram) {
+        os << "network_interface_replay stage " << stage_name << " count " << histogram.histogram_count << " p50_ns " << histogram.histogram_quantile(0.5)
+           << " p99_ns " << histogram.histogram_quantile(0.99) << " p999_ns " << histogram.histogram_quantile(0.999) << " seconds "
+           << 1e-9 * double(histogram.histogram_sum) << " share " << 1e-9 * double(histogram.histogram_sum) / seconds << std::endl;
+    };
+    auto &before = report.replay_metrics_before;
+    auto &after = report.replay_metrics_after;
+    stage("read", report.replay_read_nanoseconds);
+    stage("dump", after.network_interface_dump_nanoseconds - before.network_interface_dump_nanoseconds);
+    stage("learn", after.network_interface_learn_nanoseconds - before.network_interface_learn_nanoseconds);
+    // waits for the store locks, within learn and the staging flushes
+    stage("store_lock_wait", after.store_lock_wait_nanoseconds - before.store_lock_wait_nanoseconds);
+    auto flush_seconds = 1e-9 * double(after.network_interface_staging_flush_nanoseconds - before.network_interface_staging_flush_nanoseconds);
+    os << "network_interface_replay stage staging_flush count " << after.network_interface_staging_flushes - before.network_interface_staging_flushes
+       << " seconds " << flush_seconds << " share " << flush_seconds / seconds << std::endl;
+    os << "network_interface_replay stage paced count " << report.replay_packets << " seconds " << report.replay_paced_seconds << " share "
+       << report.replay_paced_seconds / seconds << std::endl;
 }
 
-network_interface_watcher_live::network_interface_watcher_live(std::string_view name) : network_interface_watcher(name), loop_thread() { loop_spawn(); }
+network_interface_watcher_live::network_interface_watcher_live(std::string_view name) : network_interface_watcher_dumping(name), loop_thread() { loop_spawn(); }
 
 void network_interface_watcher_live::loop_started() {
+    if (std::regex_match(interface_name, std::regex(env("capture_tpacket_interface_regex", "")))) {
+        if (!open_tpacket_ring()) { loop_stop(); }
+        return;
+    }
     char errbuf[PCAP_ERRBUF_SIZE];
     interface_pcap = pcap_open_live(
         interface_name.c_str(),
@@ -310,7 +484,43 @@ void network_interface_watcher_live::loop_started() {
     rebootping_event_log("network_interface_watcher_poll_interface", interface_name);
 }
 
-limited_pcap_dumper &network_interface_watcher_live::dumper_for_macaddr(const macaddr &ma) {
+bool network_interface_watcher_live::open_tpacket_ring() {
+    auto settings = network_interface_tpacket_settings_from_env();
+    auto fanout_workers = env("capture_tpacket_fanout_workers", 1);
+    if (fanout_workers > 1) {
+        // the group id is shared by every socket in the network namespace, so keep it distinct per process and interface
+        settings.tpacket_fanout_group = (uint16_t)((getpid() + std::hash<std::string>()(interface_name)) & 0xffff);
+        if (!settings.tpacket_fanout_group) { settings.tpacket_fanout_group = 1; }
+    }
+    // dumpers are opened against this handle, so it must exist before any ring can deliver a packet
+    interface_pcap = pcap_open_dead(DLT_EN10MB, (int)settings.tpacket_snaplen);
+    try {
+        interface_ring = std::make_unique<network_interface_tpacket_ring>(interface_name, settings);
+        for (auto worker = 1; fanout_workers > worker; ++worker) {
+            interface_fanout_workers.push_back(std::make_unique<network_interface_tpacket_worker>(*this, settings));
+        }
+    } catch (std::exception const &e) {
+        std::cerr << "network_interface_tpacket_ring " << interface_name << " " << e.what() << std::endl;
+        interface_fanout_workers.clear();
+        interface_ring.reset();
+        return false;
+    }
+    rebootping_event_log("network_interface_watcher_tpacket_interface", str(interface_name, " fanout_workers ", fanout_workers));
+    return true;
+}
+
+void network_interface_watcher_live::loop_stopped() {
+    network_interface_thread_staging().staging_flush();
+    interface_fanout_workers.clear();
+    interface_ring.reset();
+    if (interface_pcap) {
+        auto *pcap = interface_pcap;
+        interface_pcap = nullptr;
+        pcap_close(pcap);
+    }
+}
+
+limited_pcap_dumper &network_interface_watcher_dumping::dumper_for_macaddr(const macaddr &ma) {
     std::lock_guard _{dumpers_mutex};
     auto i = macaddr_dumpers.find(ma);
     if (i == macaddr_dumpers.end()) {
@@ -320,18 +530,28 @@ limited_pcap_dumper &network_interface_watcher_live::dumper_for_macaddr(const ma
     return *i->second;
 }
 
-void network_interface_watcher_live::process_one_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
+void network_interface_watcher_dumping::process_one_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
+    auto packet_start = std::chrono::steady_clock::now();
     if (const auto *ether = wire_header<ether_header>::header_from_packet(bytes, h->caplen)) {
         auto *dest_dumper = existing_dumper_for_macaddr(ether->ether_dhost);
         auto &source_dumper = dumper_for_macaddr(ether->ether_shost);
         if (dest_dumper) { dest_dumper->pcap_dump_packet(h, bytes); }
         source_dumper.pcap_dump_packet(h, bytes);
     }
+    auto learn_start = std::chrono::steady_clock::now();
     learn_from_packet(h, bytes);
-    if (loop_is_stopping()) { pcap_breakloop(interface_pcap); }
+    auto packet_end = std::chrono::steady_clock::now();
+    flat_metric().network_interface_dump_nanoseconds.histogram_record(std::chrono::nanoseconds(learn_start - packet_start).count());
+    flat_metric().network_interface_learn_nanoseconds.histogram_record(std::chrono::nanoseconds(packet_end - learn_start).count());
+    flat_metric().network_interface_packet_nanoseconds.histogram_record(std::chrono::nanoseconds(packet_end - packet_start).count());
+}
+
+void network_interface_watcher_live::process_one_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
+    network_interface_watcher_dumping::process_one_packet(h, bytes);
+    if (loop_is_stopping() && !interface_ring) { pcap_breakloop(interface_pcap); }
 }
 
-limited_pcap_dumper *network_interface_watcher_live::existing_dumper_for_macaddr(const macaddr &ma) {
+limited_pcap_dumper *network_interface_watcher_dumping::existing_dumper_for_macaddr(const macaddr &ma) {
     std::lock_guard _{dumpers_mutex};
     auto i = macaddr_dumpers.find(ma);
     if (i == macaddr_dumpers.end()) { return nullptr; }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "file_contents_cache.hpp"
+#include "flat_metrics.hpp"
 #include "limited_pcap_dumper.hpp"
 #include "loop_thread.hpp"
 #include "now_unixtime.hpp"
@@ -23,4 +24,55 @@
 #include <vector>
 
 void network_interface_watcher_learn_from_pcap_file(std::string const &filename);
+
+struct network_interface_ingest_settings {
+    // 0 is one per hardware thread
+    uint64_t ingest_workers = 0;
+    // files read ahead of the one being merged, bounding the observations held in memory; 0 is twice the workers
+    uint64_t ingest_window = 0;
+};
+
+network_interface_ingest_settings network_interface_ingest_settings_from_env();
+
+struct network_interface_ingest_report {
+    uint64_t ingest_files = 0;
+    uint64_t ingest_packets = 0;
+    uint64_t ingest_workers = 0;
+    double ingest_seconds = 0;
+    // spent by the calling thread flushing each file's observations into the stores
+    double ingest_merge_seconds = 0;
+};
+
+// Learns from many captures as network_interface_watcher_learn_from_pcap_file would one after another, leaving the
+// stores as the serial ingest would. Workers decode whole files into observations of their own, which the calling
+// thread flushes in file order. Stops at the first file that fails, after flushing what was read from it.
+network_interface_ingest_report network_interface_watcher_learn_from_pcap_files(std::vector<std::string> const &filenames,
+                                                                                 network_interface_ingest_settings const &settings);
+// learns from one packet as if captured on interface_name, leaving what it noticed staged on the calling thread
+void network_interface_watcher_learn_from_packet(std::string_view interface_name, const struct pcap_pkthdr *h, const u_char *bytes);
+
+struct network_interface_replay_settings {
+    std::string replay_interface_name = "replay0";
+    // 0 replays as fast as the packets can be read, 1 at the pace they were captured, 2 twice as fast
+    double replay_speed = 0;
+    // prepares each ping of the capture in ping_record_store when its first ECHO is replayed, and replays it and its
+    // replies with the prepared slot, cookie and time, so that they are matched as a live ping and reply would be
+    bool replay_prepare_pings = true;
+};
+
+struct network_interface_replay_report {
+    uint64_t replay_packets = 0;
+    uint64_t replay_bytes = 0;
+    double replay_seconds = 0;
+    double replay_paced_seconds = 0;
+    flat_metric_histogram replay_read_nanoseconds{};
+    // flat_metrics_sum before and after, for the stages process_one_packet times itself
+    flat_metrics_struct replay_metrics_before{};
+    flat_metrics_struct replay_metrics_after{};
+};
+
+// Feeds a capture through the whole live path, dumping each packet to the per-MAC files in the current directory
+// before learning from it, and reports where the time went.
+network_interface_replay_report network_interface_watcher_replay_pcap_file(std::string const &filename, network_interface_replay_settings const &settings);
+void network_interface_replay_report_dump(std::ostream &os, network_interface_replay_report const &report);
 std::unique_ptr<loop_thread> network_interface_watcher_thread(std::string interface_name);
@@ -1,7 +1,17 @@
+#include "flat_metrics.hpp"
 #include "network_flat_records.hpp"
+#include "network_interface_staging.hpp"
+#include "network_interface_tpacket_ring.hpp"
 #include "network_interface_watcher.hpp"
+#include "network_name_service.hpp"
+#include "network_pcap_file.hpp"
+#include "network_synthetic_packets.hpp"
+#include "network_traffic_generator.hpp"
+#include "ping_record_store.hpp"
 #include "rebootping_test.hpp"
 
+#include <filesystem>
+
 struct rebootping_records_tmpdir : tmpdir {
     rebootping_records_tmpdir() { setenv("rebootping_records_dir", tmpdir_name.c_str(), 1); }
 };
@@ -32,6 +42,28 @@ TEST(network_interface_watcher_suite, many_tcp_accepts) {
     }
 }
 
+TEST(network_interface_watcher_suite, staged_udp_recvs) {
+    macaddr m = {7, 2, 3, 4, 5, 6};
+    auto recorded_ports = [&] {
+        auto ref = write_locked_reference(udp_recv_record_store());
+        std::unordered_map<uint16_t, uint64_t> ports;
+        for (auto &&recv : ref->udp_macaddr_index(m)) {
+            for (auto &&[port, count] : recv.udp_ports().known_keys_and_counts()) { ports[port] += count; }
+        }
+        return ports;
+    };
+
+    auto &staging = network_interface_thread_staging();
+    for (int i = 0; i < 5; ++i) { staging.stage_udp_recv(m, now_unixtime(), 53); }
+    staging.stage_udp_recv(m, now_unixtime(), 123);
+    rebootping_test_check(recorded_ports().size(), ==, 0);
+
+    auto flushes = flat_metrics_sum().network_interface_staging_flushes.counter_value;
+    staging.staging_flush();
+    rebootping_test_check(flat_metrics_sum().network_interface_staging_flushes.counter_value, ==, flushes + 1);
+    rebootping_test_check(recorded_ports(), ==, (std::unordered_map<uint16_t, uint64_t>{{53, 5}, {123, 1}}));
+}
+
 TEST(network_interface_watcher_suite, dns_lookup_test) {
     while (!std::filesystem::exists("testdata")) {
         std::cerr << "Searching for testdata in parent directory of " << std::filesystem::current_path() << std::endl;
@@ -46,6 +78,9 @@ TEST(network_interface_watcher_suite, dns_lookup_test) {
         .lookup_addr = addr_dns_com,
     };
 
+    rebootping_test_check(network_flat_records_take_dirty().contains(lookup.lookup_macaddr), ==, true);
+    rebootping_test_check(network_flat_records_take_dirty().empty(), ==, true);
+
     int first_record_count = 0;
     {
         auto write_ref = write_locked_reference(dns_response_record_store());
@@ -60,6 +95,14 @@ TEST(network_interface_watcher_suite, dns_lookup_test) {
         }
         rebootping_test_check(first_record_count, ==, 1);
 
+        int addr_record_count = 0;
+        for (auto record : write_ref->dns_addr_index(addr_dns_com)) {
+            rebootping_test_check("dns.com.", ==, record.dns_response_hostname());
+            rebootping_test_check(record.dns_response_ttl_seconds(), >, 0);
+            ++addr_record_count;
+        }
+        rebootping_test_check(addr_record_count, ==, 1);
+
         const auto *timeshard = write_ref->unixtime_to_timeshard(record_unixtime);
         auto index = timeshard->dns_macaddr_lookup_index.flat_timeshard_index_lookup_key(lookup);
         rebootping_test_check(index, !=, nullptr);
@@ -71,6 +114,10 @@ TEST(network_interface_watcher_suite, dns_lookup_test) {
         }
     }
 
+    auto observed = network_name_for_addr(addr_dns_com, record_unixtime);
+    rebootping_test_check(observed.name_source == network_name_source::network_name_passive, ==, true);
+    rebootping_test_check(observed.name_hostname, ==, "dns.com.");
+
     for (int reload = 1; 878 > reload; ++reload) {
         int record_count = 0;
         {
@@ -86,4 +133,217 @@ TEST(network_interface_watcher_suite, dns_lookup_test) {
         rebootping_test_check(record_count, ==, reload);
         network_interface_watcher_learn_from_pcap_file("testdata/dns_lookup.pcap");
     }
-}
\ No newline at end of file
+}
+TEST(network_interface_watcher_suite, synthetic_packets_are_learned) {
+    macaddr host = {0x5a, 0x5a, 0, 0, 0, 1}, router = {0x5a, 0x5a, 0, 0, 0, 2};
+    auto host_addr = network_addr_from_string("10.1.2.3"), router_addr = network_addr_from_string("10.1.2.1");
+    auto dns_packets = flat_metrics_sum().network_interface_dns_packets;
+    auto learn = [&](std::string const &packet) {
+        auto h = synthetic_pkthdr(now_unixtime(), packet);
+        network_interface_watcher_learn_from_packet("synthetic0", &h, (u_char const *)packet.data());
+    };
+    learn(synthetic_tcp_packet(host, router, host_addr, router_addr, 22, 40000, uint8_t(tcp_flags::SYN) | uint8_t(tcp_flags::ACK)));
+    learn(synthetic_udp_packet(router, host, router_addr, host_addr, 40000, 123));
+    learn(synthetic_arp_reply_packet(host, host_addr, router, router_addr));
+    learn(synthetic_stp_bpdu_packet(router));
+    learn(synthetic_dns_response_packet(router, host, router_addr, host_addr, "synthetic.example.com",
+                                        {{dns_qtype::DNS_QTYPE_MX, 0, "mx.example.com"}, {dns_qtype::DNS_QTYPE_A, host_addr, {}}}));
+    network_interface_thread_staging().staging_flush();
+
+    rebootping_test_check(flat_metrics_sum().network_interface_dns_packets - dns_packets, ==, 1);
+    rebootping_test_check(write_locked_reference(tcp_accept_record_store())->tcp_macaddr_index(host).begin()->tcp_ports().known_keys_and_counts(), ==,
+                          (std::unordered_map<uint16_t, uint64_t>{{22, 1}}));
+    rebootping_test_check(write_locked_reference(udp_recv_record_store())->udp_macaddr_index(host).begin()->udp_ports().known_keys_and_counts(), ==,
+                          (std::unordered_map<uint16_t, uint64_t>{{123, 1}}));
+    {
+        auto arp = write_locked_reference(arp_response_record_store());
+        rebootping_test_check(arp->arp_macaddr_index(std::make_pair(std::string("synthetic0"), host)).begin()->arp_addresses().known_keys_and_counts(), ==,
+                              (std::unordered_map<network_addr, uint64_t>{{host_addr, 1}}));
+    }
+    {
+        auto stp = write_locked_reference(stp_record_store());
+        rebootping_test_check(stp->stp_source_macaddr_index(router).begin() != stp->stp_source_macaddr_index(router).end(), ==, true);
+    }
+    // the A answer after the MX one is still found, under the question name
+    uint64_t answers = 0;
+    for (auto &&record : write_locked_reference(dns_response_record_store())->dns_addr_index(host_addr)) {
+        rebootping_test_check(record.dns_response_hostname(), ==, "synthetic.example.com.");
+        ++answers;
+    }
+    rebootping_test_check(answers, ==, 1);
+
+    // the address at the end of a CNAME chain is recorded under the name that was asked for
+    auto canonical_addr = htonl(ntohl(host_addr) + 1);
+    learn(synthetic_dns_response_packet(router, host, router_addr, host_addr, "alias.example.com",
+                                        {{dns_qtype::DNS_QTYPE_CNAME, 0, "canonical.example.net"}, {dns_qtype::DNS_QTYPE_A, canonical_addr, {}}}));
+    network_interface_thread_staging().staging_flush();
+    answers = 0;
+    for (auto &&record : write_locked_reference(dns_response_record_store())->dns_addr_index(canonical_addr)) {
+        rebootping_test_check(record.dns_response_hostname(), ==, "alias.example.com.");
+        ++answers;
+    }
+    rebootping_test_check(answers, ==, 1);
+}
+
+TEST(network_interface_watcher_suite, generated_traffic_replays) {
+    tmpdir dumps;
+    auto filename = dumps.tmpdir_name + "/generated.pcap";
+    network_traffic_mix mix;
+    mix.traffic_packets = 2000;
+    mix.traffic_macaddrs = 64;
+    mix.traffic_icmp = 20;
+    auto pings = [] {
+        uint64_t count = 0;
+        for (auto &&record : read_locked_reference(ping_record_store())->timeshard_query()) { count += !!record.ping_cookie(); }
+        return count;
+    };
+    auto pings_before = pings();
+    rebootping_test_check(network_traffic_generate_pcap(filename, mix), ==, mix.traffic_packets);
+    // making the capture leaves the stores alone, and each ping carries the time of its ECHO
+    rebootping_test_check(pings(), ==, pings_before);
+    {
+        network_pcap_file file(filename);
+        pcap_pkthdr h;
+        const u_char *bytes;
+        uint64_t echoes = 0;
+        while (file.pcap_next_packet(h, bytes)) {
+            auto packet = rebootping_ping_ether_packet::header_from_packet(bytes, h.caplen);
+            if (!packet || packet->ip_p != (uint8_t)ip_protocol::ICMP || packet->icmp_type != (uint8_t)icmp_type::ECHO) { continue; }
+            rebootping_test_check(std::abs(packet->ping_start_unixtime - timeval_to_unixtime(h.ts)), <, 1e-5);
+            ++echoes;
+        }
+        rebootping_test_check(echoes, >, 0);
+    }
+
+    auto cwd = std::filesystem::current_path();
+    std::filesystem::current_path(dumps.tmpdir_name);
+    auto report = network_interface_watcher_replay_pcap_file(filename, {});
+    rebootping_test_check(report.replay_packets, ==, mix.traffic_packets);
+    rebootping_test_check(report.replay_read_nanoseconds.histogram_count, ==, mix.traffic_packets);
+    rebootping_test_check(report.replay_paced_seconds, ==, 0);
+
+    // the replay prepared every ping, so each ECHO and ECHOREPLY finds its record
+    auto &before = report.replay_metrics_before;
+    auto &after = report.replay_metrics_after;
+    auto echoes = after.ping_record_store_process_packet_icmp_echo - before.ping_record_store_process_packet_icmp_echo;
+    rebootping_test_check(echoes, >, 0);
+    rebootping_test_check(after.ping_record_store_process_packet_icmp_echoreply - before.ping_record_store_process_packet_icmp_echoreply, ==, echoes);
+    rebootping_test_check(after.ping_record_store_process_packet_bad_cookie - before.ping_record_store_process_packet_bad_cookie, ==, 0);
+    rebootping_test_check(pings() - pings_before, ==, echoes);
+    rebootping_test_check(after.network_interface_learn_nanoseconds.histogram_count - before.network_interface_learn_nanoseconds.histogram_count, ==,
+                          mix.traffic_packets);
+    rebootping_test_check(std::filesystem::exists(limited_pcap_dumper_filename("replay0", macaddr{{0x02, 0x47, 0, 0, 0, 0}})), ==, true);
+    std::ostringstream dumped;
+    network_interface_replay_report_dump(dumped, report);
+    rebootping_test_check(dumped.str().find("stage learn count 2000 "), !=, std::string::npos);
+
+    // at the pace of the capture, 200 packets at 1000 per second take about 0.2 seconds
+    mix.traffic_packets = 200;
+    mix.traffic_packets_per_second = 1000;
+    network_traffic_generate_pcap(filename, mix);
+    auto paced = network_interface_watcher_replay_pcap_file(filename, {.replay_speed = 1});
+    std::filesystem::current_path(cwd);
+    rebootping_test_check(paced.replay_packets, ==, 200);
+    rebootping_test_check(paced.replay_seconds, >, 0.1);
+    rebootping_test_check(paced.replay_paced_seconds, >, 0);
+}
+
+namespace {
+// what the stores learned of one generated network, with its hosts and names made the same as any other's
+std::string learned_from_network(network_traffic_mix const &mix, std::vector<std::string> const &filenames) {
+    std::ostringstream learned;
+    auto domain = str(".net", unsigned(mix.traffic_network), ".");
+    for (uint64_t i = 0; mix.traffic_macaddrs > i; ++i) {
+        macaddr host{{0x02, mix.traffic_network, 0x00, uint8_t(i >> 16), uint8_t(i >> 8), uint8_t(i)}};
+        learned << "host " << i;
+        for (auto &&record : write_locked_reference(tcp_accept_record_store())->tcp_macaddr_index(host)) {
+            learned << " tcp " << record.tcp_ports().known_keys_and_counts();
+        }
+        for (auto &&record : write_locked_reference(udp_recv_record_store())->udp_macaddr_index(host)) {
+            learned << " udp " << record.udp_ports().known_keys_and_counts();
+        }
+        for (auto &&record : write_locked_reference(ip_contact_record_store())->ip_contact_macaddr_index(host)) {
+            learned << " ip_contact " << record.ip_contact_addrs().known_keys_and_counts();
+        }
+        for (uint64_t f = 0; filenames.size() > f; ++f) {
+            for (auto &&record : write_locked_reference(arp_response_record_store())->arp_macaddr_index(std::make_pair(filenames[f], host))) {
+                learned << " arp " << f << " " << record.arp_addresses().known_keys_and_counts();
+            }
+        }
+        for (auto &&record : write_locked_reference(stp_record_store())->stp_source_macaddr_index(host)) { learned << " stp " << record.stp_unixtime(); }
+        learned << '\n';
+    }
+    // in the order they were added
+    for (auto &&record : write_locked_reference(dns_response_record_store())->timeshard_query()) {
+        std::string hostname(record.dns_response_hostname());
+        auto network = hostname.find(domain);
+        if (network == std::string::npos) { continue; }
+        learned << "dns " << hostname.erase(network, domain.size() - 1) << " " << record.dns_response_unixtime() << " " << record.dns_response_addr() << " "
+                << record.dns_response_ttl_seconds() << '\n';
+    }
+    return learned.str();
+}
+
+std::vector<std::string> generate_network(std::string const &dir, network_traffic_mix mix, uint64_t files) {
+    std::filesystem::create_directories(dir);
+    std::vector<std::string> filenames;
+    for (uint64_t f = 0; files > f; ++f) {
+        mix.traffic_seed = f + 1;
+        mix.traffic_packets = 200 + 100 * f;
+        mix.traffic_start_unixtime = 1700000000 + 3600 * f;
+        filenames.push_back(str(dir, "/capture_", f, ".pcap"));
+        network_traffic_generate_pcap(filenames.back(), mix);
+    }
+    return filenames;
+}
+} // namespace
+
+TEST(network_interface_watcher_suite, parallel_ingest_matches_serial) {
+    tmpdir captures;
+    network_traffic_mix mix;
+    mix.traffic_macaddrs = 16;
+    mix.traffic_icmp = 0;
+    mix.traffic_dns = 30;
+    // small batches, so that the serial ingest flushes many times within each file
+    setenv("network_interface_staging_max_observations", "64", 1);
+
+    mix.traffic_network = 0x48;
+    auto serial_files = generate_network(captures.tmpdir_name + "/serial", mix, 6);
+    uint64_t serial_files_learned = 0;
+    for (auto &&filename : serial_files) {
+        network_interface_watcher_learn_from_pcap_file(filename);
+        ++serial_files_learned;
+    }
+    auto serial = learned_from_network(mix, serial_files);
+
+    mix.traffic_network = 0x49;
+    auto parallel_files = generate_network(captures.tmpdir_name + "/parallel", mix, 6);
+    auto report = network_interface_watcher_learn_from_pcap_files(parallel_files, {.ingest_workers = 3, .ingest_window = 2});
+    auto parallel = learned_from_network(mix, parallel_files);
+    unsetenv("network_interface_staging_max_observations");
+
+    rebootping_test_check(report.ingest_files, ==, serial_files_learned);
+    rebootping_test_check(report.ingest_packets, ==, 200 + 300 + 400 + 500 + 600 + 700);
+    rebootping_test_check(report.ingest_workers, ==, 3);
+    rebootping_test_check(serial.find("dns host"), !=, std::string::npos);
+    rebootping_test_check(serial.find(" arp 5 "), !=, std::string::npos);
+    rebootping_test_check(parallel, ==, serial);
+
+    // stops at the first file it cannot read, having learned from the ones before
+    parallel_files.insert(parallel_files.begin() + 1, captures.tmpdir_name + "/missing.pcap");
+    try {
+        network_interface_watcher_learn_from_pcap_files(parallel_files, {.ingest_workers = 2});
+        rebootping_test_fail("network_interface_watcher_learn_from_pcap_files ingested a missing file");
+    } catch (std::exception const &e) { rebootping_test_check(std::string(e.what()).find("missing.pcap"), !=, std::string::npos); }
+}
+
+TEST(network_interface_watcher_suite, tpacket_ring_rejects_bad_block_size) {
+    network_interface_tpacket_settings settings;
+    settings.tpacket_block_bytes = getpagesize() * 3;
+    try {
+        network_interface_tpacket_ring ring("lo", settings);
+        rebootping_test_fail("network_interface_tpacket_ring accepted a block size that is not a power of two");
+    } catch (std::runtime_error const &e) {
+        rebootping_test_check(std::string(e.what()).find("capture_tpacket_block_bytes"), !=, std::string::npos);
+    }
+}
@@ -0,0 +1,113 @@
+#include "network_name_service.hpp"
+
+#include "env.hpp"
+#include "flat_cache.hpp"
+#include "flat_metrics.hpp"
+#include "loop_thread.hpp"
+#include "rebootping_records_dir.hpp"
+
+#include <netdb.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+
+namespace {
+
+struct network_name_resolver_record {
+    int resolver_error;
+    char resolver_hostname[NI_MAXHOST];
+};
+
+// getnameinfo does not report the TTL of its answer, so resolved names are kept for a configured time
+struct network_name_resolver_expire {
+    bool operator()(network_name_resolver_record const &record, double stored_unixtime, double now) const {
+        return now >= stored_unixtime + (record.resolver_error ? env("network_name_resolver_error_cache_seconds", 300.0)
+                                                               : env("network_name_resolver_cache_seconds", 3600.0));
+    }
+};
+
+// Resolves queued addresses one at a time on its own thread. resolver_mutex guards the queue and the cache,
+// and is never held across getnameinfo.
+struct network_name_resolver : loop_thread {
+    std::mutex resolver_mutex;
+    std::condition_variable resolver_wakeup;
+    std::deque<network_addr> resolver_queue;
+    std::unordered_set<network_addr> resolver_queued;
+    flat_cache<network_addr, network_name_resolver_record, network_name_resolver_expire> resolver_cache;
+
+    network_name_resolver()
+        : resolver_cache(rebootping_records_dir() + "/network_name_resolver_cache", env("network_name_resolver_cache_capacity", 4096)) {
+        loop_spawn();
+    }
+    ~network_name_resolver() override { loop_stop_join(); }
+
+    // call with resolver_mutex held
+    void resolver_enqueue(network_addr addr) {
+        if (resolver_queued.contains(addr)) { return; }
+        if (std::cmp_greater_equal(resolver_queue.size(), env("network_name_resolver_queue_max", 1024))) { return; }
+        resolver_queue.push_back(addr);
+        resolver_queued.insert(addr);
+        ++flat_metric().network_name_resolver_queued;
+        resolver_wakeup.notify_one();
+    }
+
+    bool loop_run_once() override {
+        network_addr addr;
+        {
+            std::unique_lock lock(resolver_mutex);
+            if (!resolver_wakeup.wait_for(lock, std::chrono::seconds(1), [&] { return !resolver_queue.empty(); })) { return false; }
+            addr = resolver_queue.front();
+            resolver_queue.pop_front();
+        }
+
+        network_name_resolver_record record{};
+        auto sa = sockaddr_from_network_addr(addr);
+        record.resolver_error = getnameinfo(&sa, sizeof(sa), record.resolver_hostname, sizeof(record.resolver_hostname), nullptr, 0, NI_NAMEREQD);
+        ++flat_metric().network_name_resolver_lookups;
+
+        std::lock_guard lock(resolver_mutex);
+        resolver_cache.cache_store(addr) = record;
+        resolver_queued.erase(addr);
+        return false;
+    }
+};
+
+network_name_resolver &network_name_resolver_instance() {
+    static network_name_resolver resolver;
+    return resolver;
+}
+
+} // namespace
+
+network_name network_name_for_addr(network_addr addr, double now) {
+    network_name observed;
+    {
+        // TODO allow const access to this kind of lookup so we can use a read lock
+        auto store = write_locked_reference(dns_response_record_store());
+        for (auto &&dns : store->dns_addr_index(addr)) {
+            observed.name_source = network_name_source::network_name_passive;
+            observed.name_hostname = dns.dns_response_hostname().operator std::string_view();
+            if (now < dns.dns_response_unixtime() + dns.dns_response_ttl_seconds()) {
+                ++flat_metric().network_name_passive_answers;
+                return observed;
+            }
+            break;
+        }
+    }
+
+    auto &resolver = network_name_resolver_instance();
+    std::lock_guard lock(resolver.resolver_mutex);
+    if (auto record = resolver.resolver_cache.cache_find(addr, now)) {
+        if (!record->resolver_error) {
+            ++flat_metric().network_name_resolver_answers;
+            return network_name{.name_source = network_name_source::network_name_resolver, .name_hostname = record->resolver_hostname};
+        }
+        if (observed.name_source != network_name_source::network_name_unknown) { return observed; }
+        return network_name{.name_source = network_name_source::network_name_resolver_failed, .name_resolver_error = record->resolver_error};
+    }
+    resolver.resolver_enqueue(addr);
+    return observed;
+}
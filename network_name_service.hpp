@@ -0,0 +1,23 @@
+#pragma once
+
+#include "network_flat_records.hpp"
+
+#include <string>
+
+enum class network_name_source {
+    network_name_unknown,
+    network_name_passive,
+    network_name_resolver,
+    network_name_resolver_failed,
+};
+
+struct network_name {
+    network_name_source name_source = network_name_source::network_name_unknown;
+    std::string name_hostname;
+    int name_resolver_error = 0;
+};
+
+// Never waits for the network. Answers from the names clients were seen resolving to addr, while their
+// TTL lasts, then from the resolver cache, and otherwise queues addr for the background resolver and
+// returns a stale observed name or an unknown one.
+network_name network_name_for_addr(network_addr addr, double now);
@@ -0,0 +1,186 @@
+#include "network_pcap_file.hpp"
+
+#include "env.hpp"
+#include "str.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+constexpr uint32_t pcap_magic_microseconds = 0xa1b2c3d4;
+constexpr uint32_t pcap_magic_nanoseconds = 0xa1b23c4d;
+constexpr uint64_t pcap_file_header_len = 24;
+constexpr uint64_t pcap_record_header_len = 16;
+
+constexpr uint32_t pcapng_section_header_block = 0x0a0d0d0a;
+constexpr uint32_t pcapng_interface_description_block = 1;
+constexpr uint32_t pcapng_simple_packet_block = 3;
+constexpr uint32_t pcapng_enhanced_packet_block = 6;
+constexpr uint32_t pcapng_byte_order_magic = 0x1a2b3c4d;
+constexpr uint16_t pcapng_option_end = 0;
+constexpr uint16_t pcapng_option_if_tsresol = 9;
+
+void set_timestamp(pcap_pkthdr &h, uint64_t timestamp, uint64_t units_per_second) {
+    h.ts.tv_sec = time_t(timestamp / units_per_second);
+    h.ts.tv_usec = suseconds_t((unsigned __int128)(timestamp % units_per_second) * 1000000 / units_per_second);
+}
+} // namespace
+
+network_pcap_file::network_pcap_file(std::string const &filename)
+    : pcap_mmap(filename, flat_mmap_settings_from_env("network_pcap_file", flat_mmap_settings{.mmap_readonly = true,
+                                                                                              .mmap_advice = flat_mmap_advice::advice_sequential})),
+      pcap_release_bytes(std::max(env("network_pcap_file_release_bytes", uint64_t{64} << 20), uint64_t{1})) {
+    if (pcap_file_bytes() < sizeof(uint32_t)) { throw_malformed("is too short for a file header"); }
+    auto magic = read_uint32(0);
+    if (magic == pcapng_section_header_block) {
+        pcap_is_pcapng = true;
+        return;
+    }
+    for (auto swapped : {false, true}) {
+        auto m = swapped ? __builtin_bswap32(magic) : magic;
+        if (m != pcap_magic_microseconds && m != pcap_magic_nanoseconds) { continue; }
+        pcap_swapped = swapped;
+        if (pcap_file_bytes() < pcap_file_header_len) { throw_malformed("is too short for a file header"); }
+        if (m == pcap_magic_nanoseconds) { pcap_units_per_second = 1000000000; }
+        // the upper bits may describe a frame check sequence
+        pcap_linktype = read_uint32(20) & 0xffff;
+        pcap_offset = pcap_file_header_len;
+        return;
+    }
+    throw_malformed("is neither pcap nor pcapng");
+}
+
+uint32_t network_pcap_file::read_uint32(uint64_t offset) const {
+    uint32_t value;
+    // records are not aligned in pcap
+    std::memcpy(&value, &pcap_mmap.mmap_cast<unsigned char>(offset, sizeof(value)), sizeof(value));
+    return pcap_swapped ? __builtin_bswap32(value) : value;
+}
+
+uint16_t network_pcap_file::read_uint16(uint64_t offset) const {
+    uint16_t value;
+    std::memcpy(&value, &pcap_mmap.mmap_cast<unsigned char>(offset, sizeof(value)), sizeof(value));
+    return pcap_swapped ? __builtin_bswap16(value) : value;
+}
+
+void network_pcap_file::throw_malformed(char const *what) const {
+    throw std::runtime_error(str("network_pcap_file ", pcap_mmap.flat_mmap_filename(), " ", what, " at offset ", pcap_offset));
+}
+
+bool network_pcap_file::pcap_next_packet(pcap_pkthdr &h, u_char const *&bytes) {
+    release_passed();
+    for (;;) {
+        auto found = pcap_is_pcapng ? read_pcapng_block(h, bytes) : read_pcap_record(h, bytes);
+        if (!found) { return false; }
+        if (bytes) { return true; }
+        ++pcap_skipped_packets;
+    }
+}
+
+void network_pcap_file::release_passed() {
+    if (pcap_offset < pcap_released + pcap_release_bytes) { return; }
+    pcap_mmap.mmap_release_before(pcap_offset);
+    pcap_released = pcap_offset;
+}
+
+// leaves bytes null for a packet that is not Ethernet
+bool network_pcap_file::read_pcap_record(pcap_pkthdr &h, u_char const *&bytes) {
+    if (pcap_offset == pcap_file_bytes()) { return false; }
+    if (pcap_offset + pcap_record_header_len > pcap_file_bytes()) { throw_malformed("is truncated in a packet header"); }
+    auto caplen = read_uint32(pcap_offset + 8);
+    auto data_offset = pcap_offset + pcap_record_header_len;
+    if (data_offset + caplen > pcap_file_bytes()) { throw_malformed("is truncated in a packet"); }
+    set_timestamp(h, uint64_t(read_uint32(pcap_offset)) * pcap_units_per_second + read_uint32(pcap_offset + 4), pcap_units_per_second);
+    h.caplen = caplen;
+    h.len = read_uint32(pcap_offset + 12);
+    bytes = pcap_linktype == DLT_EN10MB ? &pcap_mmap.mmap_cast<u_char>(data_offset, caplen) : nullptr;
+    pcap_offset = data_offset + caplen;
+    return true;
+}
+
+void network_pcap_file::read_section_header() {
+    // the byte order is only known from the magic after the block length
+    if (pcap_offset + 12 > pcap_file_bytes()) { throw_malformed("is truncated in a section header"); }
+    pcap_swapped = false;
+    auto magic = read_uint32(pcap_offset + 8);
+    if (magic != pcapng_byte_order_magic) {
+        if (__builtin_bswap32(magic) != pcapng_byte_order_magic) { throw_malformed("has a section header without the byte order magic"); }
+        pcap_swapped = true;
+    }
+    pcap_interfaces.clear();
+}
+
+void network_pcap_file::read_interface_description(uint64_t block_offset, uint32_t block_len) {
+    if (block_len < 20) { throw_malformed("has a short interface description"); }
+    pcapng_interface interface{.interface_linktype = read_uint16(block_offset + 8),
+                               .interface_snaplen = read_uint32(block_offset + 12),
+                               .interface_units_per_second = 1000000};
+    auto options_end = block_offset + block_len - 4;
+    for (auto option = block_offset + 16; option + 4 <= options_end;) {
+        auto code = read_uint16(option);
+        auto len = read_uint16(option + 2);
+        if (code == pcapng_option_end) { break; }
+        if (option + 4 + len > options_end) { throw_malformed("has an option past the end of its block"); }
+        if (code == pcapng_option_if_tsresol && len >= 1) {
+            // a power of ten, or of two when the top bit is set
+            auto resolution = pcap_mmap.mmap_cast<uint8_t>(option + 4);
+            uint64_t units = 1;
+            if (resolution & 0x80) {
+                units <<= std::min(resolution & 0x7f, 63);
+            } else {
+                for (auto i = std::min<int>(resolution, 19); i; --i) { units *= 10; }
+            }
+            interface.interface_units_per_second = units;
+        }
+        option += 4 + (len + 3) / 4 * 4;
+    }
+    pcap_interfaces.push_back(interface);
+}
+
+bool network_pcap_file::read_pcapng_block(pcap_pkthdr &h, u_char const *&bytes) {
+    for (;;) {
+        if (pcap_offset == pcap_file_bytes()) { return false; }
+        if (pcap_offset + 12 > pcap_file_bytes()) { throw_malformed("is truncated in a block header"); }
+        auto block_offset = pcap_offset;
+        auto type = read_uint32(block_offset);
+        if (type == pcapng_section_header_block) { read_section_header(); }
+        auto block_len = read_uint32(block_offset + 4);
+        if (block_len < 12 || block_len % 4) { throw_malformed("has a block of bad length"); }
+        if (block_offset + block_len > pcap_file_bytes()) { throw_malformed("is truncated in a block"); }
+        pcap_offset = block_offset + block_len;
+
+        switch (type) {
+        case pcapng_interface_description_block: read_interface_description(block_offset, block_len); break;
+        case pcapng_enhanced_packet_block: {
+            if (block_len < 32) { throw_malformed("has a short enhanced packet block"); }
+            auto interface_id = read_uint32(block_offset + 8);
+            if (interface_id >= pcap_interfaces.size()) { throw_malformed("has a packet of an undescribed interface"); }
+            auto &interface = pcap_interfaces[interface_id];
+            auto caplen = read_uint32(block_offset + 20);
+            if (caplen > block_len - 32) { throw_malformed("has a packet longer than its block"); }
+            set_timestamp(h, (uint64_t(read_uint32(block_offset + 12)) << 32) + read_uint32(block_offset + 16), interface.interface_units_per_second);
+            h.caplen = caplen;
+            h.len = read_uint32(block_offset + 24);
+            bytes = interface.interface_linktype == DLT_EN10MB ? &pcap_mmap.mmap_cast<u_char>(block_offset + 28, caplen) : nullptr;
+            return true;
+        }
+        case pcapng_simple_packet_block: {
+            if (block_len < 16) { throw_malformed("has a short simple packet block"); }
+            if (pcap_interfaces.empty()) { throw_malformed("has a packet of an undescribed interface"); }
+            auto &interface = pcap_interfaces.front();
+            h.len = read_uint32(block_offset + 8);
+            uint64_t caplen = std::min<uint64_t>(h.len, block_len - 16);
+            if (interface.interface_snaplen) { caplen = std::min<uint64_t>(caplen, interface.interface_snaplen); }
+            // simple packets carry no timestamp
+            h.ts = {};
+            h.caplen = uint32_t(caplen);
+            bytes = interface.interface_linktype == DLT_EN10MB ? &pcap_mmap.mmap_cast<u_char>(block_offset + 12, caplen) : nullptr;
+            return true;
+        }
+        default:
+            // section headers were read above, and statistics, name resolution and custom blocks tell the analyzers nothing
+            break;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "flat_mmap.hpp"
+
+#include <pcap/pcap.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reads a pcap or pcapng capture in place through a readonly mapping, instead of copying each packet out through
+// stdio as pcap_open_offline does. Only the header of each packet is decoded into a pcap_pkthdr; the bytes handed
+// out point into the mapping. Pages are read ahead sequentially and, every network_pcap_file_release_bytes, the ones
+// already passed are given back, so that captures larger than memory stream through it.
+// The analyzers decode Ethernet frames only, so packets of other link types are counted and skipped.
+struct network_pcap_file {
+    struct pcapng_interface {
+        uint16_t interface_linktype;
+        uint32_t interface_snaplen;
+        uint64_t interface_units_per_second;
+    };
+
+    flat_mmap pcap_mmap;
+    uint64_t pcap_offset = 0;
+    uint64_t pcap_released = 0;
+    uint64_t pcap_release_bytes;
+    bool pcap_swapped = false;
+    bool pcap_is_pcapng = false;
+    // for pcap, where every packet shares the file header's link type and timestamp resolution
+    uint32_t pcap_linktype = 0;
+    uint64_t pcap_units_per_second = 1000000;
+    // for pcapng, those of the current section
+    std::vector<pcapng_interface> pcap_interfaces;
+    uint64_t pcap_skipped_packets = 0;
+
+    explicit network_pcap_file(std::string const &filename);
+
+    // The next Ethernet packet, whose bytes stay valid until the following call. False at the end of the capture;
+    // throws on a capture that is truncated or malformed, having returned every packet before the damage.
+    bool pcap_next_packet(pcap_pkthdr &h, u_char const *&bytes);
+
+    [[nodiscard]] uint64_t pcap_file_bytes() const { return pcap_mmap.mmap_allocated_len(); }
+
+  private:
+    [[nodiscard]] uint32_t read_uint32(uint64_t offset) const;
+    [[nodiscard]] uint16_t read_uint16(uint64_t offset) const;
+    void read_section_header();
+    void read_interface_description(uint64_t block_offset, uint32_t block_len);
+    bool read_pcap_record(pcap_pkthdr &h, u_char const *&bytes);
+    bool read_pcapng_block(pcap_pkthdr &h, u_char const *&bytes);
+    void release_passed();
+    [[noreturn]] void throw_malformed(char const *what) const;
+};
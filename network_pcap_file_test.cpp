@@ -0,0 +1,173 @@
+#include "network_pcap_file.hpp"
+#include "network_synthetic_packets.hpp"
+#include "network_traffic_generator.hpp"
+#include "rebootping_test.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+namespace {
+struct read_packet {
+    double packet_unixtime;
+    uint32_t packet_len;
+    std::string packet_bytes;
+    bool operator==(read_packet const &other) const = default;
+};
+
+std::ostream &operator<<(std::ostream &os, read_packet const &packet) {
+    return os << "packet " << packet.packet_unixtime << " len " << packet.packet_len << " caplen " << packet.packet_bytes.size();
+}
+
+std::ostream &operator<<(std::ostream &os, std::vector<read_packet> const &packets) {
+    for (auto &&packet : packets) { os << packet << '\n'; }
+    return os;
+}
+
+std::vector<read_packet> read_with_mmap(std::string const &filename) {
+    network_pcap_file file(filename);
+    std::vector<read_packet> packets;
+    pcap_pkthdr h;
+    const u_char *bytes;
+    while (file.pcap_next_packet(h, bytes)) { packets.push_back({timeval_to_unixtime(h.ts), h.len, std::string((char const *)bytes, h.caplen)}); }
+    return packets;
+}
+
+std::vector<read_packet> read_with_libpcap(std::string const &filename) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    auto pcap = pcap_open_offline(filename.c_str(), errbuf);
+    rebootping_test_check(!!pcap, ==, true);
+    std::vector<read_packet> packets;
+    pcap_loop(
+        pcap, -1 /*cnt*/,
+        [](u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) {
+            ((std::vector<read_packet> *)user)->push_back({timeval_to_unixtime(h->ts), h->len, std::string((char const *)bytes, h->caplen)});
+        },
+        (u_char *)&packets);
+    pcap_close(pcap);
+    return packets;
+}
+
+template <typename pod_type> void append_pod(std::string &file, pod_type const &pod) { file.append(reinterpret_cast<char const *>(&pod), sizeof(pod)); }
+
+void append_swapped(std::string &file, uint32_t value) { append_pod(file, __builtin_bswap32(value)); }
+
+// a pcapng block of the host's byte order, padding body to a multiple of four bytes
+void append_pcapng_block(std::string &file, uint32_t type, std::string body) {
+    body.resize((body.size() + 3) / 4 * 4);
+    auto len = uint32_t(body.size() + 12);
+    append_pod(file, type);
+    append_pod(file, len);
+    file += body;
+    append_pod(file, len);
+}
+
+std::string pcapng_interface(uint16_t linktype, uint8_t tsresol) {
+    std::string body;
+    append_pod(body, linktype);
+    append_pod(body, uint16_t(0));
+    append_pod(body, uint32_t(65535));
+    append_pod(body, uint16_t(9));
+    append_pod(body, uint16_t(1));
+    append_pod(body, uint32_t(tsresol));
+    append_pod(body, uint32_t(0));
+    return body;
+}
+
+std::string pcapng_enhanced_packet(uint32_t interface_id, uint64_t timestamp, std::string const &packet) {
+    std::string body;
+    for (uint32_t value : {interface_id, uint32_t(timestamp >> 32), uint32_t(timestamp), uint32_t(packet.size()), uint32_t(packet.size() + 4)}) {
+        append_pod(body, value);
+    }
+    return body + packet;
+}
+
+void write_file(std::string const &filename, std::string const &contents) { std::ofstream(filename, std::ios::binary) << contents; }
+
+std::string const packet_a = synthetic_udp_packet(macaddr{{2, 0, 0, 0, 0, 1}}, macaddr{{2, 0, 0, 0, 0, 2}}, htonl(0x0a000001), htonl(0x0a000002), 1, 2, "a");
+std::string const packet_b = synthetic_arp_reply_packet(macaddr{{2, 0, 0, 0, 0, 3}}, htonl(0x0a000003), macaddr{{2, 0, 0, 0, 0, 4}}, htonl(0x0a000004));
+} // namespace
+
+TEST(network_pcap_file_suite, matches_libpcap) {
+    auto packets = read_with_mmap("testdata/dns_lookup.pcap");
+    rebootping_test_check(packets.size(), >, 0);
+    rebootping_test_check(packets, ==, read_with_libpcap("testdata/dns_lookup.pcap"));
+
+    // passing the release size many times over on the way through
+    tmpdir tmpdir;
+    auto filename = tmpdir.tmpdir_name + "/generated.pcap";
+    network_traffic_mix mix;
+    mix.traffic_packets = 5000;
+    network_traffic_generate_pcap(filename, mix);
+    setenv("network_pcap_file_release_bytes", "8192", 1);
+    auto generated = read_with_mmap(filename);
+    unsetenv("network_pcap_file_release_bytes");
+    rebootping_test_check(generated.size(), ==, mix.traffic_packets);
+    rebootping_test_check(generated == read_with_libpcap(filename), ==, true);
+}
+
+TEST(network_pcap_file_suite, reads_swapped_nanosecond_pcap) {
+    tmpdir tmpdir;
+    std::string file;
+    for (uint32_t value : {0xa1b23c4du, 0x00040002u, 0u, 0u, 65535u, uint32_t(DLT_EN10MB)}) { append_swapped(file, value); }
+    // the version is two shorts, swapped as a pair above
+    file.replace(4, 4, "\x00\x02\x00\x04", 4);
+    for (uint32_t value : {1700000000u, 250000000u, uint32_t(packet_a.size()), uint32_t(packet_a.size() + 10)}) { append_swapped(file, value); }
+    file += packet_a;
+    write_file(tmpdir.tmpdir_name + "/swapped.pcap", file);
+
+    auto packets = read_with_mmap(tmpdir.tmpdir_name + "/swapped.pcap");
+    rebootping_test_check(packets, ==, (std::vector<read_packet>{{1700000000.25, uint32_t(packet_a.size() + 10), packet_a}}));
+}
+
+TEST(network_pcap_file_suite, reads_pcapng) {
+    tmpdir tmpdir;
+    std::string file;
+    std::string section;
+    append_pod(section, uint32_t(0x1a2b3c4d));
+    append_pod(section, uint16_t(1));
+    append_pod(section, uint16_t(0));
+    append_pod(section, int64_t(-1));
+    append_pcapng_block(file, 0x0a0d0d0a, section);
+    // nanoseconds, then a raw IP interface whose packets are skipped
+    append_pcapng_block(file, 1, pcapng_interface(DLT_EN10MB, 9));
+    append_pcapng_block(file, 1, pcapng_interface(101, 6));
+    append_pcapng_block(file, 6, pcapng_enhanced_packet(0, 1700000000500000000ull, packet_a));
+    append_pcapng_block(file, 6, pcapng_enhanced_packet(1, 1700000000000000ull, packet_b));
+    // an interface statistics block, which tells the analyzers nothing
+    append_pcapng_block(file, 5, std::string(16, '\0'));
+    std::string simple;
+    append_pod(simple, uint32_t(packet_b.size()));
+    append_pcapng_block(file, 3, simple + packet_b);
+    write_file(tmpdir.tmpdir_name + "/capture.pcapng", file);
+
+    network_pcap_file reader(tmpdir.tmpdir_name + "/capture.pcapng");
+    std::vector<read_packet> packets;
+    pcap_pkthdr h;
+    const u_char *bytes;
+    while (reader.pcap_next_packet(h, bytes)) { packets.push_back({timeval_to_unixtime(h.ts), h.len, std::string((char const *)bytes, h.caplen)}); }
+    rebootping_test_check(packets, ==,
+                          (std::vector<read_packet>{{1700000000.5, uint32_t(packet_a.size() + 4), packet_a}, {0, uint32_t(packet_b.size()), packet_b}}));
+    rebootping_test_check(reader.pcap_skipped_packets, ==, 1);
+}
+
+TEST(network_pcap_file_suite, truncated_after_good_packets) {
+    tmpdir tmpdir;
+    std::string file;
+    for (uint32_t value : {0xa1b2c3d4u, 0x00040002u, 0u, 0u, 65535u, uint32_t(DLT_EN10MB)}) { append_pod(file, value); }
+    for (auto &&packet : {packet_a, packet_b}) {
+        for (uint32_t value : {1700000000u, 0u, uint32_t(packet.size()), uint32_t(packet.size())}) { append_pod(file, value); }
+        file += packet;
+    }
+    file.resize(file.size() - 1);
+    write_file(tmpdir.tmpdir_name + "/truncated.pcap", file);
+
+    network_pcap_file reader(tmpdir.tmpdir_name + "/truncated.pcap");
+    pcap_pkthdr h;
+    const u_char *bytes;
+    rebootping_test_check(reader.pcap_next_packet(h, bytes), ==, true);
+    rebootping_test_check(std::string((char const *)bytes, h.caplen), ==, packet_a);
+    try {
+        reader.pcap_next_packet(h, bytes);
+        rebootping_test_fail("network_pcap_file returned a truncated packet");
+    } catch (std::runtime_error const &e) { rebootping_test_check(std::string(e.what()).find("truncated in a packet"), !=, std::string::npos); }
+}
@@ -0,0 +1,43 @@
+#include "env.hpp"
+#include "network_interface_watcher.hpp"
+#include "network_traffic_generator.hpp"
+#include "rebootping_test.hpp"
+
+#include <filesystem>
+#include <iostream>
+
+// Replays a capture through the dumping and learning of a live interface and reports packets per second and where
+// the time went. Not run by ctest: run network_replay_bench directly. network_replay_bench_pcap names a capture to
+// replay, otherwise one is generated from the traffic_ env vars of network_traffic_mix_from_env.
+// network_replay_bench_speed 0 replays as fast as possible, 1 at the pace of the capture.
+// network_replay_bench_interface names the interface the packets are replayed as.
+// The per-MAC dumps and the records go to a tmpdir that is removed afterwards.
+
+int main() {
+    tmpdir tmpdir;
+    setenv("rebootping_records_dir", (tmpdir.tmpdir_name + "/records").c_str(), 1);
+    std::filesystem::create_directories(tmpdir.tmpdir_name + "/records");
+
+    auto filename = env("network_replay_bench_pcap", "");
+    if (filename.empty()) {
+        filename = tmpdir.tmpdir_name + "/network_replay_bench.pcap";
+        auto mix = network_traffic_mix_from_env();
+        auto generated = network_traffic_generate_pcap(filename, mix);
+        std::cout << "network_replay_bench generated " << generated << " packets " << std::filesystem::file_size(filename) << " bytes" << std::endl;
+    } else {
+        filename = std::filesystem::absolute(filename).string();
+    }
+
+    network_interface_replay_settings settings;
+    settings.replay_interface_name = env("network_replay_bench_interface", settings.replay_interface_name);
+    settings.replay_speed = env("network_replay_bench_speed", settings.replay_speed);
+
+    auto cwd = std::filesystem::current_path();
+    std::filesystem::create_directories(tmpdir.tmpdir_name + "/dumps");
+    std::filesystem::current_path(tmpdir.tmpdir_name + "/dumps");
+    auto report = network_interface_watcher_replay_pcap_file(filename, settings);
+    std::filesystem::current_path(cwd);
+
+    network_interface_replay_report_dump(std::cout, report);
+    return 0;
+}
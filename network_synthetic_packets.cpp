@@ -0,0 +1,150 @@
+#include "network_synthetic_packets.hpp"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+template <typename pod_type> void append_pod(std::string &packet, pod_type const &pod) { packet.append(reinterpret_cast<char const *>(&pod), sizeof(pod)); }
+
+void append_ether(std::string &packet, macaddr src, macaddr dst, uint16_t type_or_len) {
+    append_pod(packet, ether_header{.ether_dhost = dst, .ether_shost = src, .ether_type_or_len = htons(type_or_len)});
+}
+
+uint16_t ip_checksum(ip_header const &ip) {
+    uint32_t sum = 0;
+    auto const *words = reinterpret_cast<uint16_t const *>(&ip);
+    for (size_t i = 0; sizeof(ip) / 2 > i; ++i) { sum += words[i]; }
+    while (sum >> 16) { sum = (sum & 0xffff) + (sum >> 16); }
+    return uint16_t(~sum);
+}
+
+std::string ip_packet(macaddr src, macaddr dst, network_addr src_addr, network_addr dst_addr, ip_protocol protocol, std::string_view ip_payload) {
+    std::string packet;
+    packet.reserve(sizeof(ether_header) + sizeof(ip_header) + ip_payload.size());
+    append_ether(packet, src, dst, uint16_t(ether_type::IPv4));
+    ip_header ip{};
+    ip.ip_vhl = 0x45;
+    ip.ip_len = htons(uint16_t(sizeof(ip_header) + ip_payload.size()));
+    ip.ip_ttl = 64;
+    ip.ip_p = uint8_t(protocol);
+    ip.ip_src.s_addr = src_addr;
+    ip.ip_dst.s_addr = dst_addr;
+    ip.ip_sum = ip_checksum(ip);
+    append_pod(packet, ip);
+    packet.append(ip_payload);
+    return packet;
+}
+
+void append_uint16(std::string &packet, uint16_t value) { append_pod(packet, htons(value)); }
+
+void append_dns_name(std::string &packet, std::string_view name) {
+    while (!name.empty()) {
+        auto label = name.substr(0, name.find('.'));
+        packet.push_back(char(label.size()));
+        packet.append(label);
+        name.remove_prefix(std::min(name.size(), label.size() + 1));
+    }
+    packet.push_back(0);
+}
+} // namespace
+
+std::string synthetic_tcp_packet(macaddr src, macaddr dst, network_addr src_addr, network_addr dst_addr, uint16_t sport, uint16_t dport, uint8_t flags,
+                                 std::string_view payload) {
+    std::string segment;
+    append_pod(segment, tcp_header{.th_sport = htons(sport), .th_dport = htons(dport), .th_offx2 = 5 << 4, .th_flags = flags, .th_win = htons(65535)});
+    segment.append(payload);
+    return ip_packet(src, dst, src_addr, dst_addr, ip_protocol::TCP, segment);
+}
+
+std::string synthetic_udp_packet(macaddr src, macaddr dst, network_addr src_addr, network_addr dst_addr, uint16_t sport, uint16_t dport,
+                                 std::string_view payload) {
+    std::string datagram;
+    append_pod(datagram, udp_header{.uh_sport = htons(sport), .uh_dport = htons(dport), .uh_len = htons(uint16_t(sizeof(udp_header) + payload.size()))});
+    datagram.append(payload);
+    return ip_packet(src, dst, src_addr, dst_addr, ip_protocol::UDP, datagram);
+}
+
+std::string synthetic_dns_response_packet(macaddr resolver, macaddr client, network_addr resolver_addr, network_addr client_addr, std::string_view hostname,
+                                          std::vector<synthetic_dns_answer> const &answers) {
+    std::string message;
+    append_pod(message, dns_header{.dns_id = htons(uint16_t(hostname.size())), .dns_flags = htons(0x8180), .dns_questions = htons(1),
+                                   .dns_answers = htons(uint16_t(answers.size()))});
+    append_dns_name(message, hostname);
+    append_uint16(message, uint16_t(dns_qtype::DNS_QTYPE_A));
+    append_uint16(message, uint16_t(dns_qclass::DNS_QCLASS_INET));
+    // the question name, just after the header
+    uint16_t owner_offset = sizeof(dns_header);
+    for (auto &&answer : answers) {
+        append_uint16(message, 0xc000 | owner_offset);
+        append_uint16(message, uint16_t(answer.answer_qtype));
+        append_uint16(message, uint16_t(dns_qclass::DNS_QCLASS_INET));
+        append_pod(message, htonl(300));
+        std::string rdata;
+        switch (answer.answer_qtype) {
+        case dns_qtype::DNS_QTYPE_MX:
+            append_uint16(rdata, 10);
+            append_dns_name(rdata, answer.answer_name);
+            break;
+        case dns_qtype::DNS_QTYPE_CNAME: append_dns_name(rdata, answer.answer_name); break;
+        case dns_qtype::DNS_QTYPE_AAAA: append_pod(rdata, answer.answer_addr6); break;
+        default: append_pod(rdata, answer.answer_addr); break;
+        }
+        append_uint16(message, uint16_t(rdata.size()));
+        if (answer.answer_qtype == dns_qtype::DNS_QTYPE_CNAME) { owner_offset = uint16_t(message.size()); }
+        message.append(rdata);
+    }
+    return synthetic_udp_packet(resolver, client, resolver_addr, client_addr, 53, uint16_t(20000 + hostname.size()), message);
+}
+
+std::string synthetic_arp_reply_packet(macaddr sender, network_addr sender_addr, macaddr target, network_addr target_addr) {
+    std::string packet;
+    append_ether(packet, sender, target, uint16_t(ether_type::ARP));
+    arp_header arp{.arp_htype = htons(1),
+                   .arp_ptype = htons(uint16_t(ether_type::IPv4)),
+                   .arp_hlen = ETH_ALEN,
+                   .arp_plen = sizeof(in_addr),
+                   .arp_oper = htons(uint16_t(arp_operation::ARP_REPLY)),
+                   .arp_sender = sender,
+                   .arp_spa = in_addr{sender_addr},
+                   .arp_target = target,
+                   .arp_tpa = in_addr{target_addr}};
+    append_pod(packet, arp);
+    return packet;
+}
+
+std::string synthetic_stp_bpdu_packet(macaddr bridge) {
+    std::string packet;
+    // 802.1D BPDUs go to the bridge group address, with the frame length in place of an ether_type
+    append_ether(packet, bridge, macaddr{{0x01, 0x80, 0xc2, 0x00, 0x00, 0x00}}, 38);
+    append_pod(packet, llc_stp_bpdu{.llc_dsap = llc_lsap::LLC_LSAP_STP,
+                                    .llc_ssap = llc_lsap::LLC_LSAP_STP,
+                                    .llc_control = llc_ctrl::LLC_CTRL_STP,
+                                    .stp_root = htons(0x8000),
+                                    .stp_root_macaddr = bridge,
+                                    .stp_bridge = htons(0x8000),
+                                    .stp_bridge_macaddr = bridge});
+    // the port identifier, then message age, max age, hello time and forward delay in 1/256 seconds
+    append_uint16(packet, 0x8001);
+    for (uint16_t seconds : {0, 20, 2, 15}) { append_uint16(packet, seconds * 256); }
+    return packet;
+}
+
+std::string synthetic_icmp_packet(macaddr src, macaddr dst, network_addr src_addr, network_addr dst_addr, icmp_type type,
+                                  rebootping_icmp_payload const &payload) {
+    std::string message;
+    icmp_header icmp{};
+    icmp.icmp_type = uint8_t(type);
+    append_pod(message, icmp);
+    append_pod(message, payload);
+    return ip_packet(src, dst, src_addr, dst_addr, ip_protocol::ICMP, message);
+}
+
+pcap_pkthdr synthetic_pkthdr(double unixtime, std::string_view packet) {
+    pcap_pkthdr h{};
+    h.ts.tv_sec = time_t(unixtime);
+    h.ts.tv_usec = suseconds_t(std::fmod(unixtime, 1.0) * 1e6);
+    h.caplen = h.len = uint32_t(packet.size());
+    return h;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "network_flat_records.hpp"
+#include "ping_record_store.hpp"
+#include "wire_layout.hpp"
+
+#include <netinet/in.h>
+#include <pcap/pcap.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Ethernet frames of each kind network_interface_watcher learns from, for benchmarks and generated captures.
+// Ports are in host order; network_addr is in network order as everywhere else.
+
+struct synthetic_dns_answer {
+    dns_qtype answer_qtype;
+    // for DNS_QTYPE_A
+    network_addr answer_addr;
+    // the exchange for DNS_QTYPE_MX, the canonical name for DNS_QTYPE_CNAME
+    std::string answer_name;
+    // for DNS_QTYPE_AAAA
+    in6_addr answer_addr6{};
+};
+
+std::string synthetic_tcp_packet(macaddr src, macaddr dst, network_addr src_addr, network_addr dst_addr, uint16_t sport, uint16_t dport, uint8_t flags,
+                                 std::string_view payload = {});
+std::string synthetic_udp_packet(macaddr src, macaddr dst, network_addr src_addr, network_addr dst_addr, uint16_t sport, uint16_t dport,
+                                 std::string_view payload = {});
+// a reply from port 53 answering hostname, whose answers name it through a compression pointer, or after a CNAME
+// answer name its canonical name through a pointer into that answer
+std::string synthetic_dns_response_packet(macaddr resolver, macaddr client, network_addr resolver_addr, network_addr client_addr, std::string_view hostname,
+                                          std::vector<synthetic_dns_answer> const &answers);
+std::string synthetic_arp_reply_packet(macaddr sender, network_addr sender_addr, macaddr target, network_addr target_addr);
+std::string synthetic_stp_bpdu_packet(macaddr bridge);
+std::string synthetic_icmp_packet(macaddr src, macaddr dst, network_addr src_addr, network_addr dst_addr, icmp_type type,
+                                  rebootping_icmp_payload const &payload);
+
+pcap_pkthdr synthetic_pkthdr(double unixtime, std::string_view packet);
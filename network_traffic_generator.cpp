@@ -0,0 +1,152 @@
+#include "network_traffic_generator.hpp"
+
+#include "env.hpp"
+#include "make_unique_ptr_closer.hpp"
+#include "network_synthetic_packets.hpp"
+#include "now_unixtime.hpp"
+
+#include <pcap/pcap.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace {
+network_addr traffic_addr(uint64_t i) { return htonl((10u << 24) + (47u << 16) + uint32_t(i & 0xffff)); }
+
+struct traffic_generator {
+    network_traffic_mix const &mix;
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> uniform{0, 1};
+    std::discrete_distribution<int> kinds;
+    std::exponential_distribution<double> interarrival;
+    std::string filler = std::string(1500, 'x');
+    std::string domain = str(".net", unsigned(mix.traffic_network), ".example.com");
+    macaddr router = traffic_macaddr(0xffff);
+    network_addr router_addr = traffic_addr(0xfffe);
+
+    explicit traffic_generator(network_traffic_mix const &m)
+        : mix(m), rng(m.traffic_seed),
+          kinds({m.traffic_tcp_synack, m.traffic_tcp_other, m.traffic_udp, m.traffic_dns, m.traffic_arp, m.traffic_stp, m.traffic_icmp}),
+          interarrival(std::max(m.traffic_packets_per_second, 1e-9)) {}
+
+    // locally administered, so that the hosts cannot be mistaken for real ones
+    macaddr traffic_macaddr(uint64_t i) const { return macaddr{{0x02, mix.traffic_network, 0x00, uint8_t(i >> 16), uint8_t(i >> 8), uint8_t(i)}}; }
+
+    // most packets are from a few busy hosts
+    uint64_t skewed(uint64_t limit) { return std::min(uint64_t(double(limit) * std::pow(uniform(rng), 4)), limit - 1); }
+    uint64_t host() { return skewed(std::clamp(mix.traffic_macaddrs, uint64_t{1}, uint64_t{0xfff0})); }
+
+    // mostly bare acks and full segments, as on a bulk transfer
+    std::string_view tcp_payload() {
+        auto u = uniform(rng);
+        if (u < 0.5) { return {}; }
+        if (u < 0.9) { return std::string_view(filler).substr(0, 1448); }
+        return std::string_view(filler).substr(0, 1 + skewed(1448));
+    }
+
+    std::string_view udp_payload() { return std::string_view(filler).substr(0, 20 + skewed(492)); }
+
+    // the slot and cookie are random, and the replay prepares each ping in its own ping_record_store
+    rebootping_icmp_payload ping_payload(double unixtime) { return {.ping_slot = rng(), .ping_cookie = rng(), .ping_start_unixtime = unixtime}; }
+
+    // appends one or, for a ping and its reply, two packets
+    void generate(std::vector<std::string> &packets, uint64_t remaining, double unixtime) {
+        static std::array<uint16_t, 6> const server_ports{443, 80, 22, 993, 8080, 5223};
+        auto h = host();
+        auto port = server_ports[skewed(server_ports.size())];
+        auto client_port = uint16_t(32768 + rng() % 28000);
+        switch (kinds(rng)) {
+        case 0:
+            packets.push_back(synthetic_tcp_packet(traffic_macaddr(h), router, traffic_addr(h), router_addr, port, client_port,
+                                                   uint8_t(tcp_flags::SYN) | uint8_t(tcp_flags::ACK)));
+            return;
+        case 1:
+            packets.push_back(synthetic_tcp_packet(router, traffic_macaddr(h), router_addr, traffic_addr(h), port, client_port,
+                                                   uint8_t(tcp_flags::ACK) | (rng() % 2 ? uint8_t(tcp_flags::PUSH) : 0), tcp_payload()));
+            return;
+        case 2:
+            packets.push_back(synthetic_udp_packet(router, traffic_macaddr(h), router_addr, traffic_addr(h), uint16_t(1 + skewed(1024)), client_port,
+                                                   udp_payload()));
+            return;
+        case 3: {
+            auto name = skewed(4096);
+            std::vector<synthetic_dns_answer> answers;
+            if (uniform(rng) < 0.2) {
+                answers.push_back({dns_qtype::DNS_QTYPE_MX, 0, str("mx", name % 16, domain)});
+            } else {
+                for (auto i = 1 + rng() % 3; i; --i) { answers.push_back({dns_qtype::DNS_QTYPE_A, htonl((93u << 24) + uint32_t(name * 4 + i)), {}}); }
+            }
+            packets.push_back(
+                synthetic_dns_response_packet(router, traffic_macaddr(h), router_addr, traffic_addr(h), str("host", name, domain), answers));
+            return;
+        }
+        case 4: packets.push_back(synthetic_arp_reply_packet(traffic_macaddr(h), traffic_addr(h), router, router_addr)); return;
+        case 5: packets.push_back(synthetic_stp_bpdu_packet(traffic_macaddr(h % 8))); return;
+        default:
+            // a ping is only sent when its reply fits too, so that replays see as many of each
+            if (remaining < 2) {
+                packets.push_back(synthetic_udp_packet(router, traffic_macaddr(h), router_addr, traffic_addr(h), 123, client_port, udp_payload()));
+                return;
+            }
+            auto payload = ping_payload(unixtime);
+            packets.push_back(synthetic_icmp_packet(router, traffic_macaddr(h), router_addr, traffic_addr(h), icmp_type::ECHO, payload));
+            packets.push_back(synthetic_icmp_packet(traffic_macaddr(h), router, traffic_addr(h), router_addr, icmp_type::ECHOREPLY, payload));
+            return;
+        }
+    }
+};
+} // namespace
+
+network_traffic_mix network_traffic_mix_from_env() {
+    network_traffic_mix mix;
+#define network_traffic_mix_env(field) mix.field = env(#field, mix.field)
+    network_traffic_mix_env(traffic_packets);
+    network_traffic_mix_env(traffic_macaddrs);
+    mix.traffic_network = uint8_t(env("traffic_network", unsigned(mix.traffic_network)));
+    network_traffic_mix_env(traffic_start_unixtime);
+    network_traffic_mix_env(traffic_packets_per_second);
+    network_traffic_mix_env(traffic_tcp_synack);
+    network_traffic_mix_env(traffic_tcp_other);
+    network_traffic_mix_env(traffic_udp);
+    network_traffic_mix_env(traffic_dns);
+    network_traffic_mix_env(traffic_arp);
+    network_traffic_mix_env(traffic_stp);
+    network_traffic_mix_env(traffic_icmp);
+    network_traffic_mix_env(traffic_seed);
+#undef network_traffic_mix_env
+    return mix;
+}
+
+uint64_t network_traffic_generate_pcap(std::string const &filename, network_traffic_mix const &mix) {
+    auto pcap = make_unique_ptr_closer(pcap_open_dead(DLT_EN10MB, 65535), [](pcap_t *p) {
+        if (p) { pcap_close(p); }
+    });
+    if (!pcap) { throw std::runtime_error(str("network_traffic_generate_pcap pcap_open_dead failed for ", filename)); }
+    auto dumper = make_unique_ptr_closer(pcap_dump_open(pcap.get(), filename.c_str()), [](pcap_dumper_t *d) {
+        if (d) { pcap_dump_close(d); }
+    });
+    if (!dumper) { throw std::runtime_error(str("network_traffic_generate_pcap pcap_dump_open failed on ", filename, ": ", pcap_geterr(pcap.get()))); }
+
+    traffic_generator generator(mix);
+    auto unixtime = mix.traffic_start_unixtime;
+    if (unixtime <= 0) { unixtime = now_unixtime() - double(mix.traffic_packets) / std::max(mix.traffic_packets_per_second, 1e-9); }
+    std::vector<std::string> packets;
+    uint64_t written = 0;
+    while (mix.traffic_packets > written) {
+        packets.clear();
+        unixtime += generator.interarrival(generator.rng);
+        // a ping's payload carries the time of its ECHO, the first of the packets
+        generator.generate(packets, mix.traffic_packets - written, unixtime);
+        for (auto &&packet : packets) {
+            if (&packet != &packets.front()) { unixtime += generator.interarrival(generator.rng); }
+            auto h = synthetic_pkthdr(unixtime, packet);
+            pcap_dump((u_char *)dumper.get(), &h, (u_char const *)packet.data());
+            ++written;
+        }
+    }
+    if (pcap_dump_flush(dumper.get())) { throw std::runtime_error(str("network_traffic_generate_pcap pcap_dump_flush failed on ", filename)); }
+    return written;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Writes a capture of LAN traffic made of the synthetic packets, for replaying through network_interface_watcher.
+// A few hosts make most of the traffic, as on a real network, and packets carry payloads of the usual sizes.
+struct network_traffic_mix {
+    uint64_t traffic_packets = 100000;
+    uint64_t traffic_macaddrs = 4096;
+    // distinguishes the hosts and names of separately generated networks, whose private addresses may overlap
+    uint8_t traffic_network = 0x47;
+    // 0 starts the capture traffic_packets / traffic_packets_per_second before now
+    double traffic_start_unixtime = 0;
+    double traffic_packets_per_second = 10000;
+
+    // relative weights of the kinds of packet
+    double traffic_tcp_synack = 5;
+    double traffic_tcp_other = 50;
+    double traffic_udp = 20;
+    double traffic_dns = 10;
+    double traffic_arp = 5;
+    double traffic_stp = 1;
+    double traffic_icmp = 2;
+
+    uint64_t traffic_seed = 1;
+};
+
+// each field from the env var of its own name, defaulting to the above
+network_traffic_mix network_traffic_mix_from_env();
+
+// returns the number of packets written
+uint64_t network_traffic_generate_pcap(std::string const &filename, network_traffic_mix const &mix);
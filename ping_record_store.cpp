@@ -2,8 +2,10 @@
 
 #include "flat_metrics.hpp"
 #include "network_flat_records.hpp"
+#include "ping_rollup_store.hpp"
 #include "rebootping_records_dir.hpp"
 
+#include <algorithm>
 #include <mutex>
 
 namespace {
@@ -39,6 +41,7 @@ void ping_record_store_prepare(sockaddr const &src_addr, sockaddr const &dst_add
         last_ping.ping_slot() = ping_payload.ping_slot;
         last_ping.ping_start_unixtime() = ping_payload.ping_start_unixtime;
     }
+    ping_rollup_notice_sent(ping_if, dst_network_addr, ping_payload.ping_start_unixtime);
 }
 
 void ping_record_store_process_one_icmp_packet(const struct pcap_pkthdr *h, const u_char *bytes) {
@@ -49,13 +52,13 @@ void ping_record_store_process_one_icmp_packet(const struct pcap_pkthdr *h, cons
 
     const auto &ping_payload = *packet;
     ++flat_metric().ping_record_store_process_packet_packets;
-    auto lock = write_locked_reference(ping_record_store());
+    auto lock = flat_metrics_write_locked(ping_record_store());
     auto *timeshard = lock->unixtime_to_timeshard(ping_payload.ping_start_unixtime);
     if (!timeshard) {
         ++flat_metric().ping_record_store_process_packet_missing_timeshard;
         return;
     }
-    if (timeshard->timeshard_header_ref().flat_timeshard_index_next <= ping_payload.ping_slot) {
+    if (timeshard->flat_timeshard_index_next() <= ping_payload.ping_slot) {
         ++flat_metric().ping_record_store_process_packet_overflow_timeshard;
         return;
     }
@@ -68,11 +71,18 @@ void ping_record_store_process_one_icmp_packet(const struct pcap_pkthdr *h, cons
     switch (packet->icmp_type) {
     case (uint8_t)icmp_type::ECHO:
         record.ping_sent_seconds() = now_unixtime() - record.ping_start_unixtime();
+        lock->flat_record_updated(record);
         ++flat_metric().ping_record_store_process_packet_icmp_echo;
         break;
     case (uint8_t)icmp_type::ECHOREPLY:
-        record.ping_recv_seconds() = now_unixtime() - record.ping_start_unixtime();
         ++flat_metric().ping_record_store_process_packet_icmp_echoreply;
+        // a duplicated reply is not counted again in the rollups
+        if (!std::isnan(record.ping_recv_seconds())) { break; }
+        record.ping_recv_seconds() = now_unixtime() - record.ping_start_unixtime();
+        lock->flat_record_updated(record);
+        flat_metric().ping_rtt_microseconds.histogram_record(uint64_t(std::max(0.0, record.ping_recv_seconds()) * 1e6));
+        ping_rollup_notice_reply(record.ping_interface().operator std::string_view(), record.ping_dest_addr(), record.ping_start_unixtime(),
+                                 record.ping_recv_seconds());
         break;
     default: break;
     }
@@ -92,3 +102,21 @@ locked_reference<unanswered_ping_record> &unanswered_ping_record_store() {
     static locked_holder<unanswered_ping_record> store(rebootping_records_dir());
     return store;
 }
+
+void ping_record_stores_seal_before(double unixtime) {
+    write_locked_reference(last_ping_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(unanswered_ping_record_store())->seal_timeshards_before(unixtime);
+    ping_rollup_stores_seal_before(unixtime);
+}
+
+flat_column_groups ping_record_interface_summary(double start_unixtime, double end_unixtime, double bucket_seconds) {
+    using schema = ping_record::flat_record_schema_type;
+    flat_column_groups groups;
+    auto store = read_locked_reference(ping_record_store());
+    for (auto &&chunk : store->timeshard_column_chunks<schema::ping_start_unixtime, schema::ping_recv_seconds, schema::ping_interface>(
+             start_unixtime, end_unixtime)) {
+        auto &&[start_times, recv_seconds, interfaces] = chunk.chunk_columns;
+        flat_column_group_stats(*chunk.chunk_timeshard, interfaces, start_times, recv_seconds, bucket_seconds, start_unixtime, end_unixtime, groups);
+    }
+    return groups;
+}
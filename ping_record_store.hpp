@@ -1,6 +1,7 @@
 #pragma once
 
 #include "file_contents_cache.hpp"
+#include "flat_column_scan.hpp"
 #include "limited_pcap_dumper.hpp"
 #include "locked_reference.hpp"
 #include "network_flat_records.hpp"
@@ -44,3 +45,9 @@ locked_reference<last_ping_record> &last_ping_record_store();
 
 define_flat_record(unanswered_ping_record, (double, ping_start_unixtime), (uint64_t, ping_slot), (flat_index_linked_field<if_ip_lookup>, ping_if_ip_index), );
 locked_reference<unanswered_ping_record> &unanswered_ping_record_store();
+
+void ping_record_stores_seal_before(double unixtime);
+
+// Pings sent per interface per bucket_seconds in [start_unixtime, end_unixtime): the NaN fraction of
+// ping_recv_seconds is the loss rate and the stats of the rest are reply times
+flat_column_groups ping_record_interface_summary(double start_unixtime, double end_unixtime, double bucket_seconds);
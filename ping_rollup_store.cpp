@@ -0,0 +1,135 @@
+#include "ping_rollup_store.hpp"
+
+#include "flat_metrics.hpp"
+#include "rebootping_records_dir.hpp"
+
+#include <cmath>
+#include <optional>
+
+int ping_rtt_histogram::histogram_bucket(double seconds) {
+    if (!(seconds > histogram_first_upper_seconds)) { return 0; }
+    return std::min(int(std::ceil(std::log2(seconds / histogram_first_upper_seconds))), histogram_bucket_count - 1);
+}
+
+double ping_rtt_histogram::histogram_bucket_lower_seconds(int bucket) { return bucket ? std::ldexp(histogram_first_upper_seconds, bucket - 1) : 0; }
+
+double ping_rtt_histogram::histogram_bucket_upper_seconds(int bucket) { return std::ldexp(histogram_first_upper_seconds, bucket); }
+
+void ping_rtt_histogram::histogram_add(double seconds) { ++histogram_counts[histogram_bucket(seconds)]; }
+
+double ping_rtt_histogram::histogram_quantile(double quantile) const {
+    uint64_t total = 0;
+    for (auto count : histogram_counts) { total += count; }
+    if (!total) { return std::nan(""); }
+    auto target = quantile * double(total);
+    uint64_t below = 0;
+    for (int bucket = 0; histogram_bucket_count > bucket; ++bucket) {
+        auto count = histogram_counts[bucket];
+        if (count && double(below + count) >= target) {
+            auto lower = histogram_bucket_lower_seconds(bucket);
+            return lower + (histogram_bucket_upper_seconds(bucket) - lower) * std::max(0.0, target - double(below)) / double(count);
+        }
+        below += count;
+    }
+    return histogram_bucket_upper_seconds(histogram_bucket_count - 1);
+}
+
+std::string escape_json(ping_rtt_histogram const &histogram) {
+    std::string json = "[";
+    for (int bucket = 0; ping_rtt_histogram::histogram_bucket_count > bucket; ++bucket) {
+        if (bucket) { json += ", "; }
+        json += std::to_string(histogram.histogram_counts[bucket]);
+    }
+    return json + "]";
+}
+
+locked_reference<ping_rollup_minute_record> &ping_rollup_minute_record_store() {
+    static locked_holder<ping_rollup_minute_record> store(rebootping_records_dir());
+    return store;
+}
+
+locked_reference<ping_rollup_hour_record> &ping_rollup_hour_record_store() {
+    static locked_holder<ping_rollup_hour_record> store(rebootping_records_dir());
+    return store;
+}
+
+locked_reference<ping_rollup_day_record> &ping_rollup_day_record_store() {
+    static locked_holder<ping_rollup_day_record> store(rebootping_records_dir());
+    return store;
+}
+
+namespace {
+
+// Rows for a key are linked newest first, and a reply can come after the next row for its key was added,
+// so the walk stops at the first row older than the one wanted
+template <typename rollup_type>
+std::optional<typename rollup_type::timeshard_iterator_type> ping_rollup_find_row(rollup_type &store, std::string_view ping_interface, network_addr dest_addr,
+                                                                                    double rollup_start_unixtime) {
+    for (auto &&row : store.rollup_if_ip_index(std::make_pair(ping_interface, dest_addr), rollup_start_unixtime, rollup_start_unixtime)) {
+        if (row.rollup_start_unixtime() == rollup_start_unixtime) { return row; }
+        if (row.rollup_start_unixtime() < rollup_start_unixtime) { break; }
+    }
+    return std::nullopt;
+}
+
+template <typename rollup_type>
+void ping_rollup_tier_notice_sent(locked_reference<rollup_type> &rollup_store, double rollup_seconds, std::string_view ping_interface, network_addr dest_addr,
+                                  double ping_start_unixtime) {
+    auto rollup_start_unixtime = std::floor(ping_start_unixtime / rollup_seconds) * rollup_seconds;
+    auto store = write_locked_reference(rollup_store);
+    auto row = ping_rollup_find_row(*store, ping_interface, dest_addr, rollup_start_unixtime);
+    if (!row) {
+        row = store->add_flat_record(rollup_start_unixtime, [&](auto &&r) {
+            r.rollup_start_unixtime() = rollup_start_unixtime;
+            r.rollup_interface() = ping_interface;
+            r.rollup_dest_addr() = dest_addr;
+            r.rollup_sent() = 0;
+            r.rollup_replied() = 0;
+            r.rollup_rtt_min() = std::nan("");
+            r.rollup_rtt_sum() = 0;
+            r.rollup_rtt_max() = std::nan("");
+            r.rollup_rtt_histogram() = ping_rtt_histogram{};
+            r.flat_iterator_timeshard->rollup_if_ip_index.index_linked_field_add(std::make_pair(ping_interface, dest_addr), r);
+        });
+    }
+    ++row->rollup_sent();
+    store->flat_record_updated(*row);
+}
+
+template <typename rollup_type>
+void ping_rollup_tier_notice_reply(locked_reference<rollup_type> &rollup_store, double rollup_seconds, std::string_view ping_interface, network_addr dest_addr,
+                                   double ping_start_unixtime, double recv_seconds) {
+    auto rollup_start_unixtime = std::floor(ping_start_unixtime / rollup_seconds) * rollup_seconds;
+    auto store = write_locked_reference(rollup_store);
+    auto row = ping_rollup_find_row(*store, ping_interface, dest_addr, rollup_start_unixtime);
+    if (!row) {
+        ++flat_metric().ping_rollup_reply_missing_row;
+        return;
+    }
+    ++row->rollup_replied();
+    row->rollup_rtt_min() = std::fmin(row->rollup_rtt_min(), recv_seconds);
+    row->rollup_rtt_sum() += recv_seconds;
+    row->rollup_rtt_max() = std::fmax(row->rollup_rtt_max(), recv_seconds);
+    row->rollup_rtt_histogram().histogram_add(recv_seconds);
+    store->flat_record_updated(*row);
+}
+
+} // namespace
+
+void ping_rollup_notice_sent(std::string_view ping_interface, network_addr dest_addr, double ping_start_unixtime) {
+    ping_rollup_tier_notice_sent(ping_rollup_minute_record_store(), 60, ping_interface, dest_addr, ping_start_unixtime);
+    ping_rollup_tier_notice_sent(ping_rollup_hour_record_store(), 60 * 60, ping_interface, dest_addr, ping_start_unixtime);
+    ping_rollup_tier_notice_sent(ping_rollup_day_record_store(), 24 * 60 * 60, ping_interface, dest_addr, ping_start_unixtime);
+}
+
+void ping_rollup_notice_reply(std::string_view ping_interface, network_addr dest_addr, double ping_start_unixtime, double recv_seconds) {
+    ping_rollup_tier_notice_reply(ping_rollup_minute_record_store(), 60, ping_interface, dest_addr, ping_start_unixtime, recv_seconds);
+    ping_rollup_tier_notice_reply(ping_rollup_hour_record_store(), 60 * 60, ping_interface, dest_addr, ping_start_unixtime, recv_seconds);
+    ping_rollup_tier_notice_reply(ping_rollup_day_record_store(), 24 * 60 * 60, ping_interface, dest_addr, ping_start_unixtime, recv_seconds);
+}
+
+void ping_rollup_stores_seal_before(double unixtime) {
+    write_locked_reference(ping_rollup_minute_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(ping_rollup_hour_record_store())->seal_timeshards_before(unixtime);
+    write_locked_reference(ping_rollup_day_record_store())->seal_timeshards_before(unixtime);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "flat_index_field.hpp"
+#include "flat_record.hpp"
+#include "locked_reference.hpp"
+#include "network_flat_records.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Counts of reply times in buckets that double in width from 100 microseconds, so that quantiles can be
+// estimated to within the width of a bucket from a fixed size field
+struct ping_rtt_histogram {
+    static constexpr double histogram_first_upper_seconds = 100e-6;
+    static constexpr int histogram_bucket_count = 24;
+    uint32_t histogram_counts[histogram_bucket_count];
+
+    static int histogram_bucket(double seconds);
+    static double histogram_bucket_lower_seconds(int bucket);
+    static double histogram_bucket_upper_seconds(int bucket);
+
+    void histogram_add(double seconds);
+    // NaN when empty, otherwise interpolated within the bucket that holds the quantile
+    [[nodiscard]] double histogram_quantile(double quantile) const;
+};
+
+// a JSON array of the counts
+std::string escape_json(ping_rtt_histogram const &histogram);
+
+// One row per interface, target and rollup_seconds, counting the pings started in it. Replies are added to
+// the row of the ping they answer, so rollup_sent - rollup_replied is the pings lost or still in flight.
+#define ping_rollup_record_fields                                                                                                                              \
+    (double, rollup_start_unixtime), (flat_bytes_interned_ptr, rollup_interface), (network_addr, rollup_dest_addr), (uint64_t, rollup_sent),                   \
+        (uint64_t, rollup_replied), (double, rollup_rtt_min), (double, rollup_rtt_sum), (double, rollup_rtt_max),                                              \
+        (ping_rtt_histogram, rollup_rtt_histogram), (flat_index_linked_field<if_ip_lookup>, rollup_if_ip_index)
+
+define_flat_record(ping_rollup_minute_record, ping_rollup_record_fields);
+define_flat_record(ping_rollup_hour_record, ping_rollup_record_fields);
+define_flat_record(ping_rollup_day_record, ping_rollup_record_fields);
+
+locked_reference<ping_rollup_minute_record> &ping_rollup_minute_record_store();
+locked_reference<ping_rollup_hour_record> &ping_rollup_hour_record_store();
+locked_reference<ping_rollup_day_record> &ping_rollup_day_record_store();
+
+// Called as each ping is sent and as each reply arrives, and keeps every tier up to date
+void ping_rollup_notice_sent(std::string_view ping_interface, network_addr dest_addr, double ping_start_unixtime);
+void ping_rollup_notice_reply(std::string_view ping_interface, network_addr dest_addr, double ping_start_unixtime, double recv_seconds);
+
+void ping_rollup_stores_seal_before(double unixtime);
+
+// the quantile of the reply times in a rollup row, kept within its minimum and maximum
+template <typename rollup_iterator> double ping_rollup_rtt_quantile(rollup_iterator const &rollup, double quantile) {
+    auto estimate = rollup.rollup_rtt_histogram().histogram_quantile(quantile);
+    return std::clamp(estimate, rollup.rollup_rtt_min(), rollup.rollup_rtt_max());
+}
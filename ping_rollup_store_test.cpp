@@ -0,0 +1,97 @@
+#include "flat_metrics.hpp"
+#include "ping_rollup_store.hpp"
+#include "rebootping_test.hpp"
+
+#include <arpa/inet.h>
+
+#include <sstream>
+
+struct rebootping_records_tmpdir : tmpdir {
+    rebootping_records_tmpdir() { setenv("rebootping_records_dir", tmpdir_name.c_str(), 1); }
+};
+[[maybe_unused]] rebootping_records_tmpdir global_rebootping_records_tmpdir;
+
+namespace {
+network_addr test_addr(uint8_t last) { return htonl(0x0a000000 | last); }
+
+template <typename rollup_type> std::vector<typename rollup_type::timeshard_iterator_type> rollup_rows(locked_reference<rollup_type> &rollup_store) {
+    std::vector<typename rollup_type::timeshard_iterator_type> rows;
+    auto store = read_locked_reference(rollup_store);
+    for (auto &&row : store->timeshard_query()) { rows.push_back(row); }
+    return rows;
+}
+} // namespace
+
+TEST(ping_rollup_store_suite, histogram_quantiles) {
+    ping_rtt_histogram histogram{};
+    rebootping_test_check(std::isnan(histogram.histogram_quantile(0.5)), ==, true);
+    rebootping_test_check(ping_rtt_histogram::histogram_bucket(0), ==, 0);
+    rebootping_test_check(ping_rtt_histogram::histogram_bucket(100e-6), ==, 0);
+    rebootping_test_check(ping_rtt_histogram::histogram_bucket(150e-6), ==, 1);
+    rebootping_test_check(ping_rtt_histogram::histogram_bucket(1e9), ==, ping_rtt_histogram::histogram_bucket_count - 1);
+    for (int i = 0; 90 > i; ++i) { histogram.histogram_add(0.010); }
+    for (int i = 0; 10 > i; ++i) { histogram.histogram_add(1.0); }
+    auto median = histogram.histogram_quantile(0.5), p99 = histogram.histogram_quantile(0.99);
+    rebootping_test_check(median, >=, 0.010 / 2);
+    rebootping_test_check(median, <=, 0.010 * 2);
+    rebootping_test_check(p99, >=, 1.0 / 2);
+    rebootping_test_check(p99, <=, 1.0 * 2);
+    rebootping_test_check(escape_json(histogram).starts_with("[0, 0, 0, 0, 0, 0, 0, 90, 0,"), ==, true);
+}
+
+TEST(ping_rollup_store_suite, sent_and_replies_across_tiers) {
+    const double day = 24 * 60 * 60, start = 30 * day + 23 * 60 * 60 + 59 * 60;
+    // four pings in the last minute of a day, four in the first minute of the next
+    for (int i = 0; 8 > i; ++i) { ping_rollup_notice_sent("eth0", test_addr(1), start + 15 * i); }
+    ping_rollup_notice_sent("wlan0", test_addr(1), start);
+    ping_rollup_notice_reply("eth0", test_addr(1), start, 0.020);
+    ping_rollup_notice_reply("eth0", test_addr(1), start + 15, 0.040);
+    // a late reply to the older minute after the next one has been started
+    ping_rollup_notice_reply("eth0", test_addr(1), start + 45, 0.030);
+    ping_rollup_notice_reply("eth0", test_addr(1), start + 60, 0.010);
+
+    auto missing_before = flat_metrics_sum().ping_rollup_reply_missing_row;
+    ping_rollup_notice_reply("eth0", test_addr(2), start, 0.010);
+    ping_rollup_notice_reply("eth0", test_addr(1), start - day, 0.010);
+    rebootping_test_check(flat_metrics_sum().ping_rollup_reply_missing_row - missing_before, ==, 2 * 3);
+
+    auto minutes = rollup_rows(ping_rollup_minute_record_store());
+    rebootping_test_check(minutes.size(), ==, 3);
+    auto find_row = [](auto &&rows, std::string_view iface, double rollup_start) {
+        for (auto &&row : rows) {
+            if (row.rollup_interface().operator std::string_view() == iface && row.rollup_start_unixtime() == rollup_start) { return row; }
+        }
+        throw std::runtime_error(str("no rollup row ", iface, " ", rollup_start));
+    };
+    auto first = find_row(minutes, "eth0", start);
+    rebootping_test_check(first.rollup_sent(), ==, 4);
+    rebootping_test_check(first.rollup_replied(), ==, 3);
+    rebootping_test_check(first.rollup_rtt_min(), ==, 0.020);
+    rebootping_test_check(first.rollup_rtt_max(), ==, 0.040);
+    rebootping_test_check(std::abs(first.rollup_rtt_sum() - 0.090), <, 1e-12);
+    auto median = ping_rollup_rtt_quantile(first, 0.5);
+    rebootping_test_check(median, >=, 0.020);
+    rebootping_test_check(median, <=, 0.040);
+    auto second = find_row(minutes, "eth0", start + 60);
+    rebootping_test_check(second.rollup_sent(), ==, 4);
+    rebootping_test_check(second.rollup_replied(), ==, 1);
+    rebootping_test_check(ping_rollup_rtt_quantile(second, 0.99), ==, 0.010);
+    auto wlan = find_row(minutes, "wlan0", start);
+    rebootping_test_check(wlan.rollup_sent(), ==, 1);
+    rebootping_test_check(wlan.rollup_replied(), ==, 0);
+    rebootping_test_check(std::isnan(ping_rollup_rtt_quantile(wlan, 0.5)), ==, true);
+
+    // the hour and day boundaries fall on the same minute
+    auto hours = rollup_rows(ping_rollup_hour_record_store());
+    rebootping_test_check(hours.size(), ==, 3);
+    rebootping_test_check(find_row(hours, "eth0", start - 59 * 60).rollup_replied(), ==, 3);
+    rebootping_test_check(find_row(hours, "eth0", start + 60).rollup_replied(), ==, 1);
+    auto days = rollup_rows(ping_rollup_day_record_store());
+    rebootping_test_check(days.size(), ==, 3);
+    rebootping_test_check(find_row(days, "eth0", 30 * day).rollup_sent(), ==, 4);
+    rebootping_test_check(find_row(days, "eth0", 31 * day).rollup_sent(), ==, 4);
+
+    std::ostringstream json;
+    flat_record_dump_as_json(json, days.front());
+    rebootping_test_check(json.str().find("\"rollup_rtt_histogram\": [0, "), !=, std::string::npos, json.str());
+}
@@ -0,0 +1,641 @@
+#include "cmake_variables.hpp"
+#include "env.hpp"
+#include "escape_json.hpp"
+#include "flat_hash.hpp"
+#include "flat_metrics.hpp"
+#include "network_dns_message.hpp"
+#include "network_flat_records.hpp"
+#include "network_interface_staging.hpp"
+#include "network_interface_watcher.hpp"
+#include "network_pcap_file.hpp"
+#include "network_synthetic_packets.hpp"
+#include "network_traffic_generator.hpp"
+#include "now_unixtime.hpp"
+#include "ping_health_decider.hpp"
+#include "ping_record_store.hpp"
+#include "ping_rollup_store.hpp"
+#include "rebootping_event.hpp"
+#include "rebootping_test.hpp"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Micro-benchmarks of the storage engine and the packet analyzers, for comparing builds before rolling them out.
+// Not run by ctest: run rebootping_bench directly. rebootping_bench_regex picks the groups to run by name,
+// rebootping_bench_scale multiplies the operation counts, and rebootping_bench_results names a file that each
+// result is appended to as a line of JSON. Inputs come from fixed seeds, so every build is given the same work.
+// Operations are timed in batches of rebootping_bench_batch, and the percentiles are of the time per operation
+// within a batch, so that reading the clock does not swamp the cheapest operations.
+
+namespace {
+constexpr double bench_unixtime = 1700000000;
+constexpr char const *bench_interface = "bench0";
+
+struct bench_timer {
+    std::string timer_name;
+    std::string timer_params;
+    uint64_t timer_batch = std::max(env("rebootping_bench_batch", uint64_t{16}), uint64_t{1});
+    uint64_t timer_ops = 0;
+    uint64_t timer_batch_ops = 0;
+    flat_metric_histogram timer_histogram{};
+    std::chrono::steady_clock::time_point timer_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point timer_batch_start = timer_start;
+
+    bench_timer(std::string name, std::string params) : timer_name(std::move(name)), timer_params(std::move(params)) {}
+
+    void timer_tick() {
+        ++timer_ops;
+        if (++timer_batch_ops < timer_batch) { return; }
+        timer_end_batch(std::chrono::steady_clock::now());
+    }
+
+    void timer_end_batch(std::chrono::steady_clock::time_point now) {
+        if (!timer_batch_ops) { return; }
+        timer_histogram.histogram_record(uint64_t(std::chrono::nanoseconds(now - timer_batch_start).count()) / timer_batch_ops);
+        timer_batch_ops = 0;
+        timer_batch_start = now;
+    }
+
+    void timer_report() {
+        auto now = std::chrono::steady_clock::now();
+        timer_end_batch(now);
+        auto seconds = std::chrono::duration<double>(now - timer_start).count();
+        auto ns_per_op = timer_ops ? seconds * 1e9 / double(timer_ops) : 0;
+        auto ops_per_second = seconds > 0 ? double(timer_ops) / seconds : 0;
+        auto p50 = timer_histogram.histogram_quantile(0.5), p99 = timer_histogram.histogram_quantile(0.99),
+             p999 = timer_histogram.histogram_quantile(0.999), max = uint64_t{0};
+        for (unsigned bucket = 0; flat_metric_histogram::histogram_bucket_count > bucket; ++bucket) {
+            if (timer_histogram.histogram_buckets[bucket]) { max = flat_metric_histogram::histogram_bucket_low(bucket); }
+        }
+
+        std::cout << "rebootping_bench " << timer_name << " " << timer_params << " ops=" << timer_ops << std::fixed << std::setprecision(1)
+                  << " ns_per_op=" << ns_per_op << " ops_per_second=" << std::setprecision(0) << ops_per_second << " p50_ns=" << p50
+                  << " p99_ns=" << p99 << " p999_ns=" << p999 << " max_ns=" << max << std::endl;
+
+        auto results = env("rebootping_bench_results", "");
+        if (results.empty()) { return; }
+        std::ofstream out(results, std::ios::app);
+        out << "{\"bench_name\": " << escape_json(timer_name) << ", \"bench_params\": " << escape_json(timer_params) << ", \"ops\": " << escape_json(timer_ops)
+            << ", \"seconds\": " << escape_json(seconds) << ", \"ns_per_op\": " << escape_json(ns_per_op)
+            << ", \"ops_per_second\": " << escape_json(ops_per_second) << ", \"p50_ns\": " << escape_json(p50) << ", \"p99_ns\": " << escape_json(p99)
+            << ", \"p999_ns\": " << escape_json(p999) << ", \"max_ns\": " << escape_json(max) << ", \"batch\": " << escape_json(timer_batch)
+            << ", \"git_sha\": " << escape_json(flat_git_sha_string) << ", \"git_unixtime\": " << escape_json(flat_git_unixtime)
+            << ", \"unixtime\": " << escape_json(now_unixtime()) << "}" << std::endl;
+        if (!out) { throw std::runtime_error(str("rebootping_bench could not append to ", results)); }
+    }
+};
+
+bool bench_wanted(char const *group_name) { return std::regex_search(group_name, std::regex(env("rebootping_bench_regex", ""))); }
+
+uint64_t bench_count(uint64_t count) { return std::max(uint64_t(double(count) * env("rebootping_bench_scale", 1.0)), uint64_t{1}); }
+
+macaddr bench_macaddr(uint64_t i) {
+    // a handful of manufacturers, as on a real network
+    return macaddr{{0x00, 0x1b, uint8_t(0x21 + (i & 3)), uint8_t(i >> 16), uint8_t(i >> 8), uint8_t(i)}};
+}
+
+network_addr bench_addr(uint64_t i) { return htonl((10u << 24) + uint32_t(i)); }
+
+uint64_t bench_key(uint64_t *, uint64_t i) { return flat_hash_mix(i); }
+macaddr bench_key(macaddr *, uint64_t i) { return bench_macaddr(i); }
+
+template <typename key_type> void bench_flat_hash(std::string const &dir, char const *key_name, uint64_t count) {
+    auto params = str("key=", key_name, " keys=", count);
+    std::vector<key_type> keys;
+    keys.reserve(2 * count);
+    for (uint64_t i = 0; 2 * count > i; ++i) { keys.push_back(bench_key((key_type *)nullptr, i)); }
+    std::vector<uint64_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(count));
+
+    flat_hash<key_type, uint64_t> hash(str(dir, "/", key_name, "_", count, ".flathash"));
+    bench_timer add("flat_hash.hash_add_key", params);
+    for (uint64_t i = 0; count > i; ++i) {
+        hash.hash_add_key(keys[i]) = i + 1;
+        add.timer_tick();
+    }
+    add.timer_report();
+
+    uint64_t found = 0;
+    bench_timer hit("flat_hash.hash_find_key", params + " outcome=hit");
+    for (auto i : order) {
+        found += *hash.hash_find_key(keys[i]);
+        hit.timer_tick();
+    }
+    hit.timer_report();
+
+    bench_timer miss("flat_hash.hash_find_key", params + " outcome=miss");
+    for (auto i : order) {
+        found += !!hash.hash_find_key(keys[count + i]);
+        miss.timer_tick();
+    }
+    miss.timer_report();
+    if (found != count * (count + 1) / 2) { throw std::runtime_error(str("rebootping_bench lost flat_hash keys ", params)); }
+}
+
+template <typename record_type, typename add_type> void bench_add_records(std::string const &dir, char const *record_name, uint64_t count, add_type &&add) {
+    std::filesystem::create_directories(str(dir, "/", record_name));
+    record_type records(str(dir, "/", record_name));
+    bench_timer timer("flat_dirtree.add_flat_record", str("record=", record_name, " records=", count));
+    for (uint64_t i = 0; count > i; ++i) {
+        add(records, i);
+        timer.timer_tick();
+    }
+    timer.timer_report();
+}
+
+void bench_records(std::string const &dir, uint64_t count) {
+    auto addrs = std::max(count / 64, uint64_t{1});
+    bench_add_records<ping_record>(dir, "ping_record", count, [&](auto &records, uint64_t i) {
+        records.add_flat_record(bench_unixtime, [&](auto &&record) {
+            record.ping_start_unixtime() = bench_unixtime + 1e-6 * double(i);
+            record.ping_sent_seconds() = 0.001;
+            record.ping_recv_seconds() = 0.002;
+            record.ping_dest_addr() = bench_addr(i % addrs);
+            record.ping_src_addr() = bench_addr(1 << 20);
+            record.ping_interface() = bench_interface;
+            record.ping_cookie() = i;
+        });
+    });
+    bench_add_records<last_ping_record>(dir, "last_ping_record", count, [&](auto &records, uint64_t i) {
+        auto last_ping = records.ping_if_ip_index(std::make_pair(std::string_view(bench_interface), bench_addr(i % addrs))).add_if_missing(bench_unixtime);
+        last_ping.ping_slot() = i;
+        last_ping.ping_start_unixtime() = bench_unixtime;
+    });
+    bench_add_records<unanswered_ping_record>(dir, "unanswered_ping_record", count, [&](auto &records, uint64_t i) {
+        records.add_flat_record(bench_unixtime, [&](auto &&record) {
+            record.ping_start_unixtime() = bench_unixtime;
+            record.ping_slot() = i;
+            record.flat_iterator_timeshard->ping_if_ip_index.index_linked_field_add(std::make_pair(std::string_view(bench_interface), bench_addr(i % addrs)),
+                                                                                   record);
+        });
+    });
+    bench_add_records<ping_rollup_minute_record>(dir, "ping_rollup_minute_record", count, [&](auto &records, uint64_t i) {
+        records.add_flat_record(bench_unixtime, [&](auto &&record) {
+            record.rollup_start_unixtime() = bench_unixtime;
+            record.rollup_interface() = bench_interface;
+            record.rollup_dest_addr() = bench_addr(i % addrs);
+            record.rollup_sent() = 1;
+            record.rollup_rtt_histogram() = ping_rtt_histogram{};
+            record.flat_iterator_timeshard->rollup_if_ip_index.index_linked_field_add(std::make_pair(std::string_view(bench_interface), bench_addr(i % addrs)),
+                                                                                     record);
+        });
+    });
+    bench_add_records<interface_health_record>(dir, "interface_health_record", count, [&](auto &records, uint64_t i) {
+        records.add_flat_record(bench_unixtime, [&](auto &&record) {
+            record.health_decision_unixtime() = bench_unixtime + double(i);
+            record.health_last_good_unixtime() = bench_unixtime + double(i);
+            record.health_interface() = bench_interface;
+            record.health_last_good_addr() = bench_addr(i % addrs);
+        });
+    });
+    bench_add_records<rebootping_event>(dir, "rebootping_event", count, [&](auto &records, uint64_t i) {
+        records.add_flat_record(bench_unixtime, [&](auto &&record) {
+            record.event_unixtime() = bench_unixtime + double(i);
+            record.event_name() = "bench_event";
+            record.event_git_sha() = flat_git_sha_string;
+            record.event_message() = str("bench event ", i);
+        });
+    });
+    bench_add_records<dns_response_record>(dir, "dns_response_record", count, [&](auto &records, uint64_t i) {
+        records.add_flat_record(bench_unixtime, [&](auto &&record) {
+            auto lookup = macaddr_ip_lookup{.lookup_macaddr = bench_macaddr(i % 1024), .lookup_addr = bench_addr(i % addrs)};
+            record.flat_iterator_timeshard->dns_macaddr_lookup_index.index_linked_field_add(lookup, record);
+            record.flat_iterator_timeshard->dns_addr_index.index_linked_field_add(lookup.lookup_addr, record);
+            record.dns_response_hostname() = str("host", i % addrs, ".example.com");
+            record.dns_response_unixtime() = bench_unixtime;
+            record.dns_response_addr() = lookup.lookup_addr;
+            record.dns_response_ttl_seconds() = 300;
+        });
+    });
+    bench_add_records<tcp_accept_record>(dir, "tcp_accept_record", count, [&](auto &records, uint64_t i) {
+        records.tcp_macaddr_index(bench_macaddr(i % 4096)).add_if_missing(bench_unixtime).tcp_ports().notice_key(uint16_t(1 + i % 23));
+    });
+    bench_add_records<udp_recv_record>(dir, "udp_recv_record", count, [&](auto &records, uint64_t i) {
+        records.udp_macaddr_index(bench_macaddr(i % 4096)).add_if_missing(bench_unixtime).udp_ports().notice_key(uint16_t(1 + i % 23));
+    });
+    bench_add_records<ip_contact_record>(dir, "ip_contact_record", count, [&](auto &records, uint64_t i) {
+        records.ip_contact_macaddr_index(bench_macaddr(i % 4096)).add_if_missing(bench_unixtime).ip_contact_addrs().notice_key(bench_addr(i % addrs));
+    });
+    bench_add_records<arp_response_record>(dir, "arp_response_record", count, [&](auto &records, uint64_t i) {
+        records.arp_macaddr_index(std::make_pair(std::string(bench_interface), bench_macaddr(i % 4096)))
+            .add_if_missing(bench_unixtime)
+            .arp_addresses()
+            .notice_key(bench_addr(i % 4096));
+    });
+    bench_add_records<stp_record>(dir, "stp_record", count, [&](auto &records, uint64_t i) {
+        records.stp_source_macaddr_index(bench_macaddr(i % 64)).add_if_missing(bench_unixtime).stp_unixtime() = bench_unixtime + double(i);
+    });
+}
+
+void bench_queries(std::string const &dir, uint64_t count) {
+    {
+        ping_record pings(dir + "/ping_record");
+        bench_timer timer("flat_dirtree.timeshard_query", str("record=ping_record records=", count));
+        uint64_t cookies = 0;
+        for (auto &&record : pings.timeshard_query()) {
+            cookies += record.ping_cookie();
+            timer.timer_tick();
+        }
+        timer.timer_report();
+        if (cookies != count * (count - 1) / 2) { throw std::runtime_error("rebootping_bench lost ping_record rows"); }
+    }
+    {
+        dns_response_record responses(dir + "/dns_response_record");
+        auto addrs = std::max(count / 64, uint64_t{1});
+        bench_timer timer("flat_dirtree.dirtree_field_query", str("record=dns_response_record index=dns_addr_index chain=", count / addrs));
+        uint64_t visited = 0;
+        for (uint64_t i = 0; addrs > i; ++i) {
+            for (auto &&response : responses.dns_addr_index(bench_addr(i), bench_unixtime, bench_unixtime)) {
+                visited += response.dns_response_addr() == bench_addr(i);
+                timer.timer_tick();
+            }
+        }
+        timer.timer_report();
+        if (visited != count) { throw std::runtime_error(str("rebootping_bench walked ", visited, " dns_response_record rows of ", count)); }
+    }
+}
+
+void bench_mfu_mru(uint64_t count) {
+    std::mt19937_64 random(count);
+    // mostly a few well known ports, with a long tail
+    std::vector<uint16_t> ports(4096);
+    for (auto &port : ports) { port = random() % 4 ? uint16_t(std::array{22, 53, 80, 443, 8080}[random() % 5]) : uint16_t(1024 + random() % 60000); }
+    network_port_collector port_collector;
+    bench_timer ports_timer("flat_mfu_mru.notice_key", "collector=network_port_collector keys=skewed");
+    for (uint64_t i = 0; count > i; ++i) {
+        port_collector.notice_key(ports[i % ports.size()]);
+        ports_timer.timer_tick();
+    }
+    ports_timer.timer_report();
+
+    std::vector<network_addr> addrs(4096);
+    for (auto &addr : addrs) { addr = bench_addr(random() % 64); }
+    ip_collector addr_collector;
+    bench_timer addrs_timer("flat_mfu_mru.notice_key", "collector=ip_collector keys=uniform_64");
+    for (uint64_t i = 0; count > i; ++i) {
+        addr_collector.notice_key(addrs[i % addrs.size()]);
+        addrs_timer.timer_tick();
+    }
+    addrs_timer.timer_report();
+}
+
+void bench_escape_json(uint64_t count) {
+    std::vector<std::string> plain, escaped;
+    for (uint64_t i = 0; 1024 > i; ++i) {
+        plain.push_back(str("host", i, ".dynamic.example.com"));
+        escaped.push_back(str("\"quoted\"\tname\\", i, "\n\x01 with a longer tail of text"));
+    }
+    for (auto &&[kind, strings] : {std::make_pair("plain", &plain), std::make_pair("escaped", &escaped)}) {
+        std::ostringstream out;
+        bench_timer timer("escape_json", str("strings=", kind));
+        for (uint64_t i = 0; count > i; ++i) {
+            if (!(i % 1024)) { out.str(std::string()); }
+            out << escape_json((*strings)[i % strings->size()]);
+            timer.timer_tick();
+        }
+        timer.timer_report();
+    }
+}
+
+void bench_learn_packets(char const *protocol, std::vector<std::string> const &packets) {
+    std::vector<pcap_pkthdr> headers;
+    auto unixtime = now_unixtime();
+    for (auto &&packet : packets) { headers.push_back(synthetic_pkthdr(unixtime, packet)); }
+    bench_timer timer("network_interface_watcher.learn_from_packet", str("protocol=", protocol, " packets=", packets.size()));
+    for (uint64_t i = 0; packets.size() > i; ++i) {
+        network_interface_watcher_learn_from_packet(bench_interface, &headers[i], (u_char const *)packets[i].data());
+        timer.timer_tick();
+    }
+    network_interface_thread_staging().staging_flush();
+    timer.timer_report();
+}
+
+void bench_learn(uint64_t count) {
+    auto router = bench_macaddr(1 << 20);
+    auto router_addr = bench_addr(1 << 20);
+    std::vector<std::string> packets;
+    auto each = [&](auto &&make) -> std::vector<std::string> const & {
+        packets.clear();
+        for (uint64_t i = 0; count > i; ++i) { packets.push_back(make(i)); }
+        return packets;
+    };
+    bench_learn_packets("tcp_synack", each([&](uint64_t i) {
+                            return synthetic_tcp_packet(bench_macaddr(i % 4096), router, bench_addr(i % 4096), router_addr, uint16_t(1 + i % 23), 40000,
+                                                        uint8_t(tcp_flags::SYN) | uint8_t(tcp_flags::ACK));
+                        }));
+    bench_learn_packets("udp", each([&](uint64_t i) {
+                            return synthetic_udp_packet(router, bench_macaddr(i % 4096), router_addr, bench_addr(i % 4096), 40000, uint16_t(1 + i % 23));
+                        }));
+    bench_learn_packets("dns_a", each([&](uint64_t i) {
+                            return synthetic_dns_response_packet(router, bench_macaddr(i % 4096), router_addr, bench_addr(i % 4096),
+                                                                 str("host", i % 1024, ".example.com"),
+                                                                 {{dns_qtype::DNS_QTYPE_A, bench_addr(i % 1024), {}},
+                                                                  {dns_qtype::DNS_QTYPE_A, bench_addr(i), {}}});
+                        }));
+    bench_learn_packets("dns_mx", each([&](uint64_t i) {
+                            return synthetic_dns_response_packet(router, bench_macaddr(i % 4096), router_addr, bench_addr(i % 4096),
+                                                                 str("mail", i % 1024, ".example.com"), {{dns_qtype::DNS_QTYPE_MX, 0, "mx.example.com"}});
+                        }));
+    bench_learn_packets("arp_reply", each([&](uint64_t i) {
+                            return synthetic_arp_reply_packet(bench_macaddr(i % 4096), bench_addr(i % 4096), router, router_addr);
+                        }));
+    bench_learn_packets("stp", each([&](uint64_t i) { return synthetic_stp_bpdu_packet(bench_macaddr(i % 64)); }));
+
+    // replies to pings sent just before, so that each finds its ping_record and the rollups
+    auto src = sockaddr_from_network_addr(router_addr);
+    bench_learn_packets("icmp_echoreply", each([&](uint64_t i) {
+                            rebootping_icmp_payload payload;
+                            ping_record_store_prepare(src, sockaddr_from_network_addr(bench_addr(i % 256)), bench_interface, payload);
+                            return synthetic_icmp_packet(bench_macaddr(i % 256), router, bench_addr(i % 256), router_addr, icmp_type::ECHOREPLY, payload);
+                        }));
+}
+
+// ping_record_interface_summary over pings spread across a few days, against grouping a record at a time with
+// timeshard_query as the page did before it
+void bench_column_scan(uint64_t count, uint64_t queries) {
+    constexpr double days = 3, bucket = 600;
+    char const *interfaces[] = {"bench0", "bench1", "bench2", "bench3"};
+    {
+        auto store = write_locked_reference(ping_record_store());
+        for (uint64_t i = 0; count > i; ++i) {
+            auto unixtime = bench_unixtime + days * 86400 * double(i) / double(count);
+            store->add_flat_record(unixtime, [&](auto &&record) {
+                record.ping_start_unixtime() = unixtime;
+                record.ping_sent_seconds() = 0.001;
+                record.ping_recv_seconds() = i % 7 ? 0.001 * double(i % 13) : std::nan("");
+                record.ping_dest_addr() = bench_addr(i % 64);
+                record.ping_src_addr() = bench_addr(1 << 20);
+                record.ping_interface() = interfaces[i % 4];
+                record.ping_cookie() = i;
+            });
+        }
+    }
+    auto params = str("records=", count, " days=", days, " bucket_seconds=", bucket);
+    auto start = bench_unixtime, end = bench_unixtime + days * 86400;
+
+    flat_column_groups iterated;
+    {
+        bench_timer timer("flat_column_scan.timeshard_query", params);
+        for (uint64_t q = 0; queries > q; ++q) {
+            iterated.clear();
+            auto store = read_locked_reference(ping_record_store());
+            for (auto &&record : store->timeshard_query(start, end)) {
+                auto unixtime = record.ping_start_unixtime();
+                if (unixtime < start || unixtime >= end) { continue; }
+                auto key = std::make_pair(std::string(record.ping_interface().operator std::string_view()), int64_t(std::floor(unixtime / bucket)));
+                iterated[key].stats_add(record.ping_recv_seconds());
+            }
+            timer.timer_tick();
+        }
+        timer.timer_report();
+    }
+    flat_column_groups scanned;
+    {
+        bench_timer timer("flat_column_scan.ping_record_interface_summary", params);
+        for (uint64_t q = 0; queries > q; ++q) {
+            scanned = ping_record_interface_summary(start, end, bucket);
+            timer.timer_tick();
+        }
+        timer.timer_report();
+    }
+    if (scanned.size() != iterated.size()) { throw std::runtime_error(str("bench_column_scan found ", scanned.size(), " groups of ", iterated.size())); }
+    for (auto &&[key, stats] : iterated) {
+        auto &found = scanned[key];
+        if (found.stats_count != stats.stats_count || found.stats_nan_count != stats.stats_nan_count) {
+            throw std::runtime_error(str("bench_column_scan disagrees on ", key.first, " ", key.second));
+        }
+    }
+}
+
+// the same captures of a fresh network each time, so that every worker count starts from empty records
+void bench_ingest(std::string const &dir, uint64_t packets_per_file) {
+    constexpr uint64_t files = 16;
+    auto max_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    uint8_t network = 0x60;
+    for (uint64_t workers = 1;; workers = std::min<uint64_t>(workers * 2, max_workers)) {
+        network_traffic_mix mix;
+        mix.traffic_packets = packets_per_file;
+        mix.traffic_network = network++;
+        std::vector<std::string> filenames;
+        for (uint64_t f = 0; files > f; ++f) {
+            mix.traffic_seed = f + 1;
+            mix.traffic_start_unixtime = bench_unixtime + 3600 * double(f);
+            filenames.push_back(str(dir, "/network_", unsigned(mix.traffic_network), "_", f, ".pcap"));
+            std::filesystem::create_directories(dir);
+            network_traffic_generate_pcap(filenames.back(), mix);
+        }
+        bench_timer timer("network_interface_watcher.learn_from_pcap_files", str("workers=", workers, " files=", files));
+        auto report = network_interface_watcher_learn_from_pcap_files(filenames, {.ingest_workers = workers});
+        // one batch of every packet, so the percentiles are the mean
+        timer.timer_ops = timer.timer_batch_ops = report.ingest_packets;
+        timer.timer_report();
+        std::cout << std::setprecision(3) << "rebootping_bench network_interface_watcher.learn_from_pcap_files merge_seconds=" << report.ingest_merge_seconds
+                  << " seconds=" << report.ingest_seconds << std::endl;
+        for (auto &&filename : filenames) { std::filesystem::remove(filename); }
+        if (workers == max_workers) { break; }
+    }
+}
+
+// reading alone, touching every byte so that neither reader gets away without fetching the packets
+void bench_pcap_file(std::string const &dir, uint64_t packets) {
+    network_traffic_mix mix;
+    mix.traffic_packets = packets;
+    auto filename = dir + "/bench_pcap_file.pcap";
+    network_traffic_generate_pcap(filename, mix);
+    auto params = str("packets=", packets, " bytes=", std::filesystem::file_size(filename));
+    uint64_t libpcap_sum = 0, mmap_sum = 0;
+    {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        auto pcap = pcap_open_offline(filename.c_str(), errbuf);
+        if (!pcap) { throw std::runtime_error(str("bench_pcap_file pcap_open_offline failed on ", filename, ": ", errbuf)); }
+        std::pair<bench_timer, uint64_t *> user{bench_timer("network_pcap_file.libpcap", params), &libpcap_sum};
+        pcap_loop(
+            pcap, -1 /*cnt*/,
+            [](u_char *user, const struct pcap_pkthdr *h, const u_char *bytes) {
+                auto &[timer, sum] = *(std::pair<bench_timer, uint64_t *> *)user;
+                *sum = std::accumulate(bytes, bytes + h->caplen, *sum);
+                timer.timer_tick();
+            },
+            (u_char *)&user);
+        user.first.timer_report();
+        pcap_close(pcap);
+    }
+    {
+        bench_timer timer("network_pcap_file.mmap", params);
+        network_pcap_file file(filename);
+        pcap_pkthdr h;
+        const u_char *bytes;
+        while (file.pcap_next_packet(h, bytes)) {
+            mmap_sum = std::accumulate(bytes, bytes + h.caplen, mmap_sum);
+            timer.timer_tick();
+        }
+        timer.timer_report();
+    }
+    if (libpcap_sum != mmap_sum) { throw std::runtime_error(str("bench_pcap_file read different bytes from ", filename)); }
+    std::filesystem::remove(filename);
+}
+
+// the decoder network_interface_watcher used before network_dns_message, as the baseline: a fresh ostringstream for
+// every name and the depth limit from the environment each time, returning each A answer as name and address
+void bench_legacy_dns_addresses(u_char const *dns_start, u_char const *dns_end, std::vector<std::pair<std::string, network_addr>> &addresses) {
+    auto dns_ptr = dns_start + sizeof(dns_header);
+    auto eat_one = [&]() {
+        if (dns_ptr < dns_end) { return *dns_ptr++; }
+        return (u_char)0;
+    };
+    auto eat_addr = [&]() {
+        if (dns_ptr + sizeof(network_addr) <= dns_end) {
+            network_addr ret;
+            std::memcpy(&ret, dns_ptr, sizeof(ret));
+            dns_ptr += sizeof(network_addr);
+            return ret;
+        }
+        return (network_addr)0;
+    };
+    auto eat_short = [&]() { return eat_one() * 256 + eat_one(); };
+    auto eat_qname = [&]() {
+        std::ostringstream oss;
+        const u_char *saved_ptr = nullptr;
+        const int max_depth = env("network_interface_dns_packets_overflow_max_depth", 16);
+        int depth = 0;
+        while (u_char len = eat_one()) {
+            if (len > 63) {
+                auto next_len = eat_one();
+                if (++depth > max_depth) { break; }
+                if (!saved_ptr) { saved_ptr = dns_ptr; }
+                dns_ptr = dns_start + (len & 63) * 256 + next_len;
+                continue;
+            }
+            if (dns_ptr + len > dns_end) { break; }
+            oss << std::string_view((const char *)(dns_ptr), len);
+            dns_ptr += len;
+            oss << '.';
+        }
+        if (saved_ptr) { dns_ptr = saved_ptr; }
+        return oss.str();
+    };
+
+    auto header = (dns_header const *)dns_start;
+    for (auto q = 0; ntohs(header->dns_questions) > q; ++q) {
+        eat_qname();
+        eat_short();
+        eat_short();
+    }
+    for (auto a = 0; ntohs(header->dns_answers) > a; ++a) {
+        auto name = eat_qname();
+        auto qtype = eat_short();
+        auto qclass = eat_short();
+        eat_short();
+        eat_short();
+        eat_short();
+        if (qclass != (int)dns_qclass::DNS_QCLASS_INET) { break; }
+        switch (qtype) {
+        case (int)dns_qtype::DNS_QTYPE_A: addresses.emplace_back(name, eat_addr()); break;
+        case (int)dns_qtype::DNS_QTYPE_MX:
+            eat_short();
+            eat_qname();
+            break;
+        }
+    }
+}
+
+// decoding alone, the messages of a capture over and over, without learning from them
+void bench_dns_decode(uint64_t count) {
+    auto filename = env("rebootping_bench_dns_pcap", "testdata/dns_lookup.pcap");
+    if (!std::filesystem::exists(filename)) {
+        std::cout << "rebootping_bench network_dns_message skipped: no " << filename << ", run from the source directory or set rebootping_bench_dns_pcap"
+                  << std::endl;
+        return;
+    }
+    std::vector<std::string> messages;
+    network_pcap_file file(filename);
+    pcap_pkthdr h;
+    u_char const *bytes;
+    while (file.pcap_next_packet(h, bytes)) {
+        auto p = wire_header<ether_header, ip_header, udp_header, dns_header>::header_from_packet(bytes, h.caplen);
+        if (!p || (ntohs(p->uh_sport) != 53 && ntohs(p->uh_dport) != 53)) { continue; }
+        messages.emplace_back((char const *)&p->dns_id, bytes + h.caplen - (u_char const *)&p->dns_id);
+    }
+    if (messages.empty()) { throw std::runtime_error(str("bench_dns_decode found no DNS in ", filename)); }
+    auto params = str("messages=", messages.size());
+
+    std::vector<std::pair<std::string, network_addr>> legacy, decoded;
+    {
+        bench_timer timer("network_dns_message.legacy", params);
+        for (uint64_t i = 0; count > i; ++i) {
+            auto &message = messages[i % messages.size()];
+            legacy.clear();
+            bench_legacy_dns_addresses((u_char const *)message.data(), (u_char const *)message.data() + message.size(), legacy);
+            timer.timer_tick();
+        }
+        timer.timer_report();
+    }
+    uint64_t addresses = 0;
+    {
+        bench_timer timer("network_dns_message.for_each_address", params);
+        int max_depth = env("network_interface_dns_packets_overflow_max_depth", 16);
+        for (uint64_t i = 0; count > i; ++i) {
+            auto &message = messages[i % messages.size()];
+            dns_message_reader reader((u_char const *)message.data(), (u_char const *)message.data() + message.size(), max_depth);
+            dns_message_for_each_address(reader, [&](dns_name const &name, dns_address_answer const &answer) {
+                addresses += name.name_len + answer.answer_addr;
+            });
+            timer.timer_tick();
+        }
+        timer.timer_report();
+    }
+    // the A answers of every message must be the same from both
+    for (auto &&message : messages) {
+        legacy.clear();
+        decoded.clear();
+        bench_legacy_dns_addresses((u_char const *)message.data(), (u_char const *)message.data() + message.size(), legacy);
+        dns_message_reader reader((u_char const *)message.data(), (u_char const *)message.data() + message.size(), 16);
+        dns_message_for_each_address(reader, [&](dns_name const &name, dns_address_answer const &answer) {
+            if (answer.answer_qtype == dns_qtype::DNS_QTYPE_A) { decoded.emplace_back(name.name_view(), answer.answer_addr); }
+        });
+        if (legacy != decoded) { throw std::runtime_error(str("bench_dns_decode decoders disagree on ", filename)); }
+    }
+    if (!addresses) { throw std::runtime_error(str("bench_dns_decode found no addresses in ", filename)); }
+}
+} // namespace
+
+int main() {
+    tmpdir tmpdir;
+    setenv("rebootping_records_dir", (tmpdir.tmpdir_name + "/records").c_str(), 1);
+    if (bench_wanted("flat_hash")) {
+        for (uint64_t count = 1 << 10; bench_count(1 << 20) >= count; count *= 32) {
+            bench_flat_hash<uint64_t>(tmpdir.tmpdir_name, "uint64_t", count);
+            bench_flat_hash<macaddr>(tmpdir.tmpdir_name, "macaddr", count);
+        }
+    }
+    if (bench_wanted("flat_dirtree")) {
+        auto dir = tmpdir.tmpdir_name + "/flat_dirtree";
+        bench_records(dir, bench_count(1 << 16));
+        bench_queries(dir, bench_count(1 << 16));
+    }
+    if (bench_wanted("flat_mfu_mru")) { bench_mfu_mru(bench_count(1 << 22)); }
+    if (bench_wanted("escape_json")) { bench_escape_json(bench_count(1 << 20)); }
+    if (bench_wanted("flat_column_scan")) { bench_column_scan(bench_count(1 << 20), bench_count(16)); }
+    if (bench_wanted("network_interface_watcher")) { bench_learn(bench_count(1 << 16)); }
+    if (bench_wanted("network_dns_message")) { bench_dns_decode(bench_count(1 << 20)); }
+    if (bench_wanted("network_pcap_file")) { bench_pcap_file(tmpdir.tmpdir_name, bench_count(1 << 18)); }
+    if (bench_wanted("network_interface_ingest")) { bench_ingest(tmpdir.tmpdir_name + "/ingest", bench_count(1 << 14)); }
+    return 0;
+}
@@ -0,0 +1,578 @@
+#include "rebootping_http_server.hpp"
+
+#include "call_errno.hpp"
+#include "env.hpp"
+#include "flat_metrics.hpp"
+#include "flat_record.hpp"
+#include "network_flat_records.hpp"
+#include "now_unixtime.hpp"
+#include "ping_health_decider.hpp"
+#include "ping_record_store.hpp"
+#include "ping_rollup_store.hpp"
+#include "rebootping_event.hpp"
+#include "rebootping_records_dir.hpp"
+#include "rebootping_report_html.hpp"
+#include "str.hpp"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <string_view>
+
+namespace {
+
+struct http_request {
+    std::string_view request_method;
+    std::string request_path;
+    std::string_view request_query;
+    std::string_view request_range;
+    bool request_keep_alive = false;
+    bool request_has_body = false;
+};
+
+bool http_equals_ignoring_case(std::string_view a, std::string_view b) {
+    return std::ranges::equal(a, b, [](char x, char y) { return std::tolower((unsigned char)x) == std::tolower((unsigned char)y); });
+}
+
+std::string_view http_trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) { s.remove_prefix(1); }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) { s.remove_suffix(1); }
+    return s;
+}
+
+// %xx escapes decoded, or nullopt for a path that could name something outside what it appears to
+std::optional<std::string> http_decode_path(std::string_view target) {
+    std::string path;
+    for (size_t i = 0; target.size() > i; ++i) {
+        if (target[i] != '%') {
+            path += target[i];
+            continue;
+        }
+        unsigned value = 0;
+        if (i + 2 >= target.size() || std::from_chars(target.data() + i + 1, target.data() + i + 3, value, 16).ptr != target.data() + i + 3) {
+            return std::nullopt;
+        }
+        path += char(value);
+        i += 2;
+    }
+    if (!path.starts_with('/') || path.find('\0') != std::string::npos) { return std::nullopt; }
+    for (auto &&segment : std::views::split(std::string_view(path), '/')) {
+        if (std::string_view(segment.begin(), segment.end()) == "..") { return std::nullopt; }
+    }
+    return path;
+}
+
+// nullopt when the request line or headers are malformed
+std::optional<http_request> http_parse_request(std::string_view head) {
+    http_request request;
+    auto line_end = head.find("\r\n");
+    auto line = head.substr(0, line_end);
+    auto method_end = line.find(' ');
+    auto target_end = line.rfind(' ');
+    if (method_end == std::string_view::npos || method_end == target_end) { return std::nullopt; }
+    request.request_method = line.substr(0, method_end);
+    auto target = line.substr(method_end + 1, target_end - method_end - 1);
+    auto version = line.substr(target_end + 1);
+    if (version == "HTTP/1.1") {
+        request.request_keep_alive = true;
+    } else if (version != "HTTP/1.0") {
+        return std::nullopt;
+    }
+    auto query_start = target.find('?');
+    if (query_start != std::string_view::npos) { request.request_query = target.substr(query_start + 1); }
+    auto path = http_decode_path(target.substr(0, query_start));
+    if (!path) { return std::nullopt; }
+    request.request_path = std::move(*path);
+
+    for (auto rest = head.substr(line_end + 2); !rest.empty();) {
+        auto header_end = rest.find("\r\n");
+        auto header = rest.substr(0, header_end);
+        rest = header_end == std::string_view::npos ? std::string_view() : rest.substr(header_end + 2);
+        if (header.empty()) { continue; }
+        auto colon = header.find(':');
+        if (colon == std::string_view::npos) { return std::nullopt; }
+        auto name = header.substr(0, colon);
+        auto value = http_trim(header.substr(colon + 1));
+        if (http_equals_ignoring_case(name, "connection")) {
+            if (http_equals_ignoring_case(value, "close")) { request.request_keep_alive = false; }
+            if (http_equals_ignoring_case(value, "keep-alive")) { request.request_keep_alive = true; }
+        } else if (http_equals_ignoring_case(name, "range")) {
+            request.request_range = value;
+        } else if (http_equals_ignoring_case(name, "transfer-encoding") || (http_equals_ignoring_case(name, "content-length") && value != "0")) {
+            request.request_has_body = true;
+        }
+    }
+    return request;
+}
+
+template <typename value_type> value_type http_query_value(std::string_view query, std::string_view name, value_type default_value) {
+    for (auto &&pair_range : std::views::split(query, '&')) {
+        std::string_view pair(pair_range.begin(), pair_range.end());
+        if (!pair.starts_with(name) || pair.size() <= name.size() || pair[name.size()] != '=') { continue; }
+        std::istringstream is(std::string(pair.substr(name.size() + 1)));
+        value_type value;
+        if (is >> value) { return value; }
+    }
+    return default_value;
+}
+
+struct http_range {
+    enum { range_whole, range_partial, range_unsatisfiable } range_kind = range_whole;
+    uint64_t range_first = 0;
+    uint64_t range_length = 0;
+};
+
+// Only a single byte range is honoured; anything else in a Range header gets the whole file, as RFC 9110 allows
+http_range http_parse_range(std::string_view header, uint64_t size) {
+    http_range range{.range_length = size};
+    if (!header.starts_with("bytes=") || header.find(',') != std::string_view::npos) { return range; }
+    header.remove_prefix(6);
+    auto dash = header.find('-');
+    if (dash == std::string_view::npos) { return range; }
+    auto parse = [](std::string_view digits, uint64_t &value) {
+        return !digits.empty() && std::from_chars(digits.data(), digits.data() + digits.size(), value).ptr == digits.data() + digits.size();
+    };
+    uint64_t first = 0, last = size ? size - 1 : 0;
+    if (dash == 0) {
+        uint64_t suffix = 0;
+        if (!parse(header.substr(1), suffix)) { return range; }
+        if (!suffix || !size) { return http_range{.range_kind = http_range::range_unsatisfiable}; }
+        first = size - std::min(suffix, size);
+    } else {
+        if (!parse(header.substr(0, dash), first)) { return range; }
+        if (dash + 1 < header.size()) {
+            if (!parse(header.substr(dash + 1), last) || last < first) { return range; }
+            last = std::min(last, size ? size - 1 : 0);
+        }
+        if (first >= size) { return http_range{.range_kind = http_range::range_unsatisfiable}; }
+    }
+    return http_range{.range_kind = http_range::range_partial, .range_first = first, .range_length = last - first + 1};
+}
+
+std::string_view http_status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+    }
+}
+
+std::string_view http_content_type(std::filesystem::path const &path) {
+    auto extension = path.extension();
+    if (extension == ".html") { return "text/html; charset=utf-8"; }
+    if (extension == ".css") { return "text/css"; }
+    if (extension == ".js") { return "text/javascript"; }
+    if (extension == ".json") { return "application/json"; }
+    return "application/octet-stream";
+}
+
+struct http_api_store {
+    std::function<void(std::ostream &, double, double, uint64_t)> api_records;
+    std::function<void(std::ostream &)> api_schema;
+};
+
+template <typename record_type> http_api_store http_api_store_for(locked_reference<record_type> &(*store)()) {
+    return http_api_store{
+        .api_records =
+            [store](std::ostream &out, double start, double end, uint64_t limit) {
+                out << std::setprecision(15) << "[";
+                bool first = true;
+                auto locked = read_locked_reference(store());
+                for (auto &&record : locked->timeshard_query(start, end)) {
+                    if (!limit--) { break; }
+                    out << (first ? "\n" : ",\n");
+                    first = false;
+                    flat_record_dump_as_json(out, record);
+                }
+                out << "\n]\n";
+            },
+        .api_schema = [](std::ostream &out) { flat_record_schema_as_json<record_type>(out); },
+    };
+}
+
+std::unordered_map<std::string_view, http_api_store> const &http_api_stores() {
+    static std::unordered_map<std::string_view, http_api_store> stores{
+        {"ping_record", http_api_store_for(ping_record_store)},
+        {"ping_rollup_minute_record", http_api_store_for(ping_rollup_minute_record_store)},
+        {"ping_rollup_hour_record", http_api_store_for(ping_rollup_hour_record_store)},
+        {"ping_rollup_day_record", http_api_store_for(ping_rollup_day_record_store)},
+        {"dns_response_record", http_api_store_for(dns_response_record_store)},
+        {"stp_record", http_api_store_for(stp_record_store)},
+        {"interface_health_record", http_api_store_for(interface_health_record_store)},
+        {"rebootping_event", http_api_store_for(rebootping_event_log)},
+    };
+    return stores;
+}
+
+void http_dump_ping_record_summary(std::ostream &out, double start, double end, double bucket_seconds) {
+    out << "[";
+    bool first = true;
+    for (auto &&[key, stats] : ping_record_interface_summary(start, end, bucket_seconds)) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        bool answered = stats.stats_count > stats.stats_nan_count;
+        out << "{\"ping_interface\": " << escape_json(key.first) << ", \"bucket_unixtime\": " << escape_json(double(key.second) * bucket_seconds)
+            << ", \"pings\": " << stats.stats_count << ", \"loss_rate\": " << escape_json(stats.stats_nan_fraction())
+            << ", \"ping_recv_seconds_mean\": " << escape_json(stats.stats_mean())
+            << ", \"ping_recv_seconds_min\": " << escape_json(answered ? stats.stats_min : std::nan(""))
+            << ", \"ping_recv_seconds_max\": " << escape_json(answered ? stats.stats_max : std::nan("")) << "}";
+    }
+    out << "\n]\n";
+}
+
+// The file path names under rebootping_records_dir, whether the records dir was configured as an absolute
+// path or, as the report's flat_dir then is, relative to the working directory
+std::optional<std::filesystem::path> http_records_file(std::string_view path) {
+    auto records = std::filesystem::absolute(rebootping_records_dir()).lexically_normal();
+    if (!records.has_filename()) { records = records.parent_path(); }
+    for (auto &&candidate : {std::filesystem::path(path), std::filesystem::path(path.substr(1))}) {
+        auto file = std::filesystem::absolute(candidate).lexically_normal();
+        auto relative = file.lexically_relative(records);
+        if (!relative.empty() && *relative.begin() != ".." && relative != ".") { return file; }
+    }
+    return std::nullopt;
+}
+
+void http_start_response(http_server_connection &connection, int status, std::string_view content_type, uint64_t content_length,
+                         std::string_view extra_headers = {}) {
+    connection.connection_response = str("HTTP/1.1 ", status, " ", http_status_text(status), "\r\nContent-Type: ", content_type,
+                                         "\r\nContent-Length: ", content_length, "\r\nCache-Control: no-cache\r\n", extra_headers,
+                                         "Connection: ", connection.connection_close_after_response ? "close" : "keep-alive", "\r\n\r\n");
+    connection.connection_response_written = 0;
+}
+
+void http_respond(http_server_connection &connection, http_request const *request, int status, std::string_view content_type, std::string_view body,
+                  std::string_view extra_headers = {}) {
+    if (status >= 400 && !request) { connection.connection_close_after_response = true; }
+    http_start_response(connection, status, content_type, body.size(), extra_headers);
+    if (!request || request->request_method != "HEAD") { connection.connection_response += body; }
+}
+
+void http_respond_file(http_server_connection &connection, http_request const &request, std::filesystem::path const &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) { close(fd); }
+        http_respond(connection, &request, 404, "text/plain", "not found\n");
+        return;
+    }
+    uint64_t size = st.st_size;
+    auto range = http_parse_range(request.request_range, size);
+    if (range.range_kind == http_range::range_unsatisfiable) {
+        close(fd);
+        http_respond(connection, &request, 416, "text/plain", "", str("Content-Range: bytes */", size, "\r\n"));
+        return;
+    }
+    if (range.range_kind == http_range::range_partial) {
+        http_start_response(connection, 206, http_content_type(path), range.range_length,
+                            str("Accept-Ranges: bytes\r\nContent-Range: bytes ", range.range_first, "-", range.range_first + range.range_length - 1, "/",
+                                size, "\r\n"));
+    } else {
+        http_start_response(connection, 200, http_content_type(path), size, "Accept-Ranges: bytes\r\n");
+    }
+    if (request.request_method == "HEAD" || !range.range_length) {
+        close(fd);
+        return;
+    }
+    connection.connection_file_fd = fd;
+    connection.connection_file_offset = range.range_first;
+    connection.connection_file_remaining = range.range_length;
+}
+
+void http_respond_request(http_server_connection &connection, std::string_view head) {
+    ++flat_metric().http_server_requests;
+    auto request = http_parse_request(head);
+    if (!request) {
+        http_respond(connection, nullptr, 400, "text/plain", "bad request\n");
+        return;
+    }
+    connection.connection_close_after_response = !request->request_keep_alive;
+    if (request->request_has_body || (request->request_method != "GET" && request->request_method != "HEAD")) {
+        // the body is never read, so the connection cannot be reused
+        connection.connection_close_after_response = true;
+        http_respond(connection, &*request, 405, "text/plain", "only GET and HEAD\n", "Allow: GET, HEAD\r\n");
+        return;
+    }
+
+    auto &path = request->request_path;
+    if (path == "/" || path == "/index.html") {
+        auto page = report_html_latest();
+        if (!page) {
+            http_respond(connection, &*request, 503, "text/plain", "report not rendered yet\n", "Retry-After: 5\r\n");
+            return;
+        }
+        http_respond(connection, &*request, 200, "text/html; charset=utf-8", *page);
+        return;
+    }
+    if (path == "/rebootping_style.css" || path == "/rebootping_script.js") {
+        http_respond_file(connection, *request, std::filesystem::path(env("http_server_static_dir", ".")) / path.substr(1));
+        return;
+    }
+    if (path == "/api/ping_record_summary.json") {
+        auto bucket_seconds = http_query_value(request->request_query, "bucket_seconds", 60.0);
+        if (!(bucket_seconds > 0)) {
+            http_respond(connection, &*request, 400, "text/plain", "bucket_seconds must be positive\n");
+            return;
+        }
+        std::ostringstream out;
+        http_dump_ping_record_summary(out, http_query_value(request->request_query, "start", std::numeric_limits<double>::min()),
+                                      http_query_value(request->request_query, "end", std::numeric_limits<double>::max()), bucket_seconds);
+        http_respond(connection, &*request, 200, "application/json", out.str());
+        return;
+    }
+    if (path.starts_with("/api/") && path.ends_with(".json")) {
+        std::string_view name(path);
+        name = name.substr(5, name.size() - 5 - 5);
+        bool schema = name.ends_with(".schema");
+        if (schema) { name.remove_suffix(7); }
+        auto store = http_api_stores().find(name);
+        if (store != http_api_stores().end()) {
+            std::ostringstream out;
+            if (schema) {
+                store->second.api_schema(out);
+            } else {
+                store->second.api_records(out, http_query_value(request->request_query, "start", std::numeric_limits<double>::min()),
+                                          http_query_value(request->request_query, "end", std::numeric_limits<double>::max()),
+                                          http_query_value(request->request_query, "limit", env("http_server_api_max_records", uint64_t{10000})));
+            }
+            http_respond(connection, &*request, 200, "application/json", out.str());
+            return;
+        }
+    }
+    if (auto file = http_records_file(path)) {
+        http_respond_file(connection, *request, *file);
+        return;
+    }
+    http_respond(connection, &*request, 404, "text/plain", "not found\n");
+}
+
+// false when the socket would block before the response is all sent
+bool http_send_response(http_server_connection &connection) {
+    auto &response = connection.connection_response;
+    while (response.size() > connection.connection_response_written) {
+        auto sent = send(connection.connection_fd, response.data() + connection.connection_response_written,
+                         response.size() - connection.connection_response_written, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return false; }
+            throw errno_exception(errno, "send");
+        }
+        connection.connection_response_written += sent;
+    }
+    while (connection.connection_file_remaining) {
+        auto sent = sendfile(connection.connection_fd, connection.connection_file_fd, &connection.connection_file_offset,
+                             std::min<uint64_t>(connection.connection_file_remaining, 1 << 30));
+        if (sent < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return false; }
+            throw errno_exception(errno, "sendfile");
+        }
+        // the file was truncated under us after the headers went out, so the length promised cannot be met
+        if (!sent) { throw std::runtime_error(str("http_send_response file shorter than announced by ", connection.connection_file_remaining)); }
+        flat_metric().http_server_sendfile_bytes += sent;
+        connection.connection_file_remaining -= sent;
+    }
+    response.clear();
+    connection.connection_response_written = 0;
+    if (connection.connection_file_fd >= 0) {
+        close(connection.connection_file_fd);
+        connection.connection_file_fd = -1;
+    }
+    return true;
+}
+
+void http_epoll_set(int epoll_fd, http_server_connection &connection, uint32_t events) {
+    if (connection.connection_epoll_events == events) { return; }
+    epoll_event event{.events = events, .data = {.fd = connection.connection_fd}};
+    CALL_ERRNO_MINUS_1(epoll_ctl, epoll_fd, EPOLL_CTL_MOD, connection.connection_fd, &event);
+    connection.connection_epoll_events = events;
+}
+
+} // namespace
+
+http_server_connection::~http_server_connection() {
+    if (connection_file_fd >= 0) { close(connection_file_fd); }
+    if (connection_fd >= 0) { close(connection_fd); }
+}
+
+rebootping_http_server::rebootping_http_server(std::string const &listen_address) {
+    try {
+        if (listen_address.starts_with("unix:")) {
+            http_unix_socket_path = listen_address.substr(5);
+            sockaddr_un addr{.sun_family = AF_UNIX};
+            if (http_unix_socket_path.size() >= sizeof(addr.sun_path)) { throw std::runtime_error(str("http_server unix socket path too long ", listen_address)); }
+            std::strcpy(addr.sun_path, http_unix_socket_path.c_str());
+            if (std::filesystem::is_socket(http_unix_socket_path)) { std::filesystem::remove(http_unix_socket_path); }
+            http_listen_fd = CALL_ERRNO_MINUS_1(socket, AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            CALL_ERRNO_MINUS_1(bind, http_listen_fd, (sockaddr *)&addr, sizeof(addr));
+        } else {
+            auto colon = listen_address.rfind(':');
+            if (colon == std::string::npos) { throw std::runtime_error(str("http_server listen address needs a port ", listen_address)); }
+            auto host = listen_address.substr(0, colon);
+            if (host.starts_with('[') && host.ends_with(']')) { host = host.substr(1, host.size() - 2); }
+            addrinfo hints{.ai_flags = AI_PASSIVE | AI_NUMERICSERV, .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+            addrinfo *found = nullptr;
+            if (auto err = getaddrinfo(host.empty() ? nullptr : host.c_str(), listen_address.c_str() + colon + 1, &hints, &found)) {
+                throw std::runtime_error(str("http_server cannot resolve ", listen_address, ": ", gai_strerror(err)));
+            }
+            std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> found_holder(found, freeaddrinfo);
+            http_listen_fd = CALL_ERRNO_MINUS_1(socket, found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int one = 1;
+            CALL_ERRNO_MINUS_1(setsockopt, http_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            CALL_ERRNO_MINUS_1(bind, http_listen_fd, found->ai_addr, found->ai_addrlen);
+        }
+        CALL_ERRNO_MINUS_1(listen, http_listen_fd, env("http_server_listen_backlog", 64));
+
+        http_epoll_fd = CALL_ERRNO_MINUS_1(epoll_create1, EPOLL_CLOEXEC);
+        epoll_event event{.events = EPOLLIN, .data = {.fd = http_listen_fd}};
+        CALL_ERRNO_MINUS_1(epoll_ctl, http_epoll_fd, EPOLL_CTL_ADD, http_listen_fd, &event);
+    } catch (...) {
+        if (http_epoll_fd >= 0) { close(http_epoll_fd); }
+        if (http_listen_fd >= 0) { close(http_listen_fd); }
+        throw;
+    }
+    loop_spawn();
+}
+
+rebootping_http_server::~rebootping_http_server() {
+    loop_stop_join();
+    http_connections.clear();
+    close(http_epoll_fd);
+    close(http_listen_fd);
+    if (!http_unix_socket_path.empty()) { unlink(http_unix_socket_path.c_str()); }
+}
+
+uint16_t rebootping_http_server::http_listen_port() const {
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    CALL_ERRNO_MINUS_1(getsockname, http_listen_fd, (sockaddr *)&addr, &len);
+    if (addr.ss_family == AF_INET) { return ntohs(((sockaddr_in *)&addr)->sin_port); }
+    if (addr.ss_family == AF_INET6) { return ntohs(((sockaddr_in6 *)&addr)->sin6_port); }
+    return 0;
+}
+
+bool rebootping_http_server::loop_run_once() {
+    epoll_event events[64];
+    auto ready = epoll_wait(http_epoll_fd, events, std::size(events), env("http_server_poll_timeout_ms", 100));
+    if (ready < 0 && errno != EINTR) { throw errno_exception(errno, "epoll_wait"); }
+    auto now = now_unixtime();
+    for (int i = 0; ready > i; ++i) {
+        auto fd = events[i].data.fd;
+        if (fd == http_listen_fd) {
+            http_accept();
+            continue;
+        }
+        auto found = http_connections.find(fd);
+        if (found == http_connections.end()) { continue; }
+        auto &connection = *found->second;
+        connection.connection_last_active_unixtime = now;
+        bool keep;
+        try {
+            keep = http_serve(connection);
+        } catch (std::exception const &) {
+            ++flat_metric().http_server_connection_errors;
+            keep = false;
+        }
+        if (!keep) { http_connections.erase(found); }
+    }
+    auto idle_before = now - env("http_server_idle_seconds", 60.0);
+    std::erase_if(http_connections, [&](auto &&item) { return item.second->connection_last_active_unixtime < idle_before; });
+    http_accept_resume_if_due(now);
+    return false;
+}
+
+void rebootping_http_server::http_accept() {
+    for (;;) {
+        int fd = accept4(http_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) { http_accept_pause(); }
+            return;
+        }
+        auto connection = std::make_unique<http_server_connection>();
+        connection->connection_fd = fd;
+        connection->connection_last_active_unixtime = now_unixtime();
+        connection->connection_epoll_events = EPOLLIN;
+        epoll_event event{.events = EPOLLIN, .data = {.fd = fd}};
+        CALL_ERRNO_MINUS_1(epoll_ctl, http_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        http_connections[fd] = std::move(connection);
+        ++flat_metric().http_server_connections;
+    }
+}
+
+void rebootping_http_server::http_accept_pause() {
+    epoll_event event{.events = 0, .data = {.fd = http_listen_fd}};
+    CALL_ERRNO_MINUS_1(epoll_ctl, http_epoll_fd, EPOLL_CTL_MOD, http_listen_fd, &event);
+    http_accept_paused_until = now_unixtime() + env("http_server_accept_pause_seconds", 0.5);
+    http_accept_paused_connections = http_connections.size();
+    ++flat_metric().http_server_accept_pauses;
+}
+
+void rebootping_http_server::http_accept_resume_if_due(double now) {
+    if (!http_accept_paused_until) { return; }
+    if (now < http_accept_paused_until && http_connections.size() >= http_accept_paused_connections) { return; }
+    http_accept_paused_until = 0;
+    epoll_event event{.events = EPOLLIN, .data = {.fd = http_listen_fd}};
+    CALL_ERRNO_MINUS_1(epoll_ctl, http_epoll_fd, EPOLL_CTL_MOD, http_listen_fd, &event);
+}
+
+bool rebootping_http_server::http_serve(http_server_connection &connection) {
+    for (;;) {
+        if (!connection.connection_response.empty()) {
+            if (!http_send_response(connection)) {
+                http_epoll_set(http_epoll_fd, connection, EPOLLOUT);
+                return true;
+            }
+            if (connection.connection_close_after_response) { return false; }
+            continue;
+        }
+        auto head_end = connection.connection_request.find("\r\n\r\n");
+        if (head_end != std::string::npos) {
+            http_respond_request(connection, std::string_view(connection.connection_request).substr(0, head_end + 4));
+            connection.connection_request.erase(0, head_end + 4);
+            continue;
+        }
+        if (std::cmp_greater(connection.connection_request.size(), env("http_server_max_request_bytes", 16384))) {
+            connection.connection_request.clear();
+            http_respond(connection, nullptr, 431, "text/plain", "request too large\n");
+            continue;
+        }
+        char buf[4096];
+        auto received = recv(connection.connection_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                http_epoll_set(http_epoll_fd, connection, EPOLLIN);
+                return true;
+            }
+            throw errno_exception(errno, "recv");
+        }
+        if (!received) { return false; }
+        connection.connection_request.append(buf, received);
+    }
+}
+
+std::unique_ptr<rebootping_http_server> rebootping_http_server_from_env() {
+    auto listen_address = env("http_server_listen_address", "");
+    if (listen_address.empty()) { return nullptr; }
+    return std::make_unique<rebootping_http_server>(listen_address);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "loop_thread.hpp"
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+struct http_server_connection {
+    int connection_fd = -1;
+    std::string connection_request;
+    // headers and any in-memory body, then connection_file_remaining bytes of connection_file_fd
+    std::string connection_response;
+    uint64_t connection_response_written = 0;
+    int connection_file_fd = -1;
+    off_t connection_file_offset = 0;
+    uint64_t connection_file_remaining = 0;
+    bool connection_close_after_response = false;
+    uint32_t connection_epoll_events = 0;
+    double connection_last_active_unixtime = 0;
+
+    http_server_connection() = default;
+    http_server_connection(http_server_connection const &) = delete;
+    http_server_connection &operator=(http_server_connection const &) = delete;
+    ~http_server_connection();
+};
+
+// A small HTTP/1.1 server on its own thread, answering GET and HEAD with
+//   /                                 the page from the last report_html_dump()
+//   /rebootping_style.css and .js     from http_server_static_dir
+//   /api/<record>.json                records as flat_record_dump_as_json lines, from the timeshards overlapping
+//                                     ?start=&end= unixtimes, at most ?limit= of them
+//   /api/<record>.schema.json         flat_record_schema_as_json
+//   /api/ping_record_summary.json     ping_record_interface_summary for ?start=&end=&bucket_seconds=
+//   any file under rebootping_records_dir, named as the report names it, with sendfile and Range support
+// listen_address is host:port, [v6host]:port or unix:/path. A single epoll loop serves every connection
+// without blocking; only the JSON endpoints wait, for the read lock on their store.
+struct rebootping_http_server : loop_thread {
+    explicit rebootping_http_server(std::string const &listen_address);
+    ~rebootping_http_server() override;
+
+    // the bound TCP port, which is useful after asking for port 0
+    [[nodiscard]] uint16_t http_listen_port() const;
+
+  protected:
+    bool loop_run_once() override;
+
+  private:
+    std::string http_unix_socket_path;
+    int http_listen_fd = -1;
+    int http_epoll_fd = -1;
+    std::unordered_map<int, std::unique_ptr<http_server_connection>> http_connections;
+    // While out of file descriptors the listen socket is left out of the epoll set, as it would otherwise stay
+    // readable and wake the loop at once, until this time passes or a connection closes.
+    double http_accept_paused_until = 0;
+    size_t http_accept_paused_connections = 0;
+
+    void http_accept();
+    void http_accept_pause();
+    void http_accept_resume_if_due(double now);
+    // false when the connection should be closed
+    bool http_serve(http_server_connection &connection);
+};
+
+// The server for http_server_listen_address, or nullptr when that is empty
+std::unique_ptr<rebootping_http_server> rebootping_http_server_from_env();
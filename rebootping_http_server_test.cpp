@@ -0,0 +1,149 @@
+#include "rebootping_event.hpp"
+#include "rebootping_http_server.hpp"
+#include "rebootping_report_html.hpp"
+#include "rebootping_test.hpp"
+
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+struct rebootping_records_tmpdir : tmpdir {
+    rebootping_records_tmpdir() {
+        setenv("rebootping_records_dir", tmpdir_name.c_str(), 1);
+        setenv("output_html_dump_filename", "", 1);
+    }
+};
+[[maybe_unused]] rebootping_records_tmpdir global_rebootping_records_tmpdir;
+
+namespace {
+// sends request and returns everything the server says until it closes the connection
+std::string http_exchange(int fd, std::string const &request) {
+    timeval timeout{.tv_sec = 10, .tv_usec = 0};
+    CALL_ERRNO_MINUS_1(setsockopt, fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    CALL_ERRNO_MINUS_1(send, fd, request.data(), request.size(), MSG_NOSIGNAL);
+    std::string response;
+    char buf[4096];
+    while (auto received = CALL_ERRNO_MINUS_1(recv, fd, buf, sizeof(buf), 0)) { response.append(buf, received); }
+    close(fd);
+    return response;
+}
+
+std::string http_exchange(uint16_t port, std::string const &request) {
+    int fd = CALL_ERRNO_MINUS_1(socket, AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{.sin_family = AF_INET, .sin_port = htons(port), .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    CALL_ERRNO_MINUS_1(connect, fd, (sockaddr *)&addr, sizeof(addr));
+    return http_exchange(fd, request);
+}
+
+std::string http_get(uint16_t port, std::string const &path, std::string const &headers = "") {
+    return http_exchange(port, "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + headers + "Connection: close\r\n\r\n");
+}
+
+std::string http_body(std::string const &response) { return response.substr(response.find("\r\n\r\n") + 4); }
+
+uint64_t http_count(std::string const &haystack, std::string const &needle) {
+    uint64_t count = 0;
+    for (auto i = haystack.find(needle); i != std::string::npos; i = haystack.find(needle, i + 1)) { ++count; }
+    return count;
+}
+} // namespace
+
+TEST(rebootping_http_server_suite, report_api_and_ranges) {
+    rebootping_http_server server("127.0.0.1:0");
+    auto port = server.http_listen_port();
+
+    rebootping_test_check(http_get(port, "/").starts_with("HTTP/1.1 503 "), ==, true);
+    rebootping_event_log("rebootping_http_server_test_event", "served over http");
+    report_html_dump();
+    auto report = http_get(port, "/");
+    rebootping_test_check(report.starts_with("HTTP/1.1 200 OK\r\n"), ==, true);
+    rebootping_test_check(http_body(report), ==, *report_html_latest());
+    rebootping_test_check(http_body(http_exchange(port, "HEAD / HTTP/1.0\r\n\r\n")), ==, "");
+
+    auto events = http_get(port, "/api/rebootping_event.json?limit=1000");
+    rebootping_test_check(events.find("Content-Type: application/json"), !=, std::string::npos);
+    rebootping_test_check(http_count(events, "rebootping_http_server_test_event"), ==, 1);
+    rebootping_test_check(http_count(http_get(port, "/api/rebootping_event.json?limit=0"), "event_name"), ==, 0);
+    rebootping_test_check(http_body(http_get(port, "/api/rebootping_event.schema.json")).starts_with("{\"flat_fields\": {\"event_unixtime\""), ==, true);
+    rebootping_test_check(http_get(port, "/api/no_such_record.json").starts_with("HTTP/1.1 404 "), ==, true);
+    rebootping_test_check(http_body(http_get(port, "/api/ping_record_summary.json?bucket_seconds=60")), ==, "[\n]\n");
+    rebootping_test_check(http_get(port, "/api/ping_record_summary.json?bucket_seconds=0").starts_with("HTTP/1.1 400 "), ==, true);
+
+    auto shard_dir = global_rebootping_records_tmpdir.tmpdir_name + "/http_test_shard";
+    std::filesystem::create_directories(shard_dir);
+    std::ofstream(shard_dir + "/http_test_field.flatshard") << "0123456789";
+    auto shard_path = shard_dir + "/http_test_field.flatshard";
+    auto whole = http_get(port, shard_path);
+    rebootping_test_check(whole.find("Accept-Ranges: bytes"), !=, std::string::npos);
+    rebootping_test_check(http_body(whole), ==, "0123456789");
+    auto middle = http_get(port, shard_path, "Range: bytes=2-5\r\n");
+    rebootping_test_check(middle.starts_with("HTTP/1.1 206 "), ==, true);
+    rebootping_test_check(middle.find("Content-Range: bytes 2-5/10\r\n"), !=, std::string::npos);
+    rebootping_test_check(http_body(middle), ==, "2345");
+    rebootping_test_check(http_body(http_get(port, shard_path, "Range: bytes=-3\r\n")), ==, "789");
+    rebootping_test_check(http_body(http_get(port, shard_path, "Range: bytes=7-100\r\n")), ==, "789");
+    rebootping_test_check(http_body(http_get(port, shard_path, "Range: bytes=0-1,4-5\r\n")), ==, "0123456789");
+    auto beyond = http_get(port, shard_path, "Range: bytes=10-\r\n");
+    rebootping_test_check(beyond.starts_with("HTTP/1.1 416 "), ==, true);
+    rebootping_test_check(beyond.find("Content-Range: bytes */10\r\n"), !=, std::string::npos);
+
+    rebootping_test_check(http_get(port, shard_dir + "/../http_test_shard/http_test_field.flatshard").starts_with("HTTP/1.1 400 "), ==, true);
+    rebootping_test_check(http_get(port, shard_dir + "/%2e%2e/http_test_shard/http_test_field.flatshard").starts_with("HTTP/1.1 400 "), ==, true);
+    rebootping_test_check(http_get(port, "/etc/passwd").starts_with("HTTP/1.1 404 "), ==, true);
+    rebootping_test_check(http_get(port, shard_dir).starts_with("HTTP/1.1 404 "), ==, true);
+    rebootping_test_check(http_exchange(port, "POST / HTTP/1.1\r\nContent-Length: 2\r\n\r\nhi").starts_with("HTTP/1.1 405 "), ==, true);
+    rebootping_test_check(http_exchange(port, "nonsense\r\n\r\n").starts_with("HTTP/1.1 400 "), ==, true);
+}
+
+TEST(rebootping_http_server_suite, keep_alive_and_unix_socket) {
+    auto socket_path = global_rebootping_records_tmpdir.tmpdir_name + "/http.sock";
+    rebootping_http_server server("unix:" + socket_path);
+    report_html_dump();
+
+    int fd = CALL_ERRNO_MINUS_1(socket, AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{.sun_family = AF_UNIX};
+    std::strcpy(addr.sun_path, socket_path.c_str());
+    CALL_ERRNO_MINUS_1(connect, fd, (sockaddr *)&addr, sizeof(addr));
+    // pipelined: the first response must leave the connection open for the next two
+    auto responses = http_exchange(fd, "GET / HTTP/1.1\r\n\r\nHEAD /index.html HTTP/1.1\r\n\r\nGET /api/rebootping_event.schema.json HTTP/1.1\r\n"
+                                       "Connection: close\r\n\r\n");
+    rebootping_test_check(http_count(responses, "HTTP/1.1 200 OK\r\n"), ==, 3);
+    rebootping_test_check(http_count(responses, "Connection: keep-alive\r\n"), ==, 2);
+    rebootping_test_check(http_count(responses, "<h1>Interface statuses</h1>"), ==, 1);
+    rebootping_test_check(responses.ends_with("}}"), ==, true);
+}
+
+TEST(rebootping_http_server_suite, out_of_file_descriptors) {
+    rebootping_http_server server("127.0.0.1:0");
+    auto port = server.http_listen_port();
+    report_html_dump();
+
+    int fd = CALL_ERRNO_MINUS_1(socket, AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    rlimit saved{};
+    CALL_ERRNO_MINUS_1(getrlimit, RLIMIT_NOFILE, &saved);
+    // descriptors are handed out lowest first, so with fd the newest nothing else can be opened
+    rlimit lowered{.rlim_cur = rlim_t(fd) + 1, .rlim_max = saved.rlim_max};
+    CALL_ERRNO_MINUS_1(setrlimit, RLIMIT_NOFILE, &lowered);
+    sockaddr_in addr{.sin_family = AF_INET, .sin_port = htons(port), .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    CALL_ERRNO_MINUS_1(connect, fd, (sockaddr *)&addr, sizeof(addr));
+
+    // the server cannot accept the connection, and must wait rather than spin on the readable listen socket
+    rusage before{}, after{};
+    CALL_ERRNO_MINUS_1(getrusage, RUSAGE_SELF, &before);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    CALL_ERRNO_MINUS_1(getrusage, RUSAGE_SELF, &after);
+    CALL_ERRNO_MINUS_1(setrlimit, RLIMIT_NOFILE, &saved);
+    auto cpu_seconds = [](rusage const &r) {
+        return r.ru_utime.tv_sec + r.ru_stime.tv_sec + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e6;
+    };
+    rebootping_test_check(cpu_seconds(after) - cpu_seconds(before), <, 0.5);
+
+    // once descriptors are available again the waiting connection is accepted and served
+    rebootping_test_check(http_exchange(fd, "GET / HTTP/1.1\r\nConnection: close\r\n\r\n").starts_with("HTTP/1.1 200 OK\r\n"), ==, true);
+}
@@ -1,8 +1,11 @@
 #include "flat_metrics.hpp"
+#include "network_flat_records.hpp"
 #include "network_interfaces_manager.hpp"
 #include "now_unixtime.hpp"
 #include "ping_health_decider.hpp"
+#include "ping_record_store.hpp"
 #include "rebootping_event.hpp"
+#include "rebootping_http_server.hpp"
 #include "rebootping_report_html.hpp"
 #include "str.hpp"
 
@@ -34,9 +37,11 @@ int main_actions() {
     CALL_ERRNO_BAD_VALUE(signal, SIG_ERR, SIGTERM, signal_callback_handler);
 
     network_interfaces_manager interfaces_manager;
-    flat_metrics_struct last_metric = flat_metric();
+    auto http_server = rebootping_http_server_from_env();
+    flat_metrics_struct last_metric = flat_metrics_sum();
     ++flat_metric().metric_restarts;
     double last_dump_info_time = 0;
+    double last_report_html_time = 0;
     double last_heartbeat = std::nan("");
     unlimit_open_files();
 
@@ -48,10 +53,17 @@ int main_actions() {
         }
         auto now = now_unixtime();
         if (env("ping_heartbeat_external_addresses", true)) { ping_external_addresses(known_ifs, now, last_heartbeat); }
-        if (now > last_dump_info_time + env("dump_info_spacing_seconds", 60.0)) {
+        if (now > last_report_html_time + env("report_html_spacing_seconds", 5.0)) {
             report_html_dump();
+            last_report_html_time = now;
+        }
+        if (now > last_dump_info_time + env("dump_info_spacing_seconds", 60.0)) {
+            auto seal_before = now - env("seal_timeshards_grace_seconds", 3600.0);
+            network_flat_records_seal_before(seal_before);
+            ping_record_stores_seal_before(seal_before);
             last_dump_info_time = now;
-            flat_metrics_struct current_metric = flat_metric();
+            flat_metrics_collect_mmap();
+            flat_metrics_struct current_metric = flat_metrics_sum();
             flat_metrics_report_delta(std::cout, current_metric, last_metric);
             last_metric = std::move(current_metric);
         }
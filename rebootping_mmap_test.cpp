@@ -60,6 +60,51 @@ TEST(flat_hash_suite, hash_ints) {
     }
 }
 
+template <typename hash_type> void hash_layout_add_find_del(std::string const &filename, unsigned count) {
+    auto h = [](unsigned n) { return ~n * 17 + n * -13; };
+    {
+        hash_type hash(filename);
+        for (unsigned n = 0; count > n; ++n) { hash.hash_add_key(n) = h(n); }
+        for (unsigned n = 0; count > n; ++n) { rebootping_test_check(*hash.hash_find_key(n), ==, h(n)); }
+        rebootping_test_check(hash.hash_find_key(count), ==, nullptr);
+    }
+    hash_type hash(filename);
+    uint64_t walked = 0;
+    hash.hash_walk([&](auto &&k, auto &&v) {
+        rebootping_test_check(v, ==, h(k));
+        ++walked;
+    });
+    rebootping_test_check(walked, ==, count);
+
+    for (unsigned n = 0; count > n; n += 3) { rebootping_test_check(hash.hash_del_key(n), ==, true); }
+    rebootping_test_check(hash.hash_del_key(count), ==, false);
+    for (unsigned n = 0; count > n; ++n) {
+        if (n % 3) {
+            rebootping_test_check(*hash.hash_find_key(n), ==, h(n));
+        } else {
+            rebootping_test_check(hash.hash_find_key(n), ==, nullptr);
+        }
+    }
+}
+
+TEST(flat_hash_suite, hash_page_layouts) {
+    for (unsigned count = 1; count < 256 * 1024; count *= 23) {
+        tmpdir tmpdir;
+        hash_layout_add_find_del<flat_hash<uint64_t, uint64_t>>(tmpdir.tmpdir_name + "/markers.flatmap", count);
+        hash_layout_add_find_del<flat_hash<uint64_t, uint64_t, flat_hash_function_class, flat_hash_compare_function_class, flat_hash_tag_pages<>>>(
+            tmpdir.tmpdir_name + "/tags16.flatmap", count);
+        hash_layout_add_find_del<flat_hash<uint32_t, uint64_t, flat_hash_function_class, flat_hash_compare_function_class, flat_hash_tag_pages<32, 4>>>(
+            tmpdir.tmpdir_name + "/tags32.flatmap", count);
+
+        try {
+            flat_hash<uint64_t, uint64_t> markers(tmpdir.tmpdir_name + "/tags16.flatmap");
+            rebootping_test_fail("flat_hash opened pages of another layout");
+        } catch (std::exception const &e) {
+            if (std::string(e.what()).find("flat_hash_magic") == std::string::npos) { rebootping_test_fail(str("flat_hash_suite layout check ", e.what())); }
+        }
+    }
+}
+
 define_flat_record(all_numbers_records, (int8_t, i8), (int16_t, i16), (int32_t, i32), (int64_t, i64), (uint8_t, u8), (uint16_t, u16), (uint32_t, u32),
                    (uint64_t, u64), (float, f), (double, d), );
 
@@ -270,3 +315,64 @@ TEST(flat_records, all_numbers) {
         },
         2047);
 }
+
+TEST(flat_records, query_keeps_timeshard_snapshot) {
+    tmpdir tmpdir;
+    just_one_byte_records records{tmpdir.tmpdir_name};
+    records.add_flat_record("20210107", [](auto &&i) { i.u8() = 1; });
+
+    auto query = records.timeshard_query();
+    records.add_flat_record("20210108", [](auto &&i) { i.u8() = 2; });
+    records.add_flat_record("20210106", [](auto &&i) { i.u8() = 3; });
+
+    uint64_t seen = 0;
+    for (auto record : query) {
+        rebootping_test_check(record.u8(), ==, 1);
+        ++seen;
+    }
+    rebootping_test_check(seen, ==, 1);
+    rebootping_test_check(std::ranges::distance(records.timeshard_query()), ==, 3);
+}
+
+TEST(flat_records, timeshard_names_to_unixtime) {
+    rebootping_test_check(string_to_unixtime("20210107"), ==, 1609977600);
+    rebootping_test_check(string_to_unixtime("19700101"), ==, 0);
+    rebootping_test_check(yyyymmdd(string_to_unixtime("20211231")), ==, "20211231");
+}
+
+TEST(flat_records, zone_maps_skip_timeshards) {
+    tmpdir tmpdir;
+    using i32_field = all_numbers_records::flat_record_schema_type::i32;
+    using u64_field = all_numbers_records::flat_record_schema_type::u64;
+    auto count_zone_query = [](all_numbers_records const &records, double lo, double hi) {
+        return std::ranges::distance(records.template timeshard_zone_query<i32_field>(lo, hi));
+    };
+    {
+        all_numbers_records records{tmpdir.tmpdir_name};
+        for (int32_t i = 0; 10 > i; ++i) {
+            records.add_flat_record("20210107", [&](auto &&r) { r.i32() = i; });
+            records.add_flat_record("20210108", [&](auto &&r) { r.i32() = 100 + i; });
+        }
+        records.add_flat_record("20210109", [&](auto &&r) { r.u64() = std::numeric_limits<uint64_t>::max(); });
+
+        rebootping_test_check(count_zone_query(records, 50, 200), ==, 10);
+        rebootping_test_check(count_zone_query(records, 0, 9), ==, 11);
+        rebootping_test_check(count_zone_query(records, 10, 99), ==, 0);
+        rebootping_test_check(std::ranges::distance(records.timeshard_zone_query<u64_field>(std::numeric_limits<uint64_t>::max(),
+                                                                                              std::numeric_limits<uint64_t>::max())),
+                              ==, 1);
+    }
+    {
+        all_numbers_records records{tmpdir.tmpdir_name};
+        rebootping_test_check(count_zone_query(records, 50, 200), ==, 10);
+        records.add_flat_record("20210107", [&](auto &&r) { r.i32() = 150; });
+        rebootping_test_check(count_zone_query(records, 50, 200), ==, 21);
+    }
+    std::filesystem::remove(tmpdir.tmpdir_name + "/all_numbers_records.flatmanifest");
+    {
+        all_numbers_records records{tmpdir.tmpdir_name};
+        rebootping_test_check(count_zone_query(records, 50, 200), ==, 21);
+        rebootping_test_check(count_zone_query(records, 10, 99), ==, 11);
+        rebootping_test_check(count_zone_query(records, 200, 300), ==, 0);
+    }
+}
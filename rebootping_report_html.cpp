@@ -2,12 +2,20 @@
 
 #include "env.hpp"
 #include "escape_json.hpp"
+#include "file_contents_cache.hpp"
+#include "flat_cache.hpp"
+#include "network_name_service.hpp"
 #include "ping_health_decider.hpp"
 #include "ping_record_store.hpp"
 #include "rebootping_event.hpp"
+#include "rebootping_records_dir.hpp"
 
-#include <filesystem>
-#include <fstream>
+#include <netdb.h>
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
 
 namespace {
 
@@ -18,6 +26,22 @@ std::string_view interface_health_record_status_string(flat_timeshard_iterator_i
     return "Impossible";
 }
 
+struct report_oui_manufacturer_record {
+    char oui_manufacturer_name[128];
+};
+
+// Persists across restarts in rebootping_records_dir so that a report does not load the OUI database for
+// manufacturers it has seen recently. Only report_html_dump uses it, from the main loop.
+std::string_view report_oui_manufacturer_name(macaddr const &mac) {
+    static flat_cache<uint32_t, report_oui_manufacturer_record, flat_cache_expire_after<24 * 60 * 60>> cache(
+        rebootping_records_dir() + "/report_oui_manufacturer_cache", env("report_oui_manufacturer_cache_capacity", 1024));
+    auto &record = cache.cache_lookup(mac.mac_manufacturer(), [&](report_oui_manufacturer_record &record) {
+        auto name = oui_manufacturer_name(mac);
+        std::strncpy(record.oui_manufacturer_name, name.c_str(), sizeof(record.oui_manufacturer_name) - 1);
+    });
+    return record.oui_manufacturer_name;
+}
+
 template <typename index_outer_type, typename index_unwrapper_type, typename formatter_type>
 void dump_html_table(std::ostream &out, std::string_view title, index_outer_type &&index_outer, index_unwrapper_type &&index_unwrapper,
                      formatter_type &&formatter) {
@@ -43,6 +67,128 @@ void dump_html_table(std::ostream &out, std::string_view title, index_outer_type
     out << "</table></div>\n";
 }
 
+struct report_device {
+    std::unordered_set<network_addr> device_addrs;
+    std::unordered_set<std::string> device_interfaces;
+    std::string device_html;
+    bool device_needs_render = true;
+};
+
+// dotted quad, as every address on the page is shown
+std::string report_addr_html(network_addr addr) { return escape_html(in_addr{addr}); }
+
+// Renders the section of one device, returning false when a name was not known yet so the section
+// should be drawn again on the next dump
+bool dump_html_device(std::ostream &out, macaddr const &mac, report_device const &device, double now) {
+    bool names_complete = true;
+    out << "<div class=monitored_mac>";
+    out << "<h2><span class=mac>" << escape_html(maybe_obfuscate_address(mac)) << "</span> "
+        << "<span class=oui_manufacturer_name>" << escape_html(report_oui_manufacturer_name(mac)) << "</span>";
+
+    network_addr best_addr = 0;
+    for (auto &&addr : device.device_addrs) {
+        if (!best_addr) { best_addr = addr; }
+        auto name = network_name_for_addr(addr, now);
+        if (name.name_source == network_name_source::network_name_unknown) {
+            out << " <span class=dns_pending>" << report_addr_html(addr) << "</span>";
+            names_complete = false;
+        } else if (name.name_source == network_name_source::network_name_resolver_failed) {
+            out << " <span class=dns_error>" << report_addr_html(addr) << " " << escape_html(gai_strerror(name.name_resolver_error)) << "</span>";
+        } else {
+            out << " <span class=dns>" << escape_html(name.name_hostname) << "</span>";
+            best_addr = addr;
+        }
+    }
+    out << "</h2>\n";
+    for (auto &&stp : write_locked_reference(stp_record_store())->stp_source_macaddr_index(mac)) {
+        out << "<h3 class=last_stp_router_update><span class=unixtime>" << stp.stp_unixtime() << "</span></h3>" << std::endl;
+        break;
+    }
+    for (auto &&if_name : device.device_interfaces) {
+        out << "<p><a class=if_name href=\"" << escape_html(limited_pcap_dumper_filename(if_name, mac)) << "\">" << escape_html(if_name) << "</a> pcap</p>"
+            << std::endl;
+    }
+    // TODO allow const access to this kind of lookup so we can use a read lock
+    dump_html_table(
+        out, "TCP port accepts", write_locked_reference(tcp_accept_record_store())->tcp_macaddr_index(mac),
+        [&](auto &&accepts) { return accepts.tcp_ports().known_keys_and_counts(); },
+        [&](auto &&out, uint16_t p) {
+            out << "<a class=tcp_port_accept href=\"http://" << report_addr_html(best_addr) << ":" << p << "\">port " << p << "</a>";
+        });
+    dump_html_table(
+        out, "UDP port recvs", write_locked_reference(udp_recv_record_store())->udp_macaddr_index(mac),
+        [&](auto &&recvs) {
+            auto ret = recvs.udp_ports().known_keys_and_counts();
+            std::erase_if(ret, [](const auto &item) {
+                auto const &[key, value] = item;
+                return value < env("html_minimum_udp_recvs_to_report", 5);
+            });
+            return ret;
+        },
+        [&](auto &&out, uint16_t p) { out << "<span class=udp_port_recv>port " << p << "</span>"; });
+
+    dump_html_table(
+        out, "Contacted servers with addresses used", write_locked_reference(ip_contact_record_store())->ip_contact_macaddr_index(mac),
+        [&](auto &&connects) { return connects.ip_contact_addrs().known_keys_and_counts(); },
+        [&](auto &&out, auto &&addr) {
+            std::string address;
+            for (auto &&dns : write_locked_reference(dns_response_record_store())
+                                  ->dns_macaddr_lookup_index(macaddr_ip_lookup{.lookup_macaddr = mac, .lookup_addr = addr})) {
+                address = dns.dns_response_hostname().operator std::string_view();
+            }
+            out << "<span class=contacted_ip>" << escape_html(address) << " " << report_addr_html(addr) << "</span>\n";
+        });
+
+    out << "</div>\n";
+    return names_complete;
+}
+
+// Device sections are kept between dumps and redrawn only for MACs that network_flat_records_take_dirty
+// reports, so a dump costs in proportion to recent traffic. Everything is redrawn from the full ARP
+// history on the first dump, when rebootping_records_dir changes, and then every report_html_full_refresh_seconds.
+void report_html_devices(std::ostream &out, double now) {
+    static std::unordered_map<macaddr, report_device> devices;
+    static double last_full_refresh = 0;
+    static std::string devices_records_dir;
+
+    auto dirty = network_flat_records_take_dirty();
+    auto records_dir = rebootping_records_dir();
+    if (records_dir != devices_records_dir || now >= last_full_refresh + env("report_html_full_refresh_seconds", 3600.0)) {
+        devices_records_dir = records_dir;
+        devices.clear();
+        for (auto &&[interface_mac, record] : read_locked_reference(arp_response_record_store())->arp_macaddr_index()) {
+            auto &device = devices[interface_mac.lookup_addr];
+            device.device_interfaces.insert(std::string(interface_mac.lookup_if.operator std::string_view()));
+            for (auto &&[addr, count] : record.arp_addresses().known_keys_and_counts()) { device.device_addrs.insert(addr); }
+        }
+        last_full_refresh = now;
+    } else {
+        for (auto &&[mac, interfaces] : dirty) {
+            auto i = devices.find(mac);
+            if (i == devices.end() && interfaces.empty()) { continue; }
+            auto &device = devices[mac];
+            device.device_needs_render = true;
+            for (auto &&if_name : interfaces) {
+                device.device_interfaces.insert(if_name);
+                // TODO allow const access to this kind of lookup so we can use a read lock
+                for (auto &&record : write_locked_reference(arp_response_record_store())->arp_macaddr_index(std::make_pair(if_name, mac))) {
+                    for (auto &&[addr, count] : record.arp_addresses().known_keys_and_counts()) { device.device_addrs.insert(addr); }
+                }
+            }
+        }
+    }
+
+    for (auto &&[mac, device] : devices) {
+        if (device.device_needs_render) {
+            std::ostringstream device_out;
+            device_out << std::setprecision(15);
+            device.device_needs_render = !dump_html_device(device_out, mac, device, now);
+            device.device_html = device_out.str();
+        }
+        out << device.device_html;
+    }
+}
+
 } // namespace
 
 void report_html_dump(std::ostream &out) {
@@ -106,87 +252,17 @@ void report_html_dump(std::ostream &out) {
             << " flat_dir_suffix: " << escape_json(store->flat_dir_suffix) << ",\n flat_timeshards: [";
 
         bool first_timeshard = true;
-        for (auto &&shard : store->flat_timeshards) {
+        for (auto &&shard : store->flat_timeshards_snapshot()->list_timeshards) {
             if (!first_timeshard) { out << "\n, "; }
             first_timeshard = false;
-            out << escape_json(shard->flat_timeshard_name);
+            out << escape_json(shard.handle_name());
         }
     }
     out << R"(], x: "ping_start_unixtime", y: "ping_recv_seconds", hue: ["ping_interface", "ping_dest_addr"]});
 </script>
 )";
 
-    std::unordered_map<macaddr, std::unordered_set<network_addr>> mac_to_addrs;
-    std::unordered_map<macaddr, std::unordered_set<std::string>> mac_to_interfaces;
-
-    for (auto &&[interface_mac, record] : read_locked_reference(arp_response_record_store())->arp_macaddr_index()) {
-        mac_to_interfaces[interface_mac.lookup_addr].insert(std::string(interface_mac.lookup_if.operator std::string_view()));
-        for (auto &&[addr, count] : record.arp_addresses().known_keys_and_counts()) { mac_to_addrs[interface_mac.lookup_addr].insert(addr); }
-    }
-
-    std::unordered_map<macaddr, double> mac_to_last_stp;
-    for (auto &&stp : read_locked_reference(stp_record_store())->stp_source_macaddr_index()) { mac_to_last_stp[stp.first] = stp.second.stp_unixtime(); }
-
-    for (auto &&[mac, addrs] : mac_to_addrs) {
-        out << "<div class=monitored_mac>";
-        out << "<h2><span class=mac>" << escape_html(maybe_obfuscate_address(mac)) << "</span> "
-            << "<span class=oui_manufacturer_name>" << escape_html(oui_manufacturer_name(mac)) << "</span>";
-
-        network_addr best_addr = 0;
-        for (auto &&addr : addrs) {
-            if (!best_addr) { best_addr = addr; }
-            char dns[1024];
-            auto sa = sockaddr_from_network_addr(addr);
-            auto ret = getnameinfo((struct sockaddr *)&sa, sizeof(sa), dns, sizeof(dns), 0, 0, 0);
-            if (ret) {
-                out << " <span class=dns_error>" << escape_html(addr) << " " << escape_html(gai_strerror(ret)) << "</span>";
-            } else {
-                out << " <span class=dns>" << escape_html(dns) << "</span>";
-                best_addr = addr;
-            }
-        }
-        out << "</h2>\n";
-        if (auto i = mac_to_last_stp.find(mac); i != mac_to_last_stp.end()) {
-            out << "<h3 class=last_stp_router_update><span class=unixtime>" << i->second << "</span></h3>" << std::endl;
-        }
-        for (auto &&if_name : mac_to_interfaces[mac]) {
-            out << "<p><a class=if_name href=\"" << escape_html(limited_pcap_dumper_filename(if_name, mac)) << "\">" << escape_html(if_name) << "</a> pcap</p>"
-                << std::endl;
-        }
-
-        // TODO allow const access to this kind of lookup so we can use a read lock
-        dump_html_table(
-            out, "TCP port accepts", write_locked_reference(tcp_accept_record_store())->tcp_macaddr_index(mac),
-            [&](auto &&accepts) { return accepts.tcp_ports().known_keys_and_counts(); },
-            [&](auto &&out, uint16_t p) {
-                out << "<a class=tcp_port_accept href=\"http://" << escape_html(best_addr) << ":" << p << "\">port " << p << "</a>";
-            });
-        dump_html_table(
-            out, "UDP port recvs", write_locked_reference(udp_recv_record_store())->udp_macaddr_index(mac),
-            [&](auto &&recvs) {
-                auto ret = recvs.udp_ports().known_keys_and_counts();
-                std::erase_if(ret, [](const auto &item) {
-                    auto const &[key, value] = item;
-                    return value < env("html_minimum_udp_recvs_to_report", 5);
-                });
-                return ret;
-            },
-            [&](auto &&out, uint16_t p) { out << "<span class=udp_port_recv>port " << p << "</span>"; });
-
-        dump_html_table(
-            out, "Contacted servers with addresses used", write_locked_reference(ip_contact_record_store())->ip_contact_macaddr_index(mac),
-            [&](auto &&connects) { return connects.ip_contact_addrs().known_keys_and_counts(); },
-            [&](auto &&out, auto &&addr) {
-                std::string address;
-                for (auto &&dns : write_locked_reference(dns_response_record_store())
-                                      ->dns_macaddr_lookup_index(macaddr_ip_lookup{.lookup_macaddr = mac, .lookup_addr = addr})) {
-                    address = dns.dns_response_hostname().operator std::string_view();
-                }
-                out << "<span class=contacted_ip>" << escape_html(address) << " " << in_addr{addr} << "</span>\n";
-            });
-
-        out << "</div>\n";
-    }
+    report_html_devices(out, now_unixtime());
     {
         out << "<div class=rebootping_event_log_class>";
         out << "<h1>Rebootping events</h1>\n";
@@ -204,12 +280,26 @@ void report_html_dump(std::ostream &out) {
     }
     out << "\n</body>\n";
 }
+namespace {
+std::mutex report_html_latest_mutex;
+std::shared_ptr<std::string const> report_html_latest_page;
+} // namespace
+
+std::shared_ptr<std::string const> report_html_latest() {
+    std::lock_guard lock(report_html_latest_mutex);
+    return report_html_latest_page;
+}
+
 void report_html_dump() {
-    auto out_filename = env("output_html_dump_filename", "index.html");
-    auto out_filename_tmp = out_filename + ".tmp";
+    std::ostringstream out;
+    report_html_dump(out);
+    auto page = std::make_shared<std::string const>(out.str());
     {
-        std::ofstream out(out_filename_tmp);
-        report_html_dump(out);
+        std::lock_guard lock(report_html_latest_mutex);
+        report_html_latest_page = page;
     }
-    std::filesystem::rename(out_filename_tmp, out_filename);
-}
\ No newline at end of file
+
+    auto out_filename = env("output_html_dump_filename", "index.html");
+    if (out_filename.empty()) { return; }
+    file_contents_cache_write(out_filename, *page);
+}
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <memory>
 #include <ostream>
+#include <string>
 
 void report_html_dump(std::ostream &out);
 
+// Renders the report for rebootping_http_server, and to output_html_dump_filename unless that is empty.
+// Only the main loop calls this.
 void report_html_dump();
+
+// The page rendered by the last report_html_dump(), or nullptr before the first
+std::shared_ptr<std::string const> report_html_latest();
@@ -167,6 +167,7 @@ enum class dns_qtype : uint16_t {
     DNS_QTYPE_NS = 2,
     DNS_QTYPE_CNAME = 5,
     DNS_QTYPE_MX = 0xf,
+    DNS_QTYPE_AAAA = 0x1c,
 };
 
 enum class dns_qclass : uint16_t {
@@ -195,7 +196,7 @@ struct llc_stp_bpdu {
     uint16_t stp_bridge;
     macaddr stp_bridge_macaddr;
     // more fields skipped
-};
+} __attribute__((__packed__));
 
 template <typename... packet_types> struct wire_header : packet_types... {
     template <typename pointer> static wire_header<packet_types...> const *header_from_packet(pointer *bytes, size_t caplen) {